@@ -34,6 +34,7 @@
 #include "mididefs.h"
 #include "midi_event.h"
 #include "driver.h"
+#include "stats.h"
 #include "debug.h"
 
 #ifndef WITHOUT_LASH
@@ -538,6 +539,7 @@ open_alsa_seq(char *alsa_capture_ports, char *alsa_playback_ports)
 	char                    client_name[32];
 	char                    port_name[32];
 	ALSA_SEQ_INFO           *new_seq_info;
+	int                     route;
 
 	/* allocate our MIDI structure for returning everything */
 	if ((new_seq_info = malloc(sizeof(ALSA_SEQ_INFO))) == NULL) {
@@ -569,6 +571,9 @@ open_alsa_seq(char *alsa_capture_ports, char *alsa_playback_ports)
 		return NULL;
 	}
 
+	/* room for a full period of Tx events between drains */
+	snd_seq_set_output_buffer_size(new_seq_info->seq, ALSA_SEQ_OUTPUT_BUFFER_SIZE);
+
 	snd_midi_event_new(SYSEX_BUFFER_SIZE, &(new_seq_info->encoder));
 
 	/* get ports based on comma separated client:port lists. */
@@ -588,20 +593,35 @@ open_alsa_seq(char *alsa_capture_ports, char *alsa_playback_ports)
 		return NULL;
 	}
 
-	/* create rx and tx ports */
-	snprintf(port_name, sizeof(port_name), "midi_rx");
-	new_seq_info->rx_port->port =
-		snd_seq_create_simple_port(new_seq_info->seq, port_name,
-		                           SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-		                           SND_SEQ_PORT_TYPE_SOFTWARE |
-		                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
-
-	snprintf(port_name, sizeof(port_name), "midi_tx");
-	new_seq_info->tx_port->port =
-		snd_seq_create_simple_port(new_seq_info->seq, port_name,
-		                           SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
-		                           SND_SEQ_PORT_TYPE_SOFTWARE |
-		                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+	/* create rx and tx ports for each route.  route 0 keeps the original
+	   port names, and is the route used for port subscriptions. */
+	for (route = 0; route < num_midi_routes; route++) {
+		if (route == 0) {
+			snprintf(port_name, sizeof(port_name), "midi_rx");
+		}
+		else {
+			snprintf(port_name, sizeof(port_name), "midi_rx_%d", route + 1);
+		}
+		new_seq_info->route_rx_port[route] =
+			snd_seq_create_simple_port(new_seq_info->seq, port_name,
+			                           SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+			                           SND_SEQ_PORT_TYPE_SOFTWARE |
+			                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+
+		if (route == 0) {
+			snprintf(port_name, sizeof(port_name), "midi_tx");
+		}
+		else {
+			snprintf(port_name, sizeof(port_name), "midi_tx_%d", route + 1);
+		}
+		new_seq_info->route_tx_port[route] =
+			snd_seq_create_simple_port(new_seq_info->seq, port_name,
+			                           SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+			                           SND_SEQ_PORT_TYPE_SOFTWARE |
+			                           SND_SEQ_PORT_TYPE_MIDI_GENERIC);
+	}
+	new_seq_info->rx_port->port = new_seq_info->route_rx_port[0];
+	new_seq_info->tx_port->port = new_seq_info->route_tx_port[0];
 
 	/* since we opened nonblocking, we need our poll descriptors */
 	if ((new_seq_info->npfds = snd_seq_poll_descriptors_count
@@ -746,7 +766,7 @@ alsa_seq_cleanup(void *arg)
 	if (alsa_seq_info != NULL) {
 
 		/* rx */
-		if (arg == (void *)midi_rx_thread_p) {
+		if (arg == (void *)midi_rx_thread_p[0]) {
 			cur = alsa_seq_info->src_ports;
 			while (cur != NULL) {
 				if (cur->subs != NULL) {
@@ -778,12 +798,12 @@ alsa_seq_cleanup(void *arg)
 				cur = cur->next;
 				free(prev);
 			}
-			midi_rx_thread_p = 0;
+			midi_rx_thread_p[0] = 0;
 			midi_rx_stopped = 1;
 		}
 
 		/* tx */
-		if (arg == (void *)midi_tx_thread_p) {
+		if (arg == (void *)midi_tx_thread_p[0]) {
 			cur = alsa_seq_info->dest_ports;
 			while (cur != NULL) {
 				if (cur->subs != NULL) {
@@ -815,12 +835,12 @@ alsa_seq_cleanup(void *arg)
 				cur = cur->next;
 				free(prev);
 			}
-			midi_tx_thread_p = 0;
+			midi_tx_thread_p[0] = 0;
 			midi_tx_stopped = 1;
 		}
 
 		/* close sequencer only if both rx and tx are not running */
-		if ((midi_rx_thread_p == 0) && (midi_tx_thread_p == 0)) {
+		if ((midi_rx_thread_p[0] == 0) && (midi_tx_thread_p[0] == 0)) {
 			if (alsa_seq_info->seq != NULL) {
 				snd_seq_disconnect_from(alsa_seq_info->seq,
 				                        alsa_seq_info->rx_port->port,
@@ -846,6 +866,27 @@ alsa_seq_cleanup(void *arg)
 }
 
 
+/*****************************************************************************
+ * alsa_seq_get_route()
+ *
+ * Returns the route owning one of our sequencer Rx ports.  Events arriving
+ * on a port not belonging to any route are handled by route 0.
+ *****************************************************************************/
+unsigned char
+alsa_seq_get_route(ALSA_SEQ_INFO *seq_info, int rx_port)
+{
+	unsigned char   route;
+
+	for (route = 0; route < num_midi_routes; route++) {
+		if (seq_info->route_rx_port[route] == rx_port) {
+			return route;
+		}
+	}
+
+	return 0;
+}
+
+
 /*****************************************************************************
  * alsa_seq_rx_thread()
  *
@@ -857,15 +898,19 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 {
 	unsigned char       buffer[SYSEX_BUFFER_SIZE];
 	volatile MIDI_EVENT *event;
-	struct timespec     now;
+	timensec_t          now;
 	struct sched_param  schedparam;
 	pthread_t           thread_id;
 	char                thread_name[16];
 	snd_seq_event_t     *ev         = NULL;
+	unsigned char       *sysex;
+	unsigned int        sysex_len;
 	unsigned short      cycle_frame = 0;
 	unsigned short      rx_index;
 	unsigned short      period;
-	unsigned char       j;
+	unsigned short      j;
+	unsigned char       queue_num   = A2J_QUEUE;
+	unsigned char       route;
 
 	/* set realtime scheduling and priority */
 	thread_id = pthread_self();
@@ -910,9 +955,20 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 				cycle_frame    = get_midi_frame(&period, &now, FRAME_FIX_LOWER | FRAME_LIMIT_UPPER);
 				rx_index       = sync_info[period].rx_index;
 
-				event          = get_new_midi_event(A2J_QUEUE);
+				/* queue for the route owning the destination port */
+				queue_num      = A2J_ROUTE_QUEUE(alsa_seq_get_route(alsa_seq_info,
+				                                                    ev->dest.port));
+
+				/* drop the message when every event in the pool is
+				   in flight */
+				if ((event = get_new_midi_event(queue_num)) == NULL) {
+					snd_seq_free_event(ev);
+					ev = NULL;
+					continue;
+				}
 				event->type    = MIDI_EVENT_NO_EVENT;
 				event->channel = ev->data.note.channel;
+				event->ingress_time = now;
 
 				switch (ev->type) {
 
@@ -1008,13 +1064,46 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 					buffer[2]             = event->msb & 0x7F;
 					break;
 				case SND_SEQ_EVENT_SYSEX:
+					/* ALSA delivers long SysEx in chunks of its own size,
+					   which are passed on in fragments of at most
+					   SYSEX_FRAGMENT_SIZE, all but the last queued here. */
+					sysex     = (unsigned char *)(ev->data.ext.ptr);
+					sysex_len = ev->data.ext.len;
+					while (sysex_len > SYSEX_FRAGMENT_SIZE) {
+						event->type       = MIDI_EVENT_SYSEX;
+						event->bytes      = SYSEX_FRAGMENT_SIZE;
+						if ((event->data = get_sysex_buffer(queue_num,
+						                                    SYSEX_FRAGMENT_SIZE)) == NULL) {
+							free_midi_event(queue_num, event);
+							event = NULL;
+							break;
+						}
+						memcpy((void *)(event->data), sysex, SYSEX_FRAGMENT_SIZE);
+						queue_midi_event(period, queue_num, event, cycle_frame, rx_index, 0);
+						if ((event = get_new_midi_event(queue_num)) == NULL) {
+							break;
+						}
+						event->ingress_time = now;
+						sysex            += SYSEX_FRAGMENT_SIZE;
+						sysex_len        -= SYSEX_FRAGMENT_SIZE;
+					}
+					/* the rest of the chunk is lost with the pool (or
+					   the SysEx arena) full */
+					if (event == NULL) {
+						break;
+					}
 					event->type           = MIDI_EVENT_SYSEX;
-					event->bytes          = ev->data.ext.len;
-					memcpy((void *)(event->data), ev->data.ext.ptr, ev->data.ext.len);
-					memcpy(buffer, ev->data.ext.ptr, ev->data.ext.len);
+					event->bytes          = sysex_len;
+					if ((event->data = get_sysex_buffer(queue_num, event->bytes)) == NULL) {
+						free_midi_event(queue_num, event);
+						event = NULL;
+						break;
+					}
+					memcpy((void *)(event->data), sysex, event->bytes);
+					memcpy(buffer, sysex, event->bytes);
 #ifndef WITHOUT_JUNO
 					/* translate juno sysex to controllers */
-					translate_from_juno(period, A2J_QUEUE,
+					translate_from_juno(period, queue_num,
 					                    event, cycle_frame, rx_index);
 #endif
 					break;
@@ -1104,18 +1193,7 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 				}
 
 				/* queue event for jack thread */
-				if (event->type != MIDI_EVENT_NO_EVENT) {
-					/* queue notes off for the all-notes-off controller */
-					/* or any of the all-sound-off controllers */
-					if ( (event->controller >= 0x78) &&
-					     (event->type       == MIDI_EVENT_CONTROLLER) ) {
-						queue_notes_off(period, A2J_QUEUE, event->channel, cycle_frame, rx_index);
-					}
-					/* otherwise, queue event as is */
-					else {
-						queue_midi_event(period, A2J_QUEUE, event, cycle_frame, rx_index, 0);
-					}
-
+				if ((event != NULL) && (event->type != MIDI_EVENT_NO_EVENT)) {
 					if (debug) {
 						for (j = 0; j < event->bytes; j++) {
 							JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
@@ -1126,6 +1204,22 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 						                DEBUG_COLOR_CYAN "[%d] " DEBUG_COLOR_DEFAULT,
 						                cycle_frame);
 					}
+
+					/* queue notes off for the all-notes-off controller */
+					/* or any of the all-sound-off controllers */
+					if ( (event->controller >= 0x78) &&
+					     (event->type       == MIDI_EVENT_CONTROLLER) ) {
+						queue_notes_off(period, queue_num, event->channel, cycle_frame, rx_index);
+						free_midi_event(queue_num, event);
+					}
+					/* otherwise, queue event as is */
+					else {
+						queue_midi_event(period, queue_num, event, cycle_frame, rx_index, 0);
+					}
+				}
+				/* give back the event for anything not passed on */
+				else if (event != NULL) {
+					free_midi_event(queue_num, event);
 				}
 
 				snd_seq_free_event(ev);
@@ -1133,12 +1227,15 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 
 			} /* while() */
 
-			if (check_active_sensing_timeout(period, A2J_QUEUE) == ACTIVE_SENSING_STATUS_TIMEOUT) {
-				period         = get_midi_period(&now);
-				cycle_frame    = get_midi_frame(&period, &now, FRAME_LIMIT_LOWER | FRAME_LIMIT_UPPER);
-				rx_index       = sync_info[period].rx_index;
-				for (j = 0; j < 16; j++) {
-					queue_notes_off(period, A2J_QUEUE, j, cycle_frame, rx_index);
+			for (route = 0; route < num_midi_routes; route++) {
+				queue_num = A2J_ROUTE_QUEUE(route);
+				if (check_active_sensing_timeout(period, queue_num) == ACTIVE_SENSING_STATUS_TIMEOUT) {
+					period         = get_midi_period(&now);
+					cycle_frame    = get_midi_frame(&period, &now, FRAME_LIMIT_LOWER | FRAME_LIMIT_UPPER);
+					rx_index       = sync_info[period].rx_index;
+					for (j = 0; j < 16; j++) {
+						queue_notes_off(period, queue_num, j, cycle_frame, rx_index);
+					}
 				}
 			}
 		} /* if (poll()) */
@@ -1153,6 +1250,110 @@ alsa_seq_rx_thread(void *UNUSED(arg))
 }
 
 
+/*****************************************************************************
+ * alsa_seq_start_tx_queue()
+ *
+ * Allocates and starts an ALSA sequencer queue for scheduled Tx, and syncs
+ * the queue's real time with the system clock.  Returns 0 on success, or
+ * -1 on error.
+ *****************************************************************************/
+int
+alsa_seq_start_tx_queue(ALSA_SEQ_INFO *seq_info)
+{
+	int     queue;
+
+	if ((queue = snd_seq_alloc_named_queue(seq_info->seq, "jamrouter-tx")) < 0) {
+		JAMROUTER_ERROR("Unable to allocate ALSA sequencer queue -- %s\n",
+		                snd_strerror(queue));
+		return -1;
+	}
+	seq_info->queue_id = (unsigned char) queue;
+
+	snd_seq_start_queue(seq_info->seq, queue, NULL);
+	snd_seq_drain_output(seq_info->seq);
+
+	return alsa_seq_sync_tx_queue(seq_info);
+}
+
+
+/*****************************************************************************
+ * alsa_seq_sync_tx_queue()
+ *
+ * Measures the offset between the system clock used for sync_info[] and the
+ * real time of the Tx queue.  Returns 0 on success, or -1 on error.
+ *****************************************************************************/
+int
+alsa_seq_sync_tx_queue(ALSA_SEQ_INFO *seq_info)
+{
+	snd_seq_queue_status_t      *status;
+	const snd_seq_real_time_t   *real_time;
+
+	snd_seq_queue_status_alloca(&status);
+
+	if (snd_seq_get_queue_status(seq_info->seq, seq_info->queue_id, status) < 0) {
+		JAMROUTER_ERROR("Unable to get ALSA sequencer queue status.\n");
+		return -1;
+	}
+	time_get_nsecs(&(seq_info->queue_offset));
+
+	real_time = snd_seq_queue_status_get_real_time(status);
+	seq_info->queue_offset -= ((timensec_t)(real_time->tv_sec) * NSECS_PER_SEC) +
+		(timensec_t)(real_time->tv_nsec);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * alsa_seq_schedule_event()
+ *
+ * Schedules an ALSA sequencer event on the Tx queue for the real time
+ * corresponding to the given period and frame.
+ *****************************************************************************/
+void
+alsa_seq_schedule_event(ALSA_SEQ_INFO       *seq_info,
+                        snd_seq_event_t     *ev,
+                        unsigned short      period,
+                        unsigned short      frame)
+{
+	timensec_t              queue_time;
+	snd_seq_real_time_t     real_time;
+
+	queue_time = get_frame_time(period, frame) - seq_info->queue_offset;
+	if (queue_time < 0) {
+		queue_time = 0;
+	}
+	real_time.tv_sec  = (unsigned int)(queue_time / NSECS_PER_SEC);
+	real_time.tv_nsec = (unsigned int)(queue_time % NSECS_PER_SEC);
+
+	snd_seq_ev_schedule_real(ev, seq_info->queue_id, 0, &real_time);
+}
+
+
+/*****************************************************************************
+ * alsa_seq_output_event()
+ *
+ * Adds an event to the sequencer output buffer.  The buffer is sent to the
+ * sequencer with a single snd_seq_drain_output() once all events for the
+ * frame (or period, with queue scheduling) are in.
+ *****************************************************************************/
+void
+alsa_seq_output_event(ALSA_SEQ_INFO *seq_info, snd_seq_event_t *ev)
+{
+	int     ret;
+
+	/* output buffer full:  send what we have and try again. */
+	if ((ret = snd_seq_event_output(seq_info->seq, ev)) == -EAGAIN) {
+		snd_seq_drain_output(seq_info->seq);
+		ret = snd_seq_event_output(seq_info->seq, ev);
+	}
+	if (ret < 0) {
+		JAMROUTER_ERROR("Unable to output ALSA sequencer event -- %s\n",
+		                snd_strerror(ret));
+	}
+}
+
+
 /*****************************************************************************
  * alsa_seq_tx_thread()
  *
@@ -1167,21 +1368,27 @@ alsa_seq_tx_thread(void *UNUSED(arg))
 	volatile MIDI_EVENT *event;
 	volatile MIDI_EVENT *next               = NULL;
 	volatile MIDI_EVENT *cur;
-	struct timespec     now;
+	timensec_t          now;
 	struct sched_param  schedparam;
 	pthread_t           thread_id;
 	unsigned char       first;
-	unsigned char       sleep_once;
-#ifdef ENABLE_DEBUG
-	unsigned short      event_latency;
+	unsigned char       sleep_once          = 1;
+	unsigned char       pending_output      = 0;
+	timensec_t          write_time;
+	int                 event_latency;
 	unsigned short      end_frame;
 	unsigned short      end_period;
+#ifdef ENABLE_DEBUG
 	unsigned short      j;
 #endif
 	unsigned short      cycle_frame         = 0;
 	unsigned short      all_notes_off       = 0;
 	unsigned short      period;
-	unsigned short      last_period         = 0;
+	unsigned short      next_frame;
+	unsigned short      frame;
+	unsigned short      last_period[MAX_MIDI_ROUTES];
+	unsigned char       queue_num;
+	unsigned char       route;
 
 
 	/* set realtime scheduling and priority */
@@ -1195,7 +1402,12 @@ alsa_seq_tx_thread(void *UNUSED(arg))
 	/* setup thread cleanup handler */
 	pthread_cleanup_push(&alsa_seq_cleanup, (void *)thread_id);
 
-	//snd_seq_drain_output(alsa_seq_info->seq);
+	/* optionally let an ALSA sequencer queue handle Tx timing */
+	if (use_seq_queue && (alsa_seq_start_tx_queue(alsa_seq_info) != 0)) {
+		JAMROUTER_WARN("Unable to start ALSA sequencer Tx queue.  "
+		               "Using direct Tx.\n");
+		use_seq_queue = 0;
+	}
 
 	/* broadcast the midi ready condition */
 	pthread_mutex_lock(&midi_tx_ready_mutex);
@@ -1206,6 +1418,9 @@ alsa_seq_tx_thread(void *UNUSED(arg))
 	period = get_midi_period(&now);
 	period = sleep_until_next_period(period, &now);
 	cycle_frame = sync_info[period].buffer_period_size;
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		last_period[route] = 0;
+	}
 
 	/* MAIN LOOP: poll for midi input and process events */
 	while (!midi_tx_stopped && !pending_shutdown) {
@@ -1216,297 +1431,367 @@ alsa_seq_tx_thread(void *UNUSED(arg))
 		if (cycle_frame >= sync_info[period].buffer_period_size) {
 			cycle_frame = 0;
 
+			/* with queue scheduling, send the whole period at once. */
+			if (pending_output) {
+				snd_seq_drain_output(alsa_seq_info->seq);
+				pending_output = 0;
+			}
+
 			/* sleep (if necessary) until next midi period has started. */
-			last_period = period;
+			for (route = 0; route < num_midi_routes; route++) {
+				last_period[route] = period;
+			}
 			period = sleep_until_next_period(period, &now);
+
+			/* keep queue time from drifting away from system time */
+			if (use_seq_queue && (period == 0)) {
+				alsa_seq_sync_tx_queue(alsa_seq_info);
+			}
 		}
 
-		event = dequeue_midi_event(J2A_QUEUE, &last_period, period, cycle_frame);
-
-		/* Look ahead for optional translation of note off events */
-		if ( note_on_velocity || note_off_velocity ||
-		     tx_prefer_real_note_off || tx_prefer_all_notes_off ) {
-			all_notes_off = 0;
-			cur = event;
-			while ((cur != NULL) && (cur->state == EVENT_STATE_QUEUED)) {
-				if (cur->type == MIDI_EVENT_NOTE_ON) {
-					if (cur->velocity == 0) {
-						if (tx_prefer_real_note_off) {
-							cur->type = MIDI_EVENT_NOTE_OFF;
+		/* skip ahead to the next frame with events queued on any route */
+		next_frame = sync_info[period].buffer_period_size;
+		for (route = 0; route < num_midi_routes; route++) {
+			frame = get_next_queued_frame(J2A_ROUTE_QUEUE(route), period, cycle_frame);
+			if (frame < next_frame) {
+				next_frame = frame;
+			}
+		}
+		/* after a missed period, dequeue even when this period is empty,
+		   so events left in the missed period are recovered (see
+		   dequeue_midi_event()). */
+		if (next_frame < sync_info[period].buffer_period_size) {
+			cycle_frame = next_frame;
+		}
+		else {
+			for (route = 0; route < num_midi_routes; route++) {
+				if (period != sync_info[last_period[route]].next) {
+					break;
+				}
+			}
+			if (route == num_midi_routes) {
+				cycle_frame = next_frame;
+				continue;
+			}
+		}
+
+		/* all routes are serviced from one Tx thread, in route order */
+		for (route = 0; route < num_midi_routes; route++) {
+			queue_num = J2A_ROUTE_QUEUE(route);
+			event = dequeue_midi_event(queue_num, &(last_period[route]), period,
+			                           cycle_frame, NULL);
+
+			/* Look ahead for optional translation of note off events */
+			if ( note_on_velocity || note_off_velocity ||
+			     tx_prefer_real_note_off || tx_prefer_all_notes_off ) {
+				all_notes_off = 0;
+				cur = event;
+				while ((cur != NULL) && (cur->state == EVENT_STATE_QUEUED)) {
+					if (cur->type == MIDI_EVENT_NOTE_ON) {
+						if (cur->velocity == 0) {
+							if (tx_prefer_real_note_off) {
+								cur->type = MIDI_EVENT_NOTE_OFF;
+							}
+							if (note_off_velocity != 0x0) {
+								cur->velocity = note_off_velocity;
+							}
 						}
-						if (note_off_velocity != 0x0) {
-							cur->velocity = note_off_velocity;
+						else if (note_on_velocity != 0x0) {
+							cur->velocity = note_on_velocity;
 						}
 					}
-					else if (note_on_velocity != 0x0) {
-						cur->velocity = note_on_velocity;
+					else if ( (cur->type == MIDI_EVENT_NOTE_OFF) &&
+					          (note_off_velocity != 0x0) ) {
+						cur->velocity = note_off_velocity;
+					}
+					else if ( tx_prefer_all_notes_off &&
+					          (cur->type == MIDI_EVENT_CONTROLLER) &&
+					          (cur->controller == MIDI_CONTROLLER_ALL_NOTES_OFF) ) {
+						all_notes_off |= (unsigned short)(1 << (cur->channel & 0x0F));
 					}
+					cur = (MIDI_EVENT *)(cur->next);
 				}
-				else if ( (cur->type == MIDI_EVENT_NOTE_OFF) &&
-				          (note_off_velocity != 0x0) ) {
-					cur->velocity = note_off_velocity;
+			}
+
+			first = 1;
+			while ((event != NULL) && (event->state == EVENT_STATE_QUEUED)) {
+				if (first) {
+					JAMROUTER_DEBUG(DEBUG_CLASS_TX_TIMING,
+					                DEBUG_COLOR_YELLOW ": " DEBUG_COLOR_DEFAULT);
 				}
-				else if ( tx_prefer_all_notes_off &&
-				          (cur->type == MIDI_EVENT_CONTROLLER) &&
-				          (cur->controller == MIDI_CONTROLLER_ALL_NOTES_OFF) ) {
-					all_notes_off |= (unsigned short)(1 << (cur->channel & 0x0F));
+				first = 0;
+
+				/* ignore note-off message for any channels with all-notes-off messages. */
+				if ( (all_notes_off & (1 << (event->channel & 0x0F))) &&
+				     (event->type == MIDI_EVENT_NOTE_ON) && (event->velocity == 0) ) {
+					event->bytes = 0;
+					JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+					                DEBUG_COLOR_GREEN "-----%X:%02X----- " DEBUG_COLOR_DEFAULT,
+					                event->channel, event->note);
 				}
-				cur = (MIDI_EVENT *)(cur->next);
-			}
-		}
 
-		first = 1;
-		while ((event != NULL) && (event->state == EVENT_STATE_QUEUED)) {
-			if (first) {
-				JAMROUTER_DEBUG(DEBUG_CLASS_TX_TIMING,
-				                DEBUG_COLOR_YELLOW ": " DEBUG_COLOR_DEFAULT);
-			}
-			first = 0;
-
-			/* ignore note-off message for any channels with all-notes-off messages. */
-			if ( (all_notes_off & (1 << (event->channel & 0x0F))) &&
-			     (event->type == MIDI_EVENT_NOTE_ON) && (event->velocity == 0) ) {
-				event->bytes = 0;
-				JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
-				                DEBUG_COLOR_GREEN "-----%X:%02X----- " DEBUG_COLOR_DEFAULT,
-				                event->channel, event->note);
-			}
+				/* shed low priority messages under overload */
+				if (shed_dequeued_event(queue_num, event)) {
+					event->bytes = 0;
+				}
 
-			if (event->bytes > 0) {
-				/* copy event data into ALSA seq event */
-				snd_seq_ev_clear(&ev);
-				buffer[event->bytes] = 0x0;
-				switch (event->type) {
-					/* internal MIDI resync event not needed for JAMRouter's
-					   current design, but may be useful in the future. */
-					//case MIDI_EVENT_RESYNC:
-					//	event->bytes                 = 0;
-					//	ev.type                      = SND_SEQ_EVENT_NONE;
-					//	JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
-					//	                DEBUG_COLOR_GREEN "<<<<<SYNC>>>>> "
-					//                  DEBUG_COLOR_DEFAULT);
+				if (event->bytes > 0) {
+					/* copy event data into ALSA seq event */
+					snd_seq_ev_clear(&ev);
+					buffer[event->bytes] = 0x0;
+					switch (event->type) {
+						/* internal MIDI resync event not needed for JAMRouter's
+						   current design, but may be useful in the future. */
+						//case MIDI_EVENT_RESYNC:
+						//	event->bytes                 = 0;
+						//	ev.type                      = SND_SEQ_EVENT_NONE;
+						//	JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+						//	                DEBUG_COLOR_GREEN "<<<<<SYNC>>>>> "
+						//                  DEBUG_COLOR_DEFAULT);
+						//	break;
+					case MIDI_EVENT_NOTE_OFF:       // 0x80
+						ev.type                   = SND_SEQ_EVENT_NOTEOFF;
+						ev.data.note.channel      = event->channel & 0x0F;
+						ev.data.note.note         = event->note & 0x7F;
+						ev.data.note.velocity     = 0x0;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->note & 0x7F;
+						buffer[2]                 = 0x0;
+						break;
+					case MIDI_EVENT_NOTE_ON:        // 0x90
+						ev.type                   = SND_SEQ_EVENT_NOTEON;
+						ev.data.note.channel      = event->channel & 0x0F;
+						ev.data.note.note         = event->note & 0x7F;
+						ev.data.note.velocity     = event->velocity & 0x7F;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->note & 0x7F;
+						buffer[2]                 = event->velocity & 0x7F;
+						break;
+					case MIDI_EVENT_AFTERTOUCH:     // 0xA0
+						ev.type                   = SND_SEQ_EVENT_KEYPRESS;
+						ev.data.note.channel      = event->channel & 0x0F;
+						ev.data.note.note         = event->note & 0x7F;
+						ev.data.note.velocity     = event->velocity & 0x7F;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->note & 0x7F;
+						buffer[2]                 = event->velocity & 0x7F;
+						break;
+					case MIDI_EVENT_CONTROLLER:     // 0xB0
+						ev.type                   = SND_SEQ_EVENT_KEYPRESS;
+						ev.data.control.channel   = event->channel & 0x0F;
+						ev.data.control.param     = event->controller & 0x7F;
+						ev.data.control.value     = event->value & 0x7F;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->controller & 0x7F;
+						buffer[2]                 = event->value & 0x7F;
+						break;
+					case MIDI_EVENT_PROGRAM_CHANGE: // 0xC0
+						ev.type                   = SND_SEQ_EVENT_PGMCHANGE;
+						ev.data.control.channel   = event->channel & 0x0F;
+						ev.data.control.value     = event->program & 0x7F;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->program & 0x7F;
+						break;
+					case MIDI_EVENT_POLYPRESSURE:   // 0xD0
+						ev.type                   = SND_SEQ_EVENT_CHANPRESS;
+						ev.data.control.channel   = event->channel & 0x0F;
+						ev.data.control.value     = event->polypressure & 0x7F;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->polypressure & 0x7F;
+						break;
+					case MIDI_EVENT_PITCHBEND:      // 0xE0
+						ev.type                   = SND_SEQ_EVENT_PITCHBEND;
+						ev.data.control.channel   = event->channel & 0x0F;
+						ev.data.control.value     = ((event->lsb & 0x7F) | ((event->msb & 0x7F) << 7)) - 8192;
+						buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+						                                            (event->channel & 0x0F));
+						buffer[1]                 = event->lsb & 0x7F;
+						buffer[2]                 = event->msb & 0x7F;
+						break;
+					//case MIDI_EVENT_CONTROL14:      // not currently implemented.
+					//	ev.type                   = SND_SEQ_EVENT_CONTROL14;
+					//	ev.data.control.channel   = event->channel & 0x0F;
+					//	ev.data.control.value     = (event->lsb & 0x7F) | ((event->msb & 0x7F) << 7);
+					//	buffer[0]                 = (unsigned char)((event->type & 0xF0) |
+					//	                                            (event->channel & 0x0F));
+					//	buffer[1]                 = event->lsb & 0x7F;
+					//	buffer[2]                 = event->msb & 0x7F;
 					//	break;
-				case MIDI_EVENT_NOTE_OFF:       // 0x80
-					ev.type                   = SND_SEQ_EVENT_NOTEOFF;
-					ev.data.note.channel      = event->channel & 0x0F;
-					ev.data.note.note         = event->note & 0x7F;
-					ev.data.note.velocity     = 0x0;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->note & 0x7F;
-					buffer[2]                 = 0x0;
-					break;
-				case MIDI_EVENT_NOTE_ON:        // 0x90
-					ev.type                   = SND_SEQ_EVENT_NOTEON;
-					ev.data.note.channel      = event->channel & 0x0F;
-					ev.data.note.note         = event->note & 0x7F;
-					ev.data.note.velocity     = event->velocity & 0x7F;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->note & 0x7F;
-					buffer[2]                 = event->velocity & 0x7F;
-					break;
-				case MIDI_EVENT_AFTERTOUCH:     // 0xA0
-					ev.type                   = SND_SEQ_EVENT_KEYPRESS;
-					ev.data.note.channel      = event->channel & 0x0F;
-					ev.data.note.note         = event->note & 0x7F;
-					ev.data.note.velocity     = event->velocity & 0x7F;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->note & 0x7F;
-					buffer[2]                 = event->velocity & 0x7F;
-					break;
-				case MIDI_EVENT_CONTROLLER:     // 0xB0
-					ev.type                   = SND_SEQ_EVENT_KEYPRESS;
-					ev.data.control.channel   = event->channel & 0x0F;
-					ev.data.control.param     = event->controller & 0x7F;
-					ev.data.control.value     = event->value & 0x7F;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->controller & 0x7F;
-					buffer[2]                 = event->value & 0x7F;
-					break;
-				case MIDI_EVENT_PROGRAM_CHANGE: // 0xC0
-					ev.type                   = SND_SEQ_EVENT_PGMCHANGE;
-					ev.data.control.channel   = event->channel & 0x0F;
-					ev.data.control.value     = event->program & 0x7F;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->program & 0x7F;
-					break;
-				case MIDI_EVENT_POLYPRESSURE:   // 0xD0
-					ev.type                   = SND_SEQ_EVENT_CHANPRESS;
-					ev.data.control.channel   = event->channel & 0x0F;
-					ev.data.control.value     = event->polypressure & 0x7F;
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->polypressure & 0x7F;
-					break;
-				case MIDI_EVENT_PITCHBEND:      // 0xE0
-					ev.type                   = SND_SEQ_EVENT_PITCHBEND;
-					ev.data.control.channel   = event->channel & 0x0F;
-					ev.data.control.value     = (event->lsb & 0x7F) | ((event->msb & 0x7F) << 7);
-					buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-					                                            (event->channel & 0x0F));
-					buffer[1]                 = event->lsb & 0x7F;
-					buffer[2]                 = event->msb & 0x7F;
-					break;
-				//case MIDI_EVENT_CONTROL14:      // not currently implemented.
-				//	ev.type                   = SND_SEQ_EVENT_CONTROL14;
-				//	ev.data.control.channel   = event->channel & 0x0F;
-				//	ev.data.control.value     = (event->lsb & 0x7F) | ((event->msb & 0x7F) << 7);
-				//	buffer[0]                 = (unsigned char)((event->type & 0xF0) |
-				//	                                            (event->channel & 0x0F));
-				//	buffer[1]                 = event->lsb & 0x7F;
-				//	buffer[2]                 = event->msb & 0x7F;
-				//	break;
-				case MIDI_EVENT_SYSEX:          // 0xF0
-					ev.type                   = SND_SEQ_EVENT_SYSEX;
-					ev.data.ext.len           = event->bytes;
-					ev.data.ext.ptr           = (unsigned char *)(event->data);
-					memcpy(buffer, (void *)(event->data), event->bytes);
-					event->data[event->bytes] = 0x0;
-					break;
-					/* 3 byte system messages */
-				case MIDI_EVENT_SONGPOS:        // 0xF2
-					ev.type                   = SND_SEQ_EVENT_SONGPOS;
-					ev.data.control.param     = event->lsb & 0x7F;
-					ev.data.control.value     = event->msb & 0x7F;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_SONGPOS;
-					buffer[1]                 = event->lsb & 0x7F;
-					buffer[2]                 = event->msb & 0x7F;
-					break;
-					/* 2 byte system messages */
-				case MIDI_EVENT_MTC_QFRAME:     // 0xF1
-					ev.type                   = SND_SEQ_EVENT_QFRAME;
-					ev.data.control.param     = event->qframe & 0xF0;
-					ev.data.control.value     = event->qframe & 0x0F;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_MTC_QFRAME;
-					buffer[1]                 = event->qframe;
-					break;
-				case MIDI_EVENT_SONG_SELECT:    // 0xF3
-					ev.type                   = SND_SEQ_EVENT_SONGSEL;
-					ev.data.control.value     = event->value & 0x7F;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_SONG_SELECT;
-					buffer[1]                 = event->value & 0x7F;
-					break;
-					/* 1 byte realtime messages */
-				case MIDI_EVENT_BUS_SELECT:     // 0xF5
-					ev.type                   = SND_SEQ_EVENT_NONE;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_BUS_SELECT;
-					break;
-				case MIDI_EVENT_TUNE_REQUEST:   // 0xF6
-					ev.type                   = SND_SEQ_EVENT_TUNE_REQUEST;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_TUNE_REQUEST;
-					break;
-				case MIDI_EVENT_END_SYSEX:      // 0xF7
-					ev.type                   = SND_SEQ_EVENT_NONE;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_NO_EVENT;
-					break;
-				case MIDI_EVENT_TICK:           // 0xF8
-					ev.type                   = SND_SEQ_EVENT_TICK;
-					ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_TICK;
-					break;
-				case MIDI_EVENT_START:          // 0xFA
-					ev.type                   = SND_SEQ_EVENT_START;
-					ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_START;
-					break;
-				case MIDI_EVENT_CONTINUE:       // 0xFB
-					ev.type                   = SND_SEQ_EVENT_CONTINUE;
-					ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_CONTINUE;
-					break;
-				case MIDI_EVENT_STOP:           // 0xFC
-					ev.type                   = SND_SEQ_EVENT_STOP;
-					ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_STOP;
-					break;
-				case MIDI_EVENT_ACTIVE_SENSING: // 0xFE
-					ev.type                   = SND_SEQ_EVENT_SENSING;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_ACTIVE_SENSING;
-					break;
-				case MIDI_EVENT_SYSTEM_RESET:   // 0xFF
-					ev.type                   = SND_SEQ_EVENT_RESET;
-					buffer[0]                 = (unsigned char)MIDI_EVENT_SYSTEM_RESET;
-					break;
-					/* The following are internal message types */
+					case MIDI_EVENT_SYSEX:          // 0xF0
+						ev.type                   = SND_SEQ_EVENT_SYSEX;
+						ev.data.ext.len           = event->bytes;
+						ev.data.ext.ptr           = (unsigned char *)(event->data);
+						memcpy(buffer, (void *)(event->data), event->bytes);
+						break;
+						/* 3 byte system messages */
+					case MIDI_EVENT_SONGPOS:        // 0xF2
+						ev.type                   = SND_SEQ_EVENT_SONGPOS;
+						ev.data.control.param     = event->lsb & 0x7F;
+						ev.data.control.value     = event->msb & 0x7F;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_SONGPOS;
+						buffer[1]                 = event->lsb & 0x7F;
+						buffer[2]                 = event->msb & 0x7F;
+						break;
+						/* 2 byte system messages */
+					case MIDI_EVENT_MTC_QFRAME:     // 0xF1
+						ev.type                   = SND_SEQ_EVENT_QFRAME;
+						ev.data.control.param     = event->qframe & 0xF0;
+						ev.data.control.value     = event->qframe & 0x0F;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_MTC_QFRAME;
+						buffer[1]                 = event->qframe;
+						break;
+					case MIDI_EVENT_SONG_SELECT:    // 0xF3
+						ev.type                   = SND_SEQ_EVENT_SONGSEL;
+						ev.data.control.value     = event->value & 0x7F;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_SONG_SELECT;
+						buffer[1]                 = event->value & 0x7F;
+						break;
+						/* 1 byte realtime messages */
+					case MIDI_EVENT_BUS_SELECT:     // 0xF5
+						ev.type                   = SND_SEQ_EVENT_NONE;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_BUS_SELECT;
+						break;
+					case MIDI_EVENT_TUNE_REQUEST:   // 0xF6
+						ev.type                   = SND_SEQ_EVENT_TUNE_REQUEST;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_TUNE_REQUEST;
+						break;
+					case MIDI_EVENT_END_SYSEX:      // 0xF7
+						ev.type                   = SND_SEQ_EVENT_NONE;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_NO_EVENT;
+						break;
+					case MIDI_EVENT_TICK:           // 0xF8
+						ev.type                   = SND_SEQ_EVENT_TICK;
+						ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_TICK;
+						break;
+					case MIDI_EVENT_START:          // 0xFA
+						ev.type                   = SND_SEQ_EVENT_START;
+						ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_START;
+						break;
+					case MIDI_EVENT_CONTINUE:       // 0xFB
+						ev.type                   = SND_SEQ_EVENT_CONTINUE;
+						ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_CONTINUE;
+						break;
+					case MIDI_EVENT_STOP:           // 0xFC
+						ev.type                   = SND_SEQ_EVENT_STOP;
+						ev.data.queue.queue       = SND_SEQ_QUEUE_DIRECT;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_STOP;
+						break;
+					case MIDI_EVENT_ACTIVE_SENSING: // 0xFE
+						ev.type                   = SND_SEQ_EVENT_SENSING;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_ACTIVE_SENSING;
+						break;
+					case MIDI_EVENT_SYSTEM_RESET:   // 0xFF
+						ev.type                   = SND_SEQ_EVENT_RESET;
+						buffer[0]                 = (unsigned char)MIDI_EVENT_SYSTEM_RESET;
+						break;
+						/* The following are internal message types */
 #ifdef MIDI_CLOCK_SYNC
-				case MIDI_EVENT_CLOCK:
-				case MIDI_EVENT_BPM_CHANGE:
-				case MIDI_EVENT_PHASE_SYNC:
+					case MIDI_EVENT_CLOCK:
+					case MIDI_EVENT_BPM_CHANGE:
+					case MIDI_EVENT_PHASE_SYNC:
 #endif /* MIDI_CLOCK_SYNC */
-				//case MIDI_EVENT_PARAMETER:    // not currently implemented.
-				default:
-					ev.type                   = SND_SEQ_EVENT_NONE;
-					event->bytes              = 0;
-					JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
-					                DEBUG_COLOR_GREEN ">%02X< " DEBUG_COLOR_DEFAULT,
-					                event->type);
-					break;
-				}
-
-				/* send event */
-				if ((event->bytes > 0) && (ev.type != SND_SEQ_EVENT_NONE)) {
-					/*
-					  If we are too early for the current event by more then
-					  a couple samples, then sleep.
-					*/
-					if (sleep_once) {
-						sleep_until_frame(period, cycle_frame);
-						sleep_once = 0;
+					//case MIDI_EVENT_PARAMETER:    // not currently implemented.
+					default:
+						ev.type                   = SND_SEQ_EVENT_NONE;
+						event->bytes              = 0;
+						JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+						                DEBUG_COLOR_GREEN ">%02X< " DEBUG_COLOR_DEFAULT,
+						                event->type);
+						break;
 					}
 
-					/* common to all events */
-					snd_seq_ev_set_source(&ev, (unsigned char)(alsa_seq_info->tx_port->port));
-					snd_seq_ev_set_subs(&ev);
-					ev.queue = SND_SEQ_QUEUE_DIRECT;
-					snd_seq_ev_set_direct(&ev);
-					snd_seq_event_output_direct(alsa_seq_info->seq, &(ev));
+					/* send event */
+					if ((event->bytes > 0) && (ev.type != SND_SEQ_EVENT_NONE)) {
+						/* common to all events */
+						snd_seq_ev_set_source(&ev, (unsigned char)(alsa_seq_info->route_tx_port[route]));
+						snd_seq_ev_set_subs(&ev);
+
+						/* The sequencer queue handles sub-period timing. */
+						if (use_seq_queue) {
+							alsa_seq_schedule_event(alsa_seq_info, &ev,
+							                        period, cycle_frame);
+						}
+						/*
+						  If we are too early for the current event by more then
+						  a couple samples, then sleep.
+						*/
+						else {
+							if (sleep_once) {
+								sleep_until_frame(period, cycle_frame);
+								sleep_once = 0;
+							}
+							ev.queue = SND_SEQ_QUEUE_DIRECT;
+							snd_seq_ev_set_direct(&ev);
+						}
+						time_get_nsecs(&write_time);
+						alsa_seq_output_event(alsa_seq_info, &ev);
+						pending_output = 1;
+
+						end_period = get_midi_period(&now);
+						end_frame = get_midi_frame(&end_period, &now,
+						                           FRAME_FIX_LOWER | FRAME_LIMIT_UPPER);
+
+						/* signed frame error, actual vs. scheduled */
+						event_latency = (int)((unsigned short)(end_frame - cycle_frame) &
+						                      sync_info[period].buffer_size_mask);
+						if (event_latency > (sync_info[period].buffer_size >> 1)) {
+							event_latency -= sync_info[period].buffer_size;
+						}
+						stats_record_queue_delay(queue_num, write_time,
+						                         event->ingress_time);
+						stats_record_write(queue_num, event_latency,
+						                   now - write_time);
 
 #ifdef ENABLE_DEBUG
-					end_period = get_midi_period(&now);
-					end_frame = get_midi_frame(&end_period, &now,
-					                           FRAME_FIX_LOWER | FRAME_LIMIT_UPPER);
+						if (debug_class & DEBUG_CLASS_STREAM) {
+							for (j = 0; j < event->bytes; j++) {
+								JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+								                DEBUG_COLOR_GREEN "%02X " DEBUG_COLOR_DEFAULT,
+								                buffer[j]);
+							}
+						}
 
-					event_latency = (unsigned short)(end_frame - cycle_frame) &
-						sync_info[period].buffer_size_mask;
+						JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
+						                DEBUG_COLOR_GREEN "[%d%+d] " DEBUG_COLOR_DEFAULT,
+						                cycle_frame, event_latency);
+#endif
 
-					if (debug_class & DEBUG_CLASS_STREAM) {
-						for (j = 0; j < event->bytes; j++) {
-							JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
-							                DEBUG_COLOR_GREEN "%02X " DEBUG_COLOR_DEFAULT,
-							                buffer[j]);
+						/* optional Tx guard interval between messages
+						   requires sending each message on its own. */
+						if ((event_guard_time_usec > 0) && !use_seq_queue) {
+							snd_seq_drain_output(alsa_seq_info->seq);
+							pending_output = 0;
+							jamrouter_usleep(event_guard_time_usec);
 						}
 					}
+				} /* if (event->bytes > 0) */
 
-					JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-					                DEBUG_COLOR_GREEN "[%d%+d] " DEBUG_COLOR_DEFAULT,
-					                cycle_frame, event_latency);
-#endif
+				/* keep track of next event */
+				next = (MIDI_EVENT *)(event->next);
+
+				/* return event to the pool. */
+				free_midi_event(queue_num, event);
+
+				/* ready to process next event */
+				event = next;
+			} /* while() */
+		} /* for (route) */
+
+		/* send all events for this frame at once */
+		if (pending_output && !use_seq_queue) {
+			snd_seq_drain_output(alsa_seq_info->seq);
+			pending_output = 0;
+		}
 
-					/* optional Tx guard interval between messages */
-					if (event_guard_time_usec > 0) {
-						jamrouter_usleep(event_guard_time_usec);
-					}
-				}
-			} /* if (event->bytes > 0) */
-
-			/* keep track of next event */
-			next = (MIDI_EVENT *)(event->next);
-
-			/* Clear event. */
-			event->type    = 0;
-			event->channel = 0;
-			event->byte2   = 0;
-			event->byte3   = 0;
-			event->next    = NULL;
-			event->state   = EVENT_STATE_FREE;
-
-			/* ready to process next event */
-			event = next;
-		} /* while() */
 		cycle_frame++;
 		sleep_once = 1;
 	} /* while () */
@@ -27,6 +27,7 @@
 #include <asoundlib.h>
 #include "jamrouter.h"
 #include "mididefs.h"
+#include "timeutil.h"
 
 
 typedef struct alsa_seq_port {
@@ -50,10 +51,13 @@ typedef struct alsa_seq_info {
 	struct pollfd               *pfds;
     int                         npfds;
 	unsigned char               queue_id;
+	timensec_t                  queue_offset;
 	short                       auto_hw;
 	short                       auto_sw;
 	ALSA_SEQ_PORT               *rx_port;
 	ALSA_SEQ_PORT               *tx_port;
+	int                         route_rx_port[MAX_MIDI_ROUTES];
+	int                         route_tx_port[MAX_MIDI_ROUTES];
 	ALSA_SEQ_PORT               *src_ports;
 	ALSA_SEQ_PORT               *dest_ports;
 	ALSA_SEQ_PORT               *capture_ports;
@@ -98,6 +102,12 @@ ALSA_SEQ_INFO *open_alsa_seq_in(char *alsa_capture_ports,
                                 char *alsa_playback_ports);
 void alsa_seq_cleanup(void *arg);
 int alsa_seq_init(void);
+unsigned char alsa_seq_get_route(ALSA_SEQ_INFO *seq_info, int rx_port);
+int alsa_seq_start_tx_queue(ALSA_SEQ_INFO *seq_info);
+int alsa_seq_sync_tx_queue(ALSA_SEQ_INFO *seq_info);
+void alsa_seq_schedule_event(ALSA_SEQ_INFO *seq_info, snd_seq_event_t *ev,
+                             unsigned short period, unsigned short frame);
+void alsa_seq_output_event(ALSA_SEQ_INFO *seq_info, snd_seq_event_t *ev);
 void *alsa_seq_rx_thread(void *UNUSED(arg));
 void *alsa_seq_tx_thread(void *UNUSED(arg));
 
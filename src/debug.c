@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <linux/sched.h>
 #include "jamrouter.h"
 #include "debug.h"
@@ -34,6 +35,14 @@
 
 DEBUG_RINGBUFFER    main_debug_queue;
 
+DEBUG_LOG_RING      debug_log_rings[DEBUG_LOG_MAX_THREADS];
+
+static __thread DEBUG_LOG_RING  *thread_log_ring        = NULL;
+static __thread int             thread_log_ring_failed  = 0;
+
+static pthread_key_t            debug_log_ring_key;
+static pthread_once_t           debug_log_ring_once     = PTHREAD_ONCE_INIT;
+
 int                 debug       = 0;
 int                 debug_done  = 0;
 unsigned long       debug_class = 0;
@@ -70,6 +79,321 @@ jamrouter_printf(const char *format, ...)
 }
 
 
+/*****************************************************************************
+ * debug_scan_conversion()
+ *
+ * Scans a single printf() conversion specification starting just past the
+ * '%', setting the argument type it consumes.  Returns a pointer to the
+ * first character following the conversion.  Anything not safely
+ * representable in a binary log record (variable width / precision, %n,
+ * long double) is reported as DEBUG_ARG_INVALID.
+ *****************************************************************************/
+static const char *
+debug_scan_conversion(const char *p, unsigned char *type)
+{
+	int     longs   = 0;
+
+	*type = DEBUG_ARG_INVALID;
+
+	/* flags, width, precision */
+	while ((*p != '\0') && (strchr("-+ #0123456789.", *p) != NULL)) {
+		p++;
+	}
+	if (*p == '*') {
+		return p + 1;
+	}
+
+	/* length modifiers */
+	while ((*p != '\0') && (strchr("hlLzjtq", *p) != NULL)) {
+		switch (*p) {
+		case 'l':
+		case 'z':
+		case 't':
+			longs++;
+			break;
+		case 'j':
+		case 'q':
+			longs += 2;
+			break;
+		case 'L':
+			longs += 8;
+			break;
+		}
+		p++;
+	}
+
+	switch (*p) {
+	case '%':
+		*type = DEBUG_ARG_NONE;
+		break;
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'c':
+		if (longs == 0) {
+			*type = DEBUG_ARG_INT;
+		}
+		else if (longs == 1) {
+			*type = DEBUG_ARG_LONG;
+		}
+		else if (longs == 2) {
+			*type = DEBUG_ARG_LLONG;
+		}
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (longs < 8) {
+			*type = DEBUG_ARG_DOUBLE;
+		}
+		break;
+	case 's':
+		if (longs == 0) {
+			*type = DEBUG_ARG_STRING;
+		}
+		break;
+	case 'p':
+		*type = DEBUG_ARG_POINTER;
+		break;
+	case '\0':
+		return p;
+	}
+
+	return p + 1;
+}
+
+
+/*****************************************************************************
+ * release_debug_log_ring()
+ *
+ * Thread-specific data destructor.  Returns a thread's log ring to the pool
+ * when the thread exits.  Records already in the ring are still output.
+ *****************************************************************************/
+static void
+release_debug_log_ring(void *arg)
+{
+	DEBUG_LOG_RING  *ring = (DEBUG_LOG_RING *) arg;
+
+	if (ring != NULL) {
+		g_atomic_int_set(&(ring->in_use), 0);
+	}
+}
+
+
+/*****************************************************************************
+ * create_debug_log_ring_key()
+ *****************************************************************************/
+static void
+create_debug_log_ring_key(void)
+{
+	pthread_key_create(&debug_log_ring_key, release_debug_log_ring);
+}
+
+
+/*****************************************************************************
+ * get_debug_log_ring()
+ *
+ * Returns the calling thread's log ring, claiming a free ring on first use.
+ * Returns NULL when all rings are in use.
+ *****************************************************************************/
+static DEBUG_LOG_RING *
+get_debug_log_ring(void)
+{
+	int     j;
+
+	if ((thread_log_ring == NULL) && !thread_log_ring_failed) {
+		pthread_once(&debug_log_ring_once, create_debug_log_ring_key);
+		for (j = 0; j < DEBUG_LOG_MAX_THREADS; j++) {
+			if (g_atomic_int_compare_and_exchange(&(debug_log_rings[j].in_use),
+			                                      0, 1)) {
+				thread_log_ring = &(debug_log_rings[j]);
+				pthread_setspecific(debug_log_ring_key, thread_log_ring);
+				break;
+			}
+		}
+		if (thread_log_ring == NULL) {
+			thread_log_ring_failed = 1;
+		}
+	}
+
+	return thread_log_ring;
+}
+
+
+/*****************************************************************************
+ * debug_log_push()
+ *
+ * Captures a debug message into the calling thread's log ring without any
+ * formatting, locking, or waiting.  Returns 0 when the message was captured
+ * (or dropped on a full ring), or -1 when the message needs to go through
+ * the text queue instead.
+ *****************************************************************************/
+static int
+debug_log_push(const char *format, va_list args)
+{
+	DEBUG_LOG_RING      *ring;
+	DEBUG_LOG_RECORD    *rec;
+	const char          *p;
+	const char          *s;
+	unsigned char       type;
+	unsigned int        str_index = 0;
+	guint               write_index;
+
+	if ((ring = get_debug_log_ring()) == NULL) {
+		return -1;
+	}
+
+	write_index = (guint) ring->write_index;
+	if ((write_index - (guint) g_atomic_int_get(&(ring->read_index)))
+	    >= DEBUG_LOG_RING_SIZE) {
+		g_atomic_int_inc(&(ring->dropped));
+		return 0;
+	}
+	rec = &(ring->records[write_index & DEBUG_LOG_RING_MASK]);
+
+	rec->num_args = 0;
+	for (p = format; *p != '\0'; p++) {
+		if (*p != '%') {
+			continue;
+		}
+		p = debug_scan_conversion(p + 1, &type) - 1;
+		if (type == DEBUG_ARG_NONE) {
+			continue;
+		}
+		if ( (type == DEBUG_ARG_INVALID) ||
+		     (rec->num_args >= DEBUG_LOG_MAX_ARGS) ) {
+			return -1;
+		}
+		switch (type) {
+		case DEBUG_ARG_INT:
+			rec->args[rec->num_args].i = va_arg(args, int);
+			break;
+		case DEBUG_ARG_LONG:
+			rec->args[rec->num_args].i = va_arg(args, long);
+			break;
+		case DEBUG_ARG_LLONG:
+			rec->args[rec->num_args].i = va_arg(args, long long);
+			break;
+		case DEBUG_ARG_DOUBLE:
+			rec->args[rec->num_args].d = va_arg(args, double);
+			break;
+		case DEBUG_ARG_POINTER:
+			rec->args[rec->num_args].p = va_arg(args, void *);
+			break;
+		case DEBUG_ARG_STRING:
+			/* strings may not outlive the caller, so copy them */
+			s = va_arg(args, const char *);
+			if (s == NULL) {
+				s = "(null)";
+			}
+			/* with the pool used up, fall back to formatting as text */
+			if (str_index >= DEBUG_LOG_STRING_SIZE) {
+				return -1;
+			}
+			rec->args[rec->num_args].i = str_index;
+			while ((*s != '\0') && (str_index < (DEBUG_LOG_STRING_SIZE - 1))) {
+				rec->strings[str_index++] = *s++;
+			}
+			rec->strings[str_index++] = '\0';
+			break;
+		}
+		rec->arg_types[rec->num_args++] = type;
+	}
+
+	rec->format = format;
+	clock_gettime(CLOCK_MONOTONIC, &(rec->timestamp));
+
+	/* publish record to the consumer */
+	g_atomic_int_set(&(ring->write_index), (gint)(write_index + 1));
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * debug_log_format()
+ *
+ * Formats a binary log record into buf.  Runs only in the debug thread or
+ * the watchdog loop, never in a realtime thread.
+ *****************************************************************************/
+static void
+debug_log_format(DEBUG_LOG_RECORD *rec, char *buf, size_t size)
+{
+	char            spec[32];
+	const char      *p;
+	const char      *end;
+	unsigned char   type;
+	unsigned int    arg     = 0;
+	size_t          len     = 0;
+	size_t          n;
+	int             ret;
+
+	buf[0] = '\0';
+	for (p = rec->format; (*p != '\0') && (len < (size - 1)); p = end) {
+		if (*p != '%') {
+			buf[len++] = *p;
+			buf[len]   = '\0';
+			end = p + 1;
+			continue;
+		}
+		end = debug_scan_conversion(p + 1, &type);
+		n = (size_t)(end - p);
+		if (n >= sizeof(spec)) {
+			n = sizeof(spec) - 1;
+		}
+		memcpy(spec, p, n);
+		spec[n] = '\0';
+		if (type == DEBUG_ARG_NONE) {
+			buf[len++] = '%';
+			buf[len]   = '\0';
+			continue;
+		}
+		if (arg >= rec->num_args) {
+			break;
+		}
+		switch (rec->arg_types[arg]) {
+		case DEBUG_ARG_INT:
+			ret = snprintf(&(buf[len]), size - len, spec, (int)(rec->args[arg].i));
+			break;
+		case DEBUG_ARG_LONG:
+			ret = snprintf(&(buf[len]), size - len, spec, (long)(rec->args[arg].i));
+			break;
+		case DEBUG_ARG_LLONG:
+			ret = snprintf(&(buf[len]), size - len, spec, rec->args[arg].i);
+			break;
+		case DEBUG_ARG_DOUBLE:
+			ret = snprintf(&(buf[len]), size - len, spec, rec->args[arg].d);
+			break;
+		case DEBUG_ARG_POINTER:
+			ret = snprintf(&(buf[len]), size - len, spec, rec->args[arg].p);
+			break;
+		case DEBUG_ARG_STRING:
+			ret = snprintf(&(buf[len]), size - len, spec,
+			               &(rec->strings[rec->args[arg].i]));
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+		arg++;
+		if (ret > 0) {
+			len += (size_t) ret;
+			if (len >= size) {
+				len = size - 1;
+			}
+		}
+	}
+}
+
+
 /*****************************************************************************
  * jamrouter_warn()
  *****************************************************************************/
@@ -77,17 +401,26 @@ void
 jamrouter_warn(const char *format, ...)
 {
 	va_list args;
+	va_list text_args;
 	guint new_debug_index;
 
+	va_start(args, format);
+	va_copy(text_args, args);
+	if (debug_log_push(format, args) == 0) {
+		va_end(text_args);
+		va_end(args);
+		return;
+	}
+	va_end(args);
+
 	while (!g_atomic_int_compare_and_exchange(&main_debug_queue.debug_token, 0, 1));
 	new_debug_index =
 		(guint)(g_atomic_int_add(&(main_debug_queue.insert_index), 1)
 		        + 1) & DEBUG_BUFFER_MASK;
 	g_atomic_int_set(&main_debug_queue.debug_token, 0);
-	va_start(args, format);
 	vsnprintf(main_debug_queue.msgs[new_debug_index].msg,
-	          DEBUG_MESSAGE_SIZE, format, args);
-	va_end(args);
+	          DEBUG_MESSAGE_SIZE, format, text_args);
+	va_end(text_args);
 	g_atomic_int_set(&(main_debug_queue.msgs[new_debug_index].status), DEBUG_STATUS_QUEUED);
 	g_atomic_int_inc(&(main_debug_queue.write_index));
 }
@@ -100,18 +433,27 @@ void
 jamrouter_debug(unsigned int class, const char *format, ...)
 {
 	va_list args;
+	va_list text_args;
 	guint new_debug_index;
 
 	if (debug_class & (class)) {
+		va_start(args, format);
+		va_copy(text_args, args);
+		if (debug_log_push(format, args) == 0) {
+			va_end(text_args);
+			va_end(args);
+			return;
+		}
+		va_end(args);
+
 		while (!g_atomic_int_compare_and_exchange(&main_debug_queue.debug_token, 0, 1));
 		new_debug_index =
 			(guint)(g_atomic_int_add(&(main_debug_queue.insert_index), 1)
 			        + 1) & DEBUG_BUFFER_MASK;
 		g_atomic_int_set(&main_debug_queue.debug_token, 0);
-		va_start(args, format);
 		vsnprintf(main_debug_queue.msgs[new_debug_index].msg,
-		          DEBUG_MESSAGE_SIZE, format, args);
-		va_end(args);
+		          DEBUG_MESSAGE_SIZE, format, text_args);
+		va_end(text_args);
 		g_atomic_int_set(&(main_debug_queue.msgs[new_debug_index].status), DEBUG_STATUS_QUEUED);
 		g_atomic_int_inc(&(main_debug_queue.write_index));
 	}
@@ -139,11 +481,23 @@ init_debug_buffers(void)
 
 
 /*****************************************************************************
- * jamrouter_debug_iteration()
+ * output_pending_debug()
+ *
+ * Outputs text queue messages, then merges the per-thread binary log rings
+ * in timestamp order, formatting each record as it is output.
  *****************************************************************************/
 void
 output_pending_debug(void)
 {
+	char                buf[DEBUG_MESSAGE_SIZE];
+	DEBUG_LOG_RING      *ring;
+	DEBUG_LOG_RING      *oldest_ring;
+	DEBUG_LOG_RECORD    *rec;
+	DEBUG_LOG_RECORD    *oldest_rec;
+	guint               read_index;
+	gint                dropped;
+	int                 j;
+
 	while ( main_debug_queue.read_index !=
 	        (g_atomic_int_get(&(main_debug_queue.write_index))
 	         & DEBUG_BUFFER_MASK) ) {
@@ -162,6 +516,41 @@ output_pending_debug(void)
 			break;
 		}
 	}
+
+	for (;;) {
+		oldest_ring = NULL;
+		oldest_rec  = NULL;
+		for (j = 0; j < DEBUG_LOG_MAX_THREADS; j++) {
+			ring = &(debug_log_rings[j]);
+			read_index = (guint) ring->read_index;
+			if (read_index == (guint) g_atomic_int_get(&(ring->write_index))) {
+				continue;
+			}
+			rec = &(ring->records[read_index & DEBUG_LOG_RING_MASK]);
+			if ( (oldest_rec == NULL) ||
+			     (rec->timestamp.tv_sec < oldest_rec->timestamp.tv_sec) ||
+			     ( (rec->timestamp.tv_sec == oldest_rec->timestamp.tv_sec) &&
+			       (rec->timestamp.tv_nsec < oldest_rec->timestamp.tv_nsec) ) ) {
+				oldest_ring = ring;
+				oldest_rec  = rec;
+			}
+		}
+		if (oldest_ring == NULL) {
+			break;
+		}
+		debug_log_format(oldest_rec, buf, sizeof(buf));
+		fprintf(stderr, "%s", buf);
+		g_atomic_int_inc(&(oldest_ring->read_index));
+	}
+
+	for (j = 0; j < DEBUG_LOG_MAX_THREADS; j++) {
+		ring = &(debug_log_rings[j]);
+		if ((dropped = g_atomic_int_get(&(ring->dropped))) > 0) {
+			g_atomic_int_add(&(ring->dropped), -dropped);
+			fprintf(stderr, "\n*** Debug log ring %d full:  "
+			        "%d messages dropped. ***\n", j, dropped);
+		}
+	}
 }
 
 
@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include <glib/gatomic.h>
+#include <time.h>
 #include "stdio.h"
 #include "string.h"
 #include "jamrouter.h"
@@ -35,6 +36,24 @@
 #define DEBUG_MESSAGE_POOL_SIZE     2048
 #define DEBUG_BUFFER_MASK           (DEBUG_MESSAGE_POOL_SIZE - 1)
 
+/* Per-thread binary log rings.  Realtime threads never format text: each
+   debug message is captured as the format pointer, raw arguments, and a
+   timestamp, and is formatted later by output_pending_debug(). */
+#define DEBUG_LOG_MAX_THREADS       16
+#define DEBUG_LOG_RING_SIZE         512
+#define DEBUG_LOG_RING_MASK         (DEBUG_LOG_RING_SIZE - 1)
+#define DEBUG_LOG_MAX_ARGS          8
+#define DEBUG_LOG_STRING_SIZE       128
+
+#define DEBUG_ARG_NONE              0
+#define DEBUG_ARG_INT               1
+#define DEBUG_ARG_LONG              2
+#define DEBUG_ARG_LLONG             3
+#define DEBUG_ARG_DOUBLE            4
+#define DEBUG_ARG_STRING            5
+#define DEBUG_ARG_POINTER           6
+#define DEBUG_ARG_INVALID           0xFF
+
 #define DEBUG_CLASS_NONE            0
 #define DEBUG_CLASS_INIT            (1<<1)
 #define DEBUG_CLASS_DRIVER          (1<<2)
@@ -84,6 +103,29 @@ typedef struct debug_msg {
 	volatile gint       status;
 } DEBUG_MESSAGE;
 
+typedef union debug_log_arg {
+	long long           i;
+	double              d;
+	const void          *p;
+} DEBUG_LOG_ARG;
+
+typedef struct debug_log_record {
+	const char          *format;
+	struct timespec     timestamp;
+	DEBUG_LOG_ARG       args[DEBUG_LOG_MAX_ARGS];
+	unsigned char       arg_types[DEBUG_LOG_MAX_ARGS];
+	unsigned char       num_args;
+	char                strings[DEBUG_LOG_STRING_SIZE];
+} DEBUG_LOG_RECORD;
+
+typedef struct debug_log_ring {
+	DEBUG_LOG_RECORD    records[DEBUG_LOG_RING_SIZE];
+	volatile gint       read_index;
+	volatile gint       write_index;
+	volatile gint       dropped;
+	volatile gint       in_use;
+} DEBUG_LOG_RING;
+
 typedef struct debug_ringbuffer {
 	DEBUG_MESSAGE       msgs[DEBUG_MESSAGE_POOL_SIZE];
 	volatile gint       read_index;
@@ -95,6 +137,8 @@ typedef struct debug_ringbuffer {
 
 extern DEBUG_RINGBUFFER main_debug_queue;
 
+extern DEBUG_LOG_RING   debug_log_rings[DEBUG_LOG_MAX_THREADS];
+
 extern int              debug;
 extern int              debug_done;
 extern unsigned long    debug_class;
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <glib.h>
 #include "jamrouter.h"
 #include "driver.h"
 #include "timekeeping.h"
@@ -34,6 +35,8 @@
 #include "rawmidi.h"
 #include "alsa_seq.h"
 #include "jack.h"
+#include "stats.h"
+#include "testmode.h"
 
 #ifndef WITHOUT_LASH
 # include "lash.h"
@@ -92,6 +95,9 @@ char *midi_driver_names[] = {
 #endif
 #ifdef ENABLE_RAWMIDI_OSS2
 	"oss2",
+#endif
+#ifdef ENABLE_SIM
+	"sim",
 #endif
 	NULL
 };
@@ -188,6 +194,20 @@ select_midi_driver(char *driver_name, int driver_id)
 		midi_tx_thread_func = &raw_midi_tx_thread;
 		midi_watchdog_func  = NULL;
 	}
+#endif
+#ifdef ENABLE_SIM
+	else if ((driver_id == MIDI_DRIVER_RAW_SIM) ||
+	         (strcmp(driver_name, "sim") == 0)) {
+		midi_driver_name    = "sim";
+		midi_driver         = MIDI_DRIVER_RAW_SIM;
+		midi_init_func      = &rawmidi_init;
+		midi_start_func     = NULL;
+		midi_stop_func      = NULL;
+		midi_restart_func   = NULL;
+		midi_rx_thread_func = &raw_midi_rx_thread;
+		midi_tx_thread_func = &raw_midi_tx_thread;
+		midi_watchdog_func  = NULL;
+	}
 #endif
 	else if ((driver_id == MIDI_DRIVER_NONE) ||
 	         (strcmp(driver_name, "none") == 0) ||
@@ -205,6 +225,23 @@ select_midi_driver(char *driver_name, int driver_id)
 }
 
 
+/*****************************************************************************
+ * get_midi_thread_routes()
+ *
+ * Returns the number of MIDI Rx/Tx thread pairs run by the MIDI driver.  The
+ * ALSA seq driver services every route from one pair of threads, while the
+ * Raw MIDI drivers run a pair of threads (and a device) per route.
+ *****************************************************************************/
+int
+get_midi_thread_routes(void)
+{
+	if (midi_driver == MIDI_DRIVER_ALSA_SEQ) {
+		return 1;
+	}
+	return num_midi_routes;
+}
+
+
 /*****************************************************************************
  * init_jack_audio_driver()
  *****************************************************************************/
@@ -340,24 +377,29 @@ start_midi_rx(void)
 	int     saved_errno;
 #endif
 	int     ret;
+	int     route;
 
 	if (midi_rx_thread_func != NULL) {
 		init_rt_mutex(&midi_rx_ready_mutex, 1);
-		if ((ret = pthread_create(&midi_rx_thread_p, NULL,
-		                          midi_rx_thread_func, NULL)) != 0) {
+		midi_rx_ready = 0;
+		for (route = 0; route < get_midi_thread_routes(); route++) {
+			if ((ret = pthread_create(&(midi_rx_thread_p[route]), NULL,
+			                          midi_rx_thread_func,
+			                          GINT_TO_POINTER(route))) != 0) {
 #ifdef ENABLE_DEBUG
-			saved_errno = errno;
-			JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
-			                "Unable to start MIDI Rx thread:  "
-			                "error %d (%s).\n  errno=%d (%s)\n",
-			                ret,
-			                (ret == EAGAIN) ? "EAGAIN" :
-			                (ret == EINVAL) ? "EINVAL" :
-			                (ret == EPERM)  ? "EPERM"  : "",
-			                saved_errno,
-			                strerror(saved_errno));
+				saved_errno = errno;
+				JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
+				                "Unable to start MIDI Rx thread:  "
+				                "error %d (%s).\n  errno=%d (%s)\n",
+				                ret,
+				                (ret == EAGAIN) ? "EAGAIN" :
+				                (ret == EINVAL) ? "EINVAL" :
+				                (ret == EPERM)  ? "EPERM"  : "",
+				                saved_errno,
+				                strerror(saved_errno));
 #endif
-			jamrouter_shutdown("Shutting Down.");
+				jamrouter_shutdown("Shutting Down.");
+			}
 		}
 	}
 }
@@ -373,24 +415,29 @@ start_midi_tx(void)
 	int     saved_errno;
 #endif
 	int     ret;
+	int     route;
 
 	if (midi_tx_thread_func != NULL) {
 		init_rt_mutex(&midi_tx_ready_mutex, 1);
-		if ((ret = pthread_create(&midi_tx_thread_p, NULL,
-		                          midi_tx_thread_func, NULL)) != 0) {
+		midi_tx_ready = 0;
+		for (route = 0; route < get_midi_thread_routes(); route++) {
+			if ((ret = pthread_create(&(midi_tx_thread_p[route]), NULL,
+			                          midi_tx_thread_func,
+			                          GINT_TO_POINTER(route))) != 0) {
 #ifdef ENABLE_DEBUG
-			saved_errno = errno;
-			JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
-			                "Unable to start MIDI Tx thread:  "
-			                "error %d (%s).\n  errno=%d (%s)\n",
-			                ret,
-			                (ret == EAGAIN) ? "EAGAIN" :
-			                (ret == EINVAL) ? "EINVAL" :
-			                (ret == EPERM)  ? "EPERM"  : "",
-			                saved_errno,
-			                strerror(saved_errno));
+				saved_errno = errno;
+				JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
+				                "Unable to start MIDI Tx thread:  "
+				                "error %d (%s).\n  errno=%d (%s)\n",
+				                ret,
+				                (ret == EAGAIN) ? "EAGAIN" :
+				                (ret == EINVAL) ? "EINVAL" :
+				                (ret == EPERM)  ? "EPERM"  : "",
+				                saved_errno,
+				                strerror(saved_errno));
 #endif
-			jamrouter_shutdown("Shutting Down.");
+				jamrouter_shutdown("Shutting Down.");
+			}
 		}
 	}
 }
@@ -404,7 +451,7 @@ wait_midi_rx_start(void)
 {
 	if (midi_rx_thread_func != NULL) {
 		pthread_mutex_lock(&midi_rx_ready_mutex);
-		if (!midi_rx_ready) {
+		while (midi_rx_ready < get_midi_thread_routes()) {
 			pthread_cond_wait(&midi_rx_ready_cond, &midi_rx_ready_mutex);
 		}
 		pthread_mutex_unlock(&midi_rx_ready_mutex);
@@ -420,7 +467,7 @@ wait_midi_tx_start(void)
 {
 	if (midi_tx_thread_func != NULL) {
 		pthread_mutex_lock(&midi_tx_ready_mutex);
-		if (!midi_tx_ready) {
+		while (midi_tx_ready < get_midi_thread_routes()) {
 			pthread_cond_wait(&midi_tx_ready_cond, &midi_tx_ready_mutex);
 		}
 		pthread_mutex_unlock(&midi_tx_ready_mutex);
@@ -454,8 +501,17 @@ stop_midi_tx(void)
 void
 wait_midi_rx_stop(void)
 {
-	if (midi_rx_thread_p != 0) {
-		pthread_join(midi_rx_thread_p,  NULL);
+	pthread_t   thread_p;
+	int         joined  = 0;
+	int         route;
+
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		if ((thread_p = midi_rx_thread_p[route]) != 0) {
+			pthread_join(thread_p,  NULL);
+			joined = 1;
+		}
+	}
+	if (joined) {
 		usleep(125000);
 	}
 }
@@ -467,8 +523,17 @@ wait_midi_rx_stop(void)
 void
 wait_midi_tx_stop(void)
 {
-	if (midi_tx_thread_p != 0) {
-		pthread_join(midi_tx_thread_p,  NULL);
+	pthread_t   thread_p;
+	int         joined  = 0;
+	int         route;
+
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		if ((thread_p = midi_tx_thread_p[route]) != 0) {
+			pthread_join(thread_p,  NULL);
+			joined = 1;
+		}
+	}
+	if (joined) {
 		usleep(125000);
 	}
 }
@@ -551,6 +616,12 @@ jamrouter_watchdog(void)
 			wait_midi_rx_start();
 		}
 
+		/* periodic latency and jitter export, if enabled */
+		export_stats_cycle();
+
+		/* test mode results, if running */
+		test_mode_cycle();
+
 		usleep(33333);
 	}
 }
@@ -716,7 +787,7 @@ audio_driver_running(void)
 void
 query_audio_driver_status(char *buf)
 {
-	TIMESTAMP       now;
+	timensec_t      now;
 	unsigned short  period = get_midi_period(&now);
 
 	snprintf(buf, 256,
@@ -35,6 +35,7 @@
 #define MIDI_DRIVER_RAW_GENERIC     4
 #define MIDI_DRIVER_RAW_OSS         5
 #define MIDI_DRIVER_RAW_OSS2        6
+#define MIDI_DRIVER_RAW_SIM         7
 
 
 typedef void *(*THREAD_FUNC)(void *);
@@ -87,6 +88,7 @@ extern char             *midi_driver_names[];
 
 
 void select_midi_driver(char *driver_name, int driver_id);
+int  get_midi_thread_routes(void);
 
 void init_jack_audio_driver(void);
 void init_jack_audio(void);
@@ -38,6 +38,8 @@
 #include "jack.h"
 #include "jack_midi.h"
 #include "midi_event.h"
+#include "midi_sync.h"
+#include "testmode.h"
 #include "debug.h"
 #include "driver.h"
 
@@ -52,8 +54,8 @@
 jack_client_t           *jack_audio_client          = NULL;
 static char             jack_audio_client_name[64]  = "jamrouter";
 
-jack_port_t             *midi_input_port            = NULL;
-jack_port_t             *midi_output_port           = NULL;
+jack_port_t             *midi_input_port[MAX_MIDI_ROUTES];
+jack_port_t             *midi_output_port[MAX_MIDI_ROUTES];
 
 JACK_PORT_INFO          *jack_midi_input_ports      = NULL;
 JACK_PORT_INFO          *jack_midi_output_ports     = NULL;
@@ -81,6 +83,7 @@ jack_process_buffer_no_audio(jack_nframes_t nframes, void *UNUSED(arg))
 {
 	static jack_nframes_t  last_nframes     = 0;
 	unsigned short         new_period;
+	unsigned char          route;
 
 	if ((jack_audio_client == NULL)) {
 		return 0;
@@ -93,7 +96,16 @@ jack_process_buffer_no_audio(jack_nframes_t nframes, void *UNUSED(arg))
 
 	new_period = set_midi_cycle_time(jack_midi_period, (int)(nframes));
 
-	jack_process_midi_in(jack_midi_period, (unsigned short)(nframes));
+	/* test mode probes go out ahead of JACK MIDI input on route 0 */
+	test_mode_send_probes(jack_midi_period);
+
+	/* generated MIDI sync also goes out ahead of JACK MIDI input */
+	midi_sync_send(jack_midi_period, (unsigned short)(nframes));
+
+	/* all routes are serviced from this one process callback */
+	for (route = 0; route < num_midi_routes; route++) {
+		jack_process_midi_in(jack_midi_period, route, (unsigned short)(nframes));
+	}
 
 	/* During JAMRouter development, after observing memory reordering issues
 	   in the other threads, this was identified as a critical section where
@@ -110,7 +122,12 @@ jack_process_buffer_no_audio(jack_nframes_t nframes, void *UNUSED(arg))
 	   synchronization errors. */
     asm volatile ("mfence; # read/write fence" : : : "memory");
 
-	jack_process_midi_out(jack_midi_period, (unsigned short)(nframes));
+	/* regenerated MIDI clock is queued for this period before dequeueing */
+	midi_sync_regenerate(jack_midi_period);
+
+	for (route = 0; route < num_midi_routes; route++) {
+		jack_process_midi_out(jack_midi_period, route, (unsigned short)(nframes));
+	}
 
 	jack_midi_period = new_period;
 
@@ -173,15 +190,15 @@ jack_get_midi_port_list(long unsigned int flags)
 			/* rx from port that can output */
 			if (flags & JackPortIsOutput) {
 				new->connected =
-					((midi_input_port != NULL) ?
-					 (jack_port_connected_to(midi_input_port,
+					((midi_input_port[0] != NULL) ?
+					 (jack_port_connected_to(midi_input_port[0],
 					                         jack_port_name(port)) ? 1 : 0) : 0);
 			}
 			/* tx to port than can take input */
 			if (flags & JackPortIsInput) {
 				new->connected =
-					((midi_output_port != NULL) ?
-					 (jack_port_connected_to(midi_output_port,
+					((midi_output_port[0] != NULL) ?
+					 (jack_port_connected_to(midi_output_port[0],
 					                         jack_port_name(port)) ? 1 : 0) : 0);
 			}
 			new->connect_request    = 0;
@@ -357,14 +374,14 @@ jack_port_registration_handler(jack_port_id_t port_id,
 			new->type      = strdup(JACK_DEFAULT_MIDI_TYPE);
 			if (flags & JackPortIsOutput) {
 				head = cur = jack_midi_input_ports;
-				new->connected = ((midi_input_port != NULL) ?
-				                  (jack_port_connected_to(midi_input_port,
+				new->connected = ((midi_input_port[0] != NULL) ?
+				                  (jack_port_connected_to(midi_input_port[0],
 				                                          port_name) ? 1 : 0) : 0);
 			}
 			else if (flags & JackPortIsInput) {
 				head = cur = jack_midi_output_ports;
-				new->connected = ((midi_output_port != NULL) ?
-				                  (jack_port_connected_to(midi_output_port,
+				new->connected = ((midi_output_port[0] != NULL) ?
+				                  (jack_port_connected_to(midi_output_port[0],
 				                                          port_name) ? 1 : 0) : 0);
 			}
 			new->connect_request    = 0;
@@ -554,12 +571,16 @@ jack_samplerate_handler(jack_nframes_t nframes, void *UNUSED(arg))
 void
 jack_shutdown_handler(void *UNUSED(arg))
 {
+	unsigned char   route;
+
 	/* set state so client can be restarted */
 	jack_running        = 0;
 	jack_thread_p       = 0;
 	jack_audio_client   = NULL;
-	midi_input_port     = NULL;
-	midi_output_port    = NULL;
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		midi_input_port[route]  = NULL;
+		midi_output_port[route] = NULL;
+	}
 
 	JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
 	                "JACK shutdown handler called in client thread 0x%lx\n",
@@ -594,12 +615,13 @@ jack_xrun_handler(void *UNUSED(arg))
 void
 set_jack_latency(jack_latency_callback_mode_t mode)
 {
-	struct timespec         now;
+	timensec_t              now;
 	jack_latency_range_t    range;
 	jack_nframes_t          min_adj;
 	jack_nframes_t          max_adj;
 	jack_nframes_t          max_jitter;
 	unsigned short          period;
+	unsigned char           route;
 
 	range.min = 0;
 	range.max = 0;
@@ -645,8 +667,10 @@ set_jack_latency(jack_latency_callback_mode_t mode)
 		max_adj = min_adj + max_jitter;
 		range.min += min_adj;
 		range.max += max_adj;
-		jack_port_set_latency_range(midi_input_port,
-		                            JackPlaybackLatency, &range);
+		for (route = 0; route < num_midi_routes; route++) {
+			jack_port_set_latency_range(midi_input_port[route],
+			                            JackPlaybackLatency, &range);
+		}
 		JAMROUTER_DEBUG(DEBUG_CLASS_DRIVER,
 		                "JACK MIDI Input --> MIDI Tx Latency:"
 		                "   min / max  =  %d / %d\n",
@@ -660,8 +684,10 @@ set_jack_latency(jack_latency_callback_mode_t mode)
 		max_adj = min_adj + max_jitter;
 		range.min += min_adj;
 		range.max += max_adj;
-		jack_port_set_latency_range(midi_output_port,
-			JackCaptureLatency, &range);
+		for (route = 0; route < num_midi_routes; route++) {
+			jack_port_set_latency_range(midi_output_port[route],
+			                            JackCaptureLatency, &range);
+		}
 		JAMROUTER_DEBUG(DEBUG_CLASS_DRIVER,
 		                "MIDI Rx --> JACK MIDI Output Latency:"
 		                "  min / max  =  %d / %d\n",
@@ -760,6 +786,9 @@ jack_audio_init(int scan)
 	jack_status_t   client_status;
 	unsigned int    new_sample_rate;
 	unsigned int    new_buffer_period_size;
+	char            input_port_name[32];
+	char            output_port_name[32];
+	unsigned char   route;
 
 	JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
 	                "Initializing JACK client from thread 0x%lx\n",
@@ -882,13 +911,36 @@ jack_audio_init(int scan)
 	init_sync_info((unsigned int)(new_sample_rate),
 	               (short unsigned int)(new_buffer_period_size));
 
-	/* register midi input/output ports */
-	midi_input_port = jack_port_register(jack_audio_client, "midi_in",
-	                                     JACK_DEFAULT_MIDI_TYPE,
-	                                     JackPortIsInput, 0);
-	midi_output_port = jack_port_register(jack_audio_client, "midi_out",
-	                                      JACK_DEFAULT_MIDI_TYPE,
-	                                      JackPortIsOutput, 0);
+	/* register midi input/output ports for each route.  route 0 keeps the
+	   original port names. */
+	for (route = 0; route < num_midi_routes; route++) {
+		if (route == 0) {
+			snprintf(input_port_name, sizeof(input_port_name), "midi_in");
+			snprintf(output_port_name, sizeof(output_port_name), "midi_out");
+		}
+		else {
+			snprintf(input_port_name, sizeof(input_port_name),
+			         "midi_in_%d", route + 1);
+			snprintf(output_port_name, sizeof(output_port_name),
+			         "midi_out_%d", route + 1);
+		}
+		midi_input_port[route] = jack_port_register(jack_audio_client,
+		                                            input_port_name,
+		                                            JACK_DEFAULT_MIDI_TYPE,
+		                                            JackPortIsInput, 0);
+		midi_output_port[route] = jack_port_register(jack_audio_client,
+		                                             output_port_name,
+		                                             JACK_DEFAULT_MIDI_TYPE,
+		                                             JackPortIsOutput, 0);
+		if ((midi_input_port[route] == NULL) || (midi_output_port[route] == NULL)) {
+			JAMROUTER_ERROR("Unable to register JACK MIDI ports for route %d.\n",
+			                route + 1);
+			jack_client_close(jack_audio_client);
+			jack_audio_client  = NULL;
+			jack_running = 0;
+			return 1;
+		}
+	}
 
 	/* set all callbacks needed for jack */
 	jack_set_process_callback
@@ -946,6 +998,7 @@ jack_start(void)
 	JACK_PORT_INFO      *cur;
 	const char          *portname;
 	char                thread_name[16];
+	unsigned char       route;
 
 	/* activate client (callbacks start, so everything needs to be ready) */
 	if (jack_activate(jack_audio_client)) {
@@ -955,7 +1008,10 @@ jack_start(void)
 		jack_running        = 0;
 		jack_thread_p       = 0;
 		jack_audio_client   = NULL;
-		midi_input_port     = NULL;
+		for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+			midi_input_port[route]  = NULL;
+			midi_output_port[route] = NULL;
+		}
 		return 1;
 	}
 
@@ -979,7 +1035,7 @@ jack_start(void)
 		JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
 		                "Checking JACK MIDI Input port '%s'\n", cur->name);
 		if (strcmp(jack_input_port_name, cur->name) == 0) {
-			portname = jack_port_name(midi_input_port);
+			portname = jack_port_name(midi_input_port[0]);
 			if (jack_connect(jack_audio_client, cur->name, portname)) {
 				JAMROUTER_WARN("Unable to connect '%s' --> '%s'\n",
 				               cur->name, portname);
@@ -995,7 +1051,7 @@ jack_start(void)
 		JAMROUTER_DEBUG(DEBUG_CLASS_INIT,
 		                "Checking JACK MIDI Output port '%s'\n", cur->name);
 		if (strcmp(jack_output_port_name, cur->name) == 0) {
-			portname = jack_port_name(midi_output_port);
+			portname = jack_port_name(midi_output_port[0]);
 			if (jack_connect(jack_audio_client, portname, cur->name)) {
 				JAMROUTER_WARN("Unable to connect '%s' --> '%s'\n",
 				               portname, cur->name);
@@ -1020,12 +1076,13 @@ jack_stop(void)
 {
 	JACK_PORT_INFO  *cur;
 	jack_client_t   *tmp_client;
+	unsigned char   route;
 
 	if ((jack_audio_client != NULL) && jack_running && (jack_thread_p) != 0) {
 		cur = jack_midi_input_ports;
 		while (cur != NULL) {
 			if (cur->connected) {
-				jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_input_port));
+				jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_input_port[0]));
 				JAMROUTER_WARN("Disconnected port '%s'...\n", cur->name);
 				cur->connected = 0;
 			}
@@ -1034,7 +1091,7 @@ jack_stop(void)
 		cur = jack_midi_output_ports;
 		while (cur != NULL) {
 			if (cur->connected) {
-				jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_output_port));
+				jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_output_port[0]));
 				JAMROUTER_WARN("Disconnected port '%s'...\n", cur->name);
 				cur->connected = 0;
 			}
@@ -1048,8 +1105,10 @@ jack_stop(void)
 		jack_client_close(tmp_client);
 		jack_audio_client   = NULL;
 		jack_thread_p       = 0;
-		midi_input_port     = NULL;
-		midi_output_port    = NULL;
+		for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+			midi_input_port[route]  = NULL;
+			midi_output_port[route] = NULL;
+		}
 	}
 
 	jack_running = 0;
@@ -1108,8 +1167,8 @@ jack_watchdog_cycle(void)
 	cur = jack_midi_input_ports;
 	while (cur != NULL) {
 		if (cur->connect_request) {
-			jack_connect(jack_audio_client, cur->name, jack_port_name(midi_input_port));
-			if (jack_port_connected_to(midi_input_port, cur->name)) {
+			jack_connect(jack_audio_client, cur->name, jack_port_name(midi_input_port[0]));
+			if (jack_port_connected_to(midi_input_port[0], cur->name)) {
 				cur->connected          = 1;
 				cur->connect_request    = 0;
 				cur->disconnect_request = 0;
@@ -1121,8 +1180,8 @@ jack_watchdog_cycle(void)
 			}
 		}
 		else if (cur->disconnect_request) {
-			jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_input_port));
-			if (jack_port_connected_to(midi_input_port, cur->name)) {
+			jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_input_port[0]));
+			if (jack_port_connected_to(midi_input_port[0], cur->name)) {
 				cur->connected          = 1;
 				cur->connect_request    = 0;
 				cur->disconnect_request = 1;
@@ -1138,8 +1197,8 @@ jack_watchdog_cycle(void)
 	cur = jack_midi_output_ports;
 	while (cur != NULL) {
 		if (cur->connect_request) {
-			jack_connect(jack_audio_client, cur->name, jack_port_name(midi_output_port));
-			if (jack_port_connected_to(midi_output_port, cur->name)) {
+			jack_connect(jack_audio_client, cur->name, jack_port_name(midi_output_port[0]));
+			if (jack_port_connected_to(midi_output_port[0], cur->name)) {
 				cur->connected          = 1;
 				cur->connect_request    = 0;
 				cur->disconnect_request = 0;
@@ -1151,8 +1210,8 @@ jack_watchdog_cycle(void)
 			}
 		}
 		else if (cur->disconnect_request) {
-			jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_output_port));
-			if (jack_port_connected_to(midi_output_port, cur->name)) {
+			jack_disconnect(jack_audio_client, cur->name, jack_port_name(midi_output_port[0]));
+			if (jack_port_connected_to(midi_output_port[0], cur->name)) {
 				cur->connected          = 1;
 				cur->connect_request    = 0;
 				cur->disconnect_request = 1;
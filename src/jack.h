@@ -40,8 +40,8 @@ typedef struct jack_port_info {
 
 extern jack_client_t        *jack_audio_client;
 
-extern jack_port_t          *midi_input_port;
-extern jack_port_t          *midi_output_port;
+extern jack_port_t          *midi_input_port[MAX_MIDI_ROUTES];
+extern jack_port_t          *midi_output_port[MAX_MIDI_ROUTES];
 
 extern JACK_PORT_INFO       *jack_midi_input_ports;
 extern JACK_PORT_INFO       *jack_midi_output_ports;
@@ -31,6 +31,12 @@
 #include "jack.h"
 #include "jack_midi.h"
 #include "midi_event.h"
+#include "midi_sync.h"
+#include "sysex_stream.h"
+#include "param_limit.h"
+#include "timer_wheel.h"
+#include "stats.h"
+#include "testmode.h"
 #include "debug.h"
 
 #ifndef WITHOUT_JUNO
@@ -44,12 +50,13 @@
  * called by jack_process_buffer()
  *****************************************************************************/
 void
-jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
+jack_process_midi_in(unsigned short period, unsigned char route, jack_nframes_t nframes)
 {
 	volatile MIDI_EVENT *out_event;
-	void                *port_buf   = jack_port_get_buffer(midi_input_port, nframes);
+	void                *port_buf   = jack_port_get_buffer(midi_input_port[route], nframes);
 	jack_midi_event_t   in_event;
 	jack_nframes_t      num_events  = jack_midi_get_event_count(port_buf);
+	timensec_t          now         = 0;
 	unsigned char       type        = MIDI_EVENT_NO_EVENT;
 	unsigned char       channel;
 	unsigned short      translated_event;
@@ -57,6 +64,8 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 	unsigned short      j;
 	unsigned short      input_index     = sync_info[period].input_index;
 	unsigned short      output_index    = sync_info[period].output_index;
+	unsigned char       tx_queue        = J2A_ROUTE_QUEUE(route);
+	unsigned char       echo_queue      = A2J_ROUTE_QUEUE(route);
 	union {
 		short               s;
 		unsigned short      u;
@@ -68,7 +77,21 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 	for (e = 0; e < num_events; e++) {
 		translated_event = 0;
 		jack_midi_event_get(&in_event, port_buf, e);
-		out_event = get_new_midi_event(J2A_QUEUE);
+		/* continuation of SysEx sent by JACK in fragments */
+		if (in_event.buffer[0] < 0x80) {
+			sysex_stream_write(route, (unsigned short)(in_event.time),
+			                   in_event.buffer, (unsigned int)(in_event.size));
+			continue;
+		}
+		/* drop the message when every event in the pool is in flight */
+		if ((out_event = get_new_midi_event(tx_queue)) == NULL) {
+			continue;
+		}
+		/* one clock read per cycle is enough for ingress time */
+		if (now == 0) {
+			time_get_nsecs(&now);
+		}
+		out_event->ingress_time = now;
 		/* handle messages with channel number embedded in the first byte */
 		if (in_event.buffer[0] < 0xF0) {
 			type               = in_event.buffer[0] & 0xF0;
@@ -144,11 +167,11 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 					out_event->type = MIDI_EVENT_NOTE_ON;
 					/* translate back to optional alternate note off velocity */
 					out_event->velocity = note_off_velocity;
-					track_note_off(J2A_QUEUE, channel, out_event->note);
+					track_note_off(tx_queue, channel, out_event->note);
 					/* translate last note off into all-notes-off controller */
 					/* MIDI Tx thread will ignore other note-off messages queued */
 					/* for the same cycle frame to save MIDI bandwidth. */
-					if (tx_prefer_all_notes_off && (keys_in_play[J2A_QUEUE] == 0)) {
+					if (tx_prefer_all_notes_off && (keys_in_play[tx_queue] == 0)) {
 						out_event->type       = MIDI_EVENT_CONTROLLER;
 						out_event->channel    = channel;
 						out_event->controller = MIDI_CONTROLLER_ALL_NOTES_OFF;
@@ -165,7 +188,7 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 					if (note_on_velocity != 0x0) {
 						out_event->velocity = note_on_velocity;
 					}
-					track_note_on(J2A_QUEUE, channel, out_event->note);
+					track_note_on(tx_queue, channel, out_event->note);
 				}
 			}
 			/* translate pitchbend to controller on alternate channel */
@@ -182,12 +205,12 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 			}
 			/* echo translated events back to jack tx. */
 			if (echotrans && translated_event && (out_event->bytes > 0)) {
-				queue_midi_event(period, A2J_QUEUE, out_event,
+				queue_midi_event(period, echo_queue, out_event,
 				                 (unsigned short)(in_event.time), output_index, 1);
 			}
 #ifndef WITHOUT_JUNO
 			/* translate controllers to Juno-106 sysex */
-			translate_to_juno(period, J2A_QUEUE, out_event,
+			translate_to_juno(period, tx_queue, out_event,
 			                  (unsigned short)(in_event.time), output_index);
 #endif
 		}
@@ -197,26 +220,32 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 			out_event->type = (unsigned char)(in_event.buffer[0]);
 			switch (in_event.buffer[0]) {
 			case MIDI_EVENT_SYSEX:          // 0xF0
-				out_event->bytes = (unsigned int)(in_event.size);
-				if (out_event->bytes > SYSEX_BUFFER_SIZE) {
-					out_event->bytes = SYSEX_BUFFER_SIZE;
+				/* SysEx too large for one fragment, the start of a message
+				   JACK continues in later events, and anything behind a
+				   stream already in flight, is streamed to MIDI Tx. */
+				if ( (in_event.size > SYSEX_FRAGMENT_SIZE) ||
+				     (in_event.buffer[in_event.size - 1] != 0xF7) ||
+				     sysex_stream_pending(route) ) {
+					sysex_stream_write(route, (unsigned short)(in_event.time),
+					                   in_event.buffer,
+					                   (unsigned int)(in_event.size));
+					out_event->bytes = 0;
+					break;
+				}
+				/* complete message:  copy to the arena, or stream the
+				   message with the arena still in use. */
+				if ((out_event->data = get_sysex_buffer(tx_queue,
+				                                        (unsigned int)(in_event.size))) == NULL) {
+					sysex_stream_write(route, (unsigned short)(in_event.time),
+					                   in_event.buffer,
+					                   (unsigned int)(in_event.size));
+					out_event->bytes = 0;
+					break;
 				}
+				out_event->bytes = (unsigned int)(in_event.size);
 				memcpy((void *)(out_event->data), in_event.buffer, out_event->bytes);
 				/* convert end-sysex byte for obscure hardware. */
-				if (out_event->data[in_event.size - 1] != sysex_terminator) {
-					if (out_event->data[in_event.size - 1] == 0xF7) {
-						out_event->data[in_event.size - 1] = sysex_terminator;
-					}
-					else {
-						out_event->data[in_event.size] = sysex_terminator;
-						out_event->bytes++;
-						if ( (out_event->bytes < SYSEX_BUFFER_SIZE) &&
-						     (sysex_extra_terminator != 0xF7) ) {
-							out_event->data[in_event.size + 1] = sysex_extra_terminator;
-							out_event->bytes++;
-						}
-					}
-				}
+				out_event->data[out_event->bytes - 1] = sysex_terminator;
 				break;
 			/* 3 byte system messages */
 			case MIDI_EVENT_SONGPOS:        // 0xF2
@@ -246,11 +275,38 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 			default:
 				break;
 			}
+			/* drop upstream sync replaced by generated sync */
+			if (midi_sync_tx_filter(type)) {
+				out_event->bytes = 0;
+			}
 		} /* else() */
 
-		/* queue event. */
-		queue_midi_event(period, J2A_QUEUE, out_event,
-		                 (unsigned short)(in_event.time), input_index, 0);
+		/* drop redundant and too frequent parameter updates */
+		if ( (out_event->bytes > 0) &&
+		     param_limit_filter(period, route, (unsigned short)(in_event.time),
+		                        out_event) ) {
+			out_event->bytes = 0;
+		}
+
+		/* hold back events for channels with a delay set */
+		if ( (out_event->bytes > 0) &&
+		     channel_delay_event(period, route, (unsigned short)(in_event.time),
+		                         out_event) ) {
+			out_event->bytes = 0;
+		}
+
+		/* queue event, or hold it behind a SysEx stream in flight.
+		   Realtime messages may go out in the middle of SysEx. */
+		if ( (out_event->bytes > 0) &&
+		     (out_event->type < MIDI_EVENT_TICK) &&
+		     sysex_stream_pending(route) ) {
+			sysex_stream_write_event(route, (unsigned short)(in_event.time),
+			                         out_event);
+		}
+		else {
+			queue_midi_event(period, tx_queue, out_event,
+			                 (unsigned short)(in_event.time), input_index, 0);
+		}
 
 		if (debug_class & DEBUG_CLASS_STREAM) {
 			JAMROUTER_DEBUG(DEBUG_CLASS_TESTING, "\n");
@@ -268,14 +324,23 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
 
 	//jack_midi_clear_buffer(port_buf);
 
+	/* send parameter values held back by the rate limit */
+	param_limit_flush(period, route);
+
+	/* send delayed events falling due in this period */
+	timer_wheel_expire(period, route, (unsigned short)(nframes));
+
+	/* hand the next period's worth of any SysEx stream to MIDI Tx */
+	sysex_stream_pump(period, route);
+
 	/* now that all events for this cycle are handled, check for an active
 	   sensing timeout. */
 	/* a real timeout has occurred when there are _no_ midi events. */
 	if ( (num_events == 0) &&
-	     (check_active_sensing_timeout(period, J2A_QUEUE)
+	     (check_active_sensing_timeout(period, tx_queue)
 	      == ACTIVE_SENSING_STATUS_TIMEOUT) ) {
 		for (j = 0; j < 16; j++) {
-			queue_notes_off(period, J2A_QUEUE, (unsigned char)(j),
+			queue_notes_off(period, tx_queue, (unsigned char)(j),
 			                0, input_index);
 		}
 	}
@@ -287,27 +352,66 @@ jack_process_midi_in(unsigned short period, jack_nframes_t nframes)
  * called by jack_process_buffer() or jack_midi_tx_thread()
  *****************************************************************************/
 void
-jack_process_midi_out(unsigned short period, jack_nframes_t nframes)
+jack_process_midi_out(unsigned short period, unsigned char route, jack_nframes_t nframes)
 {
 	volatile MIDI_EVENT     *event;
 	volatile MIDI_EVENT     *next;
-	void                    *port_buf = jack_port_get_buffer(midi_output_port, nframes);
-	volatile unsigned char  *p;
-	volatile unsigned char  *q;
+	void                    *port_buf = jack_port_get_buffer(midi_output_port[route], nframes);
 	jack_midi_data_t        *buffer;
+	timensec_t              now         = 0;
+	timensec_t              done;
+	int                     late_frames;
 	unsigned short          cycle_frame;
 	unsigned short          j;
 	unsigned short          last_period = sync_info[period].prev;
+	unsigned char           queue_num   = A2J_ROUTE_QUEUE(route);
 
 	jack_midi_clear_buffer(port_buf);
 
-	for (cycle_frame = 0; cycle_frame < sync_info[period].buffer_period_size; cycle_frame++) {
-		event = dequeue_midi_event(A2J_QUEUE, &last_period, period, cycle_frame);
-		
+	/* visit only frames with events queued */
+	for ( cycle_frame = get_next_queued_frame(queue_num, period, 0);
+	      cycle_frame < sync_info[period].buffer_period_size;
+	      cycle_frame = get_next_queued_frame(queue_num, period,
+	                                          (unsigned short)(cycle_frame + 1)) ) {
+		event = dequeue_midi_event(queue_num, &last_period, period, cycle_frame,
+		                           &late_frames);
+
 		while ((event != NULL) && (event->state == EVENT_STATE_QUEUED)) {
 
+			if (event->bytes > 0) {
+				/* one clock read per cycle is enough for queue delay */
+				if (now == 0) {
+					time_get_nsecs(&now);
+				}
+				stats_record_queue_delay(queue_num, now, event->ingress_time);
+				/* frame delivered vs. frame the event was queued for */
+				stats_record_frame_error(&(queue_stats[queue_num].frame_error),
+				                         late_frames);
+
+				/* test mode probes are accounted for, not passed on */
+				if ((route == 0) && test_mode_receive_probe(event)) {
+					event->bytes = 0;
+				}
+				/* incoming clock is replaced by the regenerated clock */
+				else if (midi_sync_receive(period, route, cycle_frame, event)) {
+					event->bytes = 0;
+				}
+				/* shed low priority messages under overload */
+				else if (shed_dequeued_event(queue_num, event)) {
+					event->bytes = 0;
+				}
+			}
+
 			if (event->bytes > 0) {
 				buffer = jack_midi_event_reserve(port_buf, cycle_frame, event->bytes);
+				if (buffer == NULL) {
+					JAMROUTER_WARN("JACK MIDI output buffer full:  "
+					               "%d byte event dropped.\n", event->bytes);
+					event->bytes = 0;
+				}
+			}
+
+			if (event->bytes > 0) {
 
 				/* handle messages with channel number embedded in the first byte */
 				if (event->type < 0xF0) {
@@ -329,13 +433,14 @@ jack_process_midi_out(unsigned short period, jack_nframes_t nframes)
 					buffer[0] = (jack_midi_data_t)(event->type);
 					switch (event->type) {
 					case MIDI_EVENT_SYSEX:          // 0xF0
-						p = (volatile unsigned char *)(event->data);
-						q = buffer;
-						*q = 0xF0;
-						while (*p != 0xF7) {
-							*q++ = *p++;
+						/* SysEx is passed on as received, which may be a
+						   fragment lacking 0xF0 and / or 0xF7. */
+						if (event->data != NULL) {
+							memcpy(buffer, (void *)(event->data), event->bytes);
+						}
+						else {
+							buffer[event->bytes - 1] = 0xF7;
 						}
-						*q++ = 0xF7;
 						break;
 						/* 3 byte system messages */
 					case MIDI_EVENT_SONGPOS:        // 0xF2
@@ -388,17 +493,18 @@ jack_process_midi_out(unsigned short period, jack_nframes_t nframes)
 			/* keep track of next event */
 			next = (MIDI_EVENT *)(event->next);
 
-			/* Clear event. */
-			event->type    = 0;
-			event->channel = 0;
-			event->byte2   = 0;
-			event->byte3   = 0;
-			event->next    = NULL;
-			event->state   = EVENT_STATE_FREE;
+			/* return event to the pool. */
+			free_midi_event(queue_num, event);
 
 			/* process next event next while() iteration */
 			event = next;
 
 		} /* while */
 	}
+
+	/* time spent writing this cycle's events to the JACK port buffer */
+	if (now != 0) {
+		time_get_nsecs(&done);
+		stats_record_nsecs(&(queue_stats[queue_num].write_time), done - now);
+	}
 }
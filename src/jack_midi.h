@@ -24,8 +24,12 @@
 #define _JACK_MIDI_H_
 
 
-extern void jack_process_midi_in(unsigned short period, jack_nframes_t nframes);
-extern void jack_process_midi_out(unsigned short period, jack_nframes_t nframes);
+extern void jack_process_midi_in(unsigned short period,
+                                 unsigned char route,
+                                 jack_nframes_t nframes);
+extern void jack_process_midi_out(unsigned short period,
+                                  unsigned char route,
+                                  jack_nframes_t nframes);
 
 
 #endif /* _JACK_MIDI_H_ */
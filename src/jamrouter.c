@@ -40,7 +40,13 @@
 #include "alsa_seq.h"
 #include "jack.h"
 #include "midi_event.h"
+#include "midi_sync.h"
+#include "sysex_stream.h"
+#include "param_limit.h"
+#include "timer_wheel.h"
 #include "timekeeping.h"
+#include "stats.h"
+#include "testmode.h"
 #include "debug.h"
 
 
@@ -52,9 +58,9 @@
 /* command line options */
 #define HAS_ARG     1
 #ifdef WITHOUT_JUNO
-# define NUM_OPTS    (36 + 1)
+# define NUM_OPTS    (49 + 1)
 #else
-# define NUM_OPTS    (38 + 1)
+# define NUM_OPTS    (51 + 1)
 #endif
 static struct option long_opts[] = {
 #ifndef WITHOUT_JUNO
@@ -69,13 +75,23 @@ static struct option long_opts[] = {
 	{ "tx-latency",      HAS_ARG, NULL, 'X' },
 	{ "byte-guard-time", HAS_ARG, NULL, 'g' },
 	{ "event-guard-time",HAS_ARG, NULL, 'G' },
+	{ "tx-baud",         HAS_ARG, NULL, 'W' },
+	{ "tx-order",        HAS_ARG, NULL, 'O' },
+	{ "rx-order",        HAS_ARG, NULL, 'E' },
+	{ "overload",        HAS_ARG, NULL, 'w' },
+	{ "param-rate",      HAS_ARG, NULL, 'c' },
 	{ "input-port",      HAS_ARG, NULL, 'i' },
 	{ "output-port",     HAS_ARG, NULL, 'o' },
+	{ "routes",          HAS_ARG, NULL, 'm' },
+	{ "route-device",    HAS_ARG, NULL, 'V' },
 	{ "jitter-correct",  0,       NULL, 'j' },
 	{ "keymap",          HAS_ARG, NULL, 'k' },
 	{ "pitchmap",        HAS_ARG, NULL, 'p' },
 	{ "pitchcontrol",    HAS_ARG, NULL, 'q' },
+	{ "channel-delay",   HAS_ARG, NULL, 'a' },
 	{ "echotrans",       0,       NULL, 'e' },
+	{ "clock-out",       HAS_ARG, NULL, 'C' },
+	{ "smooth-clock",    0,       NULL, 'K' },
 	{ "sysexterminator", HAS_ARG, NULL, 'T' },
 	{ "extraterminator", HAS_ARG, NULL, 'U' },
 	{ "activesensing",   HAS_ARG, NULL, 'A' },
@@ -88,6 +104,7 @@ static struct option long_opts[] = {
 	{ "rx-priority",     HAS_ARG, NULL, 'y' },
 	{ "tx-priority",     HAS_ARG, NULL, 'Y' },
 	{ "debug",           HAS_ARG, NULL, 'd' },
+	{ "stats-file",      HAS_ARG, NULL, 'H' },
 	{ "uuid",            HAS_ARG, NULL, 'u' },
 	{ "list",            0,       NULL, 'l' },
 	{ "help",            0,       NULL, 'h' },
@@ -97,6 +114,8 @@ static struct option long_opts[] = {
 	{ "lash-server",     HAS_ARG, NULL, 'S' },
 	{ "lash-id",         HAS_ARG, NULL, 'I' },
 	{ "phase-lock",      HAS_ARG, NULL, 'z' },
+	{ "seq-queue",       0,       NULL, 'Q' },
+	{ "test",            HAS_ARG, NULL, 'b' },
 	{ 0,                 0,       NULL, 0 }
 };
 
@@ -105,8 +124,8 @@ char            jamrouter_cmdline[512]        = "\0";
 char            jamrouter_full_cmdline[512]   = "\0";
 
 pthread_t       debug_thread_p                = 0;
-pthread_t       midi_rx_thread_p              = 0;
-pthread_t       midi_tx_thread_p              = 0;
+pthread_t       midi_rx_thread_p[MAX_MIDI_ROUTES];
+pthread_t       midi_tx_thread_p[MAX_MIDI_ROUTES];
 pthread_t       jack_thread_p                 = 0;
 
 int             midi_rx_thread_priority       = MIDI_RX_THREAD_PRIORITY;
@@ -114,9 +133,11 @@ int             midi_tx_thread_priority       = MIDI_TX_THREAD_PRIORITY;
 
 char            *midi_rx_port_name            = NULL;
 char            *midi_tx_port_name            = NULL;
+char            *route_midi_device[MAX_MIDI_ROUTES];
 char            *jack_input_port_name         = NULL;
 char            *jack_output_port_name        = NULL;
 
+int             num_midi_routes               = 1;
 int             lash_disabled                 = 0;
 int             sample_rate                   = 0;
 int             jamrouter_instance            = 0;
@@ -127,7 +148,9 @@ int             rx_queue_real_note_off        = 0;
 int             echotrans                     = 0;
 int             active_sensing_mode           = ACTIVE_SENSING_MODE_ON;
 int             use_running_status            = 0;
+int             use_seq_queue                 = 0;
 int             byte_guard_time_usec          = 0;
+int             tx_baud_rate                  = MIDI_BAUD_RATE;
 int             event_guard_time_usec         = 0;
 int             rx_latency_periods            = 0;
 int             tx_latency_periods            = 0;
@@ -166,6 +189,10 @@ unsigned char   pitchcontrol_controller[16]   =
 	{ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
 	  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
 
+int             channel_delay_msec[16]        =
+	{ 0, 0, 0, 0, 0, 0, 0, 0,
+	  0, 0, 0, 0, 0, 0, 0, 0 };
+
 
 /*****************************************************************************
  * showusage()
@@ -180,6 +207,8 @@ showusage(char *argvzero)
 	       " -u, --uuid=             Set UUID for JACK Session handling.\n"
 	       " -d, --debug=            Can be repeated.  Choose from: full, init, driver,\n"
 	       "                           stream, timing, tx-timing, note, event, session.\n"
+	       " -H, --stats-file=       Export latency and jitter histograms as JSON to\n"
+	       "                           file, or to unix:<path> datagram socket.\n"
 #ifndef WITHOUT_LASH
 	       "LASH Options:\n\n"
 	       " -P, --lash-project=     LASH project name.\n"
@@ -197,8 +226,27 @@ showusage(char *argvzero)
 	       " -X, --tx-latency=       MIDI Tx latency periods (default 1 for buf > 128).\n"
 	       " -g, --byte-guard-time=  Guard time in microseconds after Tx of MIDI byte.\n"
 	       " -G, --event-guard-time= Guard time in microseconds after Tx of MIDI event.\n"
+	       " -W, --tx-baud=          Raw MIDI Tx wire speed for burst pacing\n"
+	       "                           (default 31250, 0 = no pacing).\n"
+	       " -O, --tx-order=         Order of MIDI Tx events due in the same frame:\n"
+	       "                           comma separated list of noteoff-first,\n"
+	       "                           noteon-first, high-first, low-first,\n"
+	       "                           controllers-first, sysex-last, realtime-first,\n"
+	       "                           or none (default).\n"
+	       " -E, --rx-order=         Order of MIDI Rx events due in the same frame\n"
+	       "                           (same rules as --tx-order).\n"
+	       " -w, --overload=         Overload handling:  off (default), thin (drop\n"
+	       "                           controller updates superseded while queued),\n"
+	       "                           or shed (thin, then drop active sensing).\n"
+	       " -c, --param-rate=       Max updates per second for each controller,\n"
+	       "                           aftertouch, and pitchbend on MIDI Tx.  Repeated\n"
+	       "                           values are dropped, and the latest value is\n"
+	       "                           always sent (default 0 = no limit).\n"
 	       " -i, --input-port=       JACK MIDI Input port name.\n"
 	       " -o, --output-port=      JACK MIDI Output port name.\n"
+	       " -m, --routes=           Number of JACK <--> MIDI port pairs to route (1-16).\n"
+	       " -V, --route-device=     <route>,<device>  Raw MIDI Rx/Tx device for route\n"
+	       "                           2-16.  Route 1 uses -D, -r, and -t.\n"
 	       " -y, --rx-priority=      Realtime thread priority for MIDI Rx thread.\n"
 	       " -Y, --tx-priority=      Realtime thread priority for MIDI Tx thread.\n\n"
 	       "MIDI Message Translation Options:\n\n"
@@ -221,6 +269,10 @@ showusage(char *argvzero)
 	       " -q, --pitchcontrol=     <rx-chan>,<tx-chan>,<controller>\n"
 	       "                           Map pitchbend to controller on alternate channel.\n"
 	       "                           (Can be repeated once per Rx channel.)\n\n"
+	       " -a, --channel-delay=    <tx-chan>,<msec>\n"
+	       "                           Delay MIDI Tx channel messages, to line up faster\n"
+	       "                           synths with slower ones.\n"
+	       "                           (Can be repeated once per Tx channel.)\n\n"
 	       " -e, --echotrans         Echo translated pitchbend and controller messages\n"
 	       "                           to JACK MIDI output port for sequencer recording.\n\n"
 #ifndef WITHOUT_JUNO
@@ -230,9 +282,21 @@ showusage(char *argvzero)
 	       " -s, --echosysex         Echo translated Juno-106 SysEx messages\n"
 	       "                           to JACK MIDI output port for sequencer recording.\n\n"
 #endif
+	       "MIDI Sync Options:\n\n"
+	       " -C, --clock-out=        Generate MIDI sync from JACK transport on MIDI Tx:\n"
+	       "                           comma separated list of clock, spp, mtc24,\n"
+	       "                           mtc25 (or mtc), mtc29 (29.97 drop), mtc30.\n"
+	       "                           Upstream sync of the same types is dropped.\n"
+	       " -K, --smooth-clock      Regenerate MIDI Rx clock with a DLL for JACK.\n\n"
 	       "Experimental Options:\n\n"
 	       " -j, --jitter-correct    Rx jitter correction mode.\n"
-	       " -z, --phase-lock=       JACK wakeup phase in MIDI Rx/Tx period (.06-.94).\n\n"
+	       " -z, --phase-lock=       JACK wakeup phase in MIDI Rx/Tx period (.06-.94).\n"
+	       " -Q, --seq-queue         Schedule MIDI Tx on an ALSA seq queue (seq only).\n\n"
+	       "Test Options:\n\n"
+	       " -b, --test=             <mode>[,<rate>[,<size>[,<seconds>]]]\n"
+	       "                           Send probes on route 0 through an external\n"
+	       "                           loopback, print results, and exit.  Modes:\n"
+	       "                           loopback, flood, bandwidth.\n\n"
 
 	       "\nJAMRouter:  JACK <--> ALSA MIDI Router  ver. " PACKAGE_VERSION "\n"
 	       "  (C) 2015 William Weston <william.h.weston@gmail.com>,\n"
@@ -355,6 +419,8 @@ jamrouter_shutdown(const char *msg)
 static void
 jamrouter_signal_handler(int i)
 {
+	int     route;
+
 	fprintf(stderr, "JAMRouter received signal %s.  Shutting down.\n",
 	        strsignal(i));
 	pending_shutdown = 1;
@@ -363,11 +429,13 @@ jamrouter_signal_handler(int i)
 	stop_jack_audio();
 	output_pending_debug();
 	sleep(1);
-	if (midi_rx_thread_p != 0) {
-		pthread_cancel(midi_rx_thread_p);
-	}
-	if (midi_tx_thread_p != 0) {
-		pthread_cancel(midi_tx_thread_p);
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		if (midi_rx_thread_p[route] != 0) {
+			pthread_cancel(midi_rx_thread_p[route]);
+		}
+		if (midi_tx_thread_p[route] != 0) {
+			pthread_cancel(midi_tx_thread_p[route]);
+		}
 	}
 	output_pending_debug();
 	exit(0);
@@ -453,9 +521,15 @@ hex_to_byte(char *hex)
  * main()
  *
  * Parse command line, load patch, start midi_tx, midi_rx, and jack threads.
+ * In the simulation harness, this is jamrouter_main(), run from its own
+ * thread by sim.c with a command line of its making.
  *****************************************************************************/
 int
+#ifdef ENABLE_SIM
+jamrouter_main(int argc, char **argv)
+#else
 main(int argc, char **argv)
+#endif
 {
 	char            thread_name[16];
 	char            opts[NUM_OPTS * 2 + 1];
@@ -470,10 +544,13 @@ main(int argc, char **argv)
 	int             saved_errno;
 	int             argcount                = 0;
 	char            **argvals               = argv;
+#ifndef ENABLE_SIM
 	char            **envp                  = environ;
 	char            *argvend                = (char *)argv;
 	size_t          argsize;
+#endif
 	unsigned char   rx_channel;
+	unsigned char   tx_channel;
 
 	setlocale(LC_ALL, "C");
 
@@ -518,7 +595,7 @@ main(int argc, char **argv)
 #endif
 
 	/* startup initializations */
-	init_midi_event_queue();
+	init_stats();
 	init_jack_audio_driver();
 	select_midi_driver(NULL, DEFAULT_MIDI_DRIVER);
 
@@ -608,12 +685,61 @@ main(int argc, char **argv)
 		case 'G':   /* Tx event guard time in usec */
 			event_guard_time_usec = atoi(optarg);
 			break;
+		case 'W':   /* Raw MIDI Tx wire speed for pacing */
+			tx_baud_rate = atoi(optarg);
+			if (tx_baud_rate < 0) {
+				tx_baud_rate = 0;
+			}
+			break;
+		case 'O':   /* same frame MIDI Tx event order */
+			if (set_event_order(&tx_event_order, optarg) != 0) {
+				showusage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'E':   /* same frame MIDI Rx event order */
+			if (set_event_order(&rx_event_order, optarg) != 0) {
+				showusage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'w':   /* overload handling mode */
+			if (set_overload_mode(optarg) != 0) {
+				showusage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'c':   /* MIDI Tx parameter update rate limit */
+			param_rate_limit = atoi(optarg);
+			if (param_rate_limit < 0) {
+				param_rate_limit = 0;
+			}
+			break;
 		case 'i':   /* JACK MIDI input port */
 			jack_input_port_name = strdup(optarg);
 			break;
 		case 'o':   /* JACK MIDI output port */
 			jack_output_port_name = strdup(optarg);
 			break;
+		case 'm':   /* number of JACK <--> MIDI routes */
+			num_midi_routes = atoi(optarg);
+			if (num_midi_routes < 1) {
+				num_midi_routes = 1;
+			}
+			else if (num_midi_routes > MAX_MIDI_ROUTES) {
+				num_midi_routes = MAX_MIDI_ROUTES;
+			}
+			break;
+		case 'V':   /* Raw MIDI device for an extra route */
+			j = (int) strtol(optarg, &term, 10);
+			if ((term == optarg) || (*term != ',') || (term[1] == '\0') ||
+			    (j < 2) || (j > MAX_MIDI_ROUTES)) {
+				JAMROUTER_ERROR("Invalid route device '%s'.\n", optarg);
+				showusage(argv[0]);
+				return -1;
+			}
+			route_midi_device[j - 1] = strdup(&(term[1]));
+			break;
 		case 'j':   /* Jitter correction mode */
 			jitter_correct_mode = 1;
 			break;
@@ -693,6 +819,28 @@ main(int argc, char **argv)
 				}
 			}
 			break;
+		case 'a':   /* per-channel MIDI Tx delay */
+			if (optarg != NULL) {
+				if ((tokbuf = alloca(strlen((const char *)optarg) * 4)) == NULL) {
+					jamrouter_shutdown("Out of memory!\n");
+				}
+				if ((p = strtok_r(optarg, ",", &tokbuf)) != NULL) {
+					tx_channel = (atoi(p) - 1) & 0x0F;
+					if ((p = strtok_r(NULL, ",", &tokbuf)) != NULL) {
+						channel_delay_msec[tx_channel] = atoi(p);
+						if (channel_delay_msec[tx_channel] < 0) {
+							channel_delay_msec[tx_channel] = 0;
+						}
+						else if (channel_delay_msec[tx_channel] > CHANNEL_DELAY_MAX_MSEC) {
+							channel_delay_msec[tx_channel] = CHANNEL_DELAY_MAX_MSEC;
+						}
+					}
+					JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Channel Delay:  "
+					                "tx_chan=%d  delay=%d msec\n",
+					                tx_channel + 1, channel_delay_msec[tx_channel]);
+				}
+			}
+			break;
 #ifndef WITHOUT_JUNO
 		case 'J':   /* Juno-106 sysex controller translation */
 			translate_juno_sysex = 1;
@@ -724,6 +872,41 @@ main(int argc, char **argv)
 		case 'R':   /* Omit running status byte on MIDI Tx */
 			use_running_status = 1;
 			break;
+		case 'Q':   /* Schedule ALSA seq Tx on a sequencer queue */
+			use_seq_queue = 1;
+			break;
+		case 'b':   /* loopback / flood / bandwidth test mode */
+			if (optarg != NULL) {
+				if ((tokbuf = alloca(strlen((const char *)optarg) * 4)) == NULL) {
+					jamrouter_shutdown("Out of memory!\n");
+				}
+				if ((p = strtok_r(optarg, ",", &tokbuf)) != NULL) {
+					if (set_test_mode(p) != 0) {
+						JAMROUTER_ERROR("Unknown test mode '%s'.\n", p);
+						showusage(argv[0]);
+						return -1;
+					}
+					if ((p = strtok_r(NULL, ",", &tokbuf)) != NULL) {
+						test_rate = (unsigned int)atoi(p);
+						if ((p = strtok_r(NULL, ",", &tokbuf)) != NULL) {
+							test_size = (unsigned int)atoi(p);
+							if ((p = strtok_r(NULL, ",", &tokbuf)) != NULL) {
+								test_seconds = (unsigned int)atoi(p);
+							}
+						}
+					}
+				}
+			}
+			break;
+		case 'C':   /* MIDI sync generated from JACK transport */
+			if (set_midi_sync_tx(optarg) != 0) {
+				showusage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'K':   /* regenerate incoming MIDI clock */
+			midi_sync_smooth_clock = 1;
+			break;
 		case 'n':   /* Note-On Velocity */
 			note_on_velocity = hex_to_byte(optarg);
 			break;
@@ -769,6 +952,9 @@ main(int argc, char **argv)
 		case 'u':   /* jack session uuid */
 			jack_session_uuid = strdup(optarg);
 			break;
+		case 'H':   /* latency and jitter stats export */
+			stats_file = strdup(optarg);
+			break;
 		case '?':
 		case 'h':   /* help */
 		default:
@@ -777,6 +963,23 @@ main(int argc, char **argv)
 		}
 	}
 
+	/* Raw MIDI drivers run one device pair per route. */
+	if ( (midi_driver != MIDI_DRIVER_ALSA_SEQ) &&
+	     (midi_driver != MIDI_DRIVER_JACK) &&
+	     (midi_driver != MIDI_DRIVER_NONE) ) {
+		for (j = 1; j < num_midi_routes; j++) {
+			if ((route_midi_device[j] == NULL) ||
+			    (midi_driver == MIDI_DRIVER_RAW_SIM)) {
+				JAMROUTER_WARN("No MIDI device for route %d.  "
+				               "Using %d route%s.\n",
+				               j + 1, j, (j == 1) ? "" : "s");
+				num_midi_routes = j;
+				break;
+			}
+		}
+	}
+
+#ifndef ENABLE_SIM
 	/* Rewrite process title */
 	argcount = argc;
 	argvals  = argv;
@@ -801,14 +1004,21 @@ main(int argc, char **argv)
 	/* rewrite process title */
 	argc = 0;
 	snprintf((char *)*argvals, argsize, "jamrouter%d", jamrouter_instance);
+#endif /* !ENABLE_SIM */
 
 	/* signal handlers for clean shutdown */
 	init_signal_handlers();
 
 	/* init MIDI system based on selected driver */
 	JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Initializing MIDI:  driver=%s.\n",
-	                midi_driver_names[midi_driver]);
+	                midi_driver_name);
+	init_midi_event_queue();
 	init_sync_info(0, 0);
+	init_test_mode();
+	init_midi_sync();
+	init_sysex_streams();
+	init_param_limit();
+	init_timer_wheels();
 	init_midi();
 
 	/* initialize JACK audio system based on selected driver */
@@ -851,11 +1061,13 @@ main(int argc, char **argv)
 	output_pending_debug();
 
 	/* Wait for threads created directly by JAMROUTER to terminate. */
-	if (midi_rx_thread_p != 0) {
-		pthread_join(midi_rx_thread_p,  NULL);
-	}
-	if (midi_tx_thread_p != 0) {
-		pthread_join(midi_tx_thread_p,  NULL);
+	for (j = 0; j < MAX_MIDI_ROUTES; j++) {
+		if (midi_rx_thread_p[j] != 0) {
+			pthread_join(midi_rx_thread_p[j],  NULL);
+		}
+		if (midi_tx_thread_p[j] != 0) {
+			pthread_join(midi_tx_thread_p[j],  NULL);
+		}
 	}
 	output_pending_debug();
 
@@ -66,6 +66,52 @@
    change from the default here. */
 #define DEFAULT_MIDI_PHASE_LOCK        0.5
 
+/* Second order DLL driving the MIDI period clock.  Loop bandwidth (in Hz)
+   starts wide whenever the clock is (re)locked, and is halved every
+   CLOCK_DLL_NARROW_MSEC until it reaches CLOCK_DLL_BANDWIDTH.  The loop
+   gain per period is capped at CLOCK_DLL_MAX_OMEGA for stability with
+   large buffer sizes. */
+#define CLOCK_DLL_BANDWIDTH_START       4.0
+#define CLOCK_DLL_BANDWIDTH             0.1
+#define CLOCK_DLL_NARROW_MSEC           500
+#define CLOCK_DLL_MAX_OMEGA             0.5
+
+/* With JACK cycle times, the offset between JACK's clock and ours is
+   averaged over about this many periods. */
+#define CLOCK_DLL_JACK_OFFSET_AVG       64
+
+/* Define ENABLE_VIRTUAL_CLOCK to build with a virtual clock that replaces
+   the system clock for all MIDI timing and timing sleeps once started with
+   virtual_clock_start().  Time then only moves when advanced by a driver
+   loop, for deterministic and faster than realtime replay of timing.  The
+   jamrouter-sim target (see sim.c) is always built with it. */
+//define ENABLE_VIRTUAL_CLOCK
+
+/* Interval at which the watchdog exports latency and jitter histograms
+   when a stats file or socket has been given with --stats-file. */
+#define STATS_EXPORT_MSEC               1000
+
+/* Loopback / flood / bandwidth test modes (--test).  Probes are sent on
+   route 0 after the MIDI clock has had TEST_SETTLE_MSEC to lock, and
+   probes still outstanding TEST_DRAIN_MSEC after the end of a stage are
+   counted as lost.  Bandwidth tests raise the rate by
+   TEST_BANDWIDTH_STEP_PERCENT each stage until probes are lost or dequeued
+   late.  Short probes are pitchbend messages on TEST_PROBE_CHANNEL. */
+#define TEST_SETTLE_MSEC                3000
+#define TEST_DRAIN_MSEC                 500
+#define TEST_MAX_STAGES                 32
+#define TEST_BANDWIDTH_STEP_PERCENT     25
+#define TEST_PROBE_CHANNEL              15
+
+/* MIDI Clock, Song Position, and MTC generated from JACK transport
+   (--clock-out) run at MIDI_SYNC_DEFAULT_BPM when the transport master
+   provides no BBT tempo.  Incoming MIDI Clock smoothing (--smooth-clock)
+   tracks ticks with a DLL of MIDI_SYNC_DLL_BANDWIDTH (in Hz), and keeps
+   regenerating ticks for up to MIDI_SYNC_FLYWHEEL_TICKS after input stops. */
+#define MIDI_SYNC_DEFAULT_BPM           120
+#define MIDI_SYNC_DLL_BANDWIDTH         1.0
+#define MIDI_SYNC_FLYWHEEL_TICKS        1
+
 /* max number of samples to use in the ringbuffer. */
 /* must be a power of 2, and must handle at least */
 /* DEFAULT_BUFFER_PERIODS * 2048. */
@@ -76,11 +122,25 @@
 #define DEFAULT_LATENCY_PERIODS         1
 #define DEFAULT_SAMPLE_RATE             48000
 
-/* For now, JAMRouter has 2 single-reader-single-writer event queues */
-#define MAX_MIDI_QUEUES                 2
+/* Each route (JACK MIDI in/out port pair <--> MIDI Rx/Tx port pair) has its
+   own pair of event queues.  Any number of threads (MIDI Rx, the JACK
+   thread with its timer wheel, and the sync and test generators) may push
+   onto a queue's frame slots, and one thread (JACK or MIDI Tx) takes from
+   it.  Queue numbers are (route << 1) | direction, so route 0 keeps
+   A2J_QUEUE and J2A_QUEUE.
+   Queue and per-route buffers are allocated at startup for the
+   NUM_MIDI_QUEUES in use, not for MAX_MIDI_QUEUES. */
+#define MAX_MIDI_ROUTES                 16
+#define MAX_MIDI_QUEUES                 (MAX_MIDI_ROUTES * 2)
+#define NUM_MIDI_QUEUES                 (num_midi_routes * 2)
 #define A2J_QUEUE                       0x0
 #define J2A_QUEUE                       0x1
 
+#define A2J_ROUTE_QUEUE(r)              ((unsigned char)(((r) << 1) | A2J_QUEUE))
+#define J2A_ROUTE_QUEUE(r)              ((unsigned char)(((r) << 1) | J2A_QUEUE))
+#define QUEUE_ROUTE(q)                  ((unsigned char)((q) >> 1))
+#define IS_J2A_QUEUE(q)                 (((q) & J2A_QUEUE) == J2A_QUEUE)
+
 /* Raw MIDI options */
 
 /* Generic Raw MIDI and ALSA Raw MIDI are stable.
@@ -97,6 +157,52 @@
 /* multibyte may be unreliable on some hardware.  Byte at a time works well. */
 //define RAWMIDI_ALSA_MULTI_BYTE_IO
 
+/* Raw MIDI Rx drains everything available per wakeup into a buffer of this
+   size.  Set to 1 for byte at a time reads with misbehaving interfaces. */
+#define RAWMIDI_RX_BUFFER_SIZE          256
+
+/* Raw MIDI Tx writes all messages due for the same frame at once while the
+   wire is free, except when a byte guard time is set.  On a short
+   nonblocking write, wait this
+   long (about one byte at wire speed) before writing the rest. */
+#define RAWMIDI_TX_RETRY_USEC           320
+
+/* Raw MIDI Tx models wire occupancy at the Tx baud rate (--tx-baud), and
+   holds each message back until the UART is within this many bytes of
+   being free, so bursts are spread over the wire instead of piling up in
+   the driver's buffer. */
+#define MIDI_BAUD_RATE                  31250
+#define RAWMIDI_TX_WIRE_LEAD_BYTES      2
+
+/* SysEx streamed from JACK is handed to the Tx queues at the Tx baud rate,
+   one period's worth at a time, or SYSEX_STREAM_PERIOD_BYTES per period
+   with --tx-baud=0. */
+#define SYSEX_STREAM_PERIOD_BYTES       4096
+
+/* SysEx streams stop handing fragments to a Tx queue with fewer than this
+   many free events in its pool, keeping room for live messages. */
+#define EVENT_POOL_BULK_RESERVE         256
+
+/* With --overload, continuous controller updates are thinned once a queue
+   is down to OVERLOAD_POOL_THIN free events or Raw MIDI Tx is predicted to
+   run OVERLOAD_WIRE_THIN_USEC late, and active sensing is shed as well at
+   OVERLOAD_POOL_SHED free events or OVERLOAD_WIRE_SHED_USEC late. */
+#define OVERLOAD_POOL_THIN              1024
+#define OVERLOAD_POOL_SHED              512
+#define OVERLOAD_WIRE_THIN_USEC         1000
+#define OVERLOAD_WIRE_SHED_USEC         5000
+
+/* With --param-rate, a controller, aftertouch, or pitchbend value already
+   sent on MIDI Tx is sent again once this long has passed, in case the
+   receiving device has been reset or has missed it. */
+#define PARAM_LIMIT_REFRESH_MSEC        1000
+
+/* Longest delay accepted by --channel-delay. */
+#define CHANNEL_DELAY_MAX_MSEC          60000
+
+/* Maximum number of 4-byte OSS raw MIDI events per write(). */
+#define RAWMIDI_OSS_TX_EVENTS           64
+
 /* Duplex operation works.  MPU-401 duplex issues are possibly a driver
    problem with some MPU-401 variants.  No known JAMRouter specific
    full duplex MIDI issues exist. */
@@ -130,6 +236,10 @@
 #define RAWMIDI_OSS_DEVICE              "/dev/sequencer"
 #define RAWMIDI_OSS2_DEVICE             "/dev/sequencer2"
 
+/* ALSA seq Tx events are buffered and sent with one drain per frame (or one
+   per period when scheduling on a sequencer queue). */
+#define ALSA_SEQ_OUTPUT_BUFFER_SIZE     32768
+
 
 /*****************************************************************************
  *
@@ -219,18 +329,20 @@ extern char            jamrouter_cmdline[512];
 extern char            jamrouter_full_cmdline[512];
 
 extern pthread_t       debug_thread_p;
-extern pthread_t       midi_rx_thread_p;
-extern pthread_t       midi_tx_thread_p;
+extern pthread_t       midi_rx_thread_p[MAX_MIDI_ROUTES];
+extern pthread_t       midi_tx_thread_p[MAX_MIDI_ROUTES];
 extern pthread_t       jack_thread_p;
 
 extern char            *midi_rx_port_name;
 extern char            *midi_tx_port_name;
+extern char            *route_midi_device[MAX_MIDI_ROUTES];
 extern char            *jack_input_port_name;
 extern char            *jack_output_port_name;
 
 extern int             midi_rx_thread_priority;
 extern int             midi_tx_thread_priority;
 
+extern int             num_midi_routes;
 extern int             lash_disabled;
 extern int             sample_rate;
 extern int             pending_shutdown;
@@ -240,8 +352,10 @@ extern int             tx_prefer_real_note_off;
 extern int             rx_queue_real_note_off;
 extern int             echotrans;
 extern int             use_running_status;
+extern int             use_seq_queue;
 extern int             active_sensing_mode;
 extern int             byte_guard_time_usec;
+extern int             tx_baud_rate;
 extern int             event_guard_time_usec;
 extern int             rx_latency_periods;
 extern int             tx_latency_periods;
@@ -266,6 +380,8 @@ extern unsigned char   pitchmap_bend_range[16];
 extern unsigned char   pitchcontrol_tx_channel[16];
 extern unsigned char   pitchcontrol_controller[16];
 
+extern int             channel_delay_msec[16];
+
 
 int get_instance_num(void);
 void jamrouter_shutdown(const char *msg);
@@ -42,9 +42,10 @@ translate_from_juno(unsigned short period,
 	int     j;
 
 	/* special handling for Juno-106 sysex */
-	if ((event->type == MIDI_EVENT_SYSEX) && translate_juno_sysex) {
+	if ( (event->type == MIDI_EVENT_SYSEX) && translate_juno_sysex &&
+	     (event->data != NULL) && (event->data[0] == 0xF0) ) {
 		/* sysex controller message conversion */
-		if ( (event->data[1] == 0x41) &&
+		if ( (event->bytes >= 7) && (event->data[1] == 0x41) &&
 		     (event->data[2] == 0x32) && (event->data[6] == 0xF7) ) {
 			event->type       = MIDI_EVENT_CONTROLLER;
 			event->channel    = event->data[3] & 0x0F;
@@ -53,7 +54,7 @@ translate_from_juno(unsigned short period,
 			event->bytes      = 3;
 		}
 		/* sysex patch message translation */
-		else if ( (event->data[1] == 0x41) &&
+		else if ( (event->bytes >= 24) && (event->data[1] == 0x41) &&
 		          ((event->data[2] == 0x30) || (event->data[2] == 0x31)) &&
 		          (event->data[23] == 0xF7) ) {
 			event->type       = MIDI_EVENT_CONTROLLER;
@@ -152,7 +153,8 @@ translate_to_juno(unsigned short period,
 			break;
 		}
 		/* 7-bit controllers */
-		if (event->controller < 0x1E) {
+		if ( (event->controller < 0x1E) &&
+		     ((event->data = get_sysex_buffer(queue_num, 7)) != NULL) ) {
 			event->type    = MIDI_EVENT_SYSEX;
 			event->data[0] = 0xF0;
 			event->data[1] = 0x41;
@@ -176,7 +178,8 @@ translate_to_juno(unsigned short period,
 					                 ((event->value >> 6) << bit));
 				juno_state_bits_set |= (unsigned short)((1 << bit) | 0x03FF);
 			}
-			if ((bit <= 7) && ((juno_state_bits_set & 0x3F80) == 0x3F80)) {
+			if ( (bit <= 7) && ((juno_state_bits_set & 0x3F80) == 0x3F80) &&
+			     ((event->data = get_sysex_buffer(queue_num, 7)) != NULL) ) {
 				event->type    = MIDI_EVENT_SYSEX;
 				event->data[0] = 0xF0;
 				event->data[1] = 0x41;
@@ -201,7 +204,8 @@ translate_to_juno(unsigned short period,
 					                 ((event->value >> 6) << bit));
 				juno_state_bits_set |= (unsigned short)((1 << bit) | 0x03FF);
 			}
-			if ((bit < 7) && ((juno_state_bits_set & 0x7F) == 0x7F)) {
+			if ( (bit < 7) && ((juno_state_bits_set & 0x7F) == 0x7F) &&
+			     ((event->data = get_sysex_buffer(queue_num, 7)) != NULL) ) {
 				event->type    = MIDI_EVENT_SYSEX;
 				event->data[0] = 0xF0;
 				event->data[1] = 0x41;
@@ -218,7 +222,7 @@ translate_to_juno(unsigned short period,
 	/* echo translated sysex events back to jack tx as well. */
 	if (echosysex && translated_event && (event->bytes > 0)) {
 		queue_midi_event(period,
-		                 queue_num == A2J_QUEUE ? J2A_QUEUE : A2J_QUEUE,
+		                 (unsigned char)(queue_num ^ J2A_QUEUE),
 		                 event, cycle_frame, index, 1);
 	}
 }
@@ -23,6 +23,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <pthread.h>
 #include <time.h>
@@ -32,6 +33,8 @@
 #include "timekeeping.h"
 #include "mididefs.h"
 #include "midi_event.h"
+#include "sysex_stream.h"
+#include "stats.h"
 #include "debug.h"
 #include "driver.h"
 
@@ -40,23 +43,83 @@ unsigned char           prev_key[MAX_MIDI_QUEUES][16];
 unsigned char           midi_key[MAX_MIDI_QUEUES][16];
 unsigned char           last_key[MAX_MIDI_QUEUES][16];
 
-KEYLIST                 keylist[MAX_MIDI_QUEUES][16][128];
-
-KEYLIST                 *keylist_head[MAX_MIDI_QUEUES][16];
+NOTE_STATE              note_state[MAX_MIDI_QUEUES][16];
 
 volatile MIDI_EVENT     realtime_events[MAX_MIDI_QUEUES];
 
-volatile MIDI_EVENT     bulk_event_pool[MAX_MIDI_QUEUES][MIDI_EVENT_POOL_SIZE];
+/* Per queue buffers are allocated by init_midi_event_queue() for the routes
+   in use, as one block each so that an arena address maps to its queue. */
+volatile MIDI_EVENT     (*bulk_event_pool)[MIDI_EVENT_POOL_SIZE]        = NULL;
+
+volatile EVENT_QUEUE    (*event_queue)[MAX_BUFFER_SIZE]                 = NULL;
 
-volatile EVENT_QUEUE    event_queue[MAX_MIDI_QUEUES][MAX_BUFFER_SIZE];
+volatile guint          (*event_queue_bitmap)[EVENT_QUEUE_BITMAP_SIZE]  = NULL;
 
 volatile gint           bulk_event_index[MAX_MIDI_QUEUES];
 
+volatile unsigned char  (*sysex_arena)[SYSEX_ARENA_SIZE]              = NULL;
+
+volatile gint           sysex_arena_index[MAX_MIDI_QUEUES];
+
+/* per arena block:  0 when free, the payload's size in blocks at its first
+   block, or -1 for the rest of its blocks */
+volatile gint           (*sysex_arena_owner)[SYSEX_ARENA_BLOCKS]        = NULL;
+
 unsigned char           keys_in_play[MAX_MIDI_QUEUES];
 
+unsigned int            tx_event_order  = EVENT_ORDER_NONE;
+unsigned int            rx_event_order  = EVENT_ORDER_NONE;
+
+int                     overload_mode   = OVERLOAD_MODE_OFF;
+
+/* overload level implied by Raw MIDI Tx wire lateness, per queue */
+static volatile gint    wire_overload[MAX_MIDI_QUEUES];
+
+/* 1 + pool index of the latest event queued for each thinning key */
+static unsigned short   (*thin_index)[EVENT_THIN_KEYS]                  = NULL;
+
+static const struct {
+	const char      *name;
+	unsigned int    set;
+	unsigned int    clear;
+} event_order_rules[] = {
+	{ "noteoff-first",     EVENT_ORDER_NOTE_OFF_FIRST,    EVENT_ORDER_NOTE_ON_FIRST },
+	{ "noteon-first",      EVENT_ORDER_NOTE_ON_FIRST,     EVENT_ORDER_NOTE_OFF_FIRST },
+	{ "high-first",        EVENT_ORDER_HIGH_NOTES_FIRST,  EVENT_ORDER_LOW_NOTES_FIRST },
+	{ "low-first",         EVENT_ORDER_LOW_NOTES_FIRST,   EVENT_ORDER_HIGH_NOTES_FIRST },
+	{ "controllers-first", EVENT_ORDER_CONTROLLERS_FIRST, 0 },
+	{ "sysex-last",        EVENT_ORDER_SYSEX_LAST,        0 },
+	{ "realtime-first",    EVENT_ORDER_REALTIME_FIRST,    0 },
+	{ NULL,                0,                             0 }
+};
+
+
+/*****************************************************************************
+ * alloc_queue_buffer()
+ *
+ * Allocates <size> bytes of zeroed memory for each of the NUM_MIDI_QUEUES
+ * in use.  Every page is written here, so that with memory locked by
+ * mlockall(), the realtime threads never fault on first touch.
+ *****************************************************************************/
+static void *
+alloc_queue_buffer(size_t size)
+{
+	void    *buf;
+
+	if ((buf = malloc(size * (size_t)(NUM_MIDI_QUEUES))) == NULL) {
+		jamrouter_shutdown("Out of memory!\n");
+	}
+	memset(buf, 0, size * (size_t)(NUM_MIDI_QUEUES));
+
+	return buf;
+}
+
 
 /*****************************************************************************
  * init_midi_event_queue()
+ *
+ * Called once at startup, after the number of routes is known, and before
+ * any MIDI or JACK thread is started.
  *****************************************************************************/
 void
 init_midi_event_queue(void)
@@ -66,39 +129,44 @@ init_midi_event_queue(void)
 	unsigned short      e;
 	unsigned short      q;
 
+	bulk_event_pool    = alloc_queue_buffer(sizeof(*bulk_event_pool));
+	event_queue        = alloc_queue_buffer(sizeof(*event_queue));
+	event_queue_bitmap = alloc_queue_buffer(sizeof(*event_queue_bitmap));
+	sysex_arena        = alloc_queue_buffer(sizeof(*sysex_arena));
+	sysex_arena_owner  = alloc_queue_buffer(sizeof(*sysex_arena_owner));
+	thin_index         = alloc_queue_buffer(sizeof(*thin_index));
+
 	memset((void *)&(realtime_events[0]), 0,
-	       sizeof(MIDI_EVENT)  * MAX_MIDI_QUEUES);
-	memset((void *)&(event_queue[0][0]),  0,
-	       sizeof(EVENT_QUEUE) * MAX_MIDI_QUEUES * MIDI_EVENT_POOL_SIZE);
-	memset((void *)&(bulk_event_pool[0]), 0,
-	       sizeof(MIDI_EVENT)  * MAX_MIDI_QUEUES * MIDI_EVENT_POOL_SIZE);
-
-	/* keylist for tracking keys in play */
-	for (q = 0; q < MAX_MIDI_QUEUES; q++) {
+	       sizeof(MIDI_EVENT)  * (size_t)(NUM_MIDI_QUEUES));
+
+	/* note state for tracking keys in play */
+	memset(&(note_state[0][0]), NOTE_NONE,
+	       sizeof(NOTE_STATE) * (size_t)(NUM_MIDI_QUEUES) * 16);
+	for (q = 0; q < NUM_MIDI_QUEUES; q++) {
 		keys_in_play[q] = 0;
 		for (c = 0; c < 16; c++) {
 			prev_key[q][c] = 0xFF;
 			midi_key[q][c] = 0xFF;
 			last_key[q][c] = 0xFF;
-			for (e = 0; e < 128; e++) {
-				keylist[q][c][e].midi_key = e & 0x7F;
-				keylist[q][c][e].next     = NULL;
+			for (e = 0; e < 4; e++) {
+				note_state[q][c].held[e] = 0;
 			}
 		}
 	}
 	/* realtime event queue for interleaved realtime events */
-	for (q = 0; q < MAX_MIDI_QUEUES; q++) {
+	for (q = 0; q < NUM_MIDI_QUEUES; q++) {
 		event          = &(realtime_events[q]);
 		event->type    = MIDI_EVENT_NO_EVENT;
 		event->channel = 0x7F;
 		event->byte2   = 0;
 		event->byte3   = 0;
 		event->bytes   = 0;
+		event->data    = NULL;
 		event->state   = EVENT_STATE_FREE;
 		event->next    = NULL;
 	}
 	/* main event queue */
-	for (q = 0; q < MAX_MIDI_QUEUES; q++) {
+	for (q = 0; q < NUM_MIDI_QUEUES; q++) {
 		for (e = 0; e < MAX_BUFFER_SIZE; e++) {
 			event_queue[q][e].head = NULL;
 		}
@@ -109,46 +177,339 @@ init_midi_event_queue(void)
 			event->byte2    = 0;
 			event->byte3    = 0;
 			event->bytes    = 0;
+			event->data     = NULL;
 			event->state    = EVENT_STATE_FREE;
 			event->next     = NULL;
 		}
 	}
-	/* bulk event queue */
-	bulk_event_index[A2J_QUEUE] = 0;
-	bulk_event_index[J2A_QUEUE] = 0;
+	/* bulk event queue and sysex arena */
+	for (q = 0; q < NUM_MIDI_QUEUES; q++) {
+		bulk_event_index[q]  = 0;
+		sysex_arena_index[q] = 0;
+		wire_overload[q]     = OVERLOAD_LEVEL_NONE;
+	}
 }
 
 
 /*****************************************************************************
  * get_midi_event()
+ *
+ * Peeks at the newest event queued in a frame slot, without taking it.
  *****************************************************************************/
 volatile MIDI_EVENT *
 get_midi_event(unsigned char queue_num,
                unsigned short cycle_frame,
                unsigned short index)
 {
-	return event_queue[queue_num][index + cycle_frame].head;
+	return g_atomic_pointer_get(&(event_queue[queue_num][index + cycle_frame].head));
+}
+
+
+/*****************************************************************************
+ * get_next_queued_frame()
+ *
+ * Returns the first cycle frame at or after cycle_frame in the given period
+ * with events queued, or buffer_period_size if the rest of the period is
+ * empty.  Lets the Tx paths skip straight over empty frame slots instead of
+ * dequeuing every frame of the period.
+ *****************************************************************************/
+unsigned short
+get_next_queued_frame(unsigned char     queue_num,
+                      unsigned short    period,
+                      unsigned short    cycle_frame)
+{
+	guint               bits;
+	unsigned short      index;
+	unsigned short      slot;
+	unsigned short      end;
+
+	index = IS_J2A_QUEUE(queue_num) ?
+		sync_info[period].tx_index : sync_info[period].output_index;
+	slot  = (unsigned short)(index + cycle_frame);
+	end   = (unsigned short)(index + sync_info[period].buffer_period_size);
+
+	while (slot < end) {
+		bits = (guint)g_atomic_int_get((volatile gint *)
+		                               &(event_queue_bitmap[queue_num][slot >> 5]));
+		bits &= ~((1U << (slot & 0x1F)) - 1U);
+		if (bits != 0) {
+			slot = (unsigned short)((slot & ~0x1F) +
+			                        (unsigned short)__builtin_ctz(bits));
+			if (slot >= end) {
+				break;
+			}
+			return (unsigned short)(slot - index);
+		}
+		slot = (unsigned short)((slot & ~0x1F) + 0x20);
+	}
+
+	return sync_info[period].buffer_period_size;
+}
+
+
+/*****************************************************************************
+ * set_event_order()
+ *
+ * Parses a comma separated list of event ordering rules into <order>.
+ * "none" clears all rules.  Returns 0 on success, or -1 on an unknown rule.
+ *****************************************************************************/
+int
+set_event_order(unsigned int *order, char *rules)
+{
+	char            *tokbuf = NULL;
+	char            *p;
+	int             j;
+
+	for (p = strtok_r(rules, ",", &tokbuf); p != NULL;
+	     p = strtok_r(NULL, ",", &tokbuf)) {
+		if (strcmp(p, "none") == 0) {
+			*order = EVENT_ORDER_NONE;
+			continue;
+		}
+		for (j = 0; event_order_rules[j].name != NULL; j++) {
+			if (strcmp(p, event_order_rules[j].name) == 0) {
+				*order &= ~(event_order_rules[j].clear);
+				*order |= event_order_rules[j].set;
+				break;
+			}
+		}
+		if (event_order_rules[j].name == NULL) {
+			JAMROUTER_ERROR("Unknown event order rule '%s'.\n", p);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * get_event_order_key()
+ *
+ * Returns the compact sort key for an event at position <index> in a frame
+ * slot:  rank bits (highest first:  SysEx last, realtime first, controllers
+ * first, note on/off order), then note number, then arrival index.  Events
+ * not distinguished by any rule get the same rank and keep arrival order.
+ * A note on or off for the same channel and note as one of the <index>
+ * events already keyed (<prior>, with <prior_keys>) takes that event's rank,
+ * so that on/off pairs for one note are never swapped.
+ *****************************************************************************/
+static guint32
+get_event_order_key(volatile MIDI_EVENT *event,
+                    unsigned int        order,
+                    unsigned int        index,
+                    volatile MIDI_EVENT **prior,
+                    guint32             *prior_keys)
+{
+	unsigned char   type  = event->type;
+	guint32         rank  = 0;
+	guint32         pitch = 0;
+	unsigned int    j;
+	int             note_off;
+
+	if ((order & EVENT_ORDER_SYSEX_LAST) && (type == MIDI_EVENT_SYSEX)) {
+		rank |= 0x8;
+	}
+	if ( !( (order & EVENT_ORDER_REALTIME_FIRST) &&
+	        (type >= MIDI_EVENT_TICK) && (type != MIDI_EVENT_EXTENDED_FD) ) ) {
+		rank |= 0x4;
+	}
+	if ( !( (order & EVENT_ORDER_CONTROLLERS_FIRST) &&
+	        ( (type == MIDI_EVENT_CONTROLLER)     ||
+	          (type == MIDI_EVENT_PITCHBEND)      ||
+	          (type == MIDI_EVENT_PROGRAM_CHANGE) ||
+	          (type == MIDI_EVENT_POLYPRESSURE)   ||
+	          (type == MIDI_EVENT_AFTERTOUCH) ) ) ) {
+		rank |= 0x2;
+	}
+	if ((type == MIDI_EVENT_NOTE_ON) || (type == MIDI_EVENT_NOTE_OFF)) {
+		note_off = (type == MIDI_EVENT_NOTE_OFF) || (event->velocity == 0);
+		for (j = 0; j < index; j++) {
+			if ( ( (prior[j]->type == MIDI_EVENT_NOTE_ON) ||
+			       (prior[j]->type == MIDI_EVENT_NOTE_OFF) ) &&
+			     (prior[j]->channel == event->channel) &&
+			     (prior[j]->note == event->note) ) {
+				break;
+			}
+		}
+		if (j < index) {
+			rank |= (prior_keys[j] >> 16) & 0x1;
+		}
+		else if ((order & EVENT_ORDER_NOTE_OFF_FIRST) && !note_off) {
+			rank |= 0x1;
+		}
+		else if ((order & EVENT_ORDER_NOTE_ON_FIRST) && note_off) {
+			rank |= 0x1;
+		}
+		if (order & EVENT_ORDER_HIGH_NOTES_FIRST) {
+			pitch = 0x7F - (guint32)(event->note & 0x7F);
+		}
+		else if (order & EVENT_ORDER_LOW_NOTES_FIRST) {
+			pitch = (guint32)(event->note & 0x7F);
+		}
+	}
+
+	return (rank << 16) | (pitch << 8) | (index & 0xFF);
+}
+
+
+/*****************************************************************************
+ * order_queued_events()
+ *
+ * Applies the ordering rules for the queue's direction to a list of events
+ * just taken from a frame slot, and returns the new head.  Only called by
+ * the dequeuing side, which owns the list once taken.  Lists are short, so
+ * an insertion sort on the compact keys is the cheapest stable sort here.
+ *****************************************************************************/
+volatile MIDI_EVENT *
+order_queued_events(unsigned char queue_num, volatile MIDI_EVENT *head)
+{
+	volatile MIDI_EVENT *events[EVENT_ORDER_MAX_SORT];
+	volatile MIDI_EVENT *rest;
+	volatile MIDI_EVENT *event;
+	guint32             keys[EVENT_ORDER_MAX_SORT];
+	guint32             key;
+	unsigned int        order;
+	unsigned int        num_events = 0;
+	unsigned int        j;
+	unsigned int        k;
+
+	order = IS_J2A_QUEUE(queue_num) ? tx_event_order : rx_event_order;
+	if ((order == EVENT_ORDER_NONE) || (head == NULL) || (head->next == NULL)) {
+		return head;
+	}
+
+	for (rest = head;
+	     (rest != NULL) && (num_events < EVENT_ORDER_MAX_SORT);
+	     rest = rest->next) {
+		/* fragments of a longer SysEx must stay in order with
+		   everything around them, so leave such a slot as is. */
+		if ( (rest->type == MIDI_EVENT_SYSEX) &&
+		     ( (rest->data == NULL) || (rest->bytes == 0) ||
+		       (rest->data[0] != 0xF0) ||
+		       (rest->data[rest->bytes - 1] != 0xF7) ) ) {
+			return head;
+		}
+		key = get_event_order_key(rest, order, num_events, events, keys);
+		for (k = num_events; (k > 0) && (keys[k - 1] > key); k--) {
+			keys[k]   = keys[k - 1];
+			events[k] = events[k - 1];
+		}
+		keys[k]   = key;
+		events[k] = rest;
+		num_events++;
+	}
+
+	/* relink in sorted order, followed by anything left unsorted */
+	for (j = 0; j < (num_events - 1); j++) {
+		event       = events[j];
+		event->next = events[j + 1];
+	}
+	events[num_events - 1]->next = rest;
+
+	return events[0];
+}
+
+
+/*****************************************************************************
+ * take_queued_events()
+ *
+ * Detaches and returns the list of events queued in a frame slot, in
+ * arrival order.  Any number of writers (the Rx threads and the JACK
+ * thread may all queue to the same slot) push onto the head of the slot
+ * with compare-and-exchange, and never touch an event once it has been
+ * pushed.  The single reader (the dequeuing side) takes the whole list by
+ * swapping head to NULL, which leaves the writers nothing to race against:
+ * an event is either on the list taken, or on a new list started after it.
+ * The list is pushed newest first, so it is reversed here.  Controllers (and
+ * Juno SysEx controllers) queued more than once in the slot are coalesced
+ * here as well, with the first event taking the last value, and the list
+ * is only walked for this on a hit in a 64-bit hash filter of the keys.
+ *****************************************************************************/
+volatile MIDI_EVENT *
+take_queued_events(unsigned char queue_num, unsigned short slot)
+{
+	volatile EVENT_QUEUE    *queue  = &(event_queue[queue_num][slot]);
+	volatile MIDI_EVENT     *head;
+	volatile MIDI_EVENT     *list   = NULL;
+	volatile MIDI_EVENT     *prev   = NULL;
+	volatile MIDI_EVENT     *event;
+	volatile MIDI_EVENT     *next;
+	volatile MIDI_EVENT     *cur;
+	guint                   filter[2] = { 0, 0 };
+	unsigned int            bit;
+	int                     key;
+
+	do {
+		head = g_atomic_pointer_get(&(queue->head));
+	} while ( (head != NULL) &&
+	          !g_atomic_pointer_compare_and_exchange(&(queue->head), head, NULL) );
+
+	/* restore arrival order */
+	for (event = head; event != NULL; event = next) {
+		next        = event->next;
+		event->next = list;
+		list        = event;
+	}
+
+	/* re-use events for the same MIDI controller (or Juno SysEx
+	   controller).  The list is only walked on a filter hit. */
+	for (event = list; event != NULL; event = next) {
+		next = event->next;
+		/* events already thinned (with no size) are passed over */
+		if ( (event->bytes > 0) &&
+		     ((key = get_event_coalesce_key(event)) >= 0) ) {
+			bit = EVENT_QUEUE_FILTER_BIT(key);
+			if (filter[bit >> 5] & (1U << (bit & 0x1F))) {
+				for (cur = list; cur != event; cur = cur->next) {
+					if ( (cur->bytes > 0) &&
+					     (get_event_coalesce_key(cur) == key) ) {
+						break;
+					}
+				}
+				if (cur != event) {
+					if (event->type == MIDI_EVENT_CONTROLLER) {
+						cur->value   = event->value;
+					}
+					else {
+						cur->data[5] = event->data[5];
+					}
+					prev->next = next;
+					free_midi_event(queue_num, event);
+					continue;
+				}
+			}
+			filter[bit >> 5] |= 1U << (bit & 0x1F);
+		}
+		prev = event;
+	}
+
+	return list;
 }
 
 
 /*****************************************************************************
  * dequeue_midi_event()
+ *
+ * Takes the events queued for <cycle_frame> of <period>, or for a missed
+ * frame of an earlier period.  When <late_frames> is not NULL, it is set to
+ * the number of frames between the frame the events were queued for and the
+ * frame they are being dequeued at.
  *****************************************************************************/
 volatile MIDI_EVENT *
 dequeue_midi_event(unsigned char queue_num,
                    unsigned short *last_period,
                    unsigned short period,
-                   unsigned short cycle_frame)
+                   unsigned short cycle_frame,
+                   int *late_frames)
 {
 	volatile MIDI_EVENT *cur;
 	unsigned short      scan_period;
+	unsigned short      p;
 	unsigned short      tx_index;
+	unsigned short      slot;
 	unsigned short      j;
 
-	tx_index = (queue_num == J2A_QUEUE) ?
-		sync_info[period].tx_index : sync_info[period].output_index;
-	cur = event_queue[queue_num][tx_index + cycle_frame].head;
-
 	/* When a period has been missed by the MIDI Tx thread (which has never
 	   been observed but still lurks as a potential corner-case if the MIDI Tx
 	   thread somehow takes an extra period to return to the dequeuing point),
@@ -165,18 +526,27 @@ dequeue_midi_event(unsigned char queue_num,
 		for ( scan_period = sync_info[period].prev;
 		      scan_period != period;
 		      scan_period = sync_info[scan_period].next ) {
-			tx_index = (queue_num == J2A_QUEUE) ?
-				sync_info[scan_period].tx_index : sync_info[scan_period].output_index;
-			for (j = 0; j < sync_info[period].buffer_period_size; j++) {
-				if (event_queue[queue_num][tx_index + j].head != NULL ) {
-					cur = event_queue[queue_num][tx_index + j].head;
-					event_queue[queue_num][tx_index + j].head = NULL;
-					JAMROUTER_DEBUG(DEBUG_CLASS_TESTING,
-					                DEBUG_COLOR_RED "<"
-					                DEBUG_COLOR_YELLOW "LATE"
-					                DEBUG_COLOR_RED "> " DEBUG_COLOR_DEFAULT);
-					return cur;
+			j = get_next_queued_frame(queue_num, scan_period, 0);
+			if (j < sync_info[scan_period].buffer_period_size) {
+				tx_index = IS_J2A_QUEUE(queue_num) ?
+					sync_info[scan_period].tx_index : sync_info[scan_period].output_index;
+				slot = (unsigned short)(tx_index + j);
+				g_atomic_int_and(&(event_queue_bitmap[queue_num][slot >> 5]),
+				                 ~(1U << (slot & 0x1F)));
+				cur = order_queued_events(queue_num,
+				                          take_queued_events(queue_num, slot));
+				queue_stats[queue_num].late_dequeues++;
+				if (late_frames != NULL) {
+					*late_frames = (int)(cycle_frame) - (int)(j);
+					for (p = scan_period; p != period; p = sync_info[p].next) {
+						*late_frames += sync_info[p].buffer_period_size;
+					}
 				}
+				JAMROUTER_DEBUG(DEBUG_CLASS_TESTING,
+				                DEBUG_COLOR_RED "<"
+				                DEBUG_COLOR_YELLOW "LATE"
+				                DEBUG_COLOR_RED "> " DEBUG_COLOR_DEFAULT);
+				return cur;
 			}
 		}
 	}
@@ -185,9 +555,19 @@ dequeue_midi_event(unsigned char queue_num,
 	   and b) there are no events to be dequeued for previous periods.
 	   This should be the normal behaviour 100% of the time. */
 	*last_period = sync_info[period].prev;
+	if (late_frames != NULL) {
+		*late_frames = 0;
+	}
 
-	tx_index = sync_info[period].tx_index;
-	event_queue[queue_num][tx_index + cycle_frame].head = NULL;
+	tx_index = IS_J2A_QUEUE(queue_num) ?
+		sync_info[period].tx_index : sync_info[period].output_index;
+	slot = (unsigned short)(tx_index + cycle_frame);
+
+	/* clear the occupancy bit first, so that an event queued while
+	   dequeuing leaves the bit set for the next scan. */
+	g_atomic_int_and(&(event_queue_bitmap[queue_num][slot >> 5]),
+	                 ~(1U << (slot & 0x1F)));
+	cur = order_queued_events(queue_num, take_queued_events(queue_num, slot));
 
 	return cur;
 }
@@ -195,21 +575,55 @@ dequeue_midi_event(unsigned char queue_num,
 
 /*****************************************************************************
  * get_new_midi_event()
+ *
+ * Allocates an event from the queue's pool.  The pool is an index ring
+ * shared by all producers for the queue.  Only free (or abandoned) slots
+ * are taken, and each is claimed by an atomic state change so two producers
+ * can never get the same event.  An event stays allocated until it is
+ * queued, or handed back with free_midi_event(), so an event held by its
+ * owner (such as the raw MIDI parser's) is never recycled out from under
+ * it.  Returns NULL when every event in the pool is in use, leaving the
+ * caller to drop its message.
  *****************************************************************************/
 volatile MIDI_EVENT *
 get_new_midi_event(unsigned char queue_num)
 {
 	volatile MIDI_EVENT *new_event;
+	QUEUE_STATS         *stats = &(queue_stats[queue_num]);
 	guint               new_bulk_index;
 	guint               old_bulk_index;
+	gint                state;
+	unsigned int        tries;
 
-	do {
-		old_bulk_index = (guint)(bulk_event_index[queue_num]);
-		new_bulk_index = (old_bulk_index + 1) & MIDI_EVENT_POOL_MASK;
-	} while (!g_atomic_int_compare_and_exchange(&(bulk_event_index[queue_num]),
-	                                            (gint)old_bulk_index,
-	                                            (gint)new_bulk_index));
-	new_event = &(bulk_event_pool[queue_num][old_bulk_index]);
+	if (g_atomic_int_get(&(stats->pool_in_use)) < MIDI_EVENT_POOL_SIZE) {
+		for (tries = 0; tries < MIDI_EVENT_POOL_SIZE; tries++) {
+			do {
+				old_bulk_index = (guint)(bulk_event_index[queue_num]);
+				new_bulk_index = (old_bulk_index + 1) & MIDI_EVENT_POOL_MASK;
+			} while (!g_atomic_int_compare_and_exchange(&(bulk_event_index[queue_num]),
+			                                            (gint)old_bulk_index,
+			                                            (gint)new_bulk_index));
+			new_event = &(bulk_event_pool[queue_num][old_bulk_index]);
+
+			state = g_atomic_int_get(&(new_event->state));
+			if ( ( (state == EVENT_STATE_FREE) ||
+			       (state == EVENT_STATE_ABANDONED) ) &&
+			     g_atomic_int_compare_and_exchange(&(new_event->state), state,
+			                                       EVENT_STATE_ALLOCATED) ) {
+				g_atomic_int_inc(&(stats->pool_allocs));
+				break;
+			}
+			new_event = NULL;
+		}
+	}
+	else {
+		new_event = NULL;
+	}
+
+	if (new_event == NULL) {
+		g_atomic_int_inc(&(stats->pool_failures));
+		return NULL;
+	}
 
 	new_event->next    = NULL;
 	new_event->type    = MIDI_EVENT_NO_EVENT;
@@ -217,13 +631,440 @@ get_new_midi_event(unsigned char queue_num)
 	new_event->byte2   = 0x0;
 	new_event->byte3   = 0x0;
 	new_event->bytes   = 0;
-	new_event->data[0] = 0xF7;
-	new_event->state   = EVENT_STATE_ALLOCATED;
+	new_event->data    = NULL;
+	new_event->ingress_time = 0;
 
 	return new_event;
 }
 
 
+/*****************************************************************************
+ * free_midi_event()
+ *
+ * Returns an event to the queue's pool, along with any SysEx arena buffer
+ * or SysEx stream bytes it holds.  Called by the dequeuing side once done
+ * with each event, and by producers dropping an event they will not queue.
+ *****************************************************************************/
+void
+free_midi_event(unsigned char queue_num, volatile MIDI_EVENT *event)
+{
+	event->type    = 0;
+	event->channel = 0;
+	event->byte2   = 0;
+	event->byte3   = 0;
+	if (event->data != NULL) {
+		/* SysEx payloads are held in an arena, or in a SysEx stream */
+		free_sysex_buffer(event->data);
+		sysex_stream_release(event->data, event->bytes);
+		event->data = NULL;
+	}
+	event->next    = NULL;
+	if (g_atomic_int_get(&(event->state)) == EVENT_STATE_QUEUED) {
+		g_atomic_int_add(&(queue_stats[queue_num].pool_in_use), -1);
+	}
+	g_atomic_int_set(&(event->state), EVENT_STATE_FREE);
+}
+
+
+/*****************************************************************************
+ * get_midi_event_pool_free()
+ *
+ * Returns the number of events in the queue's pool not currently queued,
+ * for producers of bulk data to back off before live events are refused.
+ *****************************************************************************/
+int
+get_midi_event_pool_free(unsigned char queue_num)
+{
+	return MIDI_EVENT_POOL_SIZE -
+		g_atomic_int_get(&(queue_stats[queue_num].pool_in_use));
+}
+
+
+/*****************************************************************************
+ * set_overload_mode()
+ *
+ * Parses the --overload mode:  off, thin, or shed.  Returns 0 on success,
+ * or -1 on an unknown mode.
+ *****************************************************************************/
+int
+set_overload_mode(char *mode)
+{
+	if (strcmp(mode, "off") == 0) {
+		overload_mode = OVERLOAD_MODE_OFF;
+	}
+	else if (strcmp(mode, "thin") == 0) {
+		overload_mode = OVERLOAD_MODE_THIN;
+	}
+	else if (strcmp(mode, "shed") == 0) {
+		overload_mode = OVERLOAD_MODE_SHED;
+	}
+	else {
+		JAMROUTER_ERROR("Unknown overload mode '%s'.\n", mode);
+		return -1;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * set_overload_wire_lateness()
+ *
+ * Called by the Raw MIDI Tx thread with the predicted lateness of each
+ * message behind what is already on the wire, which sets the overload
+ * level for the queue until the next message.
+ *****************************************************************************/
+void
+set_overload_wire_lateness(unsigned char queue_num, timensec_t late)
+{
+	gint            level = OVERLOAD_LEVEL_NONE;
+
+	if (late > (OVERLOAD_WIRE_SHED_USEC * 1000)) {
+		level = OVERLOAD_LEVEL_SHED;
+	}
+	else if (late > (OVERLOAD_WIRE_THIN_USEC * 1000)) {
+		level = OVERLOAD_LEVEL_THIN;
+	}
+	g_atomic_int_set(&(wire_overload[queue_num]), level);
+}
+
+
+/*****************************************************************************
+ * get_overload_level()
+ *
+ * Returns the overload level for a queue:  the worse of event pool and
+ * wire pressure, capped by the overload mode.
+ *****************************************************************************/
+static int
+get_overload_level(unsigned char queue_num)
+{
+	int             pool_free;
+	int             level;
+
+	if (overload_mode == OVERLOAD_MODE_OFF) {
+		return OVERLOAD_LEVEL_NONE;
+	}
+
+	pool_free = get_midi_event_pool_free(queue_num);
+	if (pool_free < OVERLOAD_POOL_SHED) {
+		level = OVERLOAD_LEVEL_SHED;
+	}
+	else if (pool_free < OVERLOAD_POOL_THIN) {
+		level = OVERLOAD_LEVEL_THIN;
+	}
+	else {
+		level = OVERLOAD_LEVEL_NONE;
+	}
+	if (g_atomic_int_get(&(wire_overload[queue_num])) > level) {
+		level = g_atomic_int_get(&(wire_overload[queue_num]));
+	}
+
+	return (level > overload_mode) ? overload_mode : level;
+}
+
+
+/*****************************************************************************
+ * get_event_thin_key()
+ *
+ * Returns the thinning key for continuous controller, aftertouch, channel
+ * pressure, and pitchbend events, or -1 for events never thinned.  Bank
+ * select, data entry, (N)RPN, switch, and channel mode controllers are
+ * left alone, since earlier values there are never redundant.
+ *****************************************************************************/
+int
+get_event_thin_key(volatile MIDI_EVENT *event)
+{
+	int             channel = (event->channel & 0x0F) << 9;
+
+	switch (event->type) {
+	case MIDI_EVENT_CONTROLLER:
+		switch (event->controller) {
+		case 0x00:      /* bank select */
+		case 0x06:      /* data entry */
+		case 0x20:
+		case 0x26:
+			return -1;
+		}
+		if ( ((event->controller >= 0x40) && (event->controller <= 0x45)) ||
+		     ((event->controller >= 0x60) && (event->controller <= 0x65)) ||
+		     (event->controller >= 0x78) ) {
+			return -1;
+		}
+		return channel | (event->controller & 0x7F);
+	case MIDI_EVENT_AFTERTOUCH:
+		return channel | 0x80 | (event->note & 0x7F);
+	case MIDI_EVENT_PITCHBEND:
+		return channel | 0x100;
+	case MIDI_EVENT_POLYPRESSURE:
+		return channel | 0x101;
+	}
+	return -1;
+}
+
+
+/*****************************************************************************
+ * get_shed_class()
+ *****************************************************************************/
+static int
+get_shed_class(volatile MIDI_EVENT *event)
+{
+	switch (event->type) {
+	case MIDI_EVENT_PITCHBEND:
+		return SHED_CLASS_PITCHBEND;
+	case MIDI_EVENT_AFTERTOUCH:
+	case MIDI_EVENT_POLYPRESSURE:
+		return SHED_CLASS_AFTERTOUCH;
+	case MIDI_EVENT_ACTIVE_SENSING:
+		return SHED_CLASS_ACTIVE_SENSING;
+	}
+	return SHED_CLASS_CONTROLLER;
+}
+
+
+/*****************************************************************************
+ * track_thin_event()
+ *
+ * Called as a continuous update is queued, before it is pushed.  Records it
+ * as the latest update for its parameter, so that shed_dequeued_event() can
+ * tell when an update still waiting to be sent has been superseded.
+ *****************************************************************************/
+static void
+track_thin_event(unsigned char queue_num, volatile MIDI_EVENT *event)
+{
+	volatile MIDI_EVENT *pool = &(bulk_event_pool[queue_num][0]);
+	int                 key;
+
+	if ( (overload_mode == OVERLOAD_MODE_OFF) ||
+	     (event < pool) || (event >= (pool + MIDI_EVENT_POOL_SIZE)) ||
+	     ((key = get_event_thin_key(event)) < 0) ) {
+		return;
+	}
+	thin_index[queue_num][key] = (unsigned short)((event - pool) + 1);
+}
+
+
+/*****************************************************************************
+ * shed_dequeued_event()
+ *
+ * Called by the dequeuing side for each event about to be sent, while the
+ * event belongs to it alone.  Returns nonzero (and counts the event as shed)
+ * for active sensing at the SHED overload level, and at the THIN level for
+ * a continuous update superseded by a later update for the same parameter
+ * that is still queued, so a congested link only carries the newest value.
+ * The newest value itself is always kept.
+ *****************************************************************************/
+int
+shed_dequeued_event(unsigned char queue_num, volatile MIDI_EVENT *event)
+{
+	volatile MIDI_EVENT *latest;
+	unsigned short      index;
+	int                 level;
+	int                 key;
+
+	if ((event->bytes == 0) || (overload_mode == OVERLOAD_MODE_OFF)) {
+		return 0;
+	}
+	level = get_overload_level(queue_num);
+
+	if ( (event->type == MIDI_EVENT_ACTIVE_SENSING) &&
+	     (level >= OVERLOAD_LEVEL_SHED) ) {
+		g_atomic_int_inc(&(queue_stats[queue_num].shed[SHED_CLASS_ACTIVE_SENSING]));
+		return 1;
+	}
+
+	if ( (level >= OVERLOAD_LEVEL_THIN) &&
+	     ((key = get_event_thin_key(event)) >= 0) &&
+	     ((index = thin_index[queue_num][key]) != 0) ) {
+		latest = &(bulk_event_pool[queue_num][index - 1]);
+		if ( (latest != event) &&
+		     (g_atomic_int_get(&(latest->state)) == EVENT_STATE_QUEUED) &&
+		     (get_event_thin_key(latest) == key) ) {
+			g_atomic_int_inc(&(queue_stats[queue_num].shed[get_shed_class(event)]));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * get_sysex_buffer()
+ *
+ * Allocates a contiguous SysEx payload buffer from the queue's SysEx arena.
+ * The arena is a ring of blocks handed out in order, and never straddling
+ * the end of the arena.  Each block is claimed before the ring moves past
+ * it, and stays owned by its payload until free_sysex_buffer(), so a wrap
+ * never runs over a payload still queued.  Returns NULL when the next
+ * blocks in the ring are still in use.
+ *****************************************************************************/
+volatile unsigned char *
+get_sysex_buffer(unsigned char queue_num, unsigned int size)
+{
+	volatile gint       *owner = &(sysex_arena_owner[queue_num][0]);
+	guint               old_arena_index;
+	guint               new_arena_index;
+	guint               start;
+	guint               blocks;
+	guint               j;
+	guint               k;
+
+	if (size > SYSEX_BUFFER_SIZE) {
+		size = SYSEX_BUFFER_SIZE;
+	}
+	blocks = (size + SYSEX_ARENA_BLOCK_SIZE - 1) >> SYSEX_ARENA_BLOCK_SHIFT;
+	if (blocks == 0) {
+		blocks = 1;
+	}
+
+	for (;;) {
+		old_arena_index = (guint) g_atomic_int_get(&(sysex_arena_index[queue_num]));
+		start           = old_arena_index;
+		if ((start + blocks) > SYSEX_ARENA_BLOCKS) {
+			start = 0;
+		}
+		new_arena_index = (start + blocks) & SYSEX_ARENA_BLOCK_MASK;
+
+		/* claim every block, or none */
+		for (j = 0; j < blocks; j++) {
+			if (!g_atomic_int_compare_and_exchange(&(owner[start + j]), 0, -1)) {
+				break;
+			}
+		}
+		if (j < blocks) {
+			for (k = 0; k < j; k++) {
+				g_atomic_int_set(&(owner[start + k]), 0);
+			}
+			g_atomic_int_inc(&(queue_stats[queue_num].arena_failures));
+			return NULL;
+		}
+
+		if (g_atomic_int_compare_and_exchange(&(sysex_arena_index[queue_num]),
+		                                      (gint)old_arena_index,
+		                                      (gint)new_arena_index)) {
+			break;
+		}
+		/* another producer moved the ring first */
+		for (j = 0; j < blocks; j++) {
+			g_atomic_int_set(&(owner[start + j]), 0);
+		}
+	}
+	g_atomic_int_set(&(owner[start]), (gint) blocks);
+
+	start <<= SYSEX_ARENA_BLOCK_SHIFT;
+	sysex_arena[queue_num][start] = 0xF7;
+
+	return &(sysex_arena[queue_num][start]);
+}
+
+
+/*****************************************************************************
+ * free_sysex_buffer()
+ *
+ * Hands a SysEx payload buffer back to the arena it came from.  Called when
+ * its event is freed, or by a producer dropping a payload before queueing
+ * it.  Pointers outside of the SysEx arenas are ignored.
+ *****************************************************************************/
+void
+free_sysex_buffer(volatile unsigned char *data)
+{
+	volatile gint       *owner;
+	gsize               offset;
+	guint               start;
+	gint                blocks;
+	gint                j;
+
+	if ( (data < &(sysex_arena[0][0])) ||
+	     (data >= &(sysex_arena[NUM_MIDI_QUEUES - 1][SYSEX_ARENA_SIZE])) ) {
+		return;
+	}
+	offset = (gsize)(data - &(sysex_arena[0][0]));
+	owner  = &(sysex_arena_owner[offset / SYSEX_ARENA_SIZE][0]);
+	start  = (guint)((offset & SYSEX_ARENA_MASK) >> SYSEX_ARENA_BLOCK_SHIFT);
+
+	if ((blocks = g_atomic_int_get(&(owner[start]))) <= 0) {
+		return;
+	}
+	for (j = blocks - 1; j >= 0; j--) {
+		g_atomic_int_set(&(owner[start + (guint) j]), 0);
+	}
+}
+
+
+/*****************************************************************************
+ * trim_sysex_buffer()
+ *
+ * Returns the unused blocks at the end of the most recent SysEx arena
+ * allocation, for callers that allocate a worst-case buffer before the
+ * message size is known.  Does nothing if another allocation has been made
+ * since.
+ *****************************************************************************/
+void
+trim_sysex_buffer(unsigned char             queue_num,
+                  volatile unsigned char    *data,
+                  unsigned int              size,
+                  unsigned int              used)
+{
+	volatile gint       *owner = &(sysex_arena_owner[queue_num][0]);
+	guint               start;
+	guint               blocks;
+	guint               used_blocks;
+	guint               j;
+
+	if ((data == NULL) || (used >= size)) {
+		return;
+	}
+
+	start       = (guint)(data - &(sysex_arena[queue_num][0])) >> SYSEX_ARENA_BLOCK_SHIFT;
+	blocks      = (size + SYSEX_ARENA_BLOCK_SIZE - 1) >> SYSEX_ARENA_BLOCK_SHIFT;
+	used_blocks = (used + SYSEX_ARENA_BLOCK_SIZE - 1) >> SYSEX_ARENA_BLOCK_SHIFT;
+	if (used_blocks == 0) {
+		used_blocks = 1;
+	}
+	if (used_blocks >= blocks) {
+		return;
+	}
+
+	if (g_atomic_int_compare_and_exchange(&(sysex_arena_index[queue_num]),
+	                                      (gint)((start + blocks) & SYSEX_ARENA_BLOCK_MASK),
+	                                      (gint)((start + used_blocks) & SYSEX_ARENA_BLOCK_MASK))) {
+		g_atomic_int_set(&(owner[start]), (gint) used_blocks);
+		for (j = used_blocks; j < blocks; j++) {
+			g_atomic_int_set(&(owner[start + j]), 0);
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * get_event_coalesce_key()
+ *
+ * Returns the key identifying which queued event a new event may replace
+ * within the same frame slot:  (channel, controller) for controllers, or
+ * the parameter number for Juno-106 SysEx controllers.  Returns -1 for
+ * events that are never coalesced.
+ *****************************************************************************/
+int
+get_event_coalesce_key(volatile MIDI_EVENT *event)
+{
+	if (event->type == MIDI_EVENT_CONTROLLER) {
+		return ((event->channel & 0x0F) << 7) | (event->controller & 0x7F);
+	}
+#ifndef WITHOUT_JUNO
+	if ( translate_juno_sysex &&
+	     (event->type  == MIDI_EVENT_SYSEX) &&
+	     (event->data  != NULL) &&
+	     (event->bytes >= 7) &&
+	     (event->data[0] == 0xF0) &&
+	     (event->data[1] == 0x41) &&
+	     (event->data[2] == 0x32) &&
+	     (event->data[6] == 0xF7) ) {
+		return 0x800 | event->data[4];
+	}
+#endif
+	return -1;
+}
+
+
 /*****************************************************************************
  * queue_midi_event()
  *****************************************************************************/
@@ -235,13 +1076,16 @@ queue_midi_event(unsigned short         period,
                  unsigned short         index,
                  unsigned short         copy_event)
 {
-	volatile MIDI_EVENT      *head        = NULL;
-	volatile MIDI_EVENT      *tail        = NULL;
-	volatile MIDI_EVENT      *cur         = NULL;
+	volatile EVENT_QUEUE     *queue;
+	volatile MIDI_EVENT      *head;
 	volatile MIDI_EVENT      *queue_event = event;
+	unsigned int             size;
+	QUEUE_STATS              *stats = &(queue_stats[queue_num]);
 	unsigned short           j;
-
-	tail = event_queue[queue_num][index + cycle_frame].head;
+	int                      queued       = 0;
+	int                      level;
+	gint                     in_use;
+	gint                     high_water;
 
 	if (cycle_frame > (sync_info[period].buffer_period_size + 1)) {
 		JAMROUTER_WARN("%%%%%%  Timing Error:  "
@@ -268,26 +1112,47 @@ queue_midi_event(unsigned short         period,
 		}
 	}
 
+	/* under heavy load, active sensing is the first thing to go */
+	level = get_overload_level(queue_num);
+	if ( (level >= OVERLOAD_LEVEL_SHED) &&
+	     (event->type == MIDI_EVENT_ACTIVE_SENSING) &&
+	     (event->bytes > 0) ) {
+		event->bytes = 0;
+		g_atomic_int_inc(&(stats->shed[SHED_CLASS_ACTIVE_SENSING]));
+	}
+
 	/* ignore empty events, or events with no size set */
 	if (event->bytes > 0) {
 		if (copy_event) {
-			queue_event              = get_new_midi_event(queue_num);
+			if ((queue_event = get_new_midi_event(queue_num)) == NULL) {
+				return;
+			}
 			queue_event->type        = event->type;
 			queue_event->channel     = event->channel;
 			queue_event->byte2       = event->byte2;
 			queue_event->byte3       = event->byte3;
 			queue_event->bytes       = event->bytes;
 			queue_event->float_value = event->float_value;
-			if (event->type == MIDI_EVENT_SYSEX) {
-				for (j = 0; (j < SYSEX_BUFFER_SIZE) && (j < event->bytes) &&
+			queue_event->ingress_time = event->ingress_time;
+			if ((event->type == MIDI_EVENT_SYSEX) && (event->data != NULL)) {
+				/* room for payload plus (possibly two byte) terminator */
+				size = event->bytes + 2;
+				if (size > SYSEX_BUFFER_SIZE) {
+					size = SYSEX_BUFFER_SIZE;
+				}
+				if ((queue_event->data = get_sysex_buffer(queue_num, size)) == NULL) {
+					free_midi_event(queue_num, queue_event);
+					return;
+				}
+				for (j = 0; (j < size) && (j < event->bytes) &&
 					     (event->data[j] != sysex_terminator); j++) {
 					queue_event->data[j] = event->data[j];
 				}
-				if (j < SYSEX_BUFFER_SIZE) {
+				if (j < size) {
 					queue_event->data[j] = sysex_terminator;
 				}
 				if ( (sysex_extra_terminator != 0xF7) &&
-				     (j < (SYSEX_BUFFER_SIZE - 1)) ) {
+				     (j < (size - 1)) ) {
 					queue_event->data[j+1] = sysex_extra_terminator;
 				}
 			}
@@ -295,49 +1160,39 @@ queue_midi_event(unsigned short         period,
 		queue_event->next  = NULL;
 		queue_event->state = EVENT_STATE_QUEUED;
 
-		/* link to head of list if empty */
-		if ((head = event_queue[queue_num][index + cycle_frame].head) == NULL) {
-			event_queue[queue_num][index + cycle_frame].head = queue_event;
-		}
-		else {
-			tail = head;
-			cur  = tail;
-			while (cur != NULL) {
-				/* re-use events for same MIDI controller */
-				if ( (queue_event->type == MIDI_EVENT_CONTROLLER) &&
-				     (cur->type         == MIDI_EVENT_CONTROLLER) &&
-				     (cur->channel      == queue_event->channel) &&
-				     (cur->controller   == queue_event->controller) ) {
-					cur->value         = queue_event->value;
-					queue_event->state = EVENT_STATE_ABANDONED;
-				}
-#ifndef WITHOUT_JUNO
-				/* re-use events for same juno sysex controller */
-				if ( translate_juno_sysex &&
-				     (cur->data[4]      == queue_event->data[4]) &&
-				     (queue_event->type == MIDI_EVENT_SYSEX) &&
-				     (cur->type         == MIDI_EVENT_SYSEX) &&
-				     (cur->data[1]      == 0x41) &&
-				     (cur->data[2]      == 0x32) &&
-				     (cur->data[6]      == 0xF7) ) {
-					cur->data[5]       = queue_event->data[5];
-					queue_event->state = EVENT_STATE_ABANDONED;
-				}
-#endif
-				tail = cur;
-				cur  = cur->next;
-			}
+		/* account for events in flight before the dequeuing side can
+		   see (and free) this one. */
+		in_use = g_atomic_int_add(&(stats->pool_in_use), 1) + 1;
+		do {
+			high_water = g_atomic_int_get(&(stats->pool_high_water));
+		} while ( (in_use > high_water) &&
+		          !g_atomic_int_compare_and_exchange(&(stats->pool_high_water),
+		                                             high_water, in_use) );
 
-			/* link event to tail, ignoring abandoned events */
-			if (queue_event->state != EVENT_STATE_ABANDONED) {
-				tail->next = queue_event;
-			}
-		}
+		/* note the latest update for the parameter, for thinning under
+		   load.  This must come first:  once pushed, the event may be
+		   taken and freed by the dequeuing side at any time. */
+		track_thin_event(queue_num, queue_event);
+
+		/* push onto the frame slot (see take_queued_events()) */
+		queue = &(event_queue[queue_num][index + cycle_frame]);
+		do {
+			head              = g_atomic_pointer_get(&(queue->head));
+			queue_event->next = head;
+		} while (!g_atomic_pointer_compare_and_exchange(&(queue->head),
+		                                                head, queue_event));
+		queued = 1;
+
+		/* mark frame slot as occupied for the Tx side */
+		g_atomic_int_or(&(event_queue_bitmap[queue_num][(index + cycle_frame) >> 5]),
+		                1U << ((index + cycle_frame) & 0x1F));
 	}
 
-	/* mark events no longer in use as free */
-	if (!copy_event && (queue_event->state == EVENT_STATE_ABANDONED)) {
-		queue_event->state = EVENT_STATE_FREE;
+	/* An event handed over to be queued belongs to the queue, even when
+	   there was nothing to queue, so free it if it went nowhere. */
+	if ( !copy_event && !queued &&
+	     (queue_event->state == EVENT_STATE_ALLOCATED) ) {
+		free_midi_event(queue_num, queue_event);
 	}
 
 	/* TODO: move most of the work into a real_queue_midi_event() to be used
@@ -367,6 +1222,7 @@ queue_midi_realtime_event(unsigned short    period,
 	event->byte2   = 0;
 	event->byte3   = 0;
 	event->bytes   = 1;
+	event->ingress_time = 0;
 
 	queue_midi_event(period, queue_num, event, cycle_frame, index, 1);
 }
@@ -382,13 +1238,17 @@ queue_notes_off(unsigned short  period,
                 unsigned short  cycle_frame,
                 unsigned short  index)
 {
-	KEYLIST             *cur    = keylist_head[queue_num][channel];
+	NOTE_STATE          *ns     = &(note_state[queue_num][channel]);
 	volatile MIDI_EVENT *queue_event;
+	unsigned char       note;
 
-	/* queue note off event for all notes in play on this queue/channel */
-	while (cur != NULL) {
-		queue_event           = get_new_midi_event(queue_num);
-		if ((queue_num == J2A_QUEUE) && tx_prefer_real_note_off) {
+	/* queue note off event for all notes in play on this queue/channel,
+	   oldest first.  track_note_off() removes each from the list. */
+	while ((note = ns->head) != NOTE_NONE) {
+		if ((queue_event = get_new_midi_event(queue_num)) == NULL) {
+			break;
+		}
+		if (IS_J2A_QUEUE(queue_num) && tx_prefer_real_note_off) {
 			queue_event->type     = MIDI_EVENT_NOTE_OFF;
 			queue_event->velocity = note_off_velocity;
 		}
@@ -397,12 +1257,37 @@ queue_notes_off(unsigned short  period,
 			queue_event->velocity = 0;
 		}
 		queue_event->channel  = channel;
-		queue_event->note     = cur->midi_key;
+		queue_event->note     = note;
 		queue_event->bytes    = 3;
 		queue_midi_event(period, queue_num, queue_event, cycle_frame, index, 0);
-		track_note_off(queue_num, channel, cur->midi_key);
-		cur = g_atomic_pointer_get(&(cur->next));
+		track_note_off(queue_num, channel, note);
+	}
+}
+
+
+/*****************************************************************************
+ * note_state_unlink()
+ *
+ * Removes a key from the note order list and held mask in constant time.
+ *****************************************************************************/
+void
+note_state_unlink(NOTE_STATE *ns, unsigned char midi_note)
+{
+	if (ns->prev[midi_note] == NOTE_NONE) {
+		ns->head = ns->next[midi_note];
+	}
+	else {
+		ns->next[ns->prev[midi_note]] = ns->next[midi_note];
+	}
+	if (ns->next[midi_note] == NOTE_NONE) {
+		ns->tail = ns->prev[midi_note];
 	}
+	else {
+		ns->prev[ns->next[midi_note]] = ns->prev[midi_note];
+	}
+	ns->prev[midi_note] = NOTE_NONE;
+	ns->next[midi_note] = NOTE_NONE;
+	ns->held[midi_note >> 5] &= ~((guint32)(1U << (midi_note & 0x1F)));
 }
 
 
@@ -414,54 +1299,33 @@ track_note_on(unsigned char     queue_num,
               unsigned char     channel,
               unsigned char     midi_note)
 {
-	KEYLIST     *cur;
-	KEYLIST     *prev;
+	NOTE_STATE  *ns         = &(note_state[queue_num][channel]);
 	int         key_in_play = 0;
 
+	midi_note &= 0x7F;
 
 	/* keep track of previous to newest key pressed! */
 	prev_key[queue_num][channel] = midi_key[queue_num][channel];
-	midi_key[queue_num][channel] = midi_note & 0x7F;
-	last_key[queue_num][channel] = midi_note & 0x7F;
+	midi_key[queue_num][channel] = midi_note;
+	last_key[queue_num][channel] = midi_note;
 
-	/* staccato, or no previous notes in play */
-	if ( (prev_key[queue_num][channel] == 0xFF) ||
-	     (keylist_head[queue_num][channel] == NULL) ) {
-		/* put this key at the start of the list */
-		keylist[queue_num][channel][midi_note].next = NULL;
-		keylist_head[queue_num][channel] =
-			&(keylist[queue_num][channel][midi_note]);
+	/* retriggered key moves to the end of the list */
+	if (NOTE_IN_PLAY(ns, midi_note)) {
+		key_in_play = 1;
+		note_state_unlink(ns, midi_note);
 	}
 
-	/* legato, or previous notes still in play */
+	/* link this key to the end of the list */
+	ns->prev[midi_note] = ns->tail;
+	ns->next[midi_note] = NOTE_NONE;
+	if (ns->tail == NOTE_NONE) {
+		ns->head = midi_note;
+	}
 	else {
-		/* Link this key to the end of the list,
-		   unlinking from the middle if necessary. */
-		cur  = keylist_head[queue_num][channel];
-		prev = NULL;
-		while (cur != NULL) {
-			if (cur == &(keylist[queue_num][channel][midi_note])) {
-				key_in_play = 1;
-				if (prev != NULL) {
-					prev->next = cur->next;
-				}
-			}
-			prev = cur;
-			cur  = cur->next;
-		}
-		cur = &(keylist[queue_num][channel][midi_note]);
-		/* if there is no end of the list, link it to the head */
-		if (prev == NULL) {
-			keylist_head[queue_num][channel] = cur;
-			JAMROUTER_WARN("*** track_note_on(): [queue %d] found "
-			               "previous key in play with no keylist!\n",
-			               queue_num);
-		}
-		else {
-			prev->next = cur;
-		}
-		cur->next = NULL;
+		ns->next[ns->tail] = midi_note;
 	}
+	ns->tail = midi_note;
+	ns->held[midi_note >> 5] |= (guint32)(1U << (midi_note & 0x1F));
 
 	if (!key_in_play) {
 		keys_in_play[queue_num]++;
@@ -481,39 +1345,16 @@ track_note_off(unsigned char    queue_num,
                unsigned char    channel,
                unsigned char    midi_note)
 {
-	KEYLIST     *cur;
-	KEYLIST     *prev;
-	int         unlink;
+	NOTE_STATE  *ns     = &(note_state[queue_num][channel]);
+
+	midi_note &= 0x7F;
 
 	prev_key[queue_num][channel] = midi_key[queue_num][channel];
-	midi_key[queue_num][channel] = midi_note & 0x7F;
-
-	/* remove this key from the list and then find the last key */
-	prev   = NULL;
-	cur    = keylist_head[queue_num][channel];
-	unlink = 0;
-	while (cur != NULL) {
-		/* if note is found, unlink it from the list */
-		if (cur->midi_key == midi_note) {
-			unlink = 1;
-			if (prev != NULL) {
-				prev->next = cur->next;
-				cur->next  = NULL;
-				cur        = prev->next;
-			}
-			else {
-				keylist_head[queue_num][channel] = cur->next;
-				cur->next                        = NULL;
-				cur = keylist_head[queue_num][channel];
-			}
-		}
-		/* otherwise, on to the next key in the list */
-		else {
-			prev = cur;
-			cur  = cur->next;
-		}
-	}
-	if (unlink) {
+	midi_key[queue_num][channel] = midi_note;
+
+	/* remove this key from the list */
+	if (NOTE_IN_PLAY(ns, midi_note)) {
+		note_state_unlink(ns, midi_note);
 		keys_in_play[queue_num]--;
 		JAMROUTER_DEBUG(DEBUG_CLASS_MIDI_NOTE,
 		                DEBUG_COLOR_LTBLUE "---%1X:%X:%d--- " DEBUG_COLOR_DEFAULT,
@@ -525,33 +1366,14 @@ track_note_off(unsigned char    queue_num,
 		                DEBUG_COLOR_RED "---%1X:%X:%d--- " DEBUG_COLOR_DEFAULT,
 		                channel, midi_note, keys_in_play[queue_num]);
 	}
-	/* ignore the note in the note off message if found in list */
-	//if ((prev != NULL) && (prev->midi_key == midi_note)) {
-	//	cur = keylist_head[queue_num][channel];
-	//	while (cur != NULL) {
-	//		if (cur->midi_key != midi_note) {
-	//			prev = cur;
-	//		}
-	//		cur = cur->next;
-	//	}
-	//}
-	if (prev != NULL) {
-		/* set last/current keys in play respective of notes still held */
-		last_key[queue_num][channel] = prev->midi_key;
-		midi_key[queue_num][channel] = prev->midi_key;
-		if (prev->next != NULL) {
-			JAMROUTER_WARN("*** track_note_off():  "
-			               "Fixed unterminated keytracking list."
-			               "  (queue=%d)\n", queue_num);
-			prev->next          = NULL;
-		}
-	}
-	/* re-init list if no keys */
-	else {
-		keylist_head[queue_num][channel] = NULL;
-		/* TODO:  Implement hold pedal handling. */
-		//if (!hold_pedal[queue_num][channel]) {
-		//	midi_key[queue_num][channel] = 0xFF;
-		//}
+
+	/* set last/current keys in play respective of notes still held */
+	if (ns->tail != NOTE_NONE) {
+		last_key[queue_num][channel] = ns->tail;
+		midi_key[queue_num][channel] = ns->tail;
 	}
+	/* TODO:  Implement hold pedal handling. */
+	//else if (!hold_pedal[queue_num][channel]) {
+	//	midi_key[queue_num][channel] = 0xFF;
+	//}
 }
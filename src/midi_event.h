@@ -23,43 +23,135 @@
 #ifndef _MIDI_EVENT_H_
 #define _MIDI_EVENT_H_
 
+#include <glib.h>
 #include "mididefs.h"
 
 
-typedef struct keylist {
-	unsigned char   midi_key;
-	struct keylist  *next;
-} KEYLIST;
+/* one occupancy bit per event_queue[][] frame slot */
+#define EVENT_QUEUE_BITMAP_SIZE        (MAX_BUFFER_SIZE >> 5)
+
+
+/* frame slot hash filter bit (0-63) for an event coalescing key */
+#define EVENT_QUEUE_FILTER_BIT(key)    ((((guint)(key)) * 0x9E3779B1U) >> 26)
+
+/* Ordering rules for events due in the same frame slot, applied when the
+   slot is dequeued (see order_queued_events()).  Arrival order is kept
+   for events the rules do not distinguish. */
+#define EVENT_ORDER_NONE               0x00
+#define EVENT_ORDER_NOTE_OFF_FIRST     0x01
+#define EVENT_ORDER_NOTE_ON_FIRST      0x02
+#define EVENT_ORDER_HIGH_NOTES_FIRST   0x04
+#define EVENT_ORDER_LOW_NOTES_FIRST    0x08
+#define EVENT_ORDER_CONTROLLERS_FIRST  0x10
+#define EVENT_ORDER_SYSEX_LAST         0x20
+#define EVENT_ORDER_REALTIME_FIRST     0x40
+
+/* max events per frame slot to reorder.  The rest keep arrival order. */
+#define EVENT_ORDER_MAX_SORT           64
+
+/* Overload handling (--overload).  Under pressure from a short event pool
+   or a late Raw MIDI Tx wire, the THIN level drops queued continuous
+   controller, pitchbend, and aftertouch updates superseded by a newer
+   value for the same parameter, and the SHED level drops active sensing
+   as well.  Notes, program changes, clock, and SysEx are never shed.  The
+   mode caps the level applied. */
+#define OVERLOAD_MODE_OFF              0
+#define OVERLOAD_MODE_THIN             1
+#define OVERLOAD_MODE_SHED             2
+
+#define OVERLOAD_LEVEL_NONE            0
+#define OVERLOAD_LEVEL_THIN            1
+#define OVERLOAD_LEVEL_SHED            2
+
+/* one thinning key per channel and parameter:  controllers 0-127,
+   aftertouch 128-255, pitchbend 256, and channel pressure 257. */
+#define EVENT_THIN_KEYS                (16 << 9)
+
+/* end of note order list */
+#define NOTE_NONE                      0xFF
+
+/* constant time check of a key in the held mask */
+#define NOTE_IN_PLAY(ns, note) \
+	(((ns)->held[((note) & 0x7F) >> 5] >> ((note) & 0x1F)) & 0x1)
+
+
+/* Keys in play for one queue/channel:  a 128-bit held mask plus an order
+   list (oldest to newest key pressed) linked through per-key indices. */
+typedef struct note_state {
+	guint32         held[4];
+	unsigned char   prev[128];
+	unsigned char   next[128];
+	unsigned char   head;
+	unsigned char   tail;
+} NOTE_STATE;
 
 
 extern unsigned char           prev_key[MAX_MIDI_QUEUES][16];
 extern unsigned char           midi_key[MAX_MIDI_QUEUES][16];
 extern unsigned char           last_key[MAX_MIDI_QUEUES][16];
 
-extern KEYLIST                 keylist[MAX_MIDI_QUEUES][16][128];
-
-extern KEYLIST                 *keylist_head[MAX_MIDI_QUEUES][16];
+extern NOTE_STATE              note_state[MAX_MIDI_QUEUES][16];
 
 extern volatile MIDI_EVENT     realtime_events[MAX_MIDI_QUEUES];
 
-extern volatile MIDI_EVENT     bulk_event_pool[MAX_MIDI_QUEUES][MIDI_EVENT_POOL_SIZE];
+/* per queue buffers, allocated for the NUM_MIDI_QUEUES in use */
+extern volatile MIDI_EVENT     (*bulk_event_pool)[MIDI_EVENT_POOL_SIZE];
 
-extern volatile EVENT_QUEUE    event_queue[MAX_MIDI_QUEUES][MAX_BUFFER_SIZE];
+extern volatile EVENT_QUEUE    (*event_queue)[MAX_BUFFER_SIZE];
+
+extern volatile guint          (*event_queue_bitmap)[EVENT_QUEUE_BITMAP_SIZE];
 
 extern volatile gint           bulk_event_index[MAX_MIDI_QUEUES];
 
+extern volatile unsigned char  (*sysex_arena)[SYSEX_ARENA_SIZE];
+
+extern volatile gint           sysex_arena_index[MAX_MIDI_QUEUES];
+
+extern volatile gint           (*sysex_arena_owner)[SYSEX_ARENA_BLOCKS];
+
 extern unsigned char           keys_in_play[MAX_MIDI_QUEUES];
 
+extern unsigned int            tx_event_order;
+extern unsigned int            rx_event_order;
+
+extern int                     overload_mode;
+
 
 void init_midi_event_queue(void);
 volatile MIDI_EVENT *get_new_midi_event(unsigned char queue_num);
+void free_midi_event(unsigned char queue_num, volatile MIDI_EVENT *event);
+int  get_midi_event_pool_free(unsigned char queue_num);
+int  set_overload_mode(char *mode);
+int  get_event_thin_key(volatile MIDI_EVENT *event);
+void set_overload_wire_lateness(unsigned char queue_num,
+                                timensec_t late);
+int  shed_dequeued_event(unsigned char queue_num,
+                         volatile MIDI_EVENT *event);
+volatile unsigned char *get_sysex_buffer(unsigned char queue_num,
+                                         unsigned int size);
+void free_sysex_buffer(volatile unsigned char *data);
+void trim_sysex_buffer(unsigned char queue_num,
+                       volatile unsigned char *data,
+                       unsigned int size,
+                       unsigned int used);
 volatile MIDI_EVENT *get_midi_event(unsigned char queue_num,
                                     unsigned short cycle_frame,
                                     unsigned short index);
+unsigned short get_next_queued_frame(unsigned char queue_num,
+                                     unsigned short period,
+                                     unsigned short cycle_frame);
+int set_event_order(unsigned int *order,
+                    char *rules);
+volatile MIDI_EVENT *order_queued_events(unsigned char queue_num,
+                                         volatile MIDI_EVENT *head);
+volatile MIDI_EVENT *take_queued_events(unsigned char queue_num,
+                                        unsigned short slot);
 volatile MIDI_EVENT *dequeue_midi_event(unsigned char queue_num,
                                         unsigned short *last_period,
                                         unsigned short period,
-                                        unsigned short cycle_frame);
+                                        unsigned short cycle_frame,
+                                        int *late_frames);
+int get_event_coalesce_key(volatile MIDI_EVENT *event);
 void queue_midi_event(unsigned short      period,
                       unsigned char       queue_num,
                       volatile MIDI_EVENT *event,
@@ -76,6 +168,8 @@ void queue_notes_off(unsigned short period,
                      unsigned char channel,
                      unsigned short cycle_frame,
                      unsigned short index);
+void note_state_unlink(NOTE_STATE *ns,
+                       unsigned char midi_note);
 void track_note_on(unsigned char queue_num,
                    unsigned char channel,
                    unsigned char midi_note);
@@ -0,0 +1,735 @@
+/*****************************************************************************
+ *
+ * midi_sync.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jack/jack.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "midi_event.h"
+#include "midi_sync.h"
+#include "sysex_stream.h"
+#include "jack.h"
+#include "debug.h"
+
+
+#define SYNC_RX_IDLE            0
+#define SYNC_RX_LOCKING         1
+#define SYNC_RX_RUNNING         2
+
+
+/* Clock regeneration state for one route.  Incoming ticks are matched to
+   emitted ticks by count, and the phase error of each drives a second
+   order DLL (the same loop as run_clock_dll()) steering the flywheel. */
+typedef struct midi_sync_rx {
+	timensec_t          tick_time[MIDI_SYNC_TICK_HISTORY];
+	timensec_t          next_tick_time;
+	timensec_t          last_in_time;
+	timecalc_t          tick_nsecs;
+	guint32             in_count;
+	guint32             out_count;
+	int                 state;
+} MIDI_SYNC_RX;
+
+
+int                     midi_sync_tx            = 0;
+int                     mtc_rate                = MTC_RATE_25;
+int                     midi_sync_smooth_clock  = 0;
+
+/* Everything below is owned by the JACK thread.  Transport positions are
+   kept in fixed point frames (FRAME_NSEC_FRAC_BITS), so tick and quarter
+   frame spacing never accumulates rounding error. */
+static int              sync_tx_rolling         = 0;
+static jack_nframes_t   sync_tx_next_frame      = 0;
+static jack_nframes_t   sync_tx_stopped_frame   = 0;
+static gint64           sync_tx_next_tick       = 0;
+static gint64           sync_tx_next_qframe     = 0;
+static gint64           sync_tx_mtc_block       = 0;
+static unsigned char    sync_tx_qframe_piece    = 0;
+
+static MIDI_SYNC_RX     sync_rx[MAX_MIDI_ROUTES];
+
+/* MTC frame rates (num / den), and nominal frames per second, by rate code */
+static const gint64     mtc_fps_num[4]          = { 24, 25, 30000, 30 };
+static const gint64     mtc_fps_den[4]          = { 1,  1,  1001,  1 };
+static const gint64     mtc_fps_nominal[4]      = { 24, 25, 30,    30 };
+
+
+/*****************************************************************************
+ * set_midi_sync_tx()
+ *
+ * Parses a comma separated list of sync message types to generate from
+ * JACK transport:  clock, spp, mtc (25 fps), mtc24, mtc25, mtc29 (29.97
+ * drop frame), mtc30, or none.  Returns 0 on success, or -1 on an unknown
+ * type.
+ *****************************************************************************/
+int
+set_midi_sync_tx(char *types)
+{
+	char            *tokbuf = NULL;
+	char            *p;
+
+	for (p = strtok_r(types, ",", &tokbuf); p != NULL;
+	     p = strtok_r(NULL, ",", &tokbuf)) {
+		if (strcmp(p, "none") == 0) {
+			midi_sync_tx = 0;
+		}
+		else if (strcmp(p, "clock") == 0) {
+			midi_sync_tx |= MIDI_SYNC_TX_CLOCK;
+		}
+		else if (strcmp(p, "spp") == 0) {
+			midi_sync_tx |= MIDI_SYNC_TX_SONGPOS;
+		}
+		else if ((strcmp(p, "mtc") == 0) || (strcmp(p, "mtc25") == 0)) {
+			midi_sync_tx |= MIDI_SYNC_TX_MTC;
+			mtc_rate = MTC_RATE_25;
+		}
+		else if (strcmp(p, "mtc24") == 0) {
+			midi_sync_tx |= MIDI_SYNC_TX_MTC;
+			mtc_rate = MTC_RATE_24;
+		}
+		else if (strcmp(p, "mtc29") == 0) {
+			midi_sync_tx |= MIDI_SYNC_TX_MTC;
+			mtc_rate = MTC_RATE_30_DROP;
+		}
+		else if (strcmp(p, "mtc30") == 0) {
+			midi_sync_tx |= MIDI_SYNC_TX_MTC;
+			mtc_rate = MTC_RATE_30;
+		}
+		else {
+			JAMROUTER_ERROR("Unknown MIDI sync message type '%s'.\n", p);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * init_midi_sync()
+ *
+ * Resets sync generation and clock regeneration state.  Must be called
+ * before the JACK thread is started.
+ *****************************************************************************/
+void
+init_midi_sync(void)
+{
+	sync_tx_rolling       = 0;
+	sync_tx_next_frame    = 0;
+	sync_tx_stopped_frame = 0;
+	sync_tx_next_tick     = 0;
+	sync_tx_next_qframe   = 0;
+	sync_tx_mtc_block     = 0;
+	sync_tx_qframe_piece  = 0;
+
+	memset((void *)(&(sync_rx[0])), 0, sizeof(sync_rx));
+}
+
+
+/*****************************************************************************
+ * midi_sync_tx_filter()
+ *
+ * Returns 1 if messages of <type> arriving on JACK MIDI input are to be
+ * dropped because JAMRouter generates them itself, or 0 otherwise.  This
+ * keeps upstream clock (and its jitter) off the wire while --clock-out is
+ * in use.
+ *****************************************************************************/
+int
+midi_sync_tx_filter(unsigned char type)
+{
+	switch (type) {
+	case MIDI_EVENT_TICK:
+	case MIDI_EVENT_START:
+	case MIDI_EVENT_CONTINUE:
+	case MIDI_EVENT_STOP:
+		return (midi_sync_tx & MIDI_SYNC_TX_CLOCK) ? 1 : 0;
+	case MIDI_EVENT_SONGPOS:
+		return (midi_sync_tx & MIDI_SYNC_TX_SONGPOS) ? 1 : 0;
+	case MIDI_EVENT_MTC_QFRAME:
+		return (midi_sync_tx & MIDI_SYNC_TX_MTC) ? 1 : 0;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * queue_sync_event()
+ *
+ * Queues a sync message for <frame> of <period> on the Tx queue of every
+ * route.  Non-realtime messages wait behind any SysEx stream in flight.
+ *****************************************************************************/
+static void
+queue_sync_event(unsigned short period,
+                 unsigned short frame,
+                 unsigned char  type,
+                 unsigned char  byte2,
+                 unsigned char  byte3,
+                 unsigned int   bytes)
+{
+	volatile MIDI_EVENT     *event;
+	unsigned char           queue_num;
+	unsigned char           route;
+
+	for (route = 0; route < num_midi_routes; route++) {
+		queue_num      = J2A_ROUTE_QUEUE(route);
+		if ((event = get_new_midi_event(queue_num)) == NULL) {
+			continue;
+		}
+		event->type    = type;
+		event->channel = 0;
+		event->byte2   = byte2;
+		event->byte3   = byte3;
+		event->bytes   = bytes;
+		if ((type < MIDI_EVENT_TICK) && sysex_stream_pending(route)) {
+			sysex_stream_write_event(route, frame, event);
+			continue;
+		}
+		queue_midi_event(period, queue_num, event, frame,
+		                 sync_info[period].input_index, 0);
+	}
+}
+
+
+/*****************************************************************************
+ * get_timecode()
+ *
+ * Converts a count of MTC frames at the current MTC rate to hours,
+ * minutes, seconds, and frames, with drop frame numbering for 29.97 fps.
+ *****************************************************************************/
+static void
+get_timecode(gint64 mtc_frames, unsigned char *tc)
+{
+	gint64          fps = mtc_fps_nominal[mtc_rate];
+	gint64          d;
+	gint64          m;
+
+	/* drop frame:  frame numbers 0 and 1 are skipped every minute, except
+	   every tenth minute (17982 frames per 10 minutes, 1798 per minute). */
+	if (mtc_rate == MTC_RATE_30_DROP) {
+		d = mtc_frames / 17982;
+		m = mtc_frames % 17982;
+		mtc_frames += 18 * d;
+		if (m > 1) {
+			mtc_frames += 2 * ((m - 2) / 1798);
+		}
+	}
+
+	tc[0] = (unsigned char)((mtc_frames / (fps * 3600)) % 24);
+	tc[1] = (unsigned char)((mtc_frames / (fps * 60)) % 60);
+	tc[2] = (unsigned char)((mtc_frames / fps) % 60);
+	tc[3] = (unsigned char)(mtc_frames % fps);
+}
+
+
+/*****************************************************************************
+ * queue_mtc_full_frame()
+ *
+ * Queues an MTC Full Frame message (F0 7F 7F 01 01 hr mn sc fr F7) for
+ * <mtc_frames> on the Tx queue of every route, so receivers locate
+ * immediately instead of waiting for eight quarter frames.  Goes through
+ * the SysEx stream when one is in flight.
+ *****************************************************************************/
+static void
+queue_mtc_full_frame(unsigned short period, unsigned short frame, gint64 mtc_frames)
+{
+	volatile MIDI_EVENT     *event;
+	unsigned char           tc[4];
+	unsigned char           queue_num;
+	unsigned char           route;
+
+	get_timecode(mtc_frames, tc);
+
+	for (route = 0; route < num_midi_routes; route++) {
+		queue_num      = J2A_ROUTE_QUEUE(route);
+		if ((event = get_new_midi_event(queue_num)) == NULL) {
+			continue;
+		}
+		if ((event->data = get_sysex_buffer(queue_num, 12)) == NULL) {
+			free_midi_event(queue_num, event);
+			continue;
+		}
+		event->type    = MIDI_EVENT_SYSEX;
+		event->data[0] = MIDI_EVENT_SYSEX;
+		event->data[1] = 0x7F;
+		event->data[2] = 0x7F;
+		event->data[3] = 0x01;
+		event->data[4] = 0x01;
+		event->data[5] = (unsigned char)((mtc_rate << 5) | tc[0]);
+		event->data[6] = tc[1];
+		event->data[7] = tc[2];
+		event->data[8] = tc[3];
+		event->data[9] = 0xF7;
+		event->bytes   = 10;
+		if (sysex_stream_pending(route)) {
+			sysex_stream_write(route, frame, (unsigned char *)(event->data), 10);
+			free_midi_event(queue_num, event);
+			continue;
+		}
+		queue_midi_event(period, queue_num, event, frame,
+		                 sync_info[period].input_index, 0);
+	}
+}
+
+
+/*****************************************************************************
+ * get_tick_frames()
+ *
+ * Returns the length of one MIDI Clock tick in frames at the current
+ * transport tempo, or at MIDI_SYNC_DEFAULT_BPM when the transport master
+ * provides no BBT information.  BBT beats are converted to quarter notes
+ * by the beat type.
+ *****************************************************************************/
+static double
+get_tick_frames(jack_position_t *pos, double frame_rate)
+{
+	double          bpm               = (double)(MIDI_SYNC_DEFAULT_BPM);
+	double          quarters_per_beat = 1.0;
+
+	if ( (pos->valid & JackPositionBBT) && (pos->beats_per_minute > 0.0) ) {
+		bpm = pos->beats_per_minute;
+		if (pos->beat_type > 0.0) {
+			quarters_per_beat = 4.0 / (double)(pos->beat_type);
+		}
+	}
+
+	return (frame_rate * 60.0) / (bpm * quarters_per_beat * (double)(MIDI_CLOCK_PPQN));
+}
+
+
+/*****************************************************************************
+ * get_song_ticks()
+ *
+ * Returns the transport position in MIDI Clock ticks, from BBT when
+ * available, or from the frame position and current tempo otherwise.
+ *****************************************************************************/
+static double
+get_song_ticks(jack_position_t *pos, double tick_frames)
+{
+	double          beats;
+
+	if ( (pos->valid & JackPositionBBT) &&
+	     (pos->ticks_per_beat > 0.0) &&
+	     (pos->beat_type > 0.0) ) {
+		beats = ((double)(pos->bar - 1) * (double)(pos->beats_per_bar)) +
+			(double)(pos->beat - 1) +
+			((double)(pos->tick) / pos->ticks_per_beat);
+		return beats * (4.0 / (double)(pos->beat_type)) * (double)(MIDI_CLOCK_PPQN);
+	}
+
+	return (double)(pos->frame) / tick_frames;
+}
+
+
+/*****************************************************************************
+ * locate_sync_tx()
+ *
+ * Sends position for a transport locate or start, and aligns the tick and
+ * quarter frame grids with the new position.  Clock resumes on the next
+ * Song Position (sixteenth note) boundary, and MTC on the next whole MTC
+ * frame.  When <start> is set, Start (at song position 0) or Continue is
+ * sent after the position.
+ *****************************************************************************/
+static void
+locate_sync_tx(unsigned short   period,
+               jack_position_t  *pos,
+               double           tick_frames,
+               gint64           frame_rate,
+               int              start)
+{
+	double          song_ticks = get_song_ticks(pos, tick_frames);
+	gint64          songpos;
+	gint64          rate_den;
+	gint64          fps_num;
+	gint64          mtc_frames;
+	gint64          whole;
+
+	/* Song Position is counted in sixteenth notes, 14 bits */
+	songpos = (gint64)(song_ticks / (double)(MIDI_CLOCK_TICKS_PER_SPP));
+	if (((double)(songpos) * (double)(MIDI_CLOCK_TICKS_PER_SPP)) < song_ticks) {
+		songpos++;
+	}
+	if (songpos > 0x3FFF) {
+		songpos = 0x3FFF;
+	}
+	sync_tx_next_tick = ((gint64)(pos->frame) << FRAME_NSEC_FRAC_BITS) +
+		(gint64)((((double)(songpos * MIDI_CLOCK_TICKS_PER_SPP)) - song_ticks) *
+		         tick_frames * (double)(FRAME_NSEC_ONE));
+
+	if (midi_sync_tx & MIDI_SYNC_TX_SONGPOS) {
+		queue_sync_event(period, 0, MIDI_EVENT_SONGPOS,
+		                 (unsigned char)(songpos & 0x7F),
+		                 (unsigned char)((songpos >> 7) & 0x7F), 3);
+	}
+	if (start && (midi_sync_tx & MIDI_SYNC_TX_CLOCK)) {
+		queue_sync_event(period, 0,
+		                 (songpos == 0) ? MIDI_EVENT_START : MIDI_EVENT_CONTINUE,
+		                 0, 0, 1);
+	}
+
+	if (midi_sync_tx & MIDI_SYNC_TX_MTC) {
+		rate_den   = frame_rate * mtc_fps_den[mtc_rate];
+		fps_num    = mtc_fps_num[mtc_rate];
+		mtc_frames = ((gint64)(pos->frame) * fps_num) / rate_den;
+		queue_mtc_full_frame(period, 0, mtc_frames);
+
+		/* quarter frames start with piece 0 on the next MTC frame */
+		sync_tx_mtc_block    = (((gint64)(pos->frame) * fps_num) + rate_den - 1) / rate_den;
+		sync_tx_qframe_piece = 0;
+		whole = (sync_tx_mtc_block * rate_den) / fps_num;
+		sync_tx_next_qframe = (whole << FRAME_NSEC_FRAC_BITS) +
+			((((sync_tx_mtc_block * rate_den) % fps_num) << FRAME_NSEC_FRAC_BITS) /
+			 fps_num);
+	}
+}
+
+
+/*****************************************************************************
+ * get_qframe_value()
+ *
+ * Returns the data byte (0nnndddd) of quarter frame <piece> for the MTC
+ * frame count of the current 2 frame block.
+ *****************************************************************************/
+static unsigned char
+get_qframe_value(unsigned char piece)
+{
+	unsigned char   tc[4];
+	unsigned char   value;
+
+	get_timecode(sync_tx_mtc_block, tc);
+
+	switch (piece) {
+	case 0:  value = tc[3] & 0x0F;                                     break;
+	case 1:  value = (tc[3] >> 4) & 0x01;                              break;
+	case 2:  value = tc[2] & 0x0F;                                     break;
+	case 3:  value = (tc[2] >> 4) & 0x03;                              break;
+	case 4:  value = tc[1] & 0x0F;                                     break;
+	case 5:  value = (tc[1] >> 4) & 0x03;                              break;
+	case 6:  value = tc[0] & 0x0F;                                     break;
+	default: value = (unsigned char)(((tc[0] >> 4) & 0x01) | (mtc_rate << 1)); break;
+	}
+
+	return (unsigned char)((piece << 4) | value);
+}
+
+
+/*****************************************************************************
+ * midi_sync_send()
+ *
+ * Called from the JACK thread once per process cycle, before JACK MIDI
+ * input is queued.  Queues MIDI Clock, Song Position, and MTC for the
+ * current JACK transport state on the Tx queue of every route.  Ticks and
+ * quarter frames are placed on the exact frames where they fall in the
+ * transport timeline, and tempo changes only affect the spacing of ticks
+ * not yet sent, so the generated clock carries no scheduling jitter.
+ *****************************************************************************/
+void
+midi_sync_send(unsigned short period, unsigned short nframes)
+{
+	jack_position_t         pos;
+	jack_transport_state_t  state;
+	double                  tick_frames;
+	gint64                  frame_rate;
+	gint64                  cycle_end;
+	gint64                  tick_len;
+	gint64                  qframe_len;
+	gint64                  frame;
+	int                     rolling;
+
+	if ((midi_sync_tx == 0) || (jack_audio_client == NULL)) {
+		return;
+	}
+
+	state   = jack_transport_query(jack_audio_client, &pos);
+	rolling = (state == JackTransportRolling);
+
+	frame_rate = (pos.frame_rate > 0) ?
+		(gint64)(pos.frame_rate) : (gint64)(sync_info[period].sample_rate);
+	tick_frames = get_tick_frames(&pos, (double)(frame_rate));
+
+	if (rolling) {
+		/* transport start, or locate while rolling */
+		if (!sync_tx_rolling) {
+			locate_sync_tx(period, &pos, tick_frames, frame_rate, 1);
+		}
+		else if (pos.frame != sync_tx_next_frame) {
+			if (midi_sync_tx & MIDI_SYNC_TX_CLOCK) {
+				queue_sync_event(period, 0, MIDI_EVENT_STOP, 0, 0, 1);
+			}
+			locate_sync_tx(period, &pos, tick_frames, frame_rate, 1);
+		}
+
+		cycle_end = ((gint64)(pos.frame) + nframes) << FRAME_NSEC_FRAC_BITS;
+
+		if (midi_sync_tx & MIDI_SYNC_TX_CLOCK) {
+			tick_len = (gint64)(tick_frames * (double)(FRAME_NSEC_ONE));
+			while (sync_tx_next_tick < cycle_end) {
+				frame = (sync_tx_next_tick >> FRAME_NSEC_FRAC_BITS) - (gint64)(pos.frame);
+				queue_sync_event(period, (unsigned short)((frame < 0) ? 0 : frame),
+				                 MIDI_EVENT_TICK, 0, 0, 1);
+				sync_tx_next_tick += tick_len;
+			}
+		}
+
+		if (midi_sync_tx & MIDI_SYNC_TX_MTC) {
+			qframe_len = ((frame_rate * mtc_fps_den[mtc_rate]) << FRAME_NSEC_FRAC_BITS) /
+				(mtc_fps_num[mtc_rate] * 4);
+			while (sync_tx_next_qframe < cycle_end) {
+				frame = (sync_tx_next_qframe >> FRAME_NSEC_FRAC_BITS) - (gint64)(pos.frame);
+				queue_sync_event(period, (unsigned short)((frame < 0) ? 0 : frame),
+				                 MIDI_EVENT_MTC_QFRAME,
+				                 get_qframe_value(sync_tx_qframe_piece), 0, 2);
+				if (++sync_tx_qframe_piece == 8) {
+					sync_tx_qframe_piece = 0;
+					sync_tx_mtc_block   += 2;
+				}
+				sync_tx_next_qframe += qframe_len;
+			}
+		}
+
+		sync_tx_next_frame = pos.frame + nframes;
+	}
+	else {
+		/* transport stop, or locate while stopped */
+		if (sync_tx_rolling) {
+			if (midi_sync_tx & MIDI_SYNC_TX_CLOCK) {
+				queue_sync_event(period, 0, MIDI_EVENT_STOP, 0, 0, 1);
+			}
+			locate_sync_tx(period, &pos, tick_frames, frame_rate, 0);
+		}
+		else if (pos.frame != sync_tx_stopped_frame) {
+			locate_sync_tx(period, &pos, tick_frames, frame_rate, 0);
+		}
+		sync_tx_stopped_frame = pos.frame;
+	}
+
+	sync_tx_rolling = rolling;
+}
+
+
+/*****************************************************************************
+ * midi_sync_regenerate()
+ *
+ * Called from the JACK thread once per process cycle, before MIDI is
+ * dequeued for JACK output.  For every route locked to incoming MIDI Clock,
+ * queues the flywheel ticks falling within <period> on the route's Rx
+ * queue.  The flywheel coasts for at most MIDI_SYNC_FLYWHEEL_TICKS (plus
+ * one period) past the last incoming tick before stopping.
+ *****************************************************************************/
+void
+midi_sync_regenerate(unsigned short period)
+{
+	MIDI_SYNC_RX            *rx;
+	volatile MIDI_EVENT     *event;
+	SYNC_SNAPSHOT           snap;
+	timensec_t              period_end;
+	timensec_t              coast_end;
+	timensec_t              frame;
+	unsigned char           queue_num;
+	unsigned char           route;
+
+	if (!midi_sync_smooth_clock) {
+		return;
+	}
+
+	get_sync_snapshot(period, &snap);
+	period_end = snap.start_time + snap.nsec_per_period;
+
+	for (route = 0; route < num_midi_routes; route++) {
+		rx = &(sync_rx[route]);
+		if (rx->state != SYNC_RX_RUNNING) {
+			continue;
+		}
+
+		coast_end = rx->last_in_time + snap.nsec_per_period +
+			(timensec_t)(rx->tick_nsecs * (timecalc_t)(MIDI_SYNC_FLYWHEEL_TICKS + 1));
+		if (snap.start_time >= coast_end) {
+			rx->state = SYNC_RX_IDLE;
+			continue;
+		}
+
+		queue_num = A2J_ROUTE_QUEUE(route);
+		while ((rx->next_tick_time < period_end) && (rx->next_tick_time < coast_end)) {
+			frame = 0;
+			if (rx->next_tick_time > snap.start_time) {
+				frame = NSECS_TO_FRAMES(snap.nsec_per_frame,
+				                        rx->next_tick_time - snap.start_time);
+				if (frame >= snap.buffer_period_size) {
+					frame = snap.buffer_period_size - 1;
+				}
+			}
+			if ((event = get_new_midi_event(queue_num)) != NULL) {
+				event->type    = MIDI_EVENT_TICK;
+				event->channel = MIDI_SYNC_REGEN_CHANNEL;
+				event->bytes   = 1;
+				queue_midi_event(period, queue_num, event, (unsigned short) frame,
+				                 snap.output_index, 0);
+			}
+
+			rx->out_count++;
+			rx->tick_time[rx->out_count & MIDI_SYNC_TICK_HISTORY_MASK] =
+				rx->next_tick_time;
+			rx->next_tick_time += (timensec_t)(rx->tick_nsecs);
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * midi_sync_receive()
+ *
+ * Called from the JACK thread for each event dequeued from a route's Rx
+ * queue.  With --smooth-clock, incoming ticks steer the route's clock
+ * flywheel and are replaced by its output.  Returns 1 if the event has
+ * been replaced and must not be passed on to JACK, or 0 otherwise.
+ *
+ * The first two ticks after a Start, Continue, Stop, or loss of lock are
+ * passed through while the tick length is measured.  After that, each
+ * incoming tick is compared with the flywheel tick of the same count:
+ *
+ *     omega      = 2 * pi * B * T
+ *     next_tick += sqrt(2) * omega * error
+ *     T         += omega^2 * error
+ *****************************************************************************/
+int
+midi_sync_receive(unsigned short        period,
+                  unsigned char         route,
+                  unsigned short        cycle_frame,
+                  volatile MIDI_EVENT   *event)
+{
+	MIDI_SYNC_RX    *rx = &(sync_rx[route]);
+	timensec_t      tick_time;
+	timensec_t      expected;
+	timensec_t      error;
+	timensec_t      step;
+	timensec_t      max_step;
+	timecalc_t      omega;
+	guint32         n;
+
+	if (!midi_sync_smooth_clock) {
+		return 0;
+	}
+
+	switch (event->type) {
+	case MIDI_EVENT_START:
+	case MIDI_EVENT_CONTINUE:
+	case MIDI_EVENT_STOP:
+		rx->state = SYNC_RX_IDLE;
+		return 0;
+	case MIDI_EVENT_TICK:
+		if (event->channel == MIDI_SYNC_REGEN_CHANNEL) {
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	tick_time = get_frame_time(period, cycle_frame);
+
+	switch (rx->state) {
+	case SYNC_RX_IDLE:
+		rx->in_count     = 1;
+		rx->out_count    = 1;
+		rx->last_in_time = tick_time;
+		rx->state        = SYNC_RX_LOCKING;
+		return 0;
+	case SYNC_RX_LOCKING:
+		if (tick_time <= rx->last_in_time) {
+			return 0;
+		}
+		rx->tick_nsecs     = (timecalc_t)(tick_time - rx->last_in_time);
+		rx->in_count++;
+		rx->out_count      = rx->in_count;
+		rx->tick_time[rx->out_count & MIDI_SYNC_TICK_HISTORY_MASK] = tick_time;
+		rx->next_tick_time = tick_time + (timensec_t)(rx->tick_nsecs);
+		rx->last_in_time   = tick_time;
+		rx->state          = SYNC_RX_RUNNING;
+		JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
+		                DEBUG_COLOR_PINK "<clock %d locked:  %ld ns/tick> "
+		                DEBUG_COLOR_DEFAULT,
+		                route, (long int)(rx->tick_nsecs));
+		return 0;
+	}
+
+	/* find the flywheel tick matching this incoming tick */
+	n = ++(rx->in_count);
+	if (n <= rx->out_count) {
+		if ((rx->out_count - n) >= MIDI_SYNC_TICK_HISTORY) {
+			expected = tick_time + (timensec_t)(rx->tick_nsecs);
+		}
+		else {
+			expected = rx->tick_time[n & MIDI_SYNC_TICK_HISTORY_MASK];
+		}
+	}
+	else {
+		expected = rx->next_tick_time +
+			(timensec_t)(rx->tick_nsecs * (timecalc_t)(n - rx->out_count - 1));
+	}
+	error = tick_time - expected;
+
+	/* more than half a tick off:  relock, without repeating a tick the
+	   flywheel has already sent */
+	if ((error > (timensec_t)(rx->tick_nsecs * 0.5)) ||
+	    (-error > (timensec_t)(rx->tick_nsecs * 0.5))) {
+		JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
+		                DEBUG_COLOR_RED "<clock %d relock:  %+ld ns> "
+		                DEBUG_COLOR_DEFAULT,
+		                route, (long int)(error));
+		rx->state        = SYNC_RX_LOCKING;
+		rx->last_in_time = tick_time;
+		if (n <= rx->out_count) {
+			rx->in_count = rx->out_count;
+			return 1;
+		}
+		rx->out_count = n;
+		return 0;
+	}
+
+	omega = (timecalc_t)(6.283185307179586) * (timecalc_t)(MIDI_SYNC_DLL_BANDWIDTH) *
+		rx->tick_nsecs / (timecalc_t)(1000000000.0);
+	if (omega > (timecalc_t)(CLOCK_DLL_MAX_OMEGA)) {
+		omega = (timecalc_t)(CLOCK_DLL_MAX_OMEGA);
+	}
+
+	/* first order term:  phase, limited to keep tick spacing smooth */
+	step = (timensec_t)((timecalc_t)(1.4142135623730951) * omega * (timecalc_t)(error));
+	max_step = (timensec_t)(rx->tick_nsecs) >> 4;
+	if (step > max_step) {
+		step = max_step;
+	}
+	else if (step < -max_step) {
+		step = -max_step;
+	}
+	rx->next_tick_time += step;
+
+	/* second order term:  tick length */
+	rx->tick_nsecs  += omega * omega * (timecalc_t)(error);
+	rx->last_in_time = tick_time;
+
+	return 1;
+}
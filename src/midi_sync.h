@@ -0,0 +1,76 @@
+/*****************************************************************************
+ *
+ * midi_sync.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_MIDI_SYNC_H_
+#define _JAMROUTER_MIDI_SYNC_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "mididefs.h"
+
+
+/* MIDI sync messages generated from JACK transport (--clock-out) */
+#define MIDI_SYNC_TX_CLOCK          0x01    /* Tick, Start, Continue, Stop */
+#define MIDI_SYNC_TX_SONGPOS        0x02    /* Song Position Pointer */
+#define MIDI_SYNC_TX_MTC            0x04    /* MTC Quarter Frame + Full Frame */
+
+/* MTC rate codes, as sent in the hours byte */
+#define MTC_RATE_24                 0
+#define MTC_RATE_25                 1
+#define MTC_RATE_30_DROP            2
+#define MTC_RATE_30                 3
+
+/* 24 MIDI Clock ticks per quarter note, 6 per Song Position step */
+#define MIDI_CLOCK_PPQN             24
+#define MIDI_CLOCK_TICKS_PER_SPP    6
+
+/* Ticks regenerated by the clock flywheel are queued with this channel
+   (system messages otherwise carry 0-15, or 0xFF for realtime messages
+   interleaved in the Rx stream), so they are not mistaken for incoming
+   ticks when dequeued. */
+#define MIDI_SYNC_REGEN_CHANNEL     0x10
+
+/* Emitted tick times kept per route for matching incoming ticks.  Must be
+   a power of 2. */
+#define MIDI_SYNC_TICK_HISTORY      8
+#define MIDI_SYNC_TICK_HISTORY_MASK (MIDI_SYNC_TICK_HISTORY - 1)
+
+
+extern int                  midi_sync_tx;
+extern int                  mtc_rate;
+extern int                  midi_sync_smooth_clock;
+
+
+int  set_midi_sync_tx(char *types);
+void init_midi_sync(void);
+int  midi_sync_tx_filter(unsigned char type);
+void midi_sync_send(unsigned short period,
+                    unsigned short nframes);
+void midi_sync_regenerate(unsigned short period);
+int  midi_sync_receive(unsigned short period,
+                       unsigned char route,
+                       unsigned short cycle_frame,
+                       volatile MIDI_EVENT *event);
+
+
+#endif /* _JAMROUTER_MIDI_SYNC_H_ */
@@ -25,14 +25,57 @@
 
 #include <glib.h>
 #include "jamrouter.h"
+#include "timeutil.h"
 
 
 /* event pool size must be a power of 2 */
 #define MIDI_EVENT_POOL_SIZE        2048
 #define MIDI_EVENT_POOL_MASK        (MIDI_EVENT_POOL_SIZE - 1)
 
+/* maximum size of a single SysEx buffer */
 #define SYSEX_BUFFER_SIZE           1024
 
+/* SysEx messages of any length are passed along as a stream of fragments
+   of at most this many bytes.  The first fragment starts with 0xF0, and
+   only the last ends with 0xF7. */
+#define SYSEX_FRAGMENT_SIZE         256
+
+/* per-route JACK --> MIDI SysEx stream ring size must be a power of 2.
+   Bytes handed to the Tx queue are never overwritten until the Tx side has
+   freed the event holding them. */
+#define SYSEX_STREAM_SIZE           524288
+#define SYSEX_STREAM_MASK           (SYSEX_STREAM_SIZE - 1)
+
+/* per-route JACK --> MIDI timer wheel, for events due beyond the queue
+   horizon.  Ticks are 2^TIMER_WHEEL_TICK_SHIFT frames.  The first level has
+   2^TIMER_WHEEL_L0_BITS slots of one tick, and each level above it has
+   2^TIMER_WHEEL_LN_BITS slots, each spanning a full turn of the level below,
+   for a range of 2^31 frames (over 12 hours at 48kHz).  Later events are
+   held at the end of the range and cascaded until due.  At most
+   TIMER_WHEEL_EVENTS (< 65535) events are held per route. */
+#define TIMER_WHEEL_EVENTS          4096
+#define TIMER_WHEEL_TICK_SHIFT      5
+#define TIMER_WHEEL_LEVELS          4
+#define TIMER_WHEEL_L0_BITS         8
+#define TIMER_WHEEL_L0_SLOTS        (1 << TIMER_WHEEL_L0_BITS)
+#define TIMER_WHEEL_L0_MASK         (TIMER_WHEEL_L0_SLOTS - 1)
+#define TIMER_WHEEL_LN_BITS         6
+#define TIMER_WHEEL_LN_SLOTS        (1 << TIMER_WHEEL_LN_BITS)
+#define TIMER_WHEEL_LN_MASK         (TIMER_WHEEL_LN_SLOTS - 1)
+#define TIMER_WHEEL_TICKS           (1ULL << (TIMER_WHEEL_L0_BITS + \
+                                              ((TIMER_WHEEL_LEVELS - 1) * \
+                                               TIMER_WHEEL_LN_BITS)))
+
+/* per-queue SysEx arena size must be a power of 2.  The arena is handed
+   out in blocks of 2^SYSEX_ARENA_BLOCK_SHIFT bytes, each owned by one
+   payload from allocation until its event is freed. */
+#define SYSEX_ARENA_SIZE            65536
+#define SYSEX_ARENA_MASK            (SYSEX_ARENA_SIZE - 1)
+#define SYSEX_ARENA_BLOCK_SHIFT     6
+#define SYSEX_ARENA_BLOCK_SIZE      (1 << SYSEX_ARENA_BLOCK_SHIFT)
+#define SYSEX_ARENA_BLOCKS          (SYSEX_ARENA_SIZE >> SYSEX_ARENA_BLOCK_SHIFT)
+#define SYSEX_ARENA_BLOCK_MASK      (SYSEX_ARENA_BLOCKS - 1)
+
 
 /* MIDI event types */
 
@@ -103,6 +146,9 @@
 
 
 /* JAMROUTER MIDI event structure */
+/* Events are kept small enough to share cache lines.  SysEx payloads live
+   out-of-line in the per-queue SysEx arena (see get_sysex_buffer()), with
+   data pointing into the arena and bytes holding the payload length. */
 typedef struct midi_event {
 	union {
 		gint                state;
@@ -129,12 +175,16 @@ typedef struct midi_event {
 	} __attribute__((__transparent_union__));
 	sample_t            float_value;
 	unsigned int        bytes;
-	unsigned char       data[SYSEX_BUFFER_SIZE];
+	timensec_t          ingress_time;       /* Rx time, or 0 if generated */
+	volatile unsigned char       *data;
 	volatile struct midi_event   *next;
 } MIDI_EVENT;
 
 
 /* JAMROUTER MIDI queue structure */
+/* One list of events per frame slot, pushed newest first in constant time
+   by any number of writers, and taken whole by the reader (see
+   take_queued_events()). */
 typedef struct event_queue {
 	volatile MIDI_EVENT   *head;
 } EVENT_QUEUE;
@@ -0,0 +1,289 @@
+/*****************************************************************************
+ *
+ * param_limit.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "midi_event.h"
+#include "param_limit.h"
+#include "sysex_stream.h"
+#include "timer_wheel.h"
+#include "debug.h"
+
+
+/* max updates per second per channel / parameter on MIDI Tx (0 = off) */
+int                     param_rate_limit = 0;
+
+/* one cache per route in use, allocated by init_param_limit() */
+static PARAM_LIMIT      *param_limit = NULL;
+
+
+/*****************************************************************************
+ * init_param_limit()
+ *
+ * Called once at startup, after the number of routes is known.
+ *****************************************************************************/
+void
+init_param_limit(void)
+{
+	PARAM_STATE     *state;
+	unsigned char   route;
+	unsigned short  j;
+
+	if ((param_limit = malloc(sizeof(PARAM_LIMIT) *
+	                          (size_t)(num_midi_routes))) == NULL) {
+		jamrouter_shutdown("Out of memory!\n");
+	}
+
+	for (route = 0; route < num_midi_routes; route++) {
+		for (j = 0; j < PARAM_LIMIT_KEYS; j++) {
+			state                = &(param_limit[route].param[j]);
+			state->sent_time     = 0;
+			state->sent_value    = -1;
+			state->pending_value = -1;
+			state->pending       = 0;
+			state->listed        = 0;
+		}
+		param_limit[route].num_pending = 0;
+	}
+}
+
+
+/*****************************************************************************
+ * get_param_index()
+ *
+ * Returns the dense cache index for an event's thinning key, or -1 for
+ * events not limited.
+ *****************************************************************************/
+static int
+get_param_index(volatile MIDI_EVENT *event)
+{
+	int             key = get_event_thin_key(event);
+
+	if (key < 0) {
+		return -1;
+	}
+	return ((key >> 9) * PARAM_LIMIT_PARAMS) + (key & 0x1FF);
+}
+
+
+/*****************************************************************************
+ * get_param_value()
+ *****************************************************************************/
+static short
+get_param_value(volatile MIDI_EVENT *event)
+{
+	switch (event->type) {
+	case MIDI_EVENT_PITCHBEND:
+		return (short)((event->lsb & 0x7F) | ((event->msb & 0x7F) << 7));
+	case MIDI_EVENT_POLYPRESSURE:
+		return (short)(event->byte2 & 0x7F);
+	}
+	return (short)(event->byte3 & 0x7F);
+}
+
+
+/*****************************************************************************
+ * set_param_event()
+ *
+ * Fills in <event> for parameter <index> set to <value>.
+ *****************************************************************************/
+static void
+set_param_event(volatile MIDI_EVENT *event, int index, short value)
+{
+	int             param = index % PARAM_LIMIT_PARAMS;
+
+	event->channel = (unsigned char)(index / PARAM_LIMIT_PARAMS);
+	event->bytes   = 3;
+	if (param < 0x80) {
+		event->type       = MIDI_EVENT_CONTROLLER;
+		event->controller = (unsigned char) param;
+		event->value      = (unsigned char) value;
+	}
+	else if (param < PARAM_PITCHBEND) {
+		event->type       = MIDI_EVENT_AFTERTOUCH;
+		event->note       = (unsigned char)(param & 0x7F);
+		event->aftertouch = (unsigned char) value;
+	}
+	else if (param == PARAM_PITCHBEND) {
+		event->type       = MIDI_EVENT_PITCHBEND;
+		event->lsb        = (unsigned char)(value & 0x7F);
+		event->msb        = (unsigned char)((value >> 7) & 0x7F);
+	}
+	else {
+		event->type       = MIDI_EVENT_POLYPRESSURE;
+		event->byte2      = (unsigned char) value;
+		event->byte3      = 0;
+		event->bytes      = 2;
+	}
+}
+
+
+/*****************************************************************************
+ * param_limit_filter()
+ *
+ * Called by the JACK thread for each event from JACK on its way to MIDI Tx
+ * on <route>.  Continuous controller, aftertouch, channel pressure, and
+ * pitchbend updates repeating the value last sent are dropped (but re-sent
+ * after PARAM_LIMIT_REFRESH_MSEC, in case the receiver has been reset), and
+ * updates for a parameter arriving faster than --param-rate are held back,
+ * with only the newest kept.  param_limit_flush() sends held values once
+ * their time has come, so the final value always goes out.  Returns
+ * nonzero when the event is not to be queued.
+ *****************************************************************************/
+int
+param_limit_filter(unsigned short       period,
+                   unsigned char        route,
+                   unsigned short       frame,
+                   volatile MIDI_EVENT  *event)
+{
+	PARAM_LIMIT     *limit = &(param_limit[route]);
+	PARAM_STATE     *state;
+	timensec_t      now;
+	gint64          elapsed;
+	short           value;
+	int             index;
+
+	if ((param_rate_limit <= 0) || ((index = get_param_index(event)) < 0)) {
+		return 0;
+	}
+	state = &(limit->param[index]);
+	value = get_param_value(event);
+
+	/* the newest value replaces any value already waiting, and cancels
+	   it when back to the value last sent */
+	if (state->pending) {
+		if (value == state->sent_value) {
+			state->pending = 0;
+		}
+		else {
+			state->pending_value = value;
+		}
+		return 1;
+	}
+
+	now     = get_frame_time(period, frame);
+	elapsed = (gint64)(now - state->sent_time);
+
+	if ( (value == state->sent_value) &&
+	     (elapsed < (gint64) PARAM_LIMIT_REFRESH_MSEC * 1000000) ) {
+		return 1;
+	}
+
+	if ( (state->sent_value >= 0) &&
+	     (elapsed < (gint64)(NSECS_PER_SEC / param_rate_limit)) ) {
+		state->pending       = 1;
+		state->pending_value = value;
+		if (!state->listed) {
+			state->listed = 1;
+			limit->pending_list[limit->num_pending++] = (unsigned short) index;
+		}
+		return 1;
+	}
+
+	state->sent_value = value;
+	state->sent_time  = now;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * param_limit_flush()
+ *
+ * Called by the JACK thread once per process cycle, after JACK MIDI input
+ * for <route> has been handled.  Queues each value held back by the rate
+ * limit that falls due in this period, at the frame it falls due, passing
+ * it through the channel delay like any event from JACK.
+ *****************************************************************************/
+void
+param_limit_flush(unsigned short period, unsigned char route)
+{
+	PARAM_LIMIT             *limit     = &(param_limit[route]);
+	PARAM_STATE             *state;
+	SYNC_SNAPSHOT           snap;
+	volatile MIDI_EVENT     *event;
+	timensec_t              end_time;
+	timensec_t              due;
+	timensec_t              frame;
+	unsigned char           queue_num  = J2A_ROUTE_QUEUE(route);
+	unsigned short          index;
+	unsigned short          j;
+	unsigned short          k          = 0;
+
+	if ((param_rate_limit <= 0) || (limit->num_pending == 0)) {
+		return;
+	}
+
+	get_sync_snapshot(period, &snap);
+	end_time = snap.start_time +
+		FRAMES_TO_NSECS(snap.nsec_per_frame, snap.buffer_period_size);
+
+	for (j = 0; j < limit->num_pending; j++) {
+		index = limit->pending_list[j];
+		state = &(limit->param[index]);
+
+		if (!state->pending) {
+			state->listed = 0;
+			continue;
+		}
+		due = state->sent_time + (timensec_t)(NSECS_PER_SEC / param_rate_limit);
+		if ( (due >= end_time) ||
+		     ((event = get_new_midi_event(queue_num)) == NULL) ) {
+			limit->pending_list[k++] = index;
+			continue;
+		}
+
+		frame = 0;
+		if (due > snap.start_time) {
+			frame = NSECS_TO_FRAMES(snap.nsec_per_frame, due - snap.start_time);
+			if (frame >= snap.buffer_period_size) {
+				frame = snap.buffer_period_size - 1;
+			}
+		}
+		set_param_event(event, index, state->pending_value);
+
+		/* hold back like any other event for a channel with a delay set */
+		if (channel_delay_event(period, route, (unsigned short) frame, event)) {
+			free_midi_event(queue_num, event);
+		}
+		/* keep behind any SysEx stream in flight */
+		else if (sysex_stream_pending(route)) {
+			sysex_stream_write_event(route, (unsigned short) frame, event);
+		}
+		else {
+			queue_midi_event(period, queue_num, event, (unsigned short) frame,
+			                 snap.input_index, 0);
+		}
+
+		state->sent_value = state->pending_value;
+		state->sent_time  = (due > snap.start_time) ? due : snap.start_time;
+		state->pending    = 0;
+		state->listed     = 0;
+	}
+	limit->num_pending = k;
+}
@@ -0,0 +1,72 @@
+/*****************************************************************************
+ *
+ * param_limit.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_PARAM_LIMIT_H_
+#define _JAMROUTER_PARAM_LIMIT_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "mididefs.h"
+
+
+/* Parameters per channel:  controllers 0-127, aftertouch 128-255,
+   pitchbend 256, and channel pressure 257 (the same layout as the low 9
+   bits of get_event_thin_key()). */
+#define PARAM_LIMIT_PARAMS          258
+#define PARAM_LIMIT_KEYS            (16 * PARAM_LIMIT_PARAMS)
+
+#define PARAM_PITCHBEND             0x100
+#define PARAM_CHANNEL_PRESSURE      0x101
+
+
+/* Last value sent on MIDI Tx for one channel / parameter, and the newest
+   value held back by the rate limit, if any. */
+typedef struct param_state {
+	timensec_t          sent_time;
+	short               sent_value;         /* -1 until first sent */
+	short               pending_value;
+	unsigned char       pending;            /* pending_value is waiting */
+	unsigned char       listed;             /* on the route's pending list */
+} PARAM_STATE;
+
+/* JACK --> MIDI parameter cache for one route.  Owned by the JACK thread. */
+typedef struct param_limit {
+	PARAM_STATE         param[PARAM_LIMIT_KEYS];
+	unsigned short      pending_list[PARAM_LIMIT_KEYS];
+	unsigned short      num_pending;
+} PARAM_LIMIT;
+
+
+extern int                  param_rate_limit;
+
+
+void init_param_limit(void);
+int  param_limit_filter(unsigned short period,
+                        unsigned char route,
+                        unsigned short frame,
+                        volatile MIDI_EVENT *event);
+void param_limit_flush(unsigned short period,
+                       unsigned char route);
+
+
+#endif /* _JAMROUTER_PARAM_LIMIT_H_ */
@@ -33,19 +33,23 @@
 #include "mididefs.h"
 #include "midi_event.h"
 #include "driver.h"
+#include "stats.h"
 #include "debug.h"
 
 #ifndef WITHOUT_JUNO
 #include "juno.h"
 #endif
 
+#ifdef ENABLE_SIM
+#include "sim.h"
+#endif
+
 
-RAWMIDI_INFO            *rawmidi_info;
+/* one device pair per route */
+RAWMIDI_INFO            *rawmidi_info[MAX_MIDI_ROUTES];
 
 int                     rawmidi_sleep_time       = 20000;
 
-unsigned char           midi_realtime_type[32];
-int                     realtime_event_count     = 0;
 
 #ifdef ENABLE_RAWMIDI_ALSA_RAW
 ALSA_RAWMIDI_HW_INFO    *alsa_rawmidi_rx_hw      = NULL;
@@ -53,7 +57,6 @@ ALSA_RAWMIDI_HW_INFO    *alsa_rawmidi_tx_hw      = NULL;
 
 int                     alsa_rawmidi_hw_changed  = 0;
 
-unsigned char           tx_buf[SYSEX_BUFFER_SIZE];
 
 
 /******************************************************************************
@@ -255,6 +258,10 @@ rawmidi_open(char *rx_device, char *tx_device, int driver)
 #endif
 	rawmidi->rx_device = NULL;
 	rawmidi->tx_device = NULL;
+#if defined(ENABLE_RAWMIDI_OSS) || (defined(ENABLE_RAWMIDI_ALSA_RAW) && defined(RAWMIDI_ALSA_MULTI_BYTE_IO))
+	rawmidi->read_index     = 0;
+	rawmidi->read_available = 0;
+#endif
 
 	/* use default device appropriate for driver type if none given */
 	if ( (rx_device == NULL) || (rx_device[0] == '\0') ||
@@ -285,6 +292,11 @@ rawmidi_open(char *rx_device, char *tx_device, int driver)
 		case MIDI_DRIVER_RAW_GENERIC:
 			rawmidi->rx_device = strdup(RAWMIDI_RAW_DEVICE);
 			break;
+#endif
+#ifdef ENABLE_SIM
+		case MIDI_DRIVER_RAW_SIM:
+			rawmidi->rx_device = strdup("sim");
+			break;
 #endif
 		}
 	}
@@ -333,6 +345,11 @@ rawmidi_open(char *rx_device, char *tx_device, int driver)
 		case MIDI_DRIVER_RAW_GENERIC:
 			rawmidi->tx_device = strdup(RAWMIDI_RAW_DEVICE);
 			break;
+#endif
+#ifdef ENABLE_SIM
+		case MIDI_DRIVER_RAW_SIM:
+			rawmidi->tx_device = strdup("sim");
+			break;
 #endif
 		}
 	}
@@ -763,9 +780,6 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 #endif /* ENABLE_RAWMIDI_OSS || ENABLE_RAWMIDI_OSS2 */
 	int                     bytes_read      = 0;
 #if defined(ENABLE_RAWMIDI_OSS) || (defined(ENABLE_RAWMIDI_ALSA_RAW) && defined(RAWMIDI_ALSA_MULTI_BYTE_IO))
-	static unsigned char    read_buf[256];
-	static int              buf_index       = 0;
-	static ssize_t          buf_available   = 0;
 	int                     output_index    = 0;
 #endif /* ENABLE_RAWMIDI_ALSA_RAW && RAWMIDI_ALSA_MULTI_BYTE_IO */
 
@@ -775,24 +789,24 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 #if defined(ENABLE_RAWMIDI_OSS) || defined(ENABLE_RAWMIDI_OSS2)
 	case MIDI_DRIVER_RAW_OSS:
 	case MIDI_DRIVER_RAW_OSS2:
-		if (buf_available > 0) {
-			while ((buf_index < buf_available) && (output_index < len)) {
+		if (rawmidi->read_available > 0) {
+			while ((rawmidi->read_index < rawmidi->read_available) && (output_index < len)) {
 				JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
 				                DEBUG_COLOR_CYAN "%02X "
 				                DEBUG_COLOR_DEFAULT,
-				                read_buf[buf_index]);
-				buf[output_index++] = read_buf[buf_index++];
+				                rawmidi->read_buf[rawmidi->read_index]);
+				buf[output_index++] = rawmidi->read_buf[rawmidi->read_index++];
 				if (output_index == len) {
 					return len;
 				}
 			}
 		}
-		buf_available = 0;
-		buf_index = 0;
+		rawmidi->read_available = 0;
+		rawmidi->read_index = 0;
 		/* strip raw midi message out of larger OSS message */
-		while (!midi_rx_stopped && !pending_shutdown && (buf_available < len)) {
+		while (!midi_rx_stopped && !pending_shutdown && (rawmidi->read_available < len)) {
 # ifdef RAWMIDI_OSS_USE_POLL
-			if (poll(rawmidi_info->pfds, (nfds_t) rawmidi_info->npfds, 1) > 0)
+			if (poll(rawmidi->pfds, (nfds_t) rawmidi->npfds, 1) > 0)
 # endif /* RAWMIDI_OSS_USE_POLL */
 			{
 				/* read one event quad at a time */
@@ -813,24 +827,24 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 							switch (ibuf[2]) {
 							case 0xC0:
 							case 0xD0:
-								read_buf[bytes_read++] = ibuf[2];
-								read_buf[bytes_read++] = ibuf[6];
+								rawmidi->read_buf[bytes_read++] = ibuf[2];
+								rawmidi->read_buf[bytes_read++] = ibuf[6];
 								break;
 							default:
-								read_buf[bytes_read++] = ibuf[2];
-								read_buf[bytes_read++] = ibuf[4];
-								read_buf[bytes_read++] = ibuf[6];
+								rawmidi->read_buf[bytes_read++] = ibuf[2];
+								rawmidi->read_buf[bytes_read++] = ibuf[4];
+								rawmidi->read_buf[bytes_read++] = ibuf[6];
 								break;
 							}
 							break;
 						case 0x93:
-							read_buf[bytes_read++] = ibuf[2];
-							read_buf[bytes_read++] = ibuf[4];
-							read_buf[bytes_read++] = ibuf[5];
+							rawmidi->read_buf[bytes_read++] = ibuf[2];
+							rawmidi->read_buf[bytes_read++] = ibuf[4];
+							rawmidi->read_buf[bytes_read++] = ibuf[5];
 							break;
 						case 0x94:
 							for (bytes = 2; bytes < 8; bytes++) {
-								read_buf[bytes_read++] = ibuf[bytes];
+								rawmidi->read_buf[bytes_read++] = ibuf[bytes];
 								if (ibuf[bytes] == 0xF7) {
 									break;
 								}
@@ -843,20 +857,20 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 					          //&& (ibuf[1] == rawmidi->oss_rx_device)
 					          ) {
 						/* only take the second of every four bytes */
-						read_buf[bytes_read++] = ibuf[1];
+						rawmidi->read_buf[bytes_read++] = ibuf[1];
 					}
 					else {
 						continue;
 					}
 
-					buf_index = 0;
-					buf_available = bytes_read;
-					while ((buf_index < bytes_read) && (output_index < len)) {
+					rawmidi->read_index = 0;
+					rawmidi->read_available = bytes_read;
+					while ((rawmidi->read_index < bytes_read) && (output_index < len)) {
 						JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
 						                DEBUG_COLOR_CYAN "%02X "
 						                DEBUG_COLOR_DEFAULT,
-						                read_buf[buf_index]);
-						buf[output_index++] = read_buf[buf_index++];
+						                rawmidi->read_buf[rawmidi->read_index]);
+						buf[output_index++] = rawmidi->read_buf[rawmidi->read_index++];
 					}
 					bytes_read = output_index;
 				}
@@ -878,33 +892,33 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 #ifdef ENABLE_RAWMIDI_ALSA_RAW
 	case MIDI_DRIVER_RAW_ALSA:
 # ifdef RAWMIDI_ALSA_MULTI_BYTE_IO
-		if (buf_available > 0) {
-			while ((buf_index < buf_available) && (output_index < len)) {
+		if (rawmidi->read_available > 0) {
+			while ((rawmidi->read_index < rawmidi->read_available) && (output_index < len)) {
 				JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
 				                DEBUG_COLOR_CYAN "%02X "
 				                DEBUG_COLOR_DEFAULT,
-				                read_buf[buf_index]);
-				buf[output_index++] = read_buf[buf_index++];
+				                rawmidi->read_buf[rawmidi->read_index]);
+				buf[output_index++] = rawmidi->read_buf[rawmidi->read_index++];
 			}
 		}
 		if (!midi_rx_stopped && !pending_shutdown && (output_index < len)) {
 #  if defined(RAWMIDI_ALSA_NONBLOCK) || defined(RAWMIDI_USE_POLL)
-			if (poll(rawmidi_info->pfds, (nfds_t) rawmidi_info->npfds, 1) > 0)
+			if (poll(rawmidi->pfds, (nfds_t) rawmidi->npfds, 1) > 0)
 #  endif
 			{
-				if ((buf_available = snd_rawmidi_read(rawmidi->rx_handle,
-				                                      read_buf, 256)) < 1) {
+				if ((rawmidi->read_available = snd_rawmidi_read(rawmidi->rx_handle,
+				                                      rawmidi->read_buf, 256)) < 1) {
 					JAMROUTER_ERROR("Unable to read from ALSA Raw MIDI "
 					                "device '%s'!\n",
 					                rawmidi->rx_device);
 				}
-				buf_index = 0;
-				while ((buf_index < buf_available) && (output_index < len)) {
+				rawmidi->read_index = 0;
+				while ((rawmidi->read_index < rawmidi->read_available) && (output_index < len)) {
 					JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
 					                DEBUG_COLOR_CYAN "%02X "
 					                DEBUG_COLOR_DEFAULT,
-					                read_buf[buf_index]);
-					buf[output_index++] = read_buf[buf_index++];
+					                rawmidi->read_buf[rawmidi->read_index]);
+					buf[output_index++] = rawmidi->read_buf[rawmidi->read_index++];
 				}
 			}
 		}
@@ -915,8 +929,8 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 		while (!midi_rx_stopped && !pending_shutdown &&
 		       (bytes_read < len)) {
 #  if defined(RAWMIDI_ALSA_NONBLOCK) || defined(RAWMIDI_USE_POLL)
-			if (poll(rawmidi_info->pfds,
-			         (nfds_t) rawmidi_info->npfds, 1) > 0)
+			if (poll(rawmidi->pfds,
+			         (nfds_t) rawmidi->npfds, 1) > 0)
 #  endif
 			{
 				if (snd_rawmidi_read(rawmidi->rx_handle,
@@ -948,8 +962,8 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 		       (bytes_read < len)) {
 # ifdef RAWMIDI_GENERIC_NONBLOCK
 #  ifdef RAWMIDI_USE_POLL
-			if (poll(rawmidi_info->pfds, (nfds_t)
-			         rawmidi_info->npfds, 1) > 0)
+			if (poll(rawmidi->pfds, (nfds_t)
+			         rawmidi->npfds, 1) > 0)
 #  endif /* RAWMIDI_USE_POLL */
 			{
 				if (read(rawmidi->rx_fd, &buf[bytes_read], 1) == 1) {
@@ -966,8 +980,8 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 # else /* !RAWMIDI_GENERIC_NONBLOCK */
 			if (!midi_rx_stopped && !pending_shutdown
 #  ifdef RAWMIDI_USE_POLL
-			    && (poll(rawmidi_info->pfds,
-			             (nfds_t)rawmidi_info->npfds, 0) > 0)
+			    && (poll(rawmidi->pfds,
+			             (nfds_t)rawmidi->npfds, 0) > 0)
 #  endif /* RAWMIDI_USE_POLL */
 			    ) {
 				if (read(rawmidi->rx_fd, &buf[bytes_read], 1) == 1) {
@@ -1001,19 +1015,229 @@ rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
 }
 
 
+/******************************************************************************
+ * rawmidi_read_available()
+ *  RAWMIDI_INFO    *rawmidi
+ *  char            *buf
+ *  int             len
+ *
+ * Waits briefly for input, then drains up to <len> bytes already waiting on
+ * the rawmidi input device with a single read, instead of one read (and one
+ * poll()) per byte.  Return value is the number of raw midi bytes read, zero
+ * if no input was ready, or -1 on error.
+ ******************************************************************************/
+int
+rawmidi_read_available(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len)
+{
+	ssize_t                 bytes_read      = 0;
+	ssize_t                 j;
+
+	switch (midi_driver) {
+
+#ifdef ENABLE_RAWMIDI_ALSA_RAW
+	case MIDI_DRIVER_RAW_ALSA:
+# if defined(RAWMIDI_ALSA_NONBLOCK) || defined(RAWMIDI_USE_POLL)
+		if (poll(rawmidi->pfds, (nfds_t) rawmidi->npfds, 1) <= 0) {
+			return 0;
+		}
+# endif
+		bytes_read = snd_rawmidi_read(rawmidi->rx_handle, buf, (size_t)(len));
+		if (bytes_read == -EAGAIN) {
+			return 0;
+		}
+		if (bytes_read < 0) {
+			JAMROUTER_ERROR("Unable to read from ALSA Raw MIDI "
+			                "device '%s' -- %s!\n",
+			                rawmidi->rx_device, snd_strerror((int)(bytes_read)));
+			return -1;
+		}
+		break;
+#endif /* ENABLE_RAWMIDI_ALSA_RAW */
+
+#ifdef ENABLE_RAWMIDI_GENERIC
+	case MIDI_DRIVER_RAW_GENERIC:
+# ifdef RAWMIDI_USE_POLL
+		if (poll(rawmidi->pfds, (nfds_t) rawmidi->npfds, 1) <= 0) {
+			return 0;
+		}
+# endif /* RAWMIDI_USE_POLL */
+		if ((bytes_read = read(rawmidi->rx_fd, buf, (size_t)(len))) < 0) {
+			if ((errno == EAGAIN) || (errno == EINTR)) {
+# ifndef RAWMIDI_USE_POLL
+				jamrouter_nanosleep(rawmidi_sleep_time);
+# endif /* !RAWMIDI_USE_POLL */
+				return 0;
+			}
+			JAMROUTER_ERROR("Unable to read from Raw MIDI "
+			                "device '%s' -- %s!\n",
+			                rawmidi->rx_device, strerror(errno));
+			return -1;
+		}
+		break;
+#endif /* ENABLE_RAWMIDI_GENERIC */
+
+		/* the scripted device sleeps on the virtual clock, like poll(). */
+#ifdef ENABLE_SIM
+	case MIDI_DRIVER_RAW_SIM:
+		bytes_read = sim_midi_read(buf, len);
+		break;
+#endif /* ENABLE_SIM */
+
+		/* OSS delivers event quads, which rawmidi_read() already buffers. */
+	default:
+		return rawmidi_read(rawmidi, buf, 1);
+	}
+
+	if (debug_class & DEBUG_CLASS_STREAM) {
+		for (j = 0; j < bytes_read; j++) {
+			JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+			                DEBUG_COLOR_CYAN "%02X " DEBUG_COLOR_DEFAULT,
+			                buf[j]);
+		}
+	}
+
+	return (int)(bytes_read);
+}
+
+
 /******************************************************************************
  * rawmidi_write()
  *      struct rawmidi          rm
  *      char                    *buf
  *      int                     len
  *
- * Writes <len> bytes from <buf> to the rawmidi output device, either
- * one byte or one event (4 bytes) at a time.  Return value is the
- * number of raw midi bytes read, or -1 on error.
+ * Writes <len> bytes from <buf> to the rawmidi output device with as few
+ * system calls as possible.  Any number of complete MIDI messages may be
+ * written at once.  When a byte guard time is set, or for OSS2, the byte
+ * (or event) at a time rawmidi_write_bytes() is used instead.  Return value
+ * is the number of raw midi bytes written.
  ******************************************************************************/
 int
 rawmidi_write(RAWMIDI_INFO *rawmidi, unsigned char *buf, ssize_t len)
 {
+#ifdef ENABLE_RAWMIDI_OSS
+	unsigned char       obuf[RAWMIDI_OSS_TX_EVENTS * 4];
+	ssize_t             oss_len;
+	ssize_t             k;
+#endif /* ENABLE_RAWMIDI_OSS */
+	ssize_t             j               = 0;
+	ssize_t             bytes_written   = 0;
+
+	/* byte guard time requires byte at a time writes. */
+	if (byte_guard_time_usec > 0) {
+		return rawmidi_write_bytes(rawmidi, buf, len);
+	}
+
+	switch (rawmidi->driver) {
+
+		/* for OSS, send as many raw midi byte events as will fit in
+		   the event buffer with each write. */
+#ifdef ENABLE_RAWMIDI_OSS
+	case MIDI_DRIVER_RAW_OSS:
+		while (bytes_written < len) {
+			oss_len = len - bytes_written;
+			if (oss_len > RAWMIDI_OSS_TX_EVENTS) {
+				oss_len = RAWMIDI_OSS_TX_EVENTS;
+			}
+			for (k = 0; k < oss_len; k++) {
+				obuf[(k << 2)]     = SEQ_MIDIPUTC;
+				obuf[(k << 2) + 1] = buf[bytes_written + k];
+				obuf[(k << 2) + 2] = 0;
+				obuf[(k << 2) + 3] = 0;
+			}
+			if (write(rawmidi->tx_fd, obuf, (size_t)(oss_len << 2)) !=
+			    (oss_len << 2)) {
+				JAMROUTER_ERROR("Unable to write to OSS MIDI "
+				                "device '%s' -- %s!\n",
+				                rawmidi->tx_device, strerror(errno));
+				break;
+			}
+			bytes_written += oss_len;
+		}
+		break;
+#endif /* ENABLE_RAWMIDI_OSS */
+
+#ifdef ENABLE_RAWMIDI_OSS2
+	case MIDI_DRIVER_RAW_OSS2:
+		return rawmidi_write_bytes(rawmidi, buf, len);
+#endif /* ENABLE_RAWMIDI_OSS2 */
+
+		/* With nonblocking Tx, a full device buffer results in a short
+		   write.  Wait roughly one byte at wire speed before retrying. */
+#ifdef ENABLE_RAWMIDI_ALSA_RAW
+	case MIDI_DRIVER_RAW_ALSA:
+		while (bytes_written < len) {
+			j = snd_rawmidi_write(rawmidi->tx_handle, &buf[bytes_written],
+			                      (size_t)(len - bytes_written));
+			if (j > 0) {
+				bytes_written += j;
+			}
+			else if ((j == -EAGAIN) || (j == 0)) {
+				jamrouter_usleep(RAWMIDI_TX_RETRY_USEC);
+			}
+			else {
+				JAMROUTER_ERROR("Unable to write to ALSA MIDI device "
+				                "'%s' -- %s!\n",
+				                rawmidi->tx_device, snd_strerror((int)j));
+				break;
+			}
+		}
+		break;
+#endif /* ENABLE_RAWMIDI_ALSA_RAW */
+
+#ifdef ENABLE_RAWMIDI_GENERIC
+	case MIDI_DRIVER_RAW_GENERIC:
+		while (bytes_written < len) {
+			j = write(rawmidi->tx_fd, &buf[bytes_written],
+			          (size_t)(len - bytes_written));
+			if (j > 0) {
+				bytes_written += j;
+			}
+			else if ((j == 0) || (errno == EAGAIN) || (errno == EINTR)) {
+				jamrouter_usleep(RAWMIDI_TX_RETRY_USEC);
+			}
+			else {
+				JAMROUTER_ERROR("Unable to write to Raw MIDI "
+				                "device '%s' -- %s!\n",
+				                rawmidi->tx_device, strerror(errno));
+				break;
+			}
+		}
+		break;
+#endif /* ENABLE_RAWMIDI_GENERIC */
+
+#ifdef ENABLE_SIM
+	case MIDI_DRIVER_RAW_SIM:
+		bytes_written = sim_midi_write(buf, len);
+		break;
+#endif /* ENABLE_SIM */
+	}
+
+	if (debug_class & DEBUG_CLASS_STREAM) {
+		for (j = 0; j < bytes_written; j++) {
+			JAMROUTER_DEBUG(DEBUG_CLASS_STREAM,
+			                DEBUG_COLOR_GREEN "%02X " DEBUG_COLOR_DEFAULT,
+			                buf[j]);
+		}
+	}
+
+	return (int)bytes_written;
+}
+
+
+/******************************************************************************
+ * rawmidi_write_bytes()
+ *      struct rawmidi          rm
+ *      char                    *buf
+ *      int                     len
+ *
+ * Writes <len> bytes from <buf> to the rawmidi output device, either
+ * one byte or one event (4 bytes) at a time, honoring the byte guard
+ * time.  Return value is the number of raw midi bytes written.
+ ******************************************************************************/
+int
+rawmidi_write_bytes(RAWMIDI_INFO *rawmidi, unsigned char *buf, ssize_t len)
+{
 #if defined(ENABLE_RAWMIDI_OSS) || defined(ENABLE_RAWMIDI_OSS2)
 	unsigned char       obuf[8];
 #endif /* ENABLE_RAWMIDI_OSS */
@@ -1182,6 +1406,18 @@ rawmidi_write(RAWMIDI_INFO *rawmidi, unsigned char *buf, ssize_t len)
 		bytes_written = j;
 		break;
 #endif /* ENABLE_RAWMIDI_GENERIC */
+
+#ifdef ENABLE_SIM
+	case MIDI_DRIVER_RAW_SIM:
+		for (j = 0; j < len; j++) {
+			sim_midi_write(&buf[j], 1);
+			if (byte_guard_time_usec > 0) {
+				jamrouter_usleep(byte_guard_time_usec);
+			}
+		}
+		bytes_written = j;
+		break;
+#endif /* ENABLE_SIM */
 	}
 
 	return (int)bytes_written;
@@ -1279,7 +1515,7 @@ rawmidi_watchdog_cycle(void)
 	ALSA_RAWMIDI_HW_INFO    *old_rawmidi_tx_hw;
 	ALSA_RAWMIDI_HW_INFO    *new_rawmidi_tx_hw;
 
-	if ((midi_driver == MIDI_DRIVER_RAW_ALSA) && (rawmidi_info != NULL)) {
+	if ((midi_driver == MIDI_DRIVER_RAW_ALSA) && (rawmidi_info[0] != NULL)) {
 
 		/* rx */
 		old_rawmidi_rx_hw = alsa_rawmidi_rx_hw;
@@ -1353,12 +1589,16 @@ rawmidi_watchdog_cycle(void)
 /*****************************************************************************
  * rawmidi_init()
  *
- * Open MIDI device and leave in a ready state for the MIDI thread
- * to start reading events.
+ * Open MIDI devices and leave in a ready state for the MIDI threads
+ * to start reading events.  Each route has its own device pair:  route 0
+ * uses the -D/-r/-t devices, and the rest their --route-device.  Devices
+ * still open for a route are kept.
  *****************************************************************************/
 int
 rawmidi_init(void)
 {
+	unsigned char   route;
+
 #ifdef ENABLE_RAWMIDI_ALSA_RAW
 	if (midi_driver == MIDI_DRIVER_RAW_ALSA) {
 		/* rx */
@@ -1377,10 +1617,23 @@ rawmidi_init(void)
 	}
 #endif /* ENABLE_RAWMIDI_ALSA_RAW */
 
-	if ((rawmidi_info = rawmidi_open(midi_rx_port_name,
-	                                 midi_tx_port_name,
-	                                 midi_driver)) == NULL) {
-		return -1;
+	for (route = 0; route < num_midi_routes; route++) {
+		if (rawmidi_info[route] != NULL) {
+			continue;
+		}
+		if (route == 0) {
+			rawmidi_info[route] = rawmidi_open(midi_rx_port_name,
+			                                   midi_tx_port_name,
+			                                   midi_driver);
+		}
+		else {
+			rawmidi_info[route] = rawmidi_open(route_midi_device[route],
+			                                   route_midi_device[route],
+			                                   midi_driver);
+		}
+		if (rawmidi_info[route] == NULL) {
+			return -1;
+		}
 	}
 
 	return 0;
@@ -1391,26 +1644,33 @@ rawmidi_init(void)
  * rawmidi_cleanup()
  *  void *      arg
  *
- * Cleanup handler for RAWMIDI thread.
- * Closes RAWMIDI ports.
+ * Cleanup handler for RAWMIDI threads.
+ * Closes a route's RAWMIDI ports once both of its threads are done.
  *****************************************************************************/
 void
 rawmidi_cleanup(void *arg)
 {
+	int     route;
 
-	if (arg == (void *)midi_rx_thread_p) {
-		midi_rx_thread_p = 0;
-		midi_rx_stopped  = 1;
-	}
-	if (arg == (void *)midi_tx_thread_p) {
-		midi_tx_thread_p = 0;
-		midi_tx_stopped  = 1;
-	}
-	if ( (rawmidi_info != NULL) &&
-	     (midi_rx_thread_p == 0) && (midi_tx_thread_p == 0) ) {
-		rawmidi_close(rawmidi_info);
-		rawmidi_free(rawmidi_info);
-		rawmidi_info = NULL;
+	for (route = 0; route < MAX_MIDI_ROUTES; route++) {
+		if (arg == (void *)midi_rx_thread_p[route]) {
+			midi_rx_thread_p[route] = 0;
+			midi_rx_stopped         = 1;
+		}
+		else if (arg == (void *)midi_tx_thread_p[route]) {
+			midi_tx_thread_p[route] = 0;
+			midi_tx_stopped         = 1;
+		}
+		else {
+			continue;
+		}
+		if ( (rawmidi_info[route] != NULL) &&
+		     (midi_rx_thread_p[route] == 0) && (midi_tx_thread_p[route] == 0) ) {
+			rawmidi_close(rawmidi_info[route]);
+			rawmidi_free(rawmidi_info[route]);
+			rawmidi_info[route] = NULL;
+		}
+		break;
 	}
 
 	/* Add some guard time, in case MIDI hardware is re-initialized soon. */
@@ -1419,82 +1679,289 @@ rawmidi_cleanup(void *arg)
 
 
 /*****************************************************************************
- * rawmidi_read_sysex ()
+ * rawmidi_parser_init()
  *****************************************************************************/
 void
-rawmidi_read_sysex(volatile MIDI_EVENT *event)
+rawmidi_parser_init(RAWMIDI_PARSER *parser, unsigned char queue_num)
 {
-	unsigned char   midi_byte;
-
-	do {
-		if (rawmidi_read(rawmidi_info, (unsigned char *) &midi_byte, 1) == 1) {
-			/*
-			  Sysex messages end with 0xF7.  Truncate sysex messages to
-			  SYSEX_BUFFER_SIZE in case the terminating byte is either lost in
-			  transmission or simply not sent by out of spec devices.
-			  SYSEX_BUFFER_SIZE can always be changed, or special handling
-			  for obscure sysex messages can be added.  Nonstandard
-			  end-sysex bytes are converted to standard 0xF7.
-			  TODO: Sysex message timeouts, similar to active sensing.
-			*/
-			if ( (midi_byte == sysex_terminator) ||
-			     (event->bytes == (SYSEX_BUFFER_SIZE - 1)) ) {
-				event->data[event->bytes++] = 0xF7;
-				if (sysex_extra_terminator == 0xF7) {
-					break;
-				}
-			}
-			else if ( (sysex_extra_terminator != 0xF7) &&
-			          (event->data[event->bytes - 1] == sysex_terminator) &&
-			          (midi_byte == sysex_extra_terminator) ) {
-				event->data[event->bytes] = 0xF7;
-				break;
-			}
-			/* handle interleaved MIDI realtime messages */
-			else if (midi_byte > 0xF7) {
-				JAMROUTER_DEBUG((DEBUG_CLASS_TIMING | DEBUG_CLASS_STREAM),
-				                DEBUG_COLOR_CYAN "<%X> " DEBUG_COLOR_DEFAULT,
-				                midi_byte);
-				midi_realtime_type[realtime_event_count++] = midi_byte;
-			}
-			/* anything else should be considered part of the sysex message */
-			else {
-				event->data[event->bytes++] = midi_byte;
-			}
-		}
-		else {
-			JAMROUTER_ERROR("*** Raw MIDI Read Error! *** ");
-		}
+	parser->event          = get_new_midi_event(queue_num);
+	parser->period         = 0;
+	parser->frame          = 0;
+	parser->queue_num      = queue_num;
+	parser->state          = RAWMIDI_PARSE_STATE_IDLE;
+	parser->running_status = 0;
+	parser->data_needed    = 0;
+	parser->data_count     = 0;
+}
+
+
+/*****************************************************************************
+ * rawmidi_parser_start_event()
+ *
+ * Begins a new message in the parser's event, stamped with the wire position
+ * of its first byte.  Any incomplete message is abandoned.
+ *****************************************************************************/
+void
+rawmidi_parser_start_event(RAWMIDI_PARSER   *parser,
+                           unsigned char    status,
+                           unsigned short   period,
+                           unsigned short   frame)
+{
+	volatile MIDI_EVENT *event = parser->event;
+
+	if (status < 0xF0) {
+		event->type    = status & MIDI_TYPE_MASK;      // & 0xF0
+		event->channel = status & MIDI_CHANNEL_MASK;   // & 0x0F
+	}
+	else {
+		event->type    = status;
+		event->channel = 0x0;
+	}
+	event->byte2       = 0x0;
+	event->byte3       = 0x0;
+	event->bytes       = 0;
+	if (event->data != NULL) {
+		free_sysex_buffer(event->data);
+		event->data    = NULL;
+	}
+
+	parser->period     = period;
+	parser->frame      = frame;
+	parser->data_count = 0;
+
+	switch (event->type) {
+		/* all channel specific messages except program change and
+		   polypressure have 2 bytes following status byte */
+	case MIDI_EVENT_PROGRAM_CHANGE:
+	case MIDI_EVENT_POLYPRESSURE:
+	case MIDI_EVENT_MTC_QFRAME:     // 0xF1
+	case MIDI_EVENT_SONG_SELECT:    // 0xF3
+		parser->data_needed = 1;
+		break;
+	default:
+		parser->data_needed = 2;
+		break;
 	}
-	while (!midi_rx_stopped && !pending_shutdown);
 }
 
 
 /*****************************************************************************
- * rawmidi_read_byte ()
+ * rawmidi_parser_continue_sysex()
  *
- * Note:  Some devices might break spec and treat all system messages as
- *        realtime messages and interleave sysex and MTC qframes as well.
- *        Special handling for all interleaved system messages should go here.
+ * Begins the next fragment of a SysEx message in the parser's (fresh)
+ * event, once the previous fragment has been handed off.  Each fragment is
+ * stamped with the wire position of its own first byte.  Returns -1, with
+ * the rest of the message dropped, when the SysEx arena is still in use.
  *****************************************************************************/
-unsigned char
-rawmidi_read_byte(volatile MIDI_EVENT *UNUSED(event))
+static int
+rawmidi_parser_continue_sysex(RAWMIDI_PARSER    *parser,
+                              unsigned short    period,
+                              unsigned short    frame)
 {
-	unsigned char   midi_byte;
+	volatile MIDI_EVENT *event = parser->event;
 
-	if (rawmidi_read(rawmidi_info, (unsigned char *) &midi_byte, 1) == 1) {
-		if (midi_byte > 0xF7) {
-			JAMROUTER_DEBUG((DEBUG_CLASS_TIMING | DEBUG_CLASS_STREAM),
-			                DEBUG_COLOR_CYAN "<%X> " DEBUG_COLOR_DEFAULT,
-			                midi_byte);
-			midi_realtime_type[realtime_event_count++] = midi_byte;
+	if (event->data != NULL) {
+		return 0;
+	}
+	event->type    = MIDI_EVENT_SYSEX;
+	event->channel = 0x0;
+	event->bytes   = 0;
+	if ((event->data = get_sysex_buffer(parser->queue_num, SYSEX_FRAGMENT_SIZE)) == NULL) {
+		parser->state = RAWMIDI_PARSE_STATE_IDLE;
+		return -1;
+	}
+	parser->period = period;
+	parser->frame  = frame;
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * rawmidi_parser_flush_sysex()
+ *
+ * Hands off the SysEx received so far, once per period, so long messages
+ * reach JACK while still arriving instead of all at once at the end.
+ * Returns RAWMIDI_PARSE_EVENT when parser->event holds a fragment to queue.
+ *****************************************************************************/
+int
+rawmidi_parser_flush_sysex(RAWMIDI_PARSER *parser, unsigned short period)
+{
+	volatile MIDI_EVENT *event = parser->event;
+
+	if ( (parser->state == RAWMIDI_PARSE_STATE_SYSEX) &&
+	     (event->data != NULL) && (event->bytes > 0) &&
+	     (parser->period != period) ) {
+		return RAWMIDI_PARSE_EVENT;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * rawmidi_parse_byte()
+ *
+ * Resumable byte-level MIDI parser.  Feeds one byte, stamped with its
+ * estimated wire position, into the message being assembled in the parser's
+ * event.  Messages, including SysEx and running status, may span any number
+ * of reads.  SysEx of any length is passed on in fragments of up to
+ * SYSEX_FRAGMENT_SIZE bytes, the first starting with 0xF0 and the last
+ * ending with 0xF7.  Returns a mask of:
+ *
+ *   RAWMIDI_PARSE_EVENT     parser->event holds a complete message.
+ *   RAWMIDI_PARSE_REALTIME  the byte is an (interleaved) realtime message.
+ *   RAWMIDI_PARSE_REPEAT    the byte was not consumed, and needs to be fed
+ *                           again once the completed event has been queued.
+ *****************************************************************************/
+int
+rawmidi_parse_byte(RAWMIDI_PARSER   *parser,
+                   unsigned char    midi_byte,
+                   unsigned short   period,
+                   unsigned short   frame)
+{
+	volatile MIDI_EVENT *event = parser->event;
+
+	/* Nonstandard sysex terminators may fall in the realtime range, so check
+	   for the end of sysex before anything else. */
+	switch (parser->state) {
+	case RAWMIDI_PARSE_STATE_SYSEX:
+		if (midi_byte == sysex_terminator) {
+			/* nonstandard end-sysex bytes are converted to standard 0xF7. */
+			if (rawmidi_parser_continue_sysex(parser, period, frame) != 0) {
+				return 0;
+			}
+			event->data[event->bytes++] = 0xF7;
+			if (sysex_extra_terminator == 0xF7) {
+				parser->state = RAWMIDI_PARSE_STATE_IDLE;
+				return RAWMIDI_PARSE_EVENT;
+			}
+			parser->state = RAWMIDI_PARSE_STATE_SYSEX_EXTRA;
+			return 0;
+		}
+		break;
+	case RAWMIDI_PARSE_STATE_SYSEX_EXTRA:
+		parser->state = RAWMIDI_PARSE_STATE_IDLE;
+		if (midi_byte == sysex_extra_terminator) {
+			return RAWMIDI_PARSE_EVENT;
+		}
+		/* single terminator byte was enough to end the message. */
+		return (RAWMIDI_PARSE_EVENT | RAWMIDI_PARSE_REPEAT);
+	}
+
+	/* realtime messages can be interleaved anywhere, and do not affect
+	   running status or the message being assembled. */
+	if (midi_byte >= 0xF8) {
+		return RAWMIDI_PARSE_REALTIME;
+	}
+
+	/* status bytes */
+	if (midi_byte >= 0x80) {
+		switch (parser->state) {
+		case RAWMIDI_PARSE_STATE_SYSEX:
+			/* any status byte ends a sysex message lacking its terminator */
+			if (rawmidi_parser_continue_sysex(parser, period, frame) != 0) {
+				break;
+			}
+			event->data[event->bytes++] = 0xF7;
+			parser->state = RAWMIDI_PARSE_STATE_IDLE;
+			return (RAWMIDI_PARSE_EVENT | RAWMIDI_PARSE_REPEAT);
+		}
+
+		rawmidi_parser_start_event(parser, midi_byte, period, frame);
+
+		/* channel messages set running status */
+		if (midi_byte < 0xF0) {
+			parser->running_status = midi_byte;
+			parser->state          = RAWMIDI_PARSE_STATE_DATA;
+			return 0;
+		}
+
+		/* system (but not realtime) messages clear running status */
+		parser->running_status = 0;
+		switch (midi_byte) {
+			/* variable length system messages */
+		case MIDI_EVENT_SYSEX:          // 0xF0
+			/* with the SysEx arena still in use, drop the message */
+			if ((event->data = get_sysex_buffer(parser->queue_num,
+			                                    SYSEX_FRAGMENT_SIZE)) == NULL) {
+				parser->state = RAWMIDI_PARSE_STATE_IDLE;
+				return 0;
+			}
+			event->data[0] = 0xF0;
+			event->bytes   = 1;
+			parser->state  = RAWMIDI_PARSE_STATE_SYSEX;
+			return 0;
+			/* 2 and 3 byte system messages */
+		case MIDI_EVENT_MTC_QFRAME:     // 0xF1
+		case MIDI_EVENT_SONGPOS:        // 0xF2
+		case MIDI_EVENT_SONG_SELECT:    // 0xF3
+			parser->state  = RAWMIDI_PARSE_STATE_DATA;
+			return 0;
+			/* 1 byte system messages */
+		case MIDI_EVENT_BUS_SELECT:     // 0xF5
+		case MIDI_EVENT_TUNE_REQUEST:   // 0xF6
+		case MIDI_EVENT_END_SYSEX:      // 0xF7
+			event->bytes   = 1;
+			parser->state  = RAWMIDI_PARSE_STATE_IDLE;
+			return RAWMIDI_PARSE_EVENT;
+		default:
+			parser->state  = RAWMIDI_PARSE_STATE_IDLE;
+			return 0;
 		}
 	}
+
+	/* data bytes */
+	switch (parser->state) {
+	case RAWMIDI_PARSE_STATE_SYSEX:
+		/* Hand off each full fragment and stay in sysex state.  The next
+		   fragment is started with the next byte of the message. */
+		if (rawmidi_parser_continue_sysex(parser, period, frame) != 0) {
+			return 0;
+		}
+		event->data[event->bytes++] = midi_byte;
+		if (event->bytes >= SYSEX_FRAGMENT_SIZE) {
+			return RAWMIDI_PARSE_EVENT;
+		}
+		return 0;
+	case RAWMIDI_PARSE_STATE_IDLE:
+		/* no status byte.  use running status, if any. */
+		if (parser->running_status == 0) {
+			return 0;
+		}
+		rawmidi_parser_start_event(parser, parser->running_status, period, frame);
+		parser->state = RAWMIDI_PARSE_STATE_DATA;
+		break;
+	}
+
+	if (parser->data_count == 0) {
+		event->byte2 = midi_byte;
+	}
 	else {
-		JAMROUTER_ERROR("*** Raw MIDI Read Error! *** ");
+		event->byte3 = midi_byte;
 	}
+	if (++parser->data_count < parser->data_needed) {
+		return 0;
+	}
+
+	event->bytes  = (unsigned short)(parser->data_needed + 1);
+	parser->state = RAWMIDI_PARSE_STATE_IDLE;
 
-	return midi_byte;
+	if ( (event->type == MIDI_EVENT_NOTE_OFF) ||
+	     (event->type == MIDI_EVENT_NOTE_ON) ) {
+		if ( (event->velocity == note_off_velocity) ||
+		     (event->type == MIDI_EVENT_NOTE_OFF) ) {
+			if (rx_queue_real_note_off) {
+				event->type = MIDI_EVENT_NOTE_OFF;
+			}
+			event->velocity = 0x0;
+			track_note_off(parser->queue_num, event->channel, event->note);
+		}
+		else {
+			track_note_on(parser->queue_num, event->channel, event->note);
+		}
+	}
+
+	return RAWMIDI_PARSE_EVENT;
 }
 
 
@@ -1502,18 +1969,23 @@ rawmidi_read_byte(volatile MIDI_EVENT *UNUSED(event))
  * raw_midi_rx_thread()
  *
  * Raw MIDI input thread function.  Queues incoming MIDI events read from a
- * raw MIDI device.  Since this is raw (not event driven) MIDI input, this
+ * raw MIDI device.  All bytes available at each wakeup are read at once, and
+ * each byte is stamped with its estimated position on the wire before being
+ * fed to the parser.  Since this is raw (not event driven) MIDI input, this
  * thread will properly handle interleaved MIDI realtime events.
  *****************************************************************************/
 void *
-raw_midi_rx_thread(void *UNUSED(arg))
+raw_midi_rx_thread(void *arg)
 {
+	RAWMIDI_INFO        *rawmidi;
 	char                thread_name[16];
+	unsigned char       rx_buf[RAWMIDI_RX_BUFFER_SIZE];
+	RAWMIDI_PARSER      parser;
 	volatile MIDI_EVENT *volatile out_event;
-	struct timespec     now;
+	volatile MIDI_EVENT *new_event;
+	timensec_t          now;
 	struct sched_param  schedparam;
 	pthread_t           thread_id;
-	unsigned char       running_status;
 	short               delta_frames;
 	short               target_span;
 	short               event_frame_span    = 0;
@@ -1522,17 +1994,32 @@ raw_midi_rx_thread(void *UNUSED(arg))
 	unsigned short      rx_index            = 0;
 	unsigned short      period;
 	unsigned short      last_byte_period;
-	unsigned char       type                = MIDI_EVENT_NO_EVENT;
-	unsigned char       channel             = 0x7F;
+	unsigned short      read_period;
+	unsigned short      read_frame;
+	unsigned short      byte_period;
+	unsigned short      byte_frame;
+	unsigned short      backdate;
+	unsigned short      max_backdate;
 	unsigned char       midi_byte;
+	unsigned char       route               = (unsigned char) GPOINTER_TO_INT(arg);
+	unsigned char       queue_num           = A2J_ROUTE_QUEUE(route);
 	unsigned char       j;
+	int                 bytes_read;
+	int                 parse_status;
+	int                 k;
 
-	out_event        = get_new_midi_event(A2J_QUEUE);
-	out_event->state = EVENT_STATE_ALLOCATED;
+	rawmidi = rawmidi_info[route];
+	rawmidi_parser_init(&parser, queue_num);
 
 	/* set realtime scheduling and priority */
 	thread_id = pthread_self();
-	snprintf(thread_name, 16, "jamrouter%c-rx", ('0' + jamrouter_instance));
+	if (route == 0) {
+		snprintf(thread_name, 16, "jamrouter%c-rx", ('0' + jamrouter_instance));
+	}
+	else {
+		snprintf(thread_name, 16, "jamrouter%c-rx%d", ('0' + jamrouter_instance),
+		         route + 1);
+	}
 	pthread_setname_np(thread_id, thread_name);
 	memset(&schedparam, 0, sizeof(struct sched_param));
 	schedparam.sched_priority = midi_rx_thread_priority;
@@ -1541,16 +2028,17 @@ raw_midi_rx_thread(void *UNUSED(arg))
 	/* setup thread cleanup handler */
 	pthread_cleanup_push(&rawmidi_cleanup, (void *)(thread_id));
 
-	JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Starting Raw MIDI Rx thread...\n");
+	JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Starting Raw MIDI Rx thread for route %d...\n",
+	                route + 1);
 
 	/* flush MIDI input */
 #ifdef RAWMIDI_FLUSH_ON_START
-	rawmidi_flush(rawmidi_info);
+	rawmidi_flush(rawmidi);
 #endif /* RAWMIDI_FLUSH_ON_START */
 
 	/* broadcast the midi ready condition */
 	pthread_mutex_lock(&midi_rx_ready_mutex);
-	midi_rx_ready = 1;
+	midi_rx_ready++;
 	pthread_cond_broadcast(&midi_rx_ready_cond);
 	pthread_mutex_unlock(&midi_rx_ready_mutex);
 
@@ -1560,141 +2048,89 @@ raw_midi_rx_thread(void *UNUSED(arg))
 		/* set thread cancelation point */
 		pthread_testcancel();
 
-		/* Read new MIDI input, starting with first byte. */
-		if (rawmidi_read(rawmidi_info, (unsigned char *) &midi_byte, 1) == 1) {
-
-			period           = get_midi_period(&now);
-			first_byte_frame = get_midi_frame(&period, &now,
-			                                  FRAME_FIX_LOWER |
-			                                  FRAME_LIMIT_UPPER);
-			last_byte_frame  = first_byte_frame;
-			rx_index         = sync_info[period].rx_index;
-
-			/* To determine message type, assuming no running status until
-			   we learn otherwise. */
-			running_status = 0;
-
-			/* No status byte.  Use running status.  Set running_status
-			   flag so we don't try to read the second byte again. */
-			if (midi_byte < 0x80) {
-				running_status = 1;
-			}
-			/* status byte was found so keep track of message type and
-			   channel. */
-			else {
-				type    = midi_byte & MIDI_TYPE_MASK;     // & 0xF0
-				channel = midi_byte & MIDI_CHANNEL_MASK;  // & 0x0F
-			}
-			/* handle channel events (with or without status byte). */
-			if (type < 0xF0) {
-				out_event->type    = type;
-				out_event->channel = channel;
-				/* read second byte if we haven't already */
-				if (running_status) {
-					out_event->byte2 = midi_byte;
+		/* Drain all MIDI input available at this wakeup. */
+		bytes_read = rawmidi_read_available(rawmidi, rx_buf,
+		                                    RAWMIDI_RX_BUFFER_SIZE);
+
+		if (bytes_read > 0) {
+			read_period  = get_midi_period(&now);
+			read_frame   = get_midi_frame(&read_period, &now,
+			                              FRAME_FIX_LOWER |
+			                              FRAME_LIMIT_UPPER);
+
+			/* Never backdate bytes far enough to land in a frame the JACK
+			   thread may have already dequeued.  Bytes only move back into
+			   the previous period when the Rx latency leaves a period or
+			   more of margin before JACK dequeues it. */
+			max_backdate = sync_info[read_period].buffer_period_size >> 1;
+
+			for (k = 0; k < bytes_read; ) {
+				midi_byte = rx_buf[k];
+
+				/* Estimate the wire position of each byte:  the last byte
+				   arrived at read time, with each earlier byte one MIDI
+				   byte-time before the next. */
+				backdate = (unsigned short)((bytes_read - 1 - k) *
+				                            sync_info[read_period].frames_per_byte);
+				if (backdate > max_backdate) {
+					backdate = max_backdate;
 				}
-				else {
-					out_event->byte2 = rawmidi_read_byte(out_event);
+				byte_period = read_period;
+				if (read_frame >= backdate) {
+					byte_frame = (unsigned short)(read_frame - backdate);
 				}
-				/* all channel specific messages except program change and
-				   polypressure have 2 bytes following status byte */
-				switch (type) {
-				case MIDI_EVENT_PROGRAM_CHANGE:
-				case MIDI_EVENT_POLYPRESSURE:
-					out_event->byte3 = 0x00;
-					out_event->bytes = 2;
-					break;
-				case MIDI_EVENT_CONTROLLER:
-					out_event->byte3 = rawmidi_read_byte(out_event);
-					out_event->bytes = 3;
-					break;
-				case MIDI_EVENT_NOTE_OFF:
-				case MIDI_EVENT_NOTE_ON:
-					out_event->byte3 = rawmidi_read_byte(out_event);
-					out_event->bytes = 3;
-					if ( (out_event->velocity == note_off_velocity) ||
-					      (out_event->type == MIDI_EVENT_NOTE_OFF) ) {
-						if (rx_queue_real_note_off) {
-							out_event->type = MIDI_EVENT_NOTE_OFF;
-						}
-						out_event->velocity = 0x0;
-						track_note_off(A2J_QUEUE,
-						               out_event->channel, out_event->note);
-					}
-					else {
-						track_note_on(A2J_QUEUE,
-						              out_event->channel, out_event->note);
-					}
-					break;
-				case MIDI_EVENT_AFTERTOUCH:
-				case MIDI_EVENT_PITCHBEND:
-					out_event->byte3 = rawmidi_read_byte(out_event);
-					out_event->bytes = 3;
-					break;
+				else if (sync_info[read_period].rx_latency_size >
+				         sync_info[read_period].buffer_period_size) {
+					byte_frame = (unsigned short)
+						(read_frame + sync_info[read_period].buffer_period_size - backdate);
+					byte_period = sync_info[read_period].prev;
 				}
-			}
-			/* handle system and realtime messages */
-			else {
-				/* clear running status (by setting type) when we see
-				   system (but not realtime) messages. */
-				/* clock tick and realtime msgs (0xF8 and above) do not
-				   clear running status. */
-				if (midi_byte < 0xF8) {
-					type           = midi_byte;
-					channel        = 0x0;
+				else {
+					byte_frame = 0;
 				}
-				out_event->type = midi_byte;
-				/* switch on midi_byte instead of type, since type could
-				   have been masked for channel messages */
-				switch (midi_byte) {
-					/* variable length system messages */
-				case MIDI_EVENT_SYSEX:          // 0xF0
-					out_event->data[0] = 0xF0;
-					out_event->bytes   = 1;
-					rawmidi_read_sysex(out_event);
-					break;
-					/* 3 byte system messages */
-				case MIDI_EVENT_SONGPOS:        // 0xF2
-					/* read 2 more bytes (watching out for interleaved
-					   realtime msgs). */
-					out_event->byte2 = rawmidi_read_byte(out_event);
-					out_event->byte3 = rawmidi_read_byte(out_event);
-					out_event->bytes = 3;
-					break;
-					/* 2 byte system messages */
-				case MIDI_EVENT_MTC_QFRAME:     // 0xF1
-				case MIDI_EVENT_SONG_SELECT:    // 0xF3
-					/* read 1 more byte (watching out for interleaved
-					   realtime msgs). */
-					out_event->byte2 = rawmidi_read_byte(out_event);
-					out_event->byte3 = 0x0;
-					out_event->bytes = 2;
-					break;
-					/* 1-byte system and realtime messages */
-				case MIDI_EVENT_BUS_SELECT:     // 0xF5
-				case MIDI_EVENT_TUNE_REQUEST:   // 0xF6
-				case MIDI_EVENT_END_SYSEX:      // 0xF7
-				case MIDI_EVENT_TICK:           // 0xF8
-				case MIDI_EVENT_START:          // 0xFA
-				case MIDI_EVENT_CONTINUE:       // 0xFB
-				case MIDI_EVENT_STOP:           // 0xFC
-				case MIDI_EVENT_ACTIVE_SENSING: // 0xFE
-				case MIDI_EVENT_SYSTEM_RESET:   // 0xFF
-					out_event->bytes = 1;
-					break;
-				default:
-					break;
+
+				parse_status = rawmidi_parse_byte(&parser, midi_byte,
+				                                  byte_period, byte_frame);
+				if (!(parse_status & RAWMIDI_PARSE_REPEAT)) {
+					k++;
+				}
+
+				/* Realtime messages are queued right away for the frame they
+				   arrived in, even when interleaved within other messages. */
+				if (parse_status & RAWMIDI_PARSE_REALTIME) {
+					JAMROUTER_DEBUG((DEBUG_CLASS_TIMING | DEBUG_CLASS_STREAM),
+					                DEBUG_COLOR_CYAN "<%X> " DEBUG_COLOR_DEFAULT,
+					                midi_byte);
+					queue_midi_realtime_event(byte_period, queue_num, midi_byte,
+					                          byte_frame,
+					                          sync_info[byte_period].rx_index);
+					continue;
 				}
-			}
 
-			/* prepare to queue event. */
-			if (out_event->bytes > 0) {
+				/* Pass on SysEx received in earlier periods at the end
+				   of each read. */
+				if ( !(parse_status & RAWMIDI_PARSE_EVENT) &&
+				     ( (k < bytes_read) ||
+				       !rawmidi_parser_flush_sysex(&parser, byte_period) ) ) {
+					continue;
+				}
 
-				/* keep track of last byte frame and event span for debugging */
-				last_byte_period = get_midi_period(&now);
-				last_byte_frame  = get_midi_frame(&last_byte_period, &now,
-				                                  FRAME_FIX_LOWER);
+				/* complete event:  timestamp is that of its first byte. */
+				out_event        = parser.event;
+				period           = parser.period;
+				first_byte_frame = parser.frame;
+				last_byte_period = byte_period;
+				last_byte_frame  = byte_frame;
+				rx_index         = sync_info[period].rx_index;
+				out_event->ingress_time = now;
+
+				if (out_event->type == MIDI_EVENT_SYSEX) {
+					/* give back what the message did not use */
+					trim_sysex_buffer(queue_num, out_event->data,
+					                  SYSEX_FRAGMENT_SIZE, out_event->bytes + 1);
+				}
 
+				/* keep track of event span for debugging */
 				event_frame_span = (short)
 					( (unsigned short)( sync_info[period].buffer_size -
 					    (rx_index + first_byte_frame) +
@@ -1768,52 +2204,47 @@ raw_midi_rx_thread(void *UNUSED(arg))
 #endif /* ENABLE_DEBUG */
 #ifndef WITHOUT_JUNO
 				/* translate juno sysex to controllers */
-				translate_from_juno(period, A2J_QUEUE,
+				translate_from_juno(period, queue_num,
 				                    out_event, first_byte_frame, rx_index);
 #endif /* !WITHOUT_JUNO */
-			}
 
-			/* queue event. */
-			if (out_event->bytes > 0) {
+				/* queue event. */
+				if (out_event->bytes > 0) {
 
-				/* queue notes off for all-notes-off controller. */
-				if ( (out_event->controller == MIDI_CONTROLLER_ALL_NOTES_OFF) &&
-				     (out_event->type       == MIDI_EVENT_CONTROLLER) ) {
-					queue_notes_off(period, A2J_QUEUE, out_event->channel,
-					                first_byte_frame, rx_index);
-				}
-				/* otherwise, queue event as is */
-				else {
-					queue_midi_event(period, A2J_QUEUE, out_event,
-					                 first_byte_frame, rx_index, 0);
-					out_event = get_new_midi_event(A2J_QUEUE);
-				}
-
-				JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-				                DEBUG_COLOR_CYAN "[%d-%d:%d:"
-				                DEBUG_COLOR_RED "%d" DEBUG_COLOR_CYAN "] "
-				                DEBUG_COLOR_DEFAULT,
-				                first_byte_frame, last_byte_frame,
-				                event_frame_span, period);
-			}
+					/* queue notes off for all-notes-off controller. */
+					if ( (out_event->controller == MIDI_CONTROLLER_ALL_NOTES_OFF) &&
+					     (out_event->type       == MIDI_EVENT_CONTROLLER) ) {
+						queue_notes_off(period, queue_num, out_event->channel,
+						                first_byte_frame, rx_index);
+					}
+					/* otherwise, queue event as is */
+					else if ((new_event = get_new_midi_event(queue_num)) != NULL) {
+						queue_midi_event(period, queue_num, out_event,
+						                 first_byte_frame, rx_index, 0);
+						parser.event = new_event;
+					}
+					/* with every event in the pool in flight, drop the
+					   message and let the parser reuse its event. */
+					else {
+						out_event->bytes = 0;
+						free_sysex_buffer(out_event->data);
+						out_event->data  = NULL;
+					}
 
-			/* Interleaved realtime events can only be queued _after_ the
-			   event that the realtime event was interleaved in.  Queuing
-			   interleaved events for the same cycle frame as the initial
-			   event alleviates this problem completely. */
-			for (j = 0; j < realtime_event_count; j++) {
-				queue_midi_realtime_event(period, A2J_QUEUE,
-				                          midi_realtime_type[j],
-				                          first_byte_frame, rx_index);
-				midi_realtime_type[j] = 0;
-			}
-			realtime_event_count = 0;
-		} /* if (rawmidi_read()) */
+					JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
+					                DEBUG_COLOR_CYAN "[%d-%d:%d:"
+					                DEBUG_COLOR_RED "%d" DEBUG_COLOR_CYAN "] "
+					                DEBUG_COLOR_DEFAULT,
+					                first_byte_frame, last_byte_frame,
+					                event_frame_span, period);
+				}
+			} /* for() */
+		} /* if (bytes_read > 0) */
 
 		period = get_midi_period(&now);
-		if (check_active_sensing_timeout(period, A2J_QUEUE) > 0) {
+		if (check_active_sensing_timeout(period, queue_num) > 0) {
 			for (j = 0; j < 16; j++) {
-				queue_notes_off(period, A2J_QUEUE, j, 0, rx_index);
+				queue_notes_off(period, queue_num, j, 0, rx_index);
 			}
 		}
 
@@ -1832,6 +2263,117 @@ raw_midi_rx_thread(void *UNUSED(arg))
 }
 
 
+/*****************************************************************************
+ * rawmidi_write_tx_batch()
+ *
+ * Writes the <len> bytes of MIDI messages batched in the route's Tx buffer
+ * for the given period and cycle frame with a single rawmidi_write().
+ *****************************************************************************/
+void
+rawmidi_write_tx_batch(RAWMIDI_TX     *tx,
+                       unsigned short period,
+                       unsigned short cycle_frame,
+                       ssize_t        len)
+{
+	timensec_t          now;
+	timensec_t          write_time;
+	int                 event_latency;
+	unsigned short      end_frame;
+	unsigned short      end_period;
+
+	end_period = get_midi_period(&now);
+	end_frame = get_midi_frame(&end_period, &now, FRAME_FIX_LOWER);
+
+	/* Write the batch to MIDI hardware */
+	rawmidi_write(tx->rawmidi, tx->buf, len);
+	time_get_nsecs(&write_time);
+
+	/* The batch goes on the wire after anything already there. */
+	if (tx->byte_nsecs > 0) {
+		if (tx->wire_free_time < now) {
+			tx->wire_free_time = now;
+		}
+		tx->wire_free_time += (timensec_t) len * tx->byte_nsecs;
+	}
+
+	/* signed frame error, actual vs. scheduled */
+	event_latency = (int)
+		( ( (sync_info[period].buffer_size +
+		     sync_info[end_period].tx_index + end_frame) -
+		    (sync_info[period].tx_index + cycle_frame) )
+		  & sync_info[period].buffer_size_mask );
+	if (event_latency > (sync_info[period].buffer_size >> 1)) {
+		event_latency -= sync_info[period].buffer_size;
+	}
+	stats_record_write(tx->queue_num, event_latency, write_time - now);
+
+	JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
+	                DEBUG_COLOR_GREEN "[%d%+d] "
+	                DEBUG_COLOR_DEFAULT,
+	                cycle_frame, event_latency);
+}
+
+
+/*****************************************************************************
+ * rawmidi_tx_wire_wait()
+ *
+ * Wire-aware Tx pacing, called before each message due at <cycle_frame> is
+ * added to the batch of <tx_len> bytes.  Records how late the message's
+ * first byte is predicted to reach the wire behind everything already
+ * written or batched.  When the UART will stay busy for more than
+ * RAWMIDI_TX_WIRE_LEAD_BYTES, writes out the batch and sleeps until the
+ * wire is nearly free, so the driver buffer stays shallow and later
+ * messages are not stuck behind a burst.  Returns the number of bytes
+ * still batched.
+ *****************************************************************************/
+static ssize_t
+rawmidi_tx_wire_wait(RAWMIDI_TX     *tx,
+                     unsigned short period,
+                     unsigned short cycle_frame,
+                     ssize_t        tx_len)
+{
+	timensec_t          now;
+	timensec_t          sched_time;
+	timensec_t          wire_free;
+	timensec_t          lead;
+
+	if (tx->byte_nsecs == 0) {
+		return tx_len;
+	}
+
+	time_get_nsecs(&now);
+	sched_time = get_frame_time(period, cycle_frame);
+	lead       = RAWMIDI_TX_WIRE_LEAD_BYTES * tx->byte_nsecs;
+
+	wire_free  = (tx->wire_free_time > now) ? tx->wire_free_time : now;
+	wire_free += (timensec_t) tx_len * tx->byte_nsecs;
+
+	if (wire_free > sched_time) {
+		stats_record_nsecs(&(queue_stats[tx->queue_num].wire_wait),
+		                   wire_free - sched_time);
+		set_overload_wire_lateness(tx->queue_num, wire_free - sched_time);
+		JAMROUTER_DEBUG(DEBUG_CLASS_TX_TIMING,
+		                DEBUG_COLOR_RED "<W%+d> " DEBUG_COLOR_DEFAULT,
+		                (int) NSECS_TO_FRAMES(sync_info[period].nsec_per_frame,
+		                                      wire_free - sched_time));
+	}
+	else {
+		stats_record_nsecs(&(queue_stats[tx->queue_num].wire_wait), 0);
+		set_overload_wire_lateness(tx->queue_num, 0);
+	}
+
+	if (wire_free > (now + lead)) {
+		if (tx_len > 0) {
+			rawmidi_write_tx_batch(tx, period, cycle_frame, tx_len);
+			tx_len = 0;
+		}
+		jamrouter_sleep_until(tx->wire_free_time - lead);
+	}
+
+	return tx_len;
+}
+
+
 /*****************************************************************************
  * raw_midi_tx_thread()
  *
@@ -1840,35 +2382,51 @@ raw_midi_rx_thread(void *UNUSED(arg))
  * thread will properly handle interleaved MIDI realtime events.
  *****************************************************************************/
 void *
-raw_midi_tx_thread(void *UNUSED(arg))
+raw_midi_tx_thread(void *arg)
 {
+	RAWMIDI_TX          tx;
 	char                thread_name[16];
 	volatile MIDI_EVENT midi_event;
 	volatile MIDI_EVENT *event              = &midi_event;
 	volatile MIDI_EVENT *next               = NULL;
 	volatile MIDI_EVENT *cur;
-	struct timespec     now;
+	timensec_t          now;
+	timensec_t          tx_time             = 0;
 	struct sched_param  schedparam;
 	pthread_t           thread_id;
-#ifdef ENABLE_DEBUG
-	short               event_latency;
-	unsigned short      end_frame;
-	unsigned short      end_period;
-#endif
+	unsigned char       *msg;
+	ssize_t             tx_len              = 0;
 	unsigned short      cycle_frame;
+	unsigned short      next_frame;
 	unsigned short      period;
 	unsigned short      last_period;
 	unsigned short      all_notes_off       = 0;
 	unsigned char       running_status      = 0xFF;
 	unsigned char       last_running_status = 0xFF;
 	unsigned char       first;
-	unsigned char       sleep_once;
+	unsigned char       sleep_once          = 1;
+	unsigned char       route               = (unsigned char) GPOINTER_TO_INT(arg);
+	unsigned char       queue_num           = J2A_ROUTE_QUEUE(route);
 
 	event->state = EVENT_STATE_ALLOCATED;
 
+	tx.rawmidi        = rawmidi_info[route];
+	tx.queue_num      = queue_num;
+
+	/* 10 bits on the wire per byte */
+	tx.byte_nsecs     = (tx_baud_rate > 0) ?
+		((10 * NSECS_PER_SEC) / tx_baud_rate) : 0;
+	tx.wire_free_time = 0;
+
 	/* set realtime scheduling and priority */
 	thread_id = pthread_self();
-	snprintf(thread_name, 16, "jamrouter%c-tx", ('0' + jamrouter_instance));
+	if (route == 0) {
+		snprintf(thread_name, 16, "jamrouter%c-tx", ('0' + jamrouter_instance));
+	}
+	else {
+		snprintf(thread_name, 16, "jamrouter%c-tx%d", ('0' + jamrouter_instance),
+		         route + 1);
+	}
 	pthread_setname_np(thread_id, thread_name);
 	memset(&schedparam, 0, sizeof(struct sched_param));
 	schedparam.sched_priority = midi_tx_thread_priority;
@@ -1877,16 +2435,17 @@ raw_midi_tx_thread(void *UNUSED(arg))
 	/* setup thread cleanup handler */
 	pthread_cleanup_push(&rawmidi_cleanup, (void *)(thread_id));
 
-	JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Starting Raw MIDI Tx thread...\n");
+	JAMROUTER_DEBUG(DEBUG_CLASS_INIT, "Starting Raw MIDI Tx thread for route %d...\n",
+	                route + 1);
 
 	/* drain MIDI output */
 #ifdef RAWMIDI_FLUSH_ON_START
-	//rawmidi_drain(rawmidi_info);
+	//rawmidi_drain(tx.rawmidi);
 #endif /* RAWMIDI_FLUSH_ON_START */
 
 	/* broadcast the midi ready condition */
 	pthread_mutex_lock(&midi_tx_ready_mutex);
-	midi_tx_ready = 1;
+	midi_tx_ready++;
 	pthread_cond_broadcast(&midi_tx_ready_cond);
 	pthread_mutex_unlock(&midi_tx_ready_mutex);
 
@@ -1913,7 +2472,20 @@ raw_midi_tx_thread(void *UNUSED(arg))
 			cycle_frame = 0;
 		}
 
-		event = dequeue_midi_event(J2A_QUEUE, &last_period, period, cycle_frame);
+		/* skip ahead to the next frame with events queued.  After a missed
+		   period, dequeue even when this period is empty, so events left
+		   in the missed period are recovered (see dequeue_midi_event()). */
+		next_frame = get_next_queued_frame(queue_num, period, cycle_frame);
+		if (next_frame < sync_info[period].buffer_period_size) {
+			cycle_frame = next_frame;
+		}
+		else if (period == sync_info[last_period].next) {
+			cycle_frame = next_frame;
+			continue;
+		}
+
+		event = dequeue_midi_event(queue_num, &last_period, period, cycle_frame,
+		                           NULL);
 
 		/* Look ahead for optional translation of note on/off events */
 		if ( note_on_velocity || note_off_velocity ||
@@ -1968,21 +2540,48 @@ raw_midi_tx_thread(void *UNUSED(arg))
 				                event->channel, event->note);
 			}
 
+			/* shed low priority messages under overload */
+			if (shed_dequeued_event(queue_num, event)) {
+				event->bytes = 0;
+			}
+
 			if (event->bytes > 0) {
+				/* sleep (if necessary) until this frame's Tx time. */
+				if (sleep_once) {
+					sleep_until_frame(period, cycle_frame);
+					time_get_nsecs(&tx_time);
+					sleep_once = 0;
+				}
+				stats_record_queue_delay(queue_num, tx_time,
+				                         event->ingress_time);
+
+				/* wait for the wire when a burst is still going out */
+				tx_len = rawmidi_tx_wire_wait(&tx, period, cycle_frame, tx_len);
+
+				/* make room in the batch for this message.  Channel messages
+				   are always built with three bytes, even when only two of
+				   them are sent. */
+				if ( (tx_len + ((event->type < 0xF0) ? 3 : event->bytes)) >
+				     SYSEX_BUFFER_SIZE ) {
+					rawmidi_write_tx_batch(&tx, period, cycle_frame, tx_len);
+					tx_len = 0;
+				}
+				msg = &(tx.buf[tx_len]);
+
 				/* handle messages with channel number embedded in the first byte */
 				if (event->type < 0xF0) {
 					running_status = (unsigned char)((event->type & 0xF0) |
 					                                 (event->channel & 0x0F));
-					tx_buf[0] = running_status;
-					tx_buf[1] = (unsigned char)event->byte2;
+					msg[0] = running_status;
+					msg[1] = (unsigned char)event->byte2;
 					/* all channel specific messages except program change and
 					   polypressure have 2 bytes following status byte */
 					if ( (event->type == MIDI_EVENT_PROGRAM_CHANGE) ||
 					     (event->type == MIDI_EVENT_POLYPRESSURE)      ) {
-						tx_buf[2] = (unsigned char)0x0;
+						msg[2] = (unsigned char)0x0;
 					}
 					else {
-						tx_buf[2] = (unsigned char)event->byte3;
+						msg[2] = (unsigned char)event->byte3;
 					}
 					/* internal MIDI resync event not needed for JAMRouter's
 					   current design, but may be useful in the future. */
@@ -1995,28 +2594,31 @@ raw_midi_tx_thread(void *UNUSED(arg))
 				}
 				/* handle system (non-channel) messages */
 				else {
-					tx_buf[0] = (unsigned char)(event->type);
+					msg[0] = (unsigned char)(event->type);
 					switch (event->type) {
 					case MIDI_EVENT_SYSEX:          // 0xF0
-						memcpy(tx_buf, (void *)(event->data), event->bytes);
+						memcpy(msg, (void *)(event->data), event->bytes);
 						running_status = 0xFF;
 						break;
 						/* 3 byte system messages */
 					case MIDI_EVENT_SONGPOS:        // 0xF2
-						tx_buf[1] = (unsigned char)event->byte2;
-						tx_buf[2] = (unsigned char)event->byte3;
+						msg[1] = (unsigned char)event->byte2;
+						msg[2] = (unsigned char)event->byte3;
 						running_status = 0xFF;
 						break;
 						/* 2 byte system messages */
 					case MIDI_EVENT_MTC_QFRAME:     // 0xF1
 					case MIDI_EVENT_SONG_SELECT:    // 0xF3
-						tx_buf[1] = (unsigned char)event->byte2;
+						msg[1] = (unsigned char)event->byte2;
 						running_status = 0xFF;
 						break;
-						/* 1 byte realtime messages */
+						/* 1 byte system common messages */
 					case MIDI_EVENT_BUS_SELECT:     // 0xF5
 					case MIDI_EVENT_TUNE_REQUEST:   // 0xF6
 					case MIDI_EVENT_END_SYSEX:      // 0xF7
+						running_status = 0xFF;
+						break;
+						/* 1 byte realtime messages */
 					case MIDI_EVENT_TICK:           // 0xF8
 					case MIDI_EVENT_START:          // 0xFA
 					case MIDI_EVENT_CONTINUE:       // 0xFB
@@ -2042,43 +2644,26 @@ raw_midi_tx_thread(void *UNUSED(arg))
 					}
 				}
 
-				/* Handle event if it has bytes that need to be written */
+				/* Append the message to the batch, with running status
+				   carried across messages in the batch. */
 				if (event->bytes > 0) {
-					if (sleep_once) {
-						sleep_until_frame(period, cycle_frame);
-						sleep_once = 0;
-					}
-#ifdef ENABLE_DEBUG
-					end_period = get_midi_period(&now);
-					end_frame = get_midi_frame(&end_period, &now,
-					                           FRAME_FIX_LOWER);
-#endif /* ENABLE_DEBUG */
-
-					/* Write the event to MIDI hardware */
 					if ( use_running_status &&
-					     (tx_buf[0] == last_running_status) ) {
-						rawmidi_write(rawmidi_info, &(tx_buf[1]),
-						              (ssize_t)(event->bytes) - 1);
+					     (msg[0] == last_running_status) ) {
+						memmove(msg, &(msg[1]), (size_t)(event->bytes - 1));
+						tx_len += (ssize_t)(event->bytes) - 1;
 					}
 					else {
-						rawmidi_write(rawmidi_info, tx_buf,
-						              (ssize_t)(event->bytes));
-						last_running_status = running_status;
+						tx_len += (ssize_t)(event->bytes);
+						if (msg[0] < 0xF8) {
+							last_running_status = running_status;
+						}
 					}
-#ifdef ENABLE_DEBUG
-					event_latency = (short)
-						( ( (sync_info[period].buffer_size + 
-						     sync_info[end_period].tx_index + end_frame) -
-						    (sync_info[period].tx_index + cycle_frame) )
-						  & sync_info[period].buffer_size_mask );
 
-					JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-					                DEBUG_COLOR_GREEN "[%d%+d] "
-					                DEBUG_COLOR_DEFAULT,
-					                cycle_frame, event_latency);
-#endif /* ENABLE_DEBUG */
-					/* optional Tx guard interval between messages */
+					/* optional Tx guard interval between messages requires
+					   writing each message on its own. */
 					if (event_guard_time_usec > 0) {
+						rawmidi_write_tx_batch(&tx, period, cycle_frame, tx_len);
+						tx_len = 0;
 						jamrouter_usleep(event_guard_time_usec);
 					}
 				}
@@ -2087,17 +2672,19 @@ raw_midi_tx_thread(void *UNUSED(arg))
 			/* keep track of next event */
 			next = event->next;
 
-			/* Clear event. */
-			event->type    = 0;
-			event->channel = 0;
-			event->byte2   = 0;
-			event->byte3   = 0;
-			event->next    = NULL;
-			event->state   = EVENT_STATE_FREE;
+			/* return event to the pool. */
+			free_midi_event(queue_num, event);
 
 			/* ready to process next event */
 			event = next;
 		} /* while() */
+
+		/* write all messages for this frame at once */
+		if (tx_len > 0) {
+			rawmidi_write_tx_batch(&tx, period, cycle_frame, tx_len);
+			tx_len = 0;
+		}
+
 		cycle_frame++;
 		sleep_once = 1;
 	} /* while () */
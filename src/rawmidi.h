@@ -24,6 +24,7 @@
 #define _JAMROUTER_RAWMIDI_H_
 
 #include "jamrouter.h"
+#include "midi_event.h"
 
 
 #if !defined(ENABLE_RAWMIDI_OSS) && !defined(ENABLE_RAWMIDI_ALSA_RAW) && !defined(ENABLE_RAWMIDI_GENERIC)
@@ -58,6 +59,12 @@ typedef struct rawmidi_info {
 #if defined(RAWMIDI_ALSA_NONBLOCK) || defined(RAWMIDI_GENERIC_NONBLOCK) || defined(RAWMIDI_USE_POLL) || defined(RAWMIDI_OSS_USE_POLL)
 	struct pollfd       *pfds;
 	int                 npfds;
+#endif
+#if defined(ENABLE_RAWMIDI_OSS) || (defined(ENABLE_RAWMIDI_ALSA_RAW) && defined(RAWMIDI_ALSA_MULTI_BYTE_IO))
+	/* bytes read ahead by rawmidi_read(), kept per device */
+	unsigned char       read_buf[256];
+	int                 read_index;
+	ssize_t             read_available;
 #endif
 	int                 driver;
 } RAWMIDI_INFO;
@@ -81,7 +88,41 @@ typedef struct alsa_rawmidi_hw_info {
 #endif
 
 
-extern RAWMIDI_INFO         *rawmidi_info;
+#define RAWMIDI_PARSE_STATE_IDLE            0
+#define RAWMIDI_PARSE_STATE_DATA            1
+#define RAWMIDI_PARSE_STATE_SYSEX           2
+#define RAWMIDI_PARSE_STATE_SYSEX_EXTRA     3
+
+#define RAWMIDI_PARSE_EVENT                 0x1
+#define RAWMIDI_PARSE_REALTIME              0x2
+#define RAWMIDI_PARSE_REPEAT                0x4
+
+
+/* Raw MIDI Tx state for one route, kept by the route's Tx thread.  The wire
+   model holds the time for one byte on the wire (0 for no pacing), and the
+   predicted time the UART finishes sending all bytes written. */
+typedef struct rawmidi_tx {
+	RAWMIDI_INFO        *rawmidi;
+	unsigned char       buf[SYSEX_BUFFER_SIZE];
+	timensec_t          byte_nsecs;
+	timensec_t          wire_free_time;
+	unsigned char       queue_num;
+} RAWMIDI_TX;
+
+
+typedef struct rawmidi_parser {
+	volatile MIDI_EVENT *event;
+	unsigned short      period;
+	unsigned short      frame;
+	unsigned char       queue_num;
+	unsigned char       state;
+	unsigned char       running_status;
+	unsigned char       data_needed;
+	unsigned char       data_count;
+} RAWMIDI_PARSER;
+
+
+extern RAWMIDI_INFO         *rawmidi_info[MAX_MIDI_ROUTES];
 
 extern ALSA_RAWMIDI_HW_INFO *alsa_rawmidi_rx_hw;
 extern ALSA_RAWMIDI_HW_INFO *alsa_rawmidi_tx_hw;
@@ -97,13 +138,23 @@ RAWMIDI_INFO *rawmidi_open(char *rx_device, char *tx_device, int driver);
 int rawmidi_close(RAWMIDI_INFO *rawmidi);
 int rawmidi_free(RAWMIDI_INFO *rawmidi);
 int rawmidi_read(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len);
+int rawmidi_read_available(RAWMIDI_INFO *rawmidi, unsigned char *buf, int len);
 int rawmidi_write(RAWMIDI_INFO *rawmidi, unsigned char *buf, ssize_t len);
+int rawmidi_write_bytes(RAWMIDI_INFO *rawmidi, unsigned char *buf, ssize_t len);
 int rawmidi_flush(RAWMIDI_INFO *rawmidi);
 void rawmidi_watchdog_cycle(void);
 int rawmidi_init(void);
 void rawmidi_cleanup(void *arg);
-void *raw_midi_rx_thread(void *UNUSED(arg));
-void *raw_midi_tx_thread(void *UNUSED(arg));
+void rawmidi_parser_init(RAWMIDI_PARSER *parser, unsigned char queue_num);
+void rawmidi_parser_start_event(RAWMIDI_PARSER *parser, unsigned char status,
+                                unsigned short period, unsigned short frame);
+int rawmidi_parser_flush_sysex(RAWMIDI_PARSER *parser, unsigned short period);
+int rawmidi_parse_byte(RAWMIDI_PARSER *parser, unsigned char midi_byte,
+                       unsigned short period, unsigned short frame);
+void *raw_midi_rx_thread(void *arg);
+void rawmidi_write_tx_batch(RAWMIDI_TX *tx, unsigned short period,
+                            unsigned short cycle_frame, ssize_t len);
+void *raw_midi_tx_thread(void *arg);
 
 
 #endif /* _JAMROUTER_RAWMIDI_H_ */
@@ -0,0 +1,1027 @@
+/*****************************************************************************
+ *
+ * sim.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "driver.h"
+#include "sim.h"
+#include "debug.h"
+
+
+/* jamrouter-sim:  runs jamrouter against a mock libjack (sim_jack.c) and a
+   scripted raw MIDI device (sim_midi.c), on the virtual clock.  Time only
+   moves once every jamrouter thread is asleep, one wakeup at a time, so a
+   run replays the same way every time, faster than realtime, on any box.
+   Everything seen going in and coming out on either side is recorded, and
+   matched up for a latency and jitter report at the end. */
+
+
+/* harness command line options */
+static struct option sim_long_opts[] = {
+	{ "script",          1, NULL, 's' },
+	{ "generate",        1, NULL, 'g' },
+	{ "rate",            1, NULL, 'r' },
+	{ "period",          1, NULL, 'p' },
+	{ "wakeup-jitter",   1, NULL, 'j' },
+	{ "tail",            1, NULL, 't' },
+	{ "events",          1, NULL, 'e' },
+	{ "max-jitter",      1, NULL, 'm' },
+	{ "seed",            1, NULL, 'S' },
+	{ "help",            0, NULL, 'h' },
+	{ 0,                 0, NULL, 0 }
+};
+
+
+int                     sim_sample_rate         = 48000;
+int                     sim_period_size         = 128;
+int                     sim_wakeup_jitter_usec  = 0;
+int                     sim_capture             = 0;
+
+unsigned char           *sim_input_data         = NULL;
+static size_t           sim_input_data_size     = 0;
+static size_t           sim_input_data_max      = 0;
+
+SIM_INPUT_LIST          sim_jack_input;
+SIM_INPUT_LIST          sim_midi_input;
+
+SIM_STREAM              sim_stream[SIM_STREAMS];
+
+static GRand            *sim_rand               = NULL;
+
+static int              sim_main_done           = 0;
+
+
+/*****************************************************************************
+ * sim_showusage()
+ *****************************************************************************/
+static void
+sim_showusage(char *argvzero)
+{
+	printf("Usage:  %s [sim options] [-- jamrouter options]\n\n", argvzero);
+	printf("Runs jamrouter with the 'sim' MIDI driver against a simulated JACK server\n"
+	       "and MIDI device on a virtual clock, and reports JACK --> MIDI Tx and\n"
+	       "MIDI Rx --> JACK latency and jitter.\n\n"
+	       "Simulation Options:\n\n"
+	       " -s, --script=           Replay script file ('-' for stdin).  One event per\n"
+	       "                           line:  <msec> jack|midi <hex bytes...>\n"
+	       "                           [* <count> <interval msec>].  '#' comments.\n"
+	       " -g, --generate=         Generate this many random messages each way.\n"
+	       " -S, --seed=             Random seed for --generate and --wakeup-jitter.\n"
+	       " -r, --rate=             JACK sample rate (default 48000).\n"
+	       " -p, --period=           JACK period size (default 128).\n"
+	       " -j, --wakeup-jitter=    Max random lateness of JACK process wakeups, in\n"
+	       "                           microseconds (default 0).\n"
+	       " -t, --tail=             Run on this many msec after the last input\n"
+	       "                           (default 1000).\n"
+	       " -e, --events=           Write every message matched or lost as CSV.\n"
+	       " -m, --max-jitter=       Fail when peak to peak jitter exceeds this many\n"
+	       "                           microseconds.\n"
+	       " -h, --help              Display this help message.\n\n"
+	       "Exit status is 0 on success, 1 when messages are lost, duplicated, or\n"
+	       "over --max-jitter, and 2 on error.\n\n");
+}
+
+
+/*****************************************************************************
+ * sim_random()
+ *
+ * Returns the next number from the harness random number generator, seeded
+ * with --seed for runs that repeat.
+ *****************************************************************************/
+guint32
+sim_random(void)
+{
+	return g_rand_int(sim_rand);
+}
+
+
+/*****************************************************************************
+ * sim_input_add()
+ *
+ * Adds a scripted burst of <len> bytes at virtual clock time <time>.
+ *****************************************************************************/
+static void
+sim_input_add(SIM_INPUT_LIST *list, timensec_t time, unsigned char *buf, size_t len)
+{
+	SIM_INPUT       *input;
+
+	if (sim_input_data_size + len > sim_input_data_max) {
+		sim_input_data_max = (sim_input_data_max + len) * 2;
+		sim_input_data = g_realloc(sim_input_data, sim_input_data_max);
+	}
+	if (list->count >= list->size) {
+		list->size  = (list->size + 64) * 2;
+		list->input = g_realloc(list->input, list->size * sizeof(SIM_INPUT));
+	}
+
+	input         = &(list->input[list->count++]);
+	input->time   = time;
+	input->offset = sim_input_data_size;
+	input->bytes  = len;
+
+	memcpy(&(sim_input_data[sim_input_data_size]), buf, len);
+	sim_input_data_size += len;
+}
+
+
+/*****************************************************************************
+ * sim_input_compare()
+ *
+ * Orders scripted input by time, and in script order within the same time.
+ *****************************************************************************/
+static int
+sim_input_compare(const void *a, const void *b)
+{
+	const SIM_INPUT     *ia = (const SIM_INPUT *) a;
+	const SIM_INPUT     *ib = (const SIM_INPUT *) b;
+
+	if (ia->time != ib->time) {
+		return (ia->time < ib->time) ? -1 : 1;
+	}
+	if (ia->offset != ib->offset) {
+		return (ia->offset < ib->offset) ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * sim_load_script()
+ *
+ * Reads replay script <name> ('-' for stdin).  Returns 0 on success, or -1
+ * after reporting the first line in error.
+ *****************************************************************************/
+static int
+sim_load_script(const char *name)
+{
+	FILE            *fp;
+	SIM_INPUT_LIST  *list;
+	char            line[4096];
+	char            *tok;
+	char            *save;
+	char            *end;
+	unsigned char   bytes[1024];
+	timensec_t      time;
+	double          msec;
+	double          interval    = 0.0;
+	unsigned long   value;
+	long            count;
+	long            j;
+	size_t          len;
+	int             line_num    = 0;
+	int             error       = 0;
+
+	if (strcmp(name, "-") == 0) {
+		fp = stdin;
+	}
+	else if ((fp = fopen(name, "r")) == NULL) {
+		fprintf(stderr, "Unable to open script '%s':  %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_num++;
+		if ((end = strchr(line, '#')) != NULL) {
+			*end = '\0';
+		}
+		if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL) {
+			continue;
+		}
+		error = 1;
+
+		/* time */
+		msec = strtod(tok, &end);
+		if ((*end != '\0') || (msec < 0.0)) {
+			break;
+		}
+
+		/* side */
+		if ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL) {
+			break;
+		}
+		if (strcmp(tok, "jack") == 0) {
+			list = &sim_jack_input;
+		}
+		else if (strcmp(tok, "midi") == 0) {
+			list = &sim_midi_input;
+		}
+		else {
+			break;
+		}
+
+		/* bytes, then optional repeat */
+		len   = 0;
+		count = 1;
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if (strcmp(tok, "*") == 0) {
+				if ( ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL) ||
+				     ((count = strtol(tok, &end, 10)) < 1) || (*end != '\0') ||
+				     ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL) ||
+				     ((interval = strtod(tok, &end)) < 0.0) || (*end != '\0') ) {
+					count = 0;
+				}
+				break;
+			}
+			value = strtoul(tok, &end, 16);
+			if ((*end != '\0') || (value > 0xFF) || (len >= sizeof(bytes))) {
+				len = 0;
+				break;
+			}
+			bytes[len++] = (unsigned char) value;
+		}
+		if ((len == 0) || (count == 0)) {
+			break;
+		}
+		if ((list == &sim_jack_input) && (bytes[0] < 0x80)) {
+			break;
+		}
+
+		for (j = 0; j < count; j++) {
+			time = SIM_SCRIPT_START +
+				(timensec_t)((msec + ((double) j * interval)) * 1000000.0);
+			sim_input_add(list, time, bytes, len);
+		}
+		error = 0;
+	}
+
+	if (error) {
+		fprintf(stderr, "Error in script '%s' at line %d.\n", name, line_num);
+		if (fp != stdin) {
+			fclose(fp);
+		}
+		return -1;
+	}
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * sim_generate_message()
+ *
+ * Fills <buf> with a random message, and returns its length.  Mostly notes
+ * and controllers, with some pitchbend, program changes, and short SysEx.
+ *****************************************************************************/
+static size_t
+sim_generate_message(unsigned char *buf)
+{
+	guint32         kind    = sim_random() % 100;
+	unsigned char   channel = (unsigned char)(sim_random() & 0x0F);
+	size_t          len;
+	size_t          j;
+
+	if (kind < 35) {
+		buf[0] = (unsigned char)(0x90 | channel);
+		buf[1] = (unsigned char)(sim_random() & 0x7F);
+		buf[2] = (unsigned char)(1 + (sim_random() % 127));
+		return 3;
+	}
+	if (kind < 65) {
+		buf[0] = (unsigned char)(0x80 | channel);
+		buf[1] = (unsigned char)(sim_random() & 0x7F);
+		buf[2] = (unsigned char)(sim_random() & 0x7F);
+		return 3;
+	}
+	if (kind < 85) {
+		buf[0] = (unsigned char)(0xB0 | channel);
+		buf[1] = (unsigned char)(sim_random() % 120);
+		buf[2] = (unsigned char)(sim_random() & 0x7F);
+		return 3;
+	}
+	if (kind < 93) {
+		buf[0] = (unsigned char)(0xE0 | channel);
+		buf[1] = (unsigned char)(sim_random() & 0x7F);
+		buf[2] = (unsigned char)(sim_random() & 0x7F);
+		return 3;
+	}
+	if (kind < 98) {
+		buf[0] = (unsigned char)(0xC0 | channel);
+		buf[1] = (unsigned char)(sim_random() & 0x7F);
+		return 2;
+	}
+
+	/* non-commercial SysEx */
+	len    = 3 + (sim_random() % 32);
+	buf[0] = 0xF0;
+	buf[1] = 0x7D;
+	for (j = 2; j < (len - 1); j++) {
+		buf[j] = (unsigned char)(sim_random() & 0x7F);
+	}
+	buf[len - 1] = 0xF7;
+
+	return len;
+}
+
+
+/*****************************************************************************
+ * sim_generate()
+ *
+ * Adds <count> random messages each way, a random 0-20 msec apart.
+ *****************************************************************************/
+static void
+sim_generate(long count)
+{
+	unsigned char   buf[64];
+	timensec_t      jack_time   = SIM_SCRIPT_START;
+	timensec_t      midi_time   = SIM_SCRIPT_START;
+	size_t          len;
+	long            j;
+
+	for (j = 0; j < count; j++) {
+		jack_time += (timensec_t)(sim_random() % 20000) * 1000;
+		len = sim_generate_message(buf);
+		sim_input_add(&sim_jack_input, jack_time, buf, len);
+
+		midi_time += (timensec_t)(sim_random() % 20000) * 1000;
+		len = sim_generate_message(buf);
+		sim_input_add(&sim_midi_input, midi_time, buf, len);
+	}
+}
+
+
+/*****************************************************************************
+ * sim_data_bytes()
+ *
+ * Returns the number of data bytes following (non-SysEx) status <status>.
+ *****************************************************************************/
+static unsigned char
+sim_data_bytes(unsigned char status)
+{
+	switch (status & 0xF0) {
+	case 0xC0:
+	case 0xD0:
+		return 1;
+	case 0xF0:
+		switch (status) {
+		case 0xF1:
+		case 0xF3:
+			return 1;
+		case 0xF2:
+			return 2;
+		}
+		return 0;
+	}
+	return 2;
+}
+
+
+/*****************************************************************************
+ * sim_stream_append()
+ *****************************************************************************/
+static void
+sim_stream_append(SIM_STREAM *s, unsigned char byte)
+{
+	if (s->data_size >= s->max_data) {
+		s->max_data = (s->max_data + 256) * 2;
+		s->data     = g_realloc(s->data, s->max_data);
+	}
+	s->data[s->data_size++] = byte;
+}
+
+
+/*****************************************************************************
+ * sim_stream_start()
+ *****************************************************************************/
+static void
+sim_stream_start(SIM_STREAM *s, timensec_t time, unsigned char status)
+{
+	s->start_time   = time;
+	s->start_offset = s->data_size;
+	s->in_message   = 1;
+	s->data_count   = 0;
+	sim_stream_append(s, status);
+}
+
+
+/*****************************************************************************
+ * sim_stream_finish()
+ *
+ * Ends the message being put together, with note-off in one form only:
+ * 8n, with release velocity 0.
+ *****************************************************************************/
+static void
+sim_stream_finish(SIM_STREAM *s)
+{
+	SIM_MESSAGE     *msg;
+	unsigned char   *data = &(s->data[s->start_offset]);
+	size_t          bytes = s->data_size - s->start_offset;
+
+	if ( (bytes == 3) &&
+	     ( ((data[0] & 0xF0) == 0x80) ||
+	       (((data[0] & 0xF0) == 0x90) && (data[2] == 0)) ) ) {
+		data[0] = (unsigned char)(0x80 | (data[0] & 0x0F));
+		data[2] = 0;
+	}
+
+	if (s->num_messages >= s->max_messages) {
+		s->max_messages = (s->max_messages + 256) * 2;
+		s->message = g_realloc(s->message, s->max_messages * sizeof(SIM_MESSAGE));
+	}
+	msg         = &(s->message[s->num_messages++]);
+	msg->time   = s->start_time;
+	msg->offset = s->start_offset;
+	msg->bytes  = bytes;
+	msg->match  = -1;
+
+	s->in_message = 0;
+	s->in_sysex   = 0;
+}
+
+
+/*****************************************************************************
+ * sim_stream_bytes()
+ *
+ * Records <len> bytes seen at <time> on harness stream <stream>, putting
+ * them back together into whole messages, timed by their first byte.
+ * Running status is expanded, SysEx fragments are joined, and realtime
+ * messages are taken out from within others.  A message cut short by a new
+ * status is dropped, as a receiver would drop it.  Each stream is only ever
+ * written by one thread.
+ *****************************************************************************/
+void
+sim_stream_bytes(int stream, timensec_t time, unsigned char *buf, size_t len)
+{
+	SIM_STREAM      *s = &(sim_stream[stream]);
+	unsigned char   byte;
+	size_t          partial;
+	size_t          j;
+
+	for (j = 0; j < len; j++) {
+		byte = buf[j];
+
+		/* realtime:  a message of its own, ahead of any in progress */
+		if (byte >= 0xF8) {
+			if (s->in_message) {
+				sim_stream_append(s, 0);
+				partial = s->data_size - 1 - s->start_offset;
+				memmove(&(s->data[s->start_offset + 1]),
+				        &(s->data[s->start_offset]), partial);
+				s->data[s->start_offset] = byte;
+				s->start_offset++;
+			}
+			else {
+				sim_stream_append(s, byte);
+			}
+			if (s->num_messages >= s->max_messages) {
+				s->max_messages = (s->max_messages + 256) * 2;
+				s->message = g_realloc(s->message,
+				                       s->max_messages * sizeof(SIM_MESSAGE));
+			}
+			s->message[s->num_messages].time   = time;
+			s->message[s->num_messages].offset = s->in_message ?
+				(s->start_offset - 1) : (s->data_size - 1);
+			s->message[s->num_messages].bytes  = 1;
+			s->message[s->num_messages].match  = -1;
+			s->num_messages++;
+			continue;
+		}
+
+		/* status */
+		if (byte & 0x80) {
+			if ((byte == 0xF7) && s->in_sysex) {
+				sim_stream_append(s, byte);
+				sim_stream_finish(s);
+				continue;
+			}
+			if (s->in_message) {
+				s->data_size  = s->start_offset;
+				s->in_message = 0;
+				s->in_sysex   = 0;
+			}
+			if (byte == 0xF7) {
+				continue;
+			}
+			sim_stream_start(s, time, byte);
+			if (byte == 0xF0) {
+				s->in_sysex       = 1;
+				s->running_status = 0;
+				continue;
+			}
+			s->running_status = (byte < 0xF0) ? byte : 0;
+			s->data_needed    = sim_data_bytes(byte);
+			if (s->data_needed == 0) {
+				sim_stream_finish(s);
+			}
+			continue;
+		}
+
+		/* data */
+		if (s->in_sysex) {
+			sim_stream_append(s, byte);
+			continue;
+		}
+		if (!s->in_message) {
+			if (s->running_status == 0) {
+				continue;
+			}
+			sim_stream_start(s, time, s->running_status);
+			s->data_needed = sim_data_bytes(s->running_status);
+		}
+		sim_stream_append(s, byte);
+		if (++(s->data_count) >= s->data_needed) {
+			sim_stream_finish(s);
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * sim_message_equal()
+ *****************************************************************************/
+static int
+sim_message_equal(SIM_STREAM *a, SIM_MESSAGE *ma, SIM_STREAM *b, SIM_MESSAGE *mb)
+{
+	return ( (ma->bytes == mb->bytes) &&
+	         (memcmp(&(a->data[ma->offset]), &(b->data[mb->offset]), ma->bytes) == 0) );
+}
+
+
+/*****************************************************************************
+ * sim_match()
+ *
+ * Pairs each message out with the oldest message in, not yet paired, with
+ * the same bytes and no later than it.
+ *****************************************************************************/
+static void
+sim_match(SIM_STREAM *in, SIM_STREAM *out)
+{
+	SIM_MESSAGE     *mo;
+	SIM_MESSAGE     *mi;
+	size_t          first       = 0;
+	size_t          j;
+	size_t          k;
+
+	for (j = 0; j < out->num_messages; j++) {
+		mo = &(out->message[j]);
+		while ((first < in->num_messages) && (in->message[first].match >= 0)) {
+			first++;
+		}
+		for (k = first; (k < in->num_messages) && (k < first + SIM_MATCH_WINDOW); k++) {
+			mi = &(in->message[k]);
+			if (mi->time > mo->time) {
+				break;
+			}
+			if ((mi->match < 0) && sim_message_equal(in, mi, out, mo)) {
+				mi->match = (long) j;
+				mo->match = (long) k;
+				break;
+			}
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * sim_latency_compare()
+ *****************************************************************************/
+static int
+sim_latency_compare(const void *a, const void *b)
+{
+	gint64      la = *((const gint64 *) a);
+	gint64      lb = *((const gint64 *) b);
+
+	return (la < lb) ? -1 : ((la > lb) ? 1 : 0);
+}
+
+
+/*****************************************************************************
+ * sim_write_events()
+ *
+ * Writes one CSV line per message in, matched or lost, and one per message
+ * out that matched nothing.
+ *****************************************************************************/
+static void
+sim_write_events(FILE *fp, const char *name, SIM_STREAM *in, SIM_STREAM *out)
+{
+	SIM_MESSAGE     *mi;
+	SIM_MESSAGE     *mo;
+	SIM_STREAM      *s;
+	SIM_MESSAGE     *m;
+	size_t          j;
+	size_t          k;
+
+	for (j = 0; j < in->num_messages + out->num_messages; j++) {
+		if (j < in->num_messages) {
+			s  = in;
+			m  = mi = &(in->message[j]);
+			mo = (mi->match >= 0) ? &(out->message[mi->match]) : NULL;
+		}
+		else {
+			s  = out;
+			m  = mo = &(out->message[j - in->num_messages]);
+			mi = NULL;
+			if (mo->match >= 0) {
+				continue;
+			}
+		}
+		fprintf(fp, "%s,", name);
+		if (mi != NULL) {
+			fprintf(fp, "%" G_GINT64_FORMAT, mi->time - SIM_SCRIPT_START);
+		}
+		fprintf(fp, ",");
+		if (mo != NULL) {
+			fprintf(fp, "%" G_GINT64_FORMAT, mo->time - SIM_SCRIPT_START);
+		}
+		fprintf(fp, ",");
+		if ((mi != NULL) && (mo != NULL)) {
+			fprintf(fp, "%" G_GINT64_FORMAT, mo->time - mi->time);
+		}
+		fprintf(fp, ",%s,", (mi == NULL) ? "extra" : ((mo == NULL) ? "lost" : "ok"));
+		for (k = 0; k < m->bytes; k++) {
+			fprintf(fp, "%s%02X", (k > 0) ? " " : "", s->data[m->offset + k]);
+		}
+		fprintf(fp, "\n");
+	}
+}
+
+
+/*****************************************************************************
+ * sim_report()
+ *
+ * Prints message counts, latency, and jitter for one direction.  Returns
+ * nonzero when messages were lost or duplicated, or when peak to peak
+ * jitter exceeds <max_jitter_usec> (when set).
+ *****************************************************************************/
+static int
+sim_report(const char *name, SIM_STREAM *in, SIM_STREAM *out, int max_jitter_usec)
+{
+	gint64          *latency;
+	gint64          histogram[SIM_HISTOGRAM_BUCKETS];
+	gint64          sum         = 0;
+	gint64          peak        = 0;
+	gint64          bucket;
+	double          mean;
+	double          variance    = 0.0;
+	size_t          matched     = 0;
+	size_t          lost        = 0;
+	size_t          extra       = 0;
+	size_t          j;
+	int             bar;
+	int             failed      = 0;
+	static const double percentile[] = { 50.0, 90.0, 99.0, 99.9 };
+
+	latency = g_malloc((in->num_messages + 1) * sizeof(gint64));
+	for (j = 0; j < in->num_messages; j++) {
+		if (in->message[j].match >= 0) {
+			latency[matched++] = out->message[in->message[j].match].time -
+				in->message[j].time;
+		}
+		else {
+			lost++;
+		}
+	}
+	for (j = 0; j < out->num_messages; j++) {
+		if (out->message[j].match < 0) {
+			extra++;
+		}
+	}
+
+	printf("%s:  %lu in,  %lu out,  %lu lost,  %lu extra\n", name,
+	       (unsigned long) in->num_messages, (unsigned long) out->num_messages,
+	       (unsigned long) lost, (unsigned long) extra);
+	if ((lost > 0) || (extra > 0)) {
+		failed = 1;
+	}
+
+	if (matched > 0) {
+		qsort(latency, matched, sizeof(gint64), sim_latency_compare);
+		for (j = 0; j < matched; j++) {
+			sum += latency[j];
+		}
+		mean = (double) sum / (double) matched;
+		for (j = 0; j < matched; j++) {
+			variance += ((double) latency[j] - mean) * ((double) latency[j] - mean);
+		}
+		variance /= (double) matched;
+		peak = latency[matched - 1] - latency[0];
+
+		printf("  latency (msec):  min %.3f  avg %.3f  max %.3f\n",
+		       (double) latency[0] / 1000000.0, mean / 1000000.0,
+		       (double) latency[matched - 1] / 1000000.0);
+		printf("  percentiles (msec):");
+		for (j = 0; j < (sizeof(percentile) / sizeof(percentile[0])); j++) {
+			printf("  %g%% %.3f", percentile[j],
+			       (double) latency[(size_t)((percentile[j] / 100.0) *
+			                                 (double)(matched - 1) + 0.5)] / 1000000.0);
+		}
+		printf("\n");
+		printf("  jitter (usec):  peak to peak %.1f  std dev %.1f\n",
+		       (double) peak / 1000.0, sqrt(variance) / 1000.0);
+
+		/* jitter histogram, above the minimum latency */
+		memset(histogram, 0, sizeof(histogram));
+		for (j = 0; j < matched; j++) {
+			bucket = (latency[j] - latency[0]) / SIM_HISTOGRAM_NSEC;
+			if (bucket >= SIM_HISTOGRAM_BUCKETS) {
+				bucket = SIM_HISTOGRAM_BUCKETS - 1;
+			}
+			histogram[bucket]++;
+		}
+		for (bucket = 0; bucket < SIM_HISTOGRAM_BUCKETS; bucket++) {
+			if (histogram[bucket] == 0) {
+				continue;
+			}
+			printf("  %s%6" G_GINT64_FORMAT " usec %8" G_GINT64_FORMAT "  ",
+			       (bucket == (SIM_HISTOGRAM_BUCKETS - 1)) ? ">=" : "+ ",
+			       (bucket * SIM_HISTOGRAM_NSEC) / 1000, histogram[bucket]);
+			for (bar = 0; bar < (int)((histogram[bucket] * 50) / (gint64) matched); bar++) {
+				printf("#");
+			}
+			printf("\n");
+		}
+
+		if ((max_jitter_usec > 0) && (peak > ((gint64) max_jitter_usec * 1000))) {
+			printf("  peak to peak jitter over %d usec.\n", max_jitter_usec);
+			failed = 1;
+		}
+	}
+	printf("\n");
+
+	g_free(latency);
+
+	return failed;
+}
+
+
+/*****************************************************************************
+ * sim_jamrouter_thread()
+ *
+ * Runs jamrouter, as it would run from main(), with the argument vector
+ * built by main() below.
+ *****************************************************************************/
+static void *
+sim_jamrouter_thread(void *arg)
+{
+	char    **argv  = (char **) arg;
+	int     argc    = 0;
+
+	while (argv[argc] != NULL) {
+		argc++;
+	}
+	jamrouter_main(argc, argv);
+
+	g_atomic_int_set(&sim_main_done, 1);
+
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * sim_ready()
+ *
+ * Returns nonzero once jamrouter has JACK and both MIDI threads running.
+ *****************************************************************************/
+static int
+sim_ready(void)
+{
+	return ( jack_audio_ready &&
+	         ((midi_rx_thread_func == NULL) || midi_rx_ready) &&
+	         ((midi_tx_thread_func == NULL) || midi_tx_ready) );
+}
+
+
+/*****************************************************************************
+ * main()
+ *
+ * Loads or generates the input, starts jamrouter on the virtual clock, and
+ * steps the clock from one thread wakeup to the next until the input has
+ * all gone in and the tail has run out, then reports.
+ *****************************************************************************/
+int
+main(int argc, char **argv)
+{
+	pthread_t       jamrouter_thread;
+	FILE            *events_fp      = NULL;
+	char            **jamrouter_argv;
+	char            *script_name    = NULL;
+	char            *events_name    = NULL;
+	timensec_t      end_time        = SIM_SCRIPT_START;
+	timensec_t      deadline;
+	gint64          limit;
+	long            generate        = 0;
+	long            stalls          = 0;
+	long            steps           = 0;
+	int             tail_msec       = 1000;
+	int             max_jitter_usec = 0;
+	int             threads;
+	int             stalled         = 0;
+	int             failed          = 0;
+	int             c;
+	int             j;
+	guint32         seed            = 1;
+
+	setlocale(LC_ALL, "C");
+
+	for (;;) {
+		c = getopt_long(argc, argv, "+s:g:r:p:j:t:e:m:S:h", sim_long_opts, NULL);
+		if (c == -1) {
+			break;
+		}
+		switch (c) {
+		case 's':
+			script_name = optarg;
+			break;
+		case 'g':
+			generate = atol(optarg);
+			break;
+		case 'r':
+			sim_sample_rate = atoi(optarg);
+			break;
+		case 'p':
+			sim_period_size = atoi(optarg);
+			break;
+		case 'j':
+			sim_wakeup_jitter_usec = atoi(optarg);
+			break;
+		case 't':
+			tail_msec = atoi(optarg);
+			break;
+		case 'e':
+			events_name = optarg;
+			break;
+		case 'm':
+			max_jitter_usec = atoi(optarg);
+			break;
+		case 'S':
+			seed = (guint32) strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			sim_showusage(argv[0]);
+			return 0;
+		default:
+			sim_showusage(argv[0]);
+			return 2;
+		}
+	}
+	if ( ((script_name == NULL) && (generate <= 0)) ||
+	     (sim_sample_rate < 8000) || (sim_period_size < 16) ||
+	     (sim_period_size > MAX_BUFFER_SIZE) ||
+	     (sim_wakeup_jitter_usec < 0) || (tail_msec < 0) ) {
+		sim_showusage(argv[0]);
+		return 2;
+	}
+
+	sim_rand = g_rand_new_with_seed(seed);
+	memset(&sim_jack_input, 0, sizeof(sim_jack_input));
+	memset(&sim_midi_input, 0, sizeof(sim_midi_input));
+	memset(sim_stream, 0, sizeof(sim_stream));
+
+	if ((script_name != NULL) && (sim_load_script(script_name) != 0)) {
+		return 2;
+	}
+	if (generate > 0) {
+		sim_generate(generate);
+	}
+	qsort(sim_jack_input.input, sim_jack_input.count, sizeof(SIM_INPUT),
+	      sim_input_compare);
+	qsort(sim_midi_input.input, sim_midi_input.count, sizeof(SIM_INPUT),
+	      sim_input_compare);
+	if (sim_jack_input.count > 0) {
+		end_time = sim_jack_input.input[sim_jack_input.count - 1].time;
+	}
+	if ( (sim_midi_input.count > 0) &&
+	     (sim_midi_input.input[sim_midi_input.count - 1].time > end_time) ) {
+		end_time = sim_midi_input.input[sim_midi_input.count - 1].time;
+	}
+	end_time += (timensec_t) tail_msec * 1000000;
+	sim_midi_init();
+
+	if ( (events_name != NULL) &&
+	     ((events_fp = fopen(events_name, "w")) == NULL) ) {
+		fprintf(stderr, "Unable to open '%s':  %s\n", events_name, strerror(errno));
+		return 2;
+	}
+
+	/* jamrouter gets the sim driver, then whatever is left over */
+	jamrouter_argv = g_malloc(((size_t)(argc - optind) + 4) * sizeof(char *));
+	jamrouter_argv[0] = "jamrouter";
+	jamrouter_argv[1] = "-M";
+	jamrouter_argv[2] = "sim";
+	for (j = optind; j < argc; j++) {
+		jamrouter_argv[j - optind + 3] = argv[j];
+	}
+	jamrouter_argv[argc - optind + 3] = NULL;
+	optind = 0;
+
+	virtual_clock_start(SIM_CLOCK_START);
+	g_atomic_int_set(&sim_capture, 1);
+
+	if (pthread_create(&jamrouter_thread, NULL,
+	                   &sim_jamrouter_thread, jamrouter_argv) != 0) {
+		fprintf(stderr, "Unable to start jamrouter thread.\n");
+		return 2;
+	}
+
+	/* jamrouter starts up in real time, with the virtual clock held */
+	limit = g_get_monotonic_time() + ((gint64) SIM_STARTUP_MSEC * 1000);
+	while (!sim_ready() && !pending_shutdown && !g_atomic_int_get(&sim_main_done)) {
+		if (g_get_monotonic_time() > limit) {
+			break;
+		}
+		usleep(10000);
+	}
+	if (!sim_ready() || pending_shutdown) {
+		fprintf(stderr, "jamrouter did not start.\n");
+		failed = 2;
+	}
+	threads = 1 + (midi_rx_thread_func != NULL) + (midi_tx_thread_func != NULL);
+
+	/* step from one wakeup to the next, once every thread is asleep */
+	while (!failed && !pending_shutdown) {
+		if (virtual_clock_wait_sleepers(threads, SIM_STALL_MSEC) != 0) {
+			stalls++;
+			if (++stalled >= 5) {
+				fprintf(stderr, "jamrouter threads stopped sleeping "
+				        "on the virtual clock.\n");
+				failed = 2;
+				break;
+			}
+		}
+		else {
+			stalled = 0;
+		}
+		if ((deadline = virtual_clock_next_deadline()) < 0) {
+			continue;
+		}
+		if (deadline > end_time) {
+			break;
+		}
+		virtual_clock_step();
+		steps++;
+	}
+
+	/* keep time moving while jamrouter shuts down */
+	g_atomic_int_set(&sim_capture, 0);
+	jamrouter_shutdown(NULL);
+	limit = g_get_monotonic_time() + ((gint64) SIM_STALL_MSEC * 1000);
+	while (!g_atomic_int_get(&sim_main_done) && (g_get_monotonic_time() < limit)) {
+		virtual_clock_wait_sleepers(threads, 10);
+		if (virtual_clock_step() < 0) {
+			usleep(1000);
+		}
+	}
+	virtual_clock_stop();
+	pthread_join(jamrouter_thread, NULL);
+
+	if (failed) {
+		return failed;
+	}
+
+	sim_match(&(sim_stream[SIM_JACK_IN]), &(sim_stream[SIM_MIDI_OUT]));
+	sim_match(&(sim_stream[SIM_MIDI_IN]), &(sim_stream[SIM_JACK_OUT]));
+
+	printf("\nJAMRouter simulation:  %d Hz,  %d frames per period,  "
+	       "%d usec wakeup jitter,  seed %u\n",
+	       sim_sample_rate, sim_period_size, sim_wakeup_jitter_usec, seed);
+	printf("%ld clock steps,  %ld stalls\n\n", steps, stalls);
+
+	failed |= sim_report("JACK --> MIDI Tx",
+	                     &(sim_stream[SIM_JACK_IN]), &(sim_stream[SIM_MIDI_OUT]),
+	                     max_jitter_usec);
+	failed |= sim_report("MIDI Rx --> JACK",
+	                     &(sim_stream[SIM_MIDI_IN]), &(sim_stream[SIM_JACK_OUT]),
+	                     max_jitter_usec);
+
+	if (events_fp != NULL) {
+		fprintf(events_fp, "direction,in_nsec,out_nsec,latency_nsec,result,bytes\n");
+		sim_write_events(events_fp, "jack-midi",
+		                 &(sim_stream[SIM_JACK_IN]), &(sim_stream[SIM_MIDI_OUT]));
+		sim_write_events(events_fp, "midi-jack",
+		                 &(sim_stream[SIM_MIDI_IN]), &(sim_stream[SIM_JACK_OUT]));
+		fclose(events_fp);
+	}
+
+	return failed;
+}
@@ -0,0 +1,156 @@
+/*****************************************************************************
+ *
+ * sim.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_SIM_H_
+#define _JAMROUTER_SIM_H_
+
+#include <sys/types.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+
+
+#ifndef ENABLE_VIRTUAL_CLOCK
+# error "The simulation harness needs ENABLE_VIRTUAL_CLOCK."
+#endif
+
+
+/* Virtual clock time at which every simulation starts. */
+#define SIM_CLOCK_START             G_GINT64_CONSTANT(1000000000)
+
+/* Script time zero, after the JACK and MIDI threads have had time to settle
+   into the clock (and out of the virtual clock start). */
+#define SIM_SETTLE_NSEC             G_GINT64_CONSTANT(500000000)
+#define SIM_SCRIPT_START            (SIM_CLOCK_START + SIM_SETTLE_NSEC)
+
+/* Real time allowed for a woken thread to go back to sleep on the virtual
+   clock before the harness gives up on it and steps the clock anyway. */
+#define SIM_STALL_MSEC              2000
+
+/* Real time allowed for jamrouter to start its JACK and MIDI threads. */
+#define SIM_STARTUP_MSEC            10000
+
+/* The scripted MIDI device wakes its reader at least this often when idle,
+   like the 1 msec poll() timeout of the real drivers. */
+#define SIM_MIDI_POLL_NSEC          1000000
+
+/* Wire time of one MIDI byte (start, 8 data, stop bits) on scripted Rx. */
+#define SIM_MIDI_BYTE_NSEC          ((NSECS_PER_SEC * 10) / MIDI_BAUD_RATE)
+
+/* Room in each mock JACK MIDI port buffer, per period. */
+#define SIM_JACK_MAX_EVENTS         1024
+#define SIM_JACK_BUFFER_BYTES       32768
+
+/* How far ahead of the oldest unmatched message a received message is
+   looked for, when matching output to input. */
+#define SIM_MATCH_WINDOW            4096
+
+/* Latency jitter histogram:  one bucket per SIM_HISTOGRAM_NSEC above the
+   minimum latency, with everything beyond the last in the last. */
+#define SIM_HISTOGRAM_NSEC          20000
+#define SIM_HISTOGRAM_BUCKETS       32
+
+
+/* Streams of MIDI messages seen by the harness.  Scripted input is
+   recorded when it is handed to jamrouter, and output when it leaves. */
+#define SIM_JACK_IN                 0   /* JACK midi_in, as delivered */
+#define SIM_MIDI_OUT                1   /* MIDI Tx, at wire start */
+#define SIM_MIDI_IN                 2   /* MIDI Rx, at wire start */
+#define SIM_JACK_OUT                3   /* JACK midi_out, as played */
+#define SIM_STREAMS                 4
+
+
+/* One scripted burst of bytes, for JACK midi_in (one JACK event) or for
+   MIDI Rx (any bytes, sent back to back on the wire). */
+typedef struct sim_input {
+	timensec_t          time;
+	size_t              offset;             /* into sim_input_data */
+	size_t              bytes;
+} SIM_INPUT;
+
+/* A scripted input list, in time order. */
+typedef struct sim_input_list {
+	SIM_INPUT           *input;
+	size_t              count;
+	size_t              size;
+	size_t              next;               /* first not yet delivered */
+} SIM_INPUT_LIST;
+
+/* One complete MIDI message, timed by its first byte. */
+typedef struct sim_message {
+	timensec_t          time;
+	size_t              offset;             /* into the stream's data */
+	size_t              bytes;
+	long                match;              /* other side, or -1 */
+} SIM_MESSAGE;
+
+/* Messages put back together from bytes, with running status expanded and
+   SysEx fragments joined, so that both sides compare byte for byte. */
+typedef struct sim_stream {
+	SIM_MESSAGE         *message;
+	size_t              num_messages;
+	size_t              max_messages;
+	unsigned char       *data;
+	size_t              data_size;
+	size_t              max_data;
+	timensec_t          start_time;         /* of message being parsed */
+	size_t              start_offset;
+	unsigned char       running_status;
+	unsigned char       data_needed;
+	unsigned char       data_count;
+	unsigned char       in_message;
+	unsigned char       in_sysex;
+} SIM_STREAM;
+
+
+extern int                  sim_sample_rate;
+extern int                  sim_period_size;
+extern int                  sim_wakeup_jitter_usec;
+extern int                  sim_capture;
+
+extern unsigned char        *sim_input_data;
+extern SIM_INPUT_LIST       sim_jack_input;
+extern SIM_INPUT_LIST       sim_midi_input;
+
+extern SIM_STREAM           sim_stream[SIM_STREAMS];
+
+
+/* jamrouter.c */
+int  jamrouter_main(int argc, char **argv);
+
+/* sim.c */
+void sim_stream_bytes(int stream,
+                      timensec_t time,
+                      unsigned char *buf,
+                      size_t len);
+guint32 sim_random(void);
+
+/* sim_jack.c */
+timensec_t sim_jack_frame_time(guint64 frame);
+
+/* sim_midi.c */
+void sim_midi_init(void);
+int  sim_midi_read(unsigned char *buf, int len);
+int  sim_midi_write(unsigned char *buf, ssize_t len);
+
+
+#endif /* _JAMROUTER_SIM_H_ */
@@ -0,0 +1,704 @@
+/*****************************************************************************
+ *
+ * sim_jack.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "sim.h"
+#include "debug.h"
+
+#ifdef HAVE_JACK_SESSION_H
+# include <jack/session.h>
+#endif
+
+
+/* The parts of libjack used by jamrouter, in place of a JACK server.  There
+   is one client, with no other clients or ports to connect to.  Its process
+   thread runs one cycle per period on the virtual clock, with scripted JACK
+   MIDI input on the first "midi_in" port, and records what comes out of the
+   first "midi_out" port. */
+
+
+/* One period of a JACK MIDI port buffer. */
+typedef struct sim_jack_buffer {
+	jack_midi_event_t   event[SIM_JACK_MAX_EVENTS];
+	jack_midi_data_t    data[SIM_JACK_BUFFER_BYTES];
+	uint32_t            count;
+	size_t              used;
+	jack_nframes_t      nframes;
+} SIM_JACK_BUFFER;
+
+struct _jack_port {
+	char                    *name;              /* client:port */
+	char                    *type;
+	unsigned long           flags;
+	SIM_JACK_BUFFER         buffer;
+	struct _jack_port       *next;
+};
+
+struct _jack_client {
+	char                    *name;
+	JackProcessCallback     process;
+	void                    *process_arg;
+	pthread_t               thread;
+	volatile int            active;
+	struct _jack_port       *ports;
+	guint64                 frame;              /* first frame of this cycle */
+	jack_nframes_t          nframes;
+	jack_nframes_t          rate;
+};
+
+
+/*****************************************************************************
+ * sim_jack_frame_time()
+ *
+ * Returns the virtual clock time of absolute frame <frame>.  Frame 0 is at
+ * SIM_CLOCK_START.
+ *****************************************************************************/
+timensec_t
+sim_jack_frame_time(guint64 frame)
+{
+	return SIM_CLOCK_START +
+		(timensec_t)((frame * (guint64) NSECS_PER_SEC) / (guint64) sim_sample_rate);
+}
+
+
+/*****************************************************************************
+ * sim_jack_find_port()
+ *
+ * Returns the port of <client> with short name <short_name> and <flags>,
+ * or NULL.
+ *****************************************************************************/
+static struct _jack_port *
+sim_jack_find_port(jack_client_t *client, const char *short_name, unsigned long flags)
+{
+	struct _jack_port   *port;
+	size_t              len = strlen(client->name);
+
+	for (port = client->ports; port != NULL; port = port->next) {
+		if ( (port->flags & flags) &&
+		     (strncmp(port->name, client->name, len) == 0) &&
+		     (port->name[len] == ':') &&
+		     (strcmp(&(port->name[len + 1]), short_name) == 0) ) {
+			return port;
+		}
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * sim_jack_deliver_input()
+ *
+ * Fills the "midi_in" buffer with the scripted JACK MIDI input that arrived
+ * during the last period, each event at the frame it arrived in.  Each is
+ * recorded as JACK input at the time of that frame.
+ *****************************************************************************/
+static void
+sim_jack_deliver_input(jack_client_t *client)
+{
+	struct _jack_port   *port;
+	SIM_INPUT           *input;
+	jack_midi_data_t    *data;
+	timensec_t          start;
+	timensec_t          prev_start;
+	guint64             prev_frame;
+	guint64             offset;
+
+	if ( ((port = sim_jack_find_port(client, "midi_in", JackPortIsInput)) == NULL) ||
+	     (client->frame < client->nframes) ) {
+		return;
+	}
+	prev_frame = client->frame - client->nframes;
+	prev_start = sim_jack_frame_time(prev_frame);
+	start      = sim_jack_frame_time(client->frame);
+
+	while (sim_jack_input.next < sim_jack_input.count) {
+		input = &(sim_jack_input.input[sim_jack_input.next]);
+		if (input->time >= start) {
+			break;
+		}
+		offset = 0;
+		if (input->time > prev_start) {
+			offset = ((guint64)(input->time - prev_start) * client->rate) /
+				(guint64) NSECS_PER_SEC;
+			if (offset >= client->nframes) {
+				offset = client->nframes - 1;
+			}
+		}
+		if ((data = jack_midi_event_reserve(&(port->buffer),
+		                                    (jack_nframes_t) offset,
+		                                    input->bytes)) == NULL) {
+			JAMROUTER_WARN("Simulated JACK MIDI input buffer full.\n");
+			break;
+		}
+		memcpy(data, &(sim_input_data[input->offset]), input->bytes);
+		if (g_atomic_int_get(&sim_capture)) {
+			sim_stream_bytes(SIM_JACK_IN, sim_jack_frame_time(prev_frame + offset),
+			                 data, input->bytes);
+		}
+		sim_jack_input.next++;
+	}
+}
+
+
+/*****************************************************************************
+ * sim_jack_capture_output()
+ *
+ * Records what was written to the "midi_out" buffer this cycle, each event
+ * at the time its frame is played, one period after this cycle starts.
+ *****************************************************************************/
+static void
+sim_jack_capture_output(jack_client_t *client)
+{
+	struct _jack_port   *port;
+	SIM_JACK_BUFFER     *buffer;
+	uint32_t            e;
+
+	if ( !g_atomic_int_get(&sim_capture) ||
+	     ((port = sim_jack_find_port(client, "midi_out", JackPortIsOutput)) == NULL) ) {
+		return;
+	}
+	buffer = &(port->buffer);
+	for (e = 0; e < buffer->count; e++) {
+		sim_stream_bytes(SIM_JACK_OUT,
+		                 sim_jack_frame_time(client->frame + client->nframes +
+		                                     buffer->event[e].time),
+		                 buffer->event[e].buffer, buffer->event[e].size);
+	}
+}
+
+
+/*****************************************************************************
+ * sim_jack_process_thread()
+ *
+ * Process thread of the simulated JACK client.  Each cycle wakes on the
+ * virtual clock at the start of its period, late by up to --wakeup-jitter
+ * when set, as the JACK process thread of a loaded system would.
+ *****************************************************************************/
+static void *
+sim_jack_process_thread(void *arg)
+{
+	jack_client_t       *client = (jack_client_t *) arg;
+	struct _jack_port   *port;
+	timensec_t          wake;
+
+	while (client->active && !pending_shutdown) {
+		wake = sim_jack_frame_time(client->frame);
+		if (sim_wakeup_jitter_usec > 0) {
+			wake += (timensec_t)(sim_random() %
+			                     (guint32)(sim_wakeup_jitter_usec + 1)) * 1000;
+		}
+		jamrouter_sleep_until(wake);
+		if (!client->active || pending_shutdown) {
+			break;
+		}
+
+		for (port = client->ports; port != NULL; port = port->next) {
+			jack_midi_clear_buffer(&(port->buffer));
+			port->buffer.nframes = client->nframes;
+		}
+		sim_jack_deliver_input(client);
+
+		if (client->process != NULL) {
+			client->process(client->nframes, client->process_arg);
+		}
+
+		sim_jack_capture_output(client);
+		client->frame += client->nframes;
+	}
+
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * Client
+ *****************************************************************************/
+jack_client_t *
+jack_client_open(const char *client_name, jack_options_t UNUSED(options),
+                 jack_status_t *status, ...)
+{
+	jack_client_t   *client;
+
+	if (status != NULL) {
+		*status = (jack_status_t) 0;
+	}
+	if ((client = calloc(1, sizeof(jack_client_t))) == NULL) {
+		if (status != NULL) {
+			*status = JackFailure;
+		}
+		return NULL;
+	}
+	client->name    = strdup(client_name);
+	client->nframes = (jack_nframes_t) sim_period_size;
+	client->rate    = (jack_nframes_t) sim_sample_rate;
+
+	return client;
+}
+
+int
+jack_activate(jack_client_t *client)
+{
+	if (client->active) {
+		return 0;
+	}
+	client->active = 1;
+	if (pthread_create(&(client->thread), NULL,
+	                   &sim_jack_process_thread, client) != 0) {
+		client->active = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int
+jack_deactivate(jack_client_t *client)
+{
+	if (client->active) {
+		client->active = 0;
+		pthread_join(client->thread, NULL);
+	}
+	return 0;
+}
+
+int
+jack_client_close(jack_client_t *client)
+{
+	struct _jack_port   *port;
+
+	jack_deactivate(client);
+	while ((port = client->ports) != NULL) {
+		client->ports = port->next;
+		free(port->name);
+		free(port->type);
+		free(port);
+	}
+	free(client->name);
+	free(client);
+
+	return 0;
+}
+
+char *
+jack_get_client_name(jack_client_t *client)
+{
+	return client->name;
+}
+
+jack_native_thread_t
+jack_client_thread_id(jack_client_t *client)
+{
+	return client->thread;
+}
+
+int
+jack_is_realtime(jack_client_t *UNUSED(client))
+{
+	return 1;
+}
+
+jack_nframes_t
+jack_get_sample_rate(jack_client_t *client)
+{
+	return client->rate;
+}
+
+jack_nframes_t
+jack_get_buffer_size(jack_client_t *client)
+{
+	return client->nframes;
+}
+
+void
+jack_set_error_function(void (*func)(const char *))
+{
+	(void) func;
+}
+
+void
+jack_free(void *ptr)
+{
+	free(ptr);
+}
+
+
+/*****************************************************************************
+ * Callbacks.  Only the process callback is ever called.
+ *****************************************************************************/
+int
+jack_set_process_callback(jack_client_t         *client,
+                          JackProcessCallback   process_callback,
+                          void                  *arg)
+{
+	client->process     = process_callback;
+	client->process_arg = arg;
+	return 0;
+}
+
+void
+jack_on_shutdown(jack_client_t *UNUSED(client),
+                 JackShutdownCallback UNUSED(callback), void *UNUSED(arg))
+{
+}
+
+int
+jack_set_graph_order_callback(jack_client_t *UNUSED(client),
+                              JackGraphOrderCallback UNUSED(callback),
+                              void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_xrun_callback(jack_client_t *UNUSED(client),
+                       JackXRunCallback UNUSED(callback), void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_buffer_size_callback(jack_client_t *UNUSED(client),
+                              JackBufferSizeCallback UNUSED(callback),
+                              void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_sample_rate_callback(jack_client_t *UNUSED(client),
+                              JackSampleRateCallback UNUSED(callback),
+                              void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_client_registration_callback(jack_client_t *UNUSED(client),
+                                      JackClientRegistrationCallback UNUSED(callback),
+                                      void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_port_registration_callback(jack_client_t *UNUSED(client),
+                                    JackPortRegistrationCallback UNUSED(callback),
+                                    void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_set_port_connect_callback(jack_client_t *UNUSED(client),
+                               JackPortConnectCallback UNUSED(callback),
+                               void *UNUSED(arg))
+{
+	return 0;
+}
+
+#ifdef HAVE_JACK_SET_PORT_RENAME_CALLBACK
+int
+jack_set_port_rename_callback(jack_client_t *UNUSED(client),
+                              JackPortRenameCallback UNUSED(callback),
+                              void *UNUSED(arg))
+{
+	return 0;
+}
+#endif /* HAVE_JACK_SET_PORT_RENAME_CALLBACK */
+
+#ifdef HAVE_JACK_SET_LATENCY_CALLBACK
+int
+jack_set_latency_callback(jack_client_t *UNUSED(client),
+                          JackLatencyCallback UNUSED(callback),
+                          void *UNUSED(arg))
+{
+	return 0;
+}
+#endif /* HAVE_JACK_SET_LATENCY_CALLBACK */
+
+#ifdef HAVE_JACK_SESSION_H
+int
+jack_set_session_callback(jack_client_t *UNUSED(client),
+                          JackSessionCallback UNUSED(callback),
+                          void *UNUSED(arg))
+{
+	return 0;
+}
+
+int
+jack_session_reply(jack_client_t *UNUSED(client),
+                   jack_session_event_t *UNUSED(event))
+{
+	return 0;
+}
+
+void
+jack_session_event_free(jack_session_event_t *event)
+{
+	free(event->command_line);
+	free(event);
+}
+#endif /* HAVE_JACK_SESSION_H */
+
+
+/*****************************************************************************
+ * Ports.  The client's own ports are the only ports there are.
+ *****************************************************************************/
+jack_port_t *
+jack_port_register(jack_client_t    *client,
+                   const char       *port_name,
+                   const char       *port_type,
+                   unsigned long    flags,
+                   unsigned long    UNUSED(buffer_size))
+{
+	struct _jack_port   *port;
+	struct _jack_port   **link;
+	size_t              len;
+
+	if ((port = calloc(1, sizeof(struct _jack_port))) == NULL) {
+		return NULL;
+	}
+	len        = strlen(client->name) + strlen(port_name) + 2;
+	port->name = malloc(len);
+	snprintf(port->name, len, "%s:%s", client->name, port_name);
+	port->type  = strdup(port_type);
+	port->flags = flags;
+
+	for (link = &(client->ports); *link != NULL; link = &((*link)->next));
+	*link = port;
+
+	return port;
+}
+
+void *
+jack_port_get_buffer(jack_port_t *port, jack_nframes_t nframes)
+{
+	port->buffer.nframes = nframes;
+	return &(port->buffer);
+}
+
+const char *
+jack_port_name(const jack_port_t *port)
+{
+	return port->name;
+}
+
+const char *
+jack_port_type(const jack_port_t *port)
+{
+	return port->type;
+}
+
+int
+jack_port_flags(const jack_port_t *port)
+{
+	return (int)(port->flags);
+}
+
+int
+jack_port_is_mine(const jack_client_t *client, const jack_port_t *port)
+{
+	struct _jack_port   *cur;
+
+	for (cur = client->ports; cur != NULL; cur = cur->next) {
+		if (cur == port) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int
+jack_port_connected_to(const jack_port_t *UNUSED(port),
+                       const char *UNUSED(port_name))
+{
+	return 0;
+}
+
+int
+jack_connect(jack_client_t *UNUSED(client),
+             const char *UNUSED(source_port),
+             const char *UNUSED(destination_port))
+{
+	return -1;
+}
+
+int
+jack_disconnect(jack_client_t *UNUSED(client),
+                const char *UNUSED(source_port),
+                const char *UNUSED(destination_port))
+{
+	return -1;
+}
+
+const char **
+jack_get_ports(jack_client_t *UNUSED(client),
+               const char *UNUSED(port_name_pattern),
+               const char *UNUSED(type_name_pattern),
+               unsigned long UNUSED(flags))
+{
+	return calloc(1, sizeof(const char *));
+}
+
+jack_port_t *
+jack_port_by_name(jack_client_t *client, const char *port_name)
+{
+	struct _jack_port   *port;
+
+	for (port = client->ports; port != NULL; port = port->next) {
+		if (strcmp(port->name, port_name) == 0) {
+			return port;
+		}
+	}
+	return NULL;
+}
+
+jack_port_t *
+jack_port_by_id(jack_client_t *UNUSED(client), jack_port_id_t UNUSED(port_id))
+{
+	return NULL;
+}
+
+void
+jack_port_set_latency_range(jack_port_t *UNUSED(port),
+                            jack_latency_callback_mode_t UNUSED(mode),
+                            jack_latency_range_t *UNUSED(range))
+{
+}
+
+
+/*****************************************************************************
+ * Time.  Cycle times are those of the nominal period boundaries on the
+ * virtual clock, as a JACK DLL locked to a perfect clock would give.
+ *****************************************************************************/
+jack_time_t
+jack_get_time(void)
+{
+	timensec_t      now;
+
+	time_get_nsecs(&now);
+	return (jack_time_t)(now / 1000);
+}
+
+int
+jack_get_cycle_times(const jack_client_t    *client,
+                     jack_nframes_t         *current_frames,
+                     jack_time_t            *current_usecs,
+                     jack_time_t            *next_usecs,
+                     float                  *period_usecs)
+{
+	*current_frames = (jack_nframes_t)(client->frame);
+	*current_usecs  = (jack_time_t)(sim_jack_frame_time(client->frame) / 1000);
+	*next_usecs     = (jack_time_t)
+		(sim_jack_frame_time(client->frame + client->nframes) / 1000);
+	*period_usecs   = (float)(client->nframes) * 1000000.0f / (float)(client->rate);
+
+	return 0;
+}
+
+jack_nframes_t
+jack_frames_since_cycle_start(const jack_client_t *client)
+{
+	timensec_t      now;
+	timensec_t      start = sim_jack_frame_time(client->frame);
+
+	time_get_nsecs(&now);
+	if (now <= start) {
+		return 0;
+	}
+	return (jack_nframes_t)(((guint64)(now - start) * client->rate) /
+	                        (guint64) NSECS_PER_SEC);
+}
+
+jack_transport_state_t
+jack_transport_query(const jack_client_t *client, jack_position_t *pos)
+{
+	if (pos != NULL) {
+		memset(pos, 0, sizeof(jack_position_t));
+		pos->frame_rate = client->rate;
+	}
+	return JackTransportStopped;
+}
+
+
+/*****************************************************************************
+ * MIDI port buffers
+ *****************************************************************************/
+uint32_t
+jack_midi_get_event_count(void *port_buffer)
+{
+	return ((SIM_JACK_BUFFER *) port_buffer)->count;
+}
+
+int
+jack_midi_event_get(jack_midi_event_t *event, void *port_buffer, uint32_t event_index)
+{
+	SIM_JACK_BUFFER     *buffer = (SIM_JACK_BUFFER *) port_buffer;
+
+	if (event_index >= buffer->count) {
+		return -ENODATA;
+	}
+	*event = buffer->event[event_index];
+	return 0;
+}
+
+void
+jack_midi_clear_buffer(void *port_buffer)
+{
+	SIM_JACK_BUFFER     *buffer = (SIM_JACK_BUFFER *) port_buffer;
+
+	buffer->count = 0;
+	buffer->used  = 0;
+}
+
+/* Refuses events out of time order or past the end of the period, as
+   libjack does, so that the harness catches the same mistakes. */
+jack_midi_data_t *
+jack_midi_event_reserve(void *port_buffer, jack_nframes_t time, size_t data_size)
+{
+	SIM_JACK_BUFFER     *buffer = (SIM_JACK_BUFFER *) port_buffer;
+	jack_midi_event_t   *event;
+
+	if ( (data_size == 0) ||
+	     (time >= buffer->nframes) ||
+	     (buffer->count >= SIM_JACK_MAX_EVENTS) ||
+	     ((buffer->used + data_size) > SIM_JACK_BUFFER_BYTES) ||
+	     ((buffer->count > 0) && (time < buffer->event[buffer->count - 1].time)) ) {
+		return NULL;
+	}
+	event         = &(buffer->event[buffer->count++]);
+	event->time   = time;
+	event->size   = data_size;
+	event->buffer = &(buffer->data[buffer->used]);
+	buffer->used += data_size;
+
+	return event->buffer;
+}
@@ -0,0 +1,155 @@
+/*****************************************************************************
+ *
+ * sim_midi.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "sim.h"
+#include "debug.h"
+
+
+/* Scripted MIDI Rx, one byte at a time, with the virtual clock time each
+   byte has finished arriving on the wire. */
+static unsigned char    *sim_rx_byte        = NULL;
+static timensec_t       *sim_rx_arrival     = NULL;
+static size_t           sim_rx_count        = 0;
+static size_t           sim_rx_next         = 0;
+
+/* end of the last byte sent on the simulated MIDI Tx wire */
+static timensec_t       sim_tx_wire_free    = 0;
+
+
+/*****************************************************************************
+ * sim_midi_init()
+ *
+ * Lays the scripted MIDI input out on the wire, before any thread reads it.
+ * Each burst starts at its scripted time, or as soon as the wire is free of
+ * the one before, and each byte arrives one MIDI byte time after the last.
+ *****************************************************************************/
+void
+sim_midi_init(void)
+{
+	SIM_INPUT       *input;
+	timensec_t      wire_free   = 0;
+	timensec_t      start;
+	size_t          total       = 0;
+	size_t          j;
+	size_t          k;
+
+	for (j = 0; j < sim_midi_input.count; j++) {
+		total += sim_midi_input.input[j].bytes;
+	}
+
+	sim_rx_byte      = g_malloc(total + 1);
+	sim_rx_arrival   = g_malloc((total + 1) * sizeof(timensec_t));
+	sim_rx_count     = 0;
+	sim_rx_next      = 0;
+	sim_tx_wire_free = 0;
+
+	for (j = 0; j < sim_midi_input.count; j++) {
+		input = &(sim_midi_input.input[j]);
+		start = (input->time > wire_free) ? input->time : wire_free;
+		for (k = 0; k < input->bytes; k++) {
+			sim_rx_byte[sim_rx_count]    = sim_input_data[input->offset + k];
+			sim_rx_arrival[sim_rx_count] =
+				start + ((timensec_t)(k + 1) * SIM_MIDI_BYTE_NSEC);
+			sim_rx_count++;
+		}
+		wire_free = start + ((timensec_t)(input->bytes) * SIM_MIDI_BYTE_NSEC);
+	}
+}
+
+
+/*****************************************************************************
+ * sim_midi_read()
+ *
+ * Called by the Raw MIDI Rx thread in place of poll() and read().  Sleeps on
+ * the virtual clock until the next scripted byte has arrived, or for at most
+ * SIM_MIDI_POLL_NSEC, then returns up to <len> bytes that have arrived.
+ * Each byte is recorded as MIDI Rx at the time it started on the wire.
+ *****************************************************************************/
+int
+sim_midi_read(unsigned char *buf, int len)
+{
+	timensec_t      now;
+	timensec_t      deadline;
+	int             bytes_read  = 0;
+
+	time_get_nsecs(&now);
+	if ( (sim_rx_next >= sim_rx_count) ||
+	     (sim_rx_arrival[sim_rx_next] > now) ) {
+		deadline = now + SIM_MIDI_POLL_NSEC;
+		if ( (sim_rx_next < sim_rx_count) &&
+		     (sim_rx_arrival[sim_rx_next] < deadline) ) {
+			deadline = sim_rx_arrival[sim_rx_next];
+		}
+		jamrouter_sleep_until(deadline);
+		time_get_nsecs(&now);
+	}
+
+	while ( (bytes_read < len) && (sim_rx_next < sim_rx_count) &&
+	        (sim_rx_arrival[sim_rx_next] <= now) ) {
+		buf[bytes_read] = sim_rx_byte[sim_rx_next];
+		if (g_atomic_int_get(&sim_capture)) {
+			sim_stream_bytes(SIM_MIDI_IN,
+			                 sim_rx_arrival[sim_rx_next] - SIM_MIDI_BYTE_NSEC,
+			                 &(buf[bytes_read]), 1);
+		}
+		sim_rx_next++;
+		bytes_read++;
+	}
+
+	return bytes_read;
+}
+
+
+/*****************************************************************************
+ * sim_midi_write()
+ *
+ * Called by the Raw MIDI Tx thread in place of write().  Never blocks.  The
+ * bytes go out on the simulated wire back to back, starting now or once the
+ * wire is free, and each is recorded as MIDI Tx at the time it starts.
+ *****************************************************************************/
+int
+sim_midi_write(unsigned char *buf, ssize_t len)
+{
+	timensec_t      now;
+	timensec_t      start;
+	ssize_t         j;
+
+	time_get_nsecs(&now);
+	start = (now > sim_tx_wire_free) ? now : sim_tx_wire_free;
+
+	for (j = 0; j < len; j++) {
+		if (g_atomic_int_get(&sim_capture)) {
+			sim_stream_bytes(SIM_MIDI_OUT,
+			                 start + ((timensec_t)(j) * SIM_MIDI_BYTE_NSEC),
+			                 &(buf[j]), 1);
+		}
+	}
+	sim_tx_wire_free = start + ((timensec_t)(len) * SIM_MIDI_BYTE_NSEC);
+
+	return (int) len;
+}
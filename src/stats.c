@@ -0,0 +1,489 @@
+/*****************************************************************************
+ *
+ * stats.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "stats.h"
+#include "debug.h"
+
+
+#define STATS_SOCKET_PREFIX     "unix:"
+
+
+QUEUE_STATS             queue_stats[MAX_MIDI_QUEUES];
+
+char                    *stats_file             = NULL;
+
+static timensec_t       stats_export_time       = 0;
+
+
+/*****************************************************************************
+ * nsec_bucket()
+ *
+ * Returns the log-linear histogram bucket index for <nsecs>.
+ *****************************************************************************/
+static int
+nsec_bucket(timensec_t nsecs)
+{
+	guint64     value = (guint64) nsecs;
+	int         msb;
+
+	if (nsecs < STATS_SUB_BUCKETS) {
+		return (nsecs < 0) ? 0 : (int) nsecs;
+	}
+	if (value >= ((guint64) 1 << STATS_MAX_BITS)) {
+		value = ((guint64) 1 << STATS_MAX_BITS) - 1;
+	}
+	msb = 63 - __builtin_clzll(value);
+
+	return ((msb - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS) +
+		(int)((value >> (msb - STATS_SUB_BUCKET_BITS)) - STATS_SUB_BUCKETS);
+}
+
+
+/*****************************************************************************
+ * nsec_bucket_lower()
+ *
+ * Returns the lowest value (in nanoseconds) counted in histogram bucket
+ * <bucket>.
+ *****************************************************************************/
+static timensec_t
+nsec_bucket_lower(int bucket)
+{
+	int         group = bucket / STATS_SUB_BUCKETS;
+	int         sub   = bucket % STATS_SUB_BUCKETS;
+
+	if (group == 0) {
+		return (timensec_t) sub;
+	}
+	return ((timensec_t)(STATS_SUB_BUCKETS + sub)) << (group - 1);
+}
+
+
+/*****************************************************************************
+ * stats_record_nsecs()
+ *
+ * Counts one sample in a nanosecond histogram.  Must only be called from
+ * the single thread that owns the histogram.
+ *****************************************************************************/
+void
+stats_record_nsecs(NSEC_HISTOGRAM *hist, timensec_t nsecs)
+{
+	hist->count[nsec_bucket(nsecs)]++;
+	if (nsecs > hist->max) {
+		hist->max = nsecs;
+	}
+	hist->samples++;
+}
+
+
+/*****************************************************************************
+ * stats_record_frame_error()
+ *
+ * Counts one sample of scheduled vs. actual frame error.  Must only be
+ * called from the single thread that owns the histogram.
+ *****************************************************************************/
+void
+stats_record_frame_error(FRAME_HISTOGRAM *hist, int frames)
+{
+	if (frames < -STATS_FRAME_ERROR_RANGE) {
+		frames = -STATS_FRAME_ERROR_RANGE;
+	}
+	else if (frames > STATS_FRAME_ERROR_RANGE) {
+		frames = STATS_FRAME_ERROR_RANGE;
+	}
+	hist->count[frames + STATS_FRAME_ERROR_RANGE]++;
+	hist->samples++;
+}
+
+
+/*****************************************************************************
+ * stats_record_queue_delay()
+ *
+ * Counts the time an event has spent between ingress and <now> in the
+ * queue delay histogram for <queue_num>.  Events without an ingress time
+ * (generated internally) are not counted.
+ *****************************************************************************/
+void
+stats_record_queue_delay(unsigned char queue_num,
+                         timensec_t    now,
+                         timensec_t    ingress_time)
+{
+	if (ingress_time != 0) {
+		stats_record_nsecs(&(queue_stats[queue_num].queue_delay),
+		                   now - ingress_time);
+	}
+}
+
+
+/*****************************************************************************
+ * stats_record_write()
+ *
+ * Counts the frame error and write duration of one output write for
+ * <queue_num>.
+ *****************************************************************************/
+void
+stats_record_write(unsigned char queue_num,
+                   int           frame_error,
+                   timensec_t    write_nsecs)
+{
+	stats_record_frame_error(&(queue_stats[queue_num].frame_error),
+	                         frame_error);
+	stats_record_nsecs(&(queue_stats[queue_num].write_time), write_nsecs);
+}
+
+
+/*****************************************************************************
+ * init_stats()
+ *****************************************************************************/
+void
+init_stats(void)
+{
+	memset((void *)(&(queue_stats[0])), 0, sizeof(queue_stats));
+	stats_export_time = 0;
+}
+
+
+/*****************************************************************************
+ * nsec_percentile()
+ *
+ * Returns the lower bound of the bucket holding the given fraction
+ * (in 1/1000) of samples from a histogram copy.
+ *****************************************************************************/
+static timensec_t
+nsec_percentile(guint32 *count, guint32 samples, guint32 permille)
+{
+	guint64     target = (((guint64) samples) * permille + 999) / 1000;
+	guint64     seen   = 0;
+	int         bucket;
+
+	for (bucket = 0; bucket < STATS_NSEC_BUCKETS; bucket++) {
+		seen += count[bucket];
+		if ((seen >= target) && (seen > 0)) {
+			return nsec_bucket_lower(bucket);
+		}
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * stats_nsec_percentile()
+ *
+ * Returns the given fraction (in 1/1000) of samples from a live histogram.
+ *****************************************************************************/
+timensec_t
+stats_nsec_percentile(NSEC_HISTOGRAM *hist, guint32 permille)
+{
+	guint32     count[STATS_NSEC_BUCKETS];
+	guint32     samples = 0;
+	int         bucket;
+
+	for (bucket = 0; bucket < STATS_NSEC_BUCKETS; bucket++) {
+		count[bucket] = hist->count[bucket];
+		samples += count[bucket];
+	}
+
+	return nsec_percentile(count, samples, permille);
+}
+
+
+/*****************************************************************************
+ * append_nsec_histogram()
+ *****************************************************************************/
+static void
+append_nsec_histogram(GString *json, const char *name, NSEC_HISTOGRAM *hist)
+{
+	guint32     count[STATS_NSEC_BUCKETS];
+	guint32     samples = 0;
+	int         bucket;
+	int         first   = 1;
+
+	for (bucket = 0; bucket < STATS_NSEC_BUCKETS; bucket++) {
+		count[bucket] = hist->count[bucket];
+		samples += count[bucket];
+	}
+
+	g_string_append_printf(json,
+	                       "\"%s\":{\"samples\":%u,\"max\":%" G_GINT64_FORMAT
+	                       ",\"p50\":%" G_GINT64_FORMAT
+	                       ",\"p99\":%" G_GINT64_FORMAT
+	                       ",\"p999\":%" G_GINT64_FORMAT
+	                       ",\"buckets\":[",
+	                       name, samples, (gint64)(hist->max),
+	                       (gint64) nsec_percentile(count, samples, 500),
+	                       (gint64) nsec_percentile(count, samples, 990),
+	                       (gint64) nsec_percentile(count, samples, 999));
+	for (bucket = 0; bucket < STATS_NSEC_BUCKETS; bucket++) {
+		if (count[bucket] != 0) {
+			g_string_append_printf(json, "%s[%" G_GINT64_FORMAT ",%u]",
+			                       first ? "" : ",",
+			                       (gint64) nsec_bucket_lower(bucket),
+			                       count[bucket]);
+			first = 0;
+		}
+	}
+	g_string_append(json, "]}");
+}
+
+
+/*****************************************************************************
+ * append_frame_histogram()
+ *****************************************************************************/
+static void
+append_frame_histogram(GString *json, const char *name, FRAME_HISTOGRAM *hist)
+{
+	guint32     count;
+	guint32     samples = 0;
+	int         bucket;
+	int         first   = 1;
+
+	g_string_append_printf(json, "\"%s\":{\"buckets\":[", name);
+	for (bucket = 0; bucket < STATS_FRAME_ERROR_BUCKETS; bucket++) {
+		if ((count = hist->count[bucket]) != 0) {
+			g_string_append_printf(json, "%s[%d,%u]",
+			                       first ? "" : ",",
+			                       bucket - STATS_FRAME_ERROR_RANGE,
+			                       count);
+			samples += count;
+			first = 0;
+		}
+	}
+	g_string_append_printf(json, "],\"samples\":%u}", samples);
+}
+
+
+/*****************************************************************************
+ * send_stats_datagram()
+ *
+ * Sends one JSON document as a single datagram to the unix socket at
+ * <path>.  A monitor that is not listening is not an error.
+ *****************************************************************************/
+static int
+send_stats_datagram(const char *path, GString *json)
+{
+	struct sockaddr_un  addr;
+	int                 sock;
+	int                 ret = 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		JAMROUTER_WARN("Stats socket path too long:  %s\n", path);
+		return -1;
+	}
+	if ((sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		JAMROUTER_WARN("Unable to create stats socket:  %s\n",
+		               strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (sendto(sock, json->str, json->len, MSG_DONTWAIT,
+	           (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		if ((errno != ECONNREFUSED) && (errno != ENOENT) &&
+		    (errno != EAGAIN)) {
+			JAMROUTER_WARN("Unable to send stats to %s:  %s\n",
+			               path, strerror(errno));
+		}
+		ret = -1;
+	}
+	close(sock);
+
+	return ret;
+}
+
+
+/*****************************************************************************
+ * write_stats_file()
+ *
+ * Replaces <filename> with one JSON document, by way of a temporary file
+ * and rename(), so readers never see a partial export.
+ *****************************************************************************/
+static int
+write_stats_file(const char *filename, GString *json)
+{
+	char        tmp_filename[1024];
+	FILE        *fp;
+
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+	if ((fp = fopen(tmp_filename, "w")) == NULL) {
+		JAMROUTER_WARN("Unable to open stats file %s:  %s\n",
+		               tmp_filename, strerror(errno));
+		return -1;
+	}
+	if ((fwrite(json->str, 1, json->len, fp) != json->len) ||
+	    (fclose(fp) != 0)) {
+		JAMROUTER_WARN("Unable to write stats file %s:  %s\n",
+		               tmp_filename, strerror(errno));
+		unlink(tmp_filename);
+		return -1;
+	}
+	if (rename(tmp_filename, filename) != 0) {
+		JAMROUTER_WARN("Unable to rename stats file %s:  %s\n",
+		               filename, strerror(errno));
+		unlink(tmp_filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * export_stats()
+ *
+ * Exports all per-queue histograms along with the current clock DLL error
+ * terms as one JSON document.  Histograms are cumulative since startup.
+ * <filename> names a regular file, or a unix datagram socket when given as
+ * "unix:/path".  Called from the watchdog thread, never from realtime
+ * threads.
+ *****************************************************************************/
+int
+export_stats(const char *filename)
+{
+	GString         *json;
+	timensec_t      now;
+	unsigned char   queue_num;
+	int             first = 1;
+	int             ret;
+
+	time_get_nsecs(&now);
+
+	json = g_string_sized_new(4096);
+	g_string_append_printf(json,
+	                       "{\"time\":%" G_GINT64_FORMAT
+	                       ",\"sample_rate\":%d"
+	                       ",\"clock_dll\":{\"bandwidth\":%f"
+	                       ",\"phase_error\":%" G_GINT64_FORMAT
+	                       ",\"phase_error_max\":%" G_GINT64_FORMAT
+	                       ",\"period_error\":%" G_GINT64_FORMAT
+	                       ",\"relocks\":%u}"
+	                       ",\"queues\":[",
+	                       (gint64) now,
+	                       sample_rate,
+	                       (double) clock_dll.bandwidth,
+	                       (gint64) clock_dll.phase_error,
+	                       (gint64) clock_dll.phase_error_max,
+	                       (gint64) clock_dll.period_error,
+	                       clock_dll.relocks);
+
+	for (queue_num = 0; queue_num < MAX_MIDI_QUEUES; queue_num++) {
+		if ((queue_stats[queue_num].queue_delay.samples == 0) &&
+		    (queue_stats[queue_num].write_time.samples == 0) &&
+		    (queue_stats[queue_num].late_dequeues == 0) &&
+		    (queue_stats[queue_num].pool_allocs == 0) &&
+		    (queue_stats[queue_num].pool_failures == 0) &&
+		    (queue_stats[queue_num].arena_failures == 0)) {
+			continue;
+		}
+		g_string_append_printf(json,
+		                       "%s{\"queue\":%d,\"route\":%d"
+		                       ",\"direction\":\"%s\""
+		                       ",\"late_dequeues\":%u"
+		                       ",\"pool\":{\"size\":%d,\"in_use\":%d"
+		                       ",\"high_water\":%d,\"allocs\":%u"
+		                       ",\"failures\":%u}"
+		                       ",\"sysex_arena\":{\"size\":%d,\"failures\":%u}"
+		                       ",\"shed\":{\"controller\":%u,\"pitchbend\":%u"
+		                       ",\"aftertouch\":%u,\"active_sensing\":%u},",
+		                       first ? "" : ",",
+		                       queue_num,
+		                       QUEUE_ROUTE(queue_num),
+		                       IS_J2A_QUEUE(queue_num) ?
+		                       "jack_to_midi" : "midi_to_jack",
+		                       queue_stats[queue_num].late_dequeues,
+		                       MIDI_EVENT_POOL_SIZE,
+		                       g_atomic_int_get(&(queue_stats[queue_num].pool_in_use)),
+		                       g_atomic_int_get(&(queue_stats[queue_num].pool_high_water)),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].pool_allocs)),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].pool_failures)),
+		                       SYSEX_ARENA_SIZE,
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].arena_failures)),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].shed[SHED_CLASS_CONTROLLER])),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].shed[SHED_CLASS_PITCHBEND])),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].shed[SHED_CLASS_AFTERTOUCH])),
+		                       (guint32) g_atomic_int_get(&(queue_stats[queue_num].shed[SHED_CLASS_ACTIVE_SENSING])));
+		append_frame_histogram(json, "frame_error",
+		                       &(queue_stats[queue_num].frame_error));
+		g_string_append_c(json, ',');
+		append_nsec_histogram(json, "queue_delay",
+		                      &(queue_stats[queue_num].queue_delay));
+		g_string_append_c(json, ',');
+		append_nsec_histogram(json, "write_time",
+		                      &(queue_stats[queue_num].write_time));
+		if (queue_stats[queue_num].wire_wait.samples != 0) {
+			g_string_append_c(json, ',');
+			append_nsec_histogram(json, "wire_wait",
+			                      &(queue_stats[queue_num].wire_wait));
+		}
+		g_string_append_c(json, '}');
+		first = 0;
+	}
+	g_string_append(json, "]}\n");
+
+	if (strncmp(filename, STATS_SOCKET_PREFIX,
+	            sizeof(STATS_SOCKET_PREFIX) - 1) == 0) {
+		ret = send_stats_datagram(filename + sizeof(STATS_SOCKET_PREFIX) - 1,
+		                          json);
+	}
+	else {
+		ret = write_stats_file(filename, json);
+	}
+
+	g_string_free(json, TRUE);
+
+	return ret;
+}
+
+
+/*****************************************************************************
+ * export_stats_cycle()
+ *
+ * Called once per watchdog cycle.  Exports stats every STATS_EXPORT_MSEC
+ * when a stats file has been given on the command line.
+ *****************************************************************************/
+void
+export_stats_cycle(void)
+{
+	timensec_t      now;
+
+	if (stats_file == NULL) {
+		return;
+	}
+	time_get_nsecs(&now);
+	if ((now - stats_export_time) >=
+	    ((timensec_t) STATS_EXPORT_MSEC * 1000000)) {
+		stats_export_time = now;
+		export_stats(stats_file);
+	}
+}
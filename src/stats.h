@@ -0,0 +1,109 @@
+/*****************************************************************************
+ *
+ * stats.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_STATS_H_
+#define _JAMROUTER_STATS_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+
+
+/* Log-linear (HDR style) nanosecond histograms:  values below
+   STATS_SUB_BUCKETS get one bucket each, and every power of 2 above that is
+   split into STATS_SUB_BUCKETS linear buckets, for a constant relative
+   precision of 1/16.  Values are clamped at 2^STATS_MAX_BITS nsec. */
+#define STATS_SUB_BUCKET_BITS       4
+#define STATS_SUB_BUCKETS           (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_MAX_BITS              36
+#define STATS_NSEC_BUCKETS          \
+	((STATS_MAX_BITS - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+/* Scheduled vs. actual frame error is kept in one linear bucket per frame,
+   clamped at +/- STATS_FRAME_ERROR_RANGE. */
+#define STATS_FRAME_ERROR_RANGE     128
+#define STATS_FRAME_ERROR_BUCKETS   ((STATS_FRAME_ERROR_RANGE * 2) + 1)
+
+
+/* Event classes shed under overload (--overload) */
+#define SHED_CLASS_CONTROLLER       0
+#define SHED_CLASS_PITCHBEND        1
+#define SHED_CLASS_AFTERTOUCH       2
+#define SHED_CLASS_ACTIVE_SENSING   3
+#define SHED_CLASSES                4
+
+
+/* Every histogram has exactly one writer (the JACK thread for wire-->JACK
+   queues, or the queue's MIDI Tx thread for JACK-->wire queues), so updates
+   need no locking.  The exporting thread may read a count one update
+   behind, which is harmless for monitoring. */
+typedef struct nsec_histogram {
+	volatile guint32    count[STATS_NSEC_BUCKETS];
+	volatile guint32    samples;
+	volatile timensec_t max;
+} NSEC_HISTOGRAM;
+
+typedef struct frame_histogram {
+	volatile guint32    count[STATS_FRAME_ERROR_BUCKETS];
+	volatile guint32    samples;
+} FRAME_HISTOGRAM;
+
+typedef struct queue_stats {
+	FRAME_HISTOGRAM     frame_error;
+	NSEC_HISTOGRAM      queue_delay;
+	NSEC_HISTOGRAM      write_time;
+	NSEC_HISTOGRAM      wire_wait;          /* predicted Tx lateness */
+	volatile guint32    late_dequeues;
+	/* event pool accounting, updated atomically by every producer */
+	volatile gint       pool_allocs;
+	volatile gint       pool_failures;
+	volatile gint       pool_in_use;        /* events queued, not yet freed */
+	volatile gint       pool_high_water;
+	volatile gint       arena_failures;     /* SysEx arena still in use */
+	/* events shed under overload, per class, also updated atomically */
+	volatile gint       shed[SHED_CLASSES];
+} QUEUE_STATS;
+
+
+extern QUEUE_STATS          queue_stats[MAX_MIDI_QUEUES];
+
+extern char                 *stats_file;
+
+
+void stats_record_nsecs(NSEC_HISTOGRAM *hist,
+                        timensec_t nsecs);
+void stats_record_frame_error(FRAME_HISTOGRAM *hist,
+                              int frames);
+void stats_record_queue_delay(unsigned char queue_num,
+                              timensec_t now,
+                              timensec_t ingress_time);
+void stats_record_write(unsigned char queue_num,
+                        int frame_error,
+                        timensec_t write_nsecs);
+timensec_t stats_nsec_percentile(NSEC_HISTOGRAM *hist,
+                                 guint32 permille);
+void init_stats(void);
+int  export_stats(const char *filename);
+void export_stats_cycle(void);
+
+
+#endif /* _JAMROUTER_STATS_H_ */
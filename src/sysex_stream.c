@@ -0,0 +1,466 @@
+/*****************************************************************************
+ *
+ * sysex_stream.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "midi_event.h"
+#include "sysex_stream.h"
+#include "debug.h"
+
+
+/* one stream per route in use, allocated by init_sysex_streams() */
+static SYSEX_STREAM     *sysex_stream = NULL;
+
+
+/*****************************************************************************
+ * init_sysex_streams()
+ *
+ * Called once at startup, after the number of routes is known.  The stream
+ * buffers are written here, so that with memory locked, the JACK and Tx
+ * threads never fault on them.
+ *****************************************************************************/
+void
+init_sysex_streams(void)
+{
+	size_t          size = sizeof(SYSEX_STREAM) * (size_t)(num_midi_routes);
+	unsigned char   route;
+
+	if ((sysex_stream = malloc(size)) == NULL) {
+		jamrouter_shutdown("Out of memory!\n");
+	}
+	memset(sysex_stream, 0, size);
+
+	for (route = 0; route < num_midi_routes; route++) {
+		sysex_stream[route].write_index = 0;
+		sysex_stream[route].read_index  = 0;
+		sysex_stream[route].queued_end  = 0;
+		sysex_stream[route].free_index  = 0;
+		sysex_stream[route].frame       = 0;
+		sysex_stream[route].in_sysex    = 0;
+		sysex_stream[route].discard     = 0;
+		sysex_stream[route].tx_in_sysex = 0;
+	}
+}
+
+
+/*****************************************************************************
+ * sysex_stream_pending()
+ *
+ * Returns nonzero while a SysEx stream is in flight on <route>, either with
+ * bytes not yet handed to the Tx queue, or with a message from JACK not yet
+ * terminated.  Everything but realtime messages must then go through the
+ * stream to keep its place behind the SysEx.
+ *****************************************************************************/
+int
+sysex_stream_pending(unsigned char route)
+{
+	SYSEX_STREAM    *stream = &(sysex_stream[route]);
+
+	return ( (stream->write_index != stream->read_index) ||
+	         stream->in_sysex || stream->discard );
+}
+
+
+/*****************************************************************************
+ * sysex_stream_room()
+ *
+ * Returns the number of bytes that may be written to the stream without
+ * overwriting anything still on its way to the wire.
+ *****************************************************************************/
+static unsigned int
+sysex_stream_room(SYSEX_STREAM *stream)
+{
+	guint32         used = stream->write_index -
+		(guint32) g_atomic_int_get(&(stream->free_index));
+
+	if (used >= SYSEX_STREAM_SIZE) {
+		return 0;
+	}
+	return (unsigned int)(SYSEX_STREAM_SIZE - used);
+}
+
+
+/*****************************************************************************
+ * sysex_stream_release()
+ *
+ * Called (through free_midi_event()) as the Tx side frees an event holding
+ * <bytes> of SysEx at <data>.  Fragments of a stream are freed in the order
+ * they were queued, so the stream is free up to the end of this fragment,
+ * including any held messages queued before it.  Pointers outside of the
+ * SysEx streams are ignored.
+ *****************************************************************************/
+void
+sysex_stream_release(volatile unsigned char *data, unsigned int bytes)
+{
+	SYSEX_STREAM    *stream;
+	gsize           offset;
+	guint32         pos;
+	guint32         free_index;
+	guint32         delta;
+
+	if ( (sysex_stream == NULL) ||
+	     (data < &(sysex_stream[0].buffer[0])) ||
+	     (data >= &(sysex_stream[num_midi_routes - 1].buffer[SYSEX_STREAM_SIZE])) ) {
+		return;
+	}
+	offset = (gsize)(data - &(sysex_stream[0].buffer[0]));
+	stream = &(sysex_stream[offset / sizeof(SYSEX_STREAM)]);
+	pos    = (guint32)(offset % sizeof(SYSEX_STREAM));
+	if (pos >= SYSEX_STREAM_SIZE) {
+		return;
+	}
+
+	/* a fragment freed out of order (coalesced into an earlier one) is
+	   behind the free index, and changes nothing */
+	free_index = (guint32) g_atomic_int_get(&(stream->free_index));
+	delta      = (pos + bytes - free_index) & SYSEX_STREAM_MASK;
+	if (delta < (SYSEX_STREAM_SIZE / 2)) {
+		g_atomic_int_set(&(stream->free_index), (gint)(free_index + delta));
+	}
+}
+
+
+/*****************************************************************************
+ * sysex_stream_release_held()
+ *
+ * Held messages are copied out of the stream as they are queued.  With no
+ * fragment still on its way to the wire, the stream is free up to <end>
+ * right away.  Otherwise, freeing the last fragment frees them as well.
+ *****************************************************************************/
+static void
+sysex_stream_release_held(SYSEX_STREAM *stream, guint32 end)
+{
+	if (g_atomic_int_compare_and_exchange(&(stream->free_index),
+	                                      (gint)(stream->queued_end), (gint) end)) {
+		stream->queued_end = end;
+	}
+}
+
+
+/*****************************************************************************
+ * sysex_stream_put()
+ *****************************************************************************/
+static inline void
+sysex_stream_put(SYSEX_STREAM *stream, unsigned char byte)
+{
+	stream->buffer[stream->write_index & SYSEX_STREAM_MASK] = byte;
+	stream->write_index++;
+}
+
+
+/*****************************************************************************
+ * sysex_stream_put_end()
+ *
+ * Writes the (possibly nonstandard, possibly 2 byte) SysEx terminator.
+ *****************************************************************************/
+static void
+sysex_stream_put_end(SYSEX_STREAM *stream)
+{
+	sysex_stream_put(stream, sysex_terminator);
+	if (sysex_extra_terminator != 0xF7) {
+		sysex_stream_put(stream, sysex_extra_terminator);
+	}
+}
+
+
+/*****************************************************************************
+ * sysex_stream_write()
+ *
+ * Appends SysEx from JACK (a complete message, the start of one, or a
+ * continuation fragment) to the stream for <route>, due at <frame> if the
+ * stream is currently idle.  End-SysEx is converted for obscure hardware
+ * as it is written.  A message too large for the room left in the stream
+ * is terminated early, and the rest of it is discarded.  Returns the
+ * number of bytes accepted.
+ *****************************************************************************/
+unsigned int
+sysex_stream_write(unsigned char        route,
+                   unsigned short       frame,
+                   const unsigned char  *data,
+                   unsigned int         len)
+{
+	SYSEX_STREAM    *stream = &(sysex_stream[route]);
+	unsigned int    room;
+	unsigned int    need;
+	unsigned int    j;
+	int             last;
+
+	if (len == 0) {
+		return 0;
+	}
+	last = (data[len - 1] == 0xF7);
+
+	if (data[0] == MIDI_EVENT_SYSEX) {
+		stream->in_sysex = 1;
+		stream->discard  = 0;
+	}
+	else if (stream->discard || !stream->in_sysex) {
+		/* rest of an oversize message, or a stray continuation */
+		if (last) {
+			stream->discard = 0;
+		}
+		return 0;
+	}
+
+	if (stream->write_index == stream->read_index) {
+		stream->frame = frame;
+	}
+
+	room = sysex_stream_room(stream);
+	need = len + ((sysex_extra_terminator != 0xF7) ? 1 : 0);
+
+	if (need > room) {
+		JAMROUTER_WARN("SysEx stream full on route %d:  "
+		               "message truncated.\n", route);
+		/* leave room for the terminator, which the message cannot
+		   already contain at this length */
+		len = (room > 2) ? (room - 2) : 0;
+		if (len > 0) {
+			for (j = 0; j < len; j++) {
+				sysex_stream_put(stream, data[j]);
+			}
+			sysex_stream_put_end(stream);
+		}
+		stream->in_sysex = 0;
+		stream->discard  = (unsigned char)(!last);
+		return len;
+	}
+
+	for (j = 0; j < (len - (unsigned int) last); j++) {
+		sysex_stream_put(stream, data[j]);
+	}
+	if (last) {
+		sysex_stream_put_end(stream);
+		stream->in_sysex = 0;
+	}
+
+	return len;
+}
+
+
+/*****************************************************************************
+ * sysex_stream_write_event()
+ *
+ * Holds a (non-SysEx, non-realtime) event behind the SysEx in flight on
+ * <route>, to be queued once the stream gets to it.  The message is copied
+ * into the stream, and <event> is returned to the pool.
+ *****************************************************************************/
+void
+sysex_stream_write_event(unsigned char          route,
+                         unsigned short         frame,
+                         volatile MIDI_EVENT    *event)
+{
+	SYSEX_STREAM    *stream = &(sysex_stream[route]);
+
+	if ((event->bytes == 0) || (event->bytes > 3)) {
+		free_midi_event(J2A_ROUTE_QUEUE(route), event);
+		return;
+	}
+	if (sysex_stream_room(stream) < (event->bytes + 2)) {
+		JAMROUTER_WARN("SysEx stream full on route %d:  "
+		               "event %02X dropped.\n", route, event->type);
+		free_midi_event(J2A_ROUTE_QUEUE(route), event);
+		return;
+	}
+
+	if (stream->write_index == stream->read_index) {
+		stream->frame = frame;
+	}
+	/* any status byte ends SysEx on the wire, so a message never
+	   finished by JACK is terminated here rather than left open. */
+	if (stream->in_sysex) {
+		JAMROUTER_WARN("Unterminated SysEx on route %d.\n", route);
+		sysex_stream_put_end(stream);
+		stream->in_sysex = 0;
+	}
+	if (event->type < 0xF0) {
+		sysex_stream_put(stream, (unsigned char)((event->type & 0xF0) |
+		                                         (event->channel & 0x0F)));
+	}
+	else {
+		sysex_stream_put(stream, event->type);
+	}
+	if (event->bytes > 1) {
+		sysex_stream_put(stream, event->byte2);
+	}
+	if (event->bytes > 2) {
+		sysex_stream_put(stream, event->byte3);
+	}
+	free_midi_event(J2A_ROUTE_QUEUE(route), event);
+}
+
+
+/*****************************************************************************
+ * get_held_message_size()
+ *
+ * Returns the size of a message held in the stream, by status byte.
+ *****************************************************************************/
+static unsigned int
+get_held_message_size(unsigned char status)
+{
+	if (status < 0xF0) {
+		switch (status & MIDI_TYPE_MASK) {
+		case MIDI_EVENT_PROGRAM_CHANGE:
+		case MIDI_EVENT_POLYPRESSURE:
+			return 2;
+		}
+		return 3;
+	}
+	switch (status) {
+	case MIDI_EVENT_MTC_QFRAME:
+	case MIDI_EVENT_SONG_SELECT:
+		return 2;
+	case MIDI_EVENT_SONGPOS:
+		return 3;
+	}
+	return 1;
+}
+
+
+/*****************************************************************************
+ * sysex_stream_pump()
+ *
+ * Called from the JACK thread once per process cycle, after JACK MIDI input
+ * for <route> has been handled.  Hands the Tx queue one period's worth of
+ * the stream at the Tx baud rate, as SysEx fragments (which never straddle
+ * the end of the ring) and held messages.  Whatever is queued in a cycle
+ * shares one frame slot, in stream order.  Nothing is queued while the Tx
+ * queue's event pool is down to its reserve for live messages.  Fragments
+ * point into the ring, and their bytes stay reserved until the Tx side
+ * frees them (see sysex_stream_release()).
+ *****************************************************************************/
+void
+sysex_stream_pump(unsigned short period, unsigned char route)
+{
+	SYSEX_STREAM            *stream    = &(sysex_stream[route]);
+	volatile MIDI_EVENT     *event;
+	unsigned char           queue_num  = J2A_ROUTE_QUEUE(route);
+	unsigned char           end_byte;
+	unsigned char           status;
+	guint32                 pos;
+	guint32                 avail;
+	unsigned int            size;
+	unsigned int            j;
+	int                     fragment;
+	int                     budget;
+
+	if (stream->write_index == stream->read_index) {
+		sysex_stream_release_held(stream, stream->read_index);
+		return;
+	}
+
+	if (tx_baud_rate > 0) {
+		/* 10 bits per byte on the wire */
+		budget = (int)(((gint64)(tx_baud_rate) * sync_info[period].nsec_per_period) /
+		               (10 * NSECS_PER_SEC)) + 1;
+	}
+	else {
+		budget = SYSEX_STREAM_PERIOD_BYTES;
+	}
+	end_byte = (sysex_extra_terminator != 0xF7) ? sysex_extra_terminator : sysex_terminator;
+
+	while ((budget > 0) && (stream->write_index != stream->read_index)) {
+		pos    = stream->read_index & SYSEX_STREAM_MASK;
+		avail  = stream->write_index - stream->read_index;
+		status = stream->buffer[pos];
+
+		/* back off while the Tx queue is short of events, and let the
+		   stream ring absorb the dump instead */
+		if ( (get_midi_event_pool_free(queue_num) < EVENT_POOL_BULK_RESERVE) ||
+		     ((event = get_new_midi_event(queue_num)) == NULL) ) {
+			break;
+		}
+
+		/* held message */
+		fragment = (stream->tx_in_sysex || (status == MIDI_EVENT_SYSEX));
+		if (!fragment) {
+			size = get_held_message_size(status);
+			if (size > avail) {
+				free_midi_event(queue_num, event);
+				break;
+			}
+			if (status < 0xF0) {
+				event->type    = status & MIDI_TYPE_MASK;
+				event->channel = status & MIDI_CHANNEL_MASK;
+			}
+			else {
+				event->type    = status;
+			}
+			if (size > 1) {
+				event->byte2 = stream->buffer[(stream->read_index + 1) & SYSEX_STREAM_MASK];
+			}
+			if (size > 2) {
+				event->byte3 = stream->buffer[(stream->read_index + 2) & SYSEX_STREAM_MASK];
+			}
+			event->bytes = size;
+		}
+
+		/* SysEx fragment, ending early at the end of the message */
+		else {
+			stream->tx_in_sysex = 1;
+			size = SYSEX_FRAGMENT_SIZE;
+			if (size > avail) {
+				size = avail;
+			}
+			if (size > (SYSEX_STREAM_SIZE - pos)) {
+				size = SYSEX_STREAM_SIZE - pos;
+			}
+			if ((int) size > budget) {
+				size = (unsigned int) budget;
+			}
+			for (j = 0; j < size; j++) {
+				if ((j > 0) && (stream->buffer[pos + j] == MIDI_EVENT_SYSEX)) {
+					size = j;
+					stream->tx_in_sysex = 0;
+					break;
+				}
+				if (stream->buffer[pos + j] == end_byte) {
+					size = j + 1;
+					stream->tx_in_sysex = 0;
+					break;
+				}
+			}
+			event->type  = MIDI_EVENT_SYSEX;
+			event->data  = &(stream->buffer[pos]);
+			event->bytes = size;
+		}
+
+		queue_midi_event(period, queue_num, event, stream->frame,
+		                 sync_info[period].input_index, 0);
+		stream->read_index += size;
+		budget             -= (int) size;
+		if (fragment) {
+			stream->queued_end = stream->read_index;
+		}
+		else {
+			sysex_stream_release_held(stream, stream->read_index);
+		}
+	}
+
+	/* the rest goes out at the start of the following periods */
+	stream->frame = 0;
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ *
+ * sysex_stream.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_SYSEX_STREAM_H_
+#define _JAMROUTER_SYSEX_STREAM_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "mididefs.h"
+
+
+/* JACK --> MIDI SysEx stream for one route.  Large SysEx from JACK is
+   copied here once, and handed to the Tx queue in fragments at wire speed.
+   Other (non-realtime) messages arriving while a stream is in flight are
+   held in the same ring, in order, so they cannot land inside the SysEx on
+   the wire.  Owned by the JACK thread, except for free_index, which the Tx
+   side advances as it frees each fragment.  Indices are free running. */
+typedef struct sysex_stream {
+	unsigned char       buffer[SYSEX_STREAM_SIZE];
+	guint32             write_index;
+	guint32             read_index;         /* handed to the Tx queue */
+	guint32             queued_end;         /* end of last fragment queued */
+	volatile gint       free_index;         /* done with by the Tx side */
+	unsigned short      frame;              /* frame for the next fragment */
+	unsigned char       in_sysex;           /* JACK side message is open */
+	unsigned char       discard;            /* dropping an oversize message */
+	unsigned char       tx_in_sysex;        /* Tx side fragment is open */
+} SYSEX_STREAM;
+
+
+void init_sysex_streams(void);
+int  sysex_stream_pending(unsigned char route);
+unsigned int sysex_stream_write(unsigned char route,
+                                unsigned short frame,
+                                const unsigned char *data,
+                                unsigned int len);
+void sysex_stream_write_event(unsigned char route,
+                              unsigned short frame,
+                              volatile MIDI_EVENT *event);
+void sysex_stream_pump(unsigned short period,
+                       unsigned char route);
+void sysex_stream_release(volatile unsigned char *data,
+                          unsigned int bytes);
+
+
+#endif /* _JAMROUTER_SYSEX_STREAM_H_ */
@@ -0,0 +1,526 @@
+/*****************************************************************************
+ *
+ * testmode.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "midi_event.h"
+#include "stats.h"
+#include "testmode.h"
+#include "debug.h"
+
+
+#define TEST_STATE_IDLE         0
+#define TEST_STATE_SENDING      1
+#define TEST_STATE_DRAINING     2
+#define TEST_STATE_DONE         3
+
+
+/* Send time of each outstanding probe, by sequence number.  stage is the
+   test stage number + 1, or 0 once the probe has come back. */
+typedef struct test_probe {
+	timensec_t          sched_time;
+	unsigned short      stage;
+} TEST_PROBE;
+
+
+int                     test_mode               = TEST_MODE_NONE;
+unsigned int            test_rate               = 0;
+unsigned int            test_size               = 3;
+unsigned int            test_seconds            = 0;
+
+/* Everything below, up to test_stages_done, is owned by the JACK thread. */
+static TEST_PROBE       test_probes[TEST_PROBE_TABLE_SIZE];
+static TEST_STAGE       test_stages[TEST_MAX_STAGES];
+
+static int              test_state              = TEST_STATE_IDLE;
+static int              test_stage              = 0;
+static unsigned short   test_probe_seq          = 0;
+static guint32          test_late_start         = 0;
+static timensec_t       test_start_time         = 0;
+static timensec_t       test_stage_start        = 0;
+static timensec_t       test_stage_end          = 0;
+static timensec_t       test_drain_end          = 0;
+static timensec_t       test_next_probe_time    = 0;
+static timensec_t       test_probe_interval     = 0;
+
+/* Handoff of completed stages to the watchdog thread. */
+static volatile gint    test_stages_done        = 0;
+static volatile gint    test_finished           = 0;
+
+/* Owned by the watchdog thread. */
+static int              test_stages_printed     = 0;
+
+static const char       *test_mode_names[]      =
+	{ "none", "loopback", "flood", "bandwidth" };
+
+
+/*****************************************************************************
+ * set_test_mode()
+ *
+ * Selects a test mode by name.  Returns 0 on success, or -1 for an unknown
+ * mode.
+ *****************************************************************************/
+int
+set_test_mode(char *mode)
+{
+	int         j;
+
+	for (j = TEST_MODE_LOOPBACK; j <= TEST_MODE_BANDWIDTH; j++) {
+		if (strcmp(mode, test_mode_names[j]) == 0) {
+			test_mode = j;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/*****************************************************************************
+ * init_test_mode()
+ *
+ * Fills in test defaults for the selected mode and normalizes the probe
+ * size.  Must be called before the JACK and MIDI threads are started.
+ *****************************************************************************/
+void
+init_test_mode(void)
+{
+	if (test_mode == TEST_MODE_NONE) {
+		return;
+	}
+
+	switch (test_mode) {
+	case TEST_MODE_LOOPBACK:
+		if (test_rate == 0) {
+			test_rate = 10;
+		}
+		if (test_seconds == 0) {
+			test_seconds = 10;
+		}
+		break;
+	case TEST_MODE_FLOOD:
+		if (test_rate == 0) {
+			test_rate = 1000;
+		}
+		if (test_seconds == 0) {
+			test_seconds = 10;
+		}
+		break;
+	case TEST_MODE_BANDWIDTH:
+		if (test_rate == 0) {
+			test_rate = 100;
+		}
+		if (test_seconds == 0) {
+			test_seconds = 2;
+		}
+		break;
+	}
+
+	/* Each probe in a stage needs its own sequence number. */
+	if (test_rate > TEST_PROBE_TABLE_SIZE) {
+		JAMROUTER_WARN("Test rate %u is over the %d probe limit:  "
+		               "using %d.\n", test_rate, TEST_PROBE_TABLE_SIZE,
+		               TEST_PROBE_TABLE_SIZE);
+		test_rate = TEST_PROBE_TABLE_SIZE;
+	}
+	if (((guint64) test_rate * test_seconds) > TEST_PROBE_TABLE_SIZE) {
+		JAMROUTER_WARN("Test of %u probes/sec for %u sec is over the %d probe "
+		               "limit:  using %u sec.\n", test_rate, test_seconds,
+		               TEST_PROBE_TABLE_SIZE,
+		               TEST_PROBE_TABLE_SIZE / test_rate);
+		test_seconds = TEST_PROBE_TABLE_SIZE / test_rate;
+	}
+
+	/* Probes need room for a sequence number:  a 3 byte pitchbend message,
+	   or a SysEx message of at least TEST_PROBE_SYSEX_MIN_SIZE. */
+	if (test_size <= 3) {
+		test_size = 3;
+	}
+	else if (test_size < TEST_PROBE_SYSEX_MIN_SIZE) {
+		test_size = TEST_PROBE_SYSEX_MIN_SIZE;
+	}
+	else if (test_size > (SYSEX_BUFFER_SIZE - 2)) {
+		test_size = SYSEX_BUFFER_SIZE - 2;
+	}
+
+	memset((void *)(&(test_probes[0])), 0, sizeof(test_probes));
+	test_state          = TEST_STATE_IDLE;
+	test_stage          = 0;
+	test_probe_seq      = 0;
+	test_start_time     = 0;
+	test_stages_done    = 0;
+	test_finished       = 0;
+	test_stages_printed = 0;
+}
+
+
+/*****************************************************************************
+ * start_test_stage()
+ *
+ * Starts sending probes for the current stage at <rate> probes per second,
+ * beginning at <now>.  Stages at rates raised by the bandwidth test are cut
+ * short so that no more probes are sent than there are sequence numbers.
+ *****************************************************************************/
+static void
+start_test_stage(timensec_t now, unsigned int rate)
+{
+	TEST_STAGE      *stage = &(test_stages[test_stage]);
+	timensec_t      stage_nsec;
+
+	memset((void *)(stage), 0, sizeof(TEST_STAGE));
+	stage->rate = rate;
+
+	test_probe_interval  = NSECS_PER_SEC / rate;
+	stage_nsec           = (timensec_t) test_seconds * NSECS_PER_SEC;
+	if (stage_nsec > ((timensec_t) TEST_PROBE_TABLE_SIZE * test_probe_interval)) {
+		stage_nsec = (timensec_t) TEST_PROBE_TABLE_SIZE * test_probe_interval;
+	}
+	test_stage_start     = now;
+	test_stage_end       = now + stage_nsec;
+	test_next_probe_time = now;
+	test_late_start      = queue_stats[J2A_ROUTE_QUEUE(0)].late_dequeues;
+	test_state           = TEST_STATE_SENDING;
+}
+
+
+/*****************************************************************************
+ * finish_test_stage()
+ *
+ * Hands the current stage off to the watchdog thread, and either starts
+ * the next bandwidth test stage or ends the test.
+ *****************************************************************************/
+static void
+finish_test_stage(timensec_t now)
+{
+	TEST_STAGE      *stage = &(test_stages[test_stage]);
+	unsigned int    rate;
+
+	stage->late_dequeues =
+		queue_stats[J2A_ROUTE_QUEUE(0)].late_dequeues - test_late_start;
+
+	/* g_atomic_int_set() orders all stage writes before the handoff. */
+	g_atomic_int_set(&test_stages_done, test_stage + 1);
+
+	if ( (test_mode == TEST_MODE_BANDWIDTH) &&
+	     (stage->received == stage->sent) &&
+	     (stage->late_dequeues == 0) &&
+	     ((test_stage + 1) < TEST_MAX_STAGES) ) {
+		rate = stage->rate + ((stage->rate * TEST_BANDWIDTH_STEP_PERCENT) / 100);
+		if (rate == stage->rate) {
+			rate++;
+		}
+		test_stage++;
+		start_test_stage(now, rate);
+	}
+	else {
+		test_state = TEST_STATE_DONE;
+		g_atomic_int_set(&test_finished, 1);
+	}
+}
+
+
+/*****************************************************************************
+ * send_probe()
+ *
+ * Queues one probe on the route 0 Tx queue for <frame> of <period>, due on
+ * the wire at <sched_time>.
+ *****************************************************************************/
+static void
+send_probe(unsigned short period, unsigned short frame, timensec_t sched_time)
+{
+	volatile MIDI_EVENT     *event;
+	unsigned char           queue_num = J2A_ROUTE_QUEUE(0);
+	unsigned short          seq       = test_probe_seq;
+	unsigned int            j;
+
+	test_probe_seq = (unsigned short)((seq + 1) & TEST_PROBE_SEQ_MASK);
+
+	if ((event = get_new_midi_event(queue_num)) == NULL) {
+		return;
+	}
+	if (test_size == 3) {
+		event->type    = MIDI_EVENT_PITCHBEND;
+		event->channel = TEST_PROBE_CHANNEL;
+		event->lsb     = (unsigned char)(seq & 0x7F);
+		event->msb     = (unsigned char)((seq >> 7) & 0x7F);
+		event->bytes   = 3;
+	}
+	else {
+		if ((event->data = get_sysex_buffer(queue_num, test_size + 2)) == NULL) {
+			free_midi_event(queue_num, event);
+			return;
+		}
+		event->type    = MIDI_EVENT_SYSEX;
+		event->data[0] = MIDI_EVENT_SYSEX;
+		event->data[1] = TEST_PROBE_SYSEX_ID;
+		event->data[2] = TEST_PROBE_SYSEX_TAG;
+		event->data[3] = (unsigned char)(seq & 0x7F);
+		event->data[4] = (unsigned char)((seq >> 7) & 0x7F);
+		for (j = 5; j < (test_size - 1); j++) {
+			event->data[j] = 0x00;
+		}
+		event->data[test_size - 1] = 0xF7;
+		event->bytes   = test_size;
+	}
+
+	test_probes[seq].sched_time = sched_time;
+	test_probes[seq].stage      = (unsigned short)(test_stage + 1);
+	test_stages[test_stage].sent++;
+
+	queue_midi_event(period, queue_num, event, frame,
+	                 sync_info[period].input_index, 0);
+}
+
+
+/*****************************************************************************
+ * test_mode_send_probes()
+ *
+ * Called from the JACK thread once per process cycle, before JACK MIDI
+ * input is queued.  Queues all probes due within <period> and runs the
+ * test stage state machine.
+ *****************************************************************************/
+void
+test_mode_send_probes(unsigned short period)
+{
+	SYNC_SNAPSHOT   snap;
+	timensec_t      period_end;
+	timensec_t      tx_latency;
+	timensec_t      frame;
+
+	if ((test_mode == TEST_MODE_NONE) || (test_state == TEST_STATE_DONE)) {
+		return;
+	}
+
+	get_sync_snapshot(period, &snap);
+	period_end = snap.start_time + snap.nsec_per_period;
+
+	switch (test_state) {
+	case TEST_STATE_IDLE:
+		/* give the MIDI clock DLL time to lock before the first stage */
+		if (test_start_time == 0) {
+			test_start_time = snap.start_time +
+				((timensec_t) TEST_SETTLE_MSEC * 1000000);
+		}
+		if (snap.start_time < test_start_time) {
+			break;
+		}
+		start_test_stage(snap.start_time, test_rate);
+		/* intentional fall-through */
+	case TEST_STATE_SENDING:
+		/* events queued for this period go out tx_latency later */
+		tx_latency = FRAMES_TO_NSECS(snap.nsec_per_frame,
+		                             sync_info[period].tx_latency_size);
+		while ( (test_next_probe_time < period_end) &&
+		        (test_next_probe_time < test_stage_end) ) {
+			frame = 0;
+			if (test_next_probe_time > snap.start_time) {
+				frame = NSECS_TO_FRAMES(snap.nsec_per_frame,
+				                        test_next_probe_time - snap.start_time);
+				if (frame >= snap.buffer_period_size) {
+					frame = snap.buffer_period_size - 1;
+				}
+			}
+			send_probe(period, (unsigned short) frame,
+			           snap.start_time +
+			           FRAMES_TO_NSECS(snap.nsec_per_frame, frame) +
+			           tx_latency);
+			test_next_probe_time += test_probe_interval;
+		}
+		if (period_end >= test_stage_end) {
+			test_stages[test_stage].duration = test_stage_end - test_stage_start;
+			test_drain_end = test_stage_end + ((timensec_t) TEST_DRAIN_MSEC * 1000000);
+			test_state     = TEST_STATE_DRAINING;
+		}
+		break;
+	case TEST_STATE_DRAINING:
+		if (snap.start_time >= test_drain_end) {
+			finish_test_stage(snap.start_time);
+		}
+		break;
+	}
+}
+
+
+/*****************************************************************************
+ * test_mode_receive_probe()
+ *
+ * Called from the JACK thread for each event dequeued from the route 0 Rx
+ * queue.  Returns 1 if the event is a probe, which has been accounted for
+ * and must not be passed on to JACK, or 0 for any other event.
+ *****************************************************************************/
+int
+test_mode_receive_probe(volatile MIDI_EVENT *event)
+{
+	TEST_STAGE      *stage;
+	timensec_t      latency;
+	unsigned short  seq;
+
+	if (test_mode == TEST_MODE_NONE) {
+		return 0;
+	}
+
+	if ( (test_size == 3) &&
+	     (event->type == MIDI_EVENT_PITCHBEND) &&
+	     (event->channel == TEST_PROBE_CHANNEL) ) {
+		seq = (unsigned short)((event->lsb & 0x7F) | ((event->msb & 0x7F) << 7));
+	}
+	else if ( (event->type == MIDI_EVENT_SYSEX) &&
+	          (event->data != NULL) &&
+	          (event->bytes >= TEST_PROBE_SYSEX_MIN_SIZE) &&
+	          (event->data[1] == TEST_PROBE_SYSEX_ID) &&
+	          (event->data[2] == TEST_PROBE_SYSEX_TAG) ) {
+		seq = (unsigned short)((event->data[3] & 0x7F) |
+		                       ((event->data[4] & 0x7F) << 7));
+	}
+	else {
+		return 0;
+	}
+
+	if ((test_state != TEST_STATE_SENDING) && (test_state != TEST_STATE_DRAINING)) {
+		return 1;
+	}
+
+	stage = &(test_stages[test_stage]);
+	if ( (test_probes[seq].stage != (unsigned short)(test_stage + 1)) ||
+	     (event->ingress_time == 0) ) {
+		stage->stray++;
+		return 1;
+	}
+	test_probes[seq].stage = 0;
+
+	latency = event->ingress_time - test_probes[seq].sched_time;
+	if ((stage->received == 0) || (latency < stage->latency_min)) {
+		stage->latency_min = latency;
+	}
+	if ((stage->received == 0) || (latency > stage->latency_max)) {
+		stage->latency_max = latency;
+	}
+	stage->latency_sum += latency;
+	stats_record_nsecs(&(stage->latency), latency);
+	stage->received++;
+
+	return 1;
+}
+
+
+/*****************************************************************************
+ * print_test_stage()
+ *
+ * Prints one row of the test results table.  Latencies are in usec, from
+ * scheduled Tx time to Rx read time.
+ *****************************************************************************/
+static void
+print_test_stage(TEST_STAGE *stage)
+{
+	guint32         lost    = stage->sent - stage->received;
+	double          seconds = (double) stage->duration / (double) NSECS_PER_SEC;
+	timensec_t      avg     = 0;
+
+	if (stage->received > 0) {
+		avg = stage->latency_sum / stage->received;
+	}
+	if (seconds <= 0.0) {
+		seconds = 1.0;
+	}
+
+	printf("%7u %7u %7u %6u %6.2f %8.1f %9.1f %5u %5u "
+	       "%8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+	       " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+	       stage->rate,
+	       stage->sent,
+	       stage->received,
+	       lost,
+	       (stage->sent > 0) ? ((100.0 * lost) / stage->sent) : 0.0,
+	       stage->received / seconds,
+	       (stage->received * test_size) / seconds,
+	       stage->late_dequeues,
+	       stage->stray,
+	       (gint64)(stage->latency_min / 1000),
+	       (gint64)(avg / 1000),
+	       (gint64)(stats_nsec_percentile(&(stage->latency), 500) / 1000),
+	       (gint64)(stats_nsec_percentile(&(stage->latency), 990) / 1000),
+	       (gint64)(stage->latency_max / 1000),
+	       (gint64)((stage->latency_max - stage->latency_min) / 1000));
+}
+
+
+/*****************************************************************************
+ * test_mode_cycle()
+ *
+ * Called once per watchdog cycle.  Prints results for completed test
+ * stages, and shuts down once the test is finished.
+ *****************************************************************************/
+void
+test_mode_cycle(void)
+{
+	TEST_STAGE      *stage;
+	TEST_STAGE      *best  = NULL;
+	int             done;
+	int             j;
+
+	if (test_mode == TEST_MODE_NONE) {
+		return;
+	}
+
+	done = g_atomic_int_get(&test_stages_done);
+	while (test_stages_printed < done) {
+		if (test_stages_printed == 0) {
+			printf("\nJAMRouter %s test:  route 0, %u byte probes, %u sec per stage.\n"
+			       "Latency (usec) is from scheduled Tx time to Rx read time.\n\n"
+			       "   rate    sent    recv   lost  loss%%   recv/s    bytes/s  late stray"
+			       "  lat min  lat avg  lat p50  lat p99  lat max   jitter\n",
+			       test_mode_names[test_mode], test_size, test_seconds);
+		}
+		print_test_stage(&(test_stages[test_stages_printed]));
+		test_stages_printed++;
+	}
+
+	if (g_atomic_int_get(&test_finished) && (test_stages_printed == done)) {
+		if (test_mode == TEST_MODE_BANDWIDTH) {
+			for (j = 0; j < done; j++) {
+				stage = &(test_stages[j]);
+				if ( (stage->received == stage->sent) &&
+				     (stage->late_dequeues == 0) ) {
+					best = stage;
+				}
+			}
+			if (best != NULL) {
+				printf("\nSustained %u probes/sec (%u bytes/sec) "
+				       "with no loss or late dequeues.\n",
+				       best->rate, best->rate * test_size);
+			}
+			else {
+				printf("\nUnable to sustain %u probes/sec "
+				       "without loss or late dequeues.\n",
+				       test_stages[0].rate);
+			}
+		}
+		fflush(stdout);
+		jamrouter_shutdown(NULL);
+	}
+}
@@ -0,0 +1,78 @@
+/*****************************************************************************
+ *
+ * testmode.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_TESTMODE_H_
+#define _JAMROUTER_TESTMODE_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "timeutil.h"
+#include "mididefs.h"
+#include "stats.h"
+
+
+#define TEST_MODE_NONE              0
+#define TEST_MODE_LOOPBACK          1
+#define TEST_MODE_FLOOD             2
+#define TEST_MODE_BANDWIDTH         3
+
+/* Probe sequence numbers are 14 bits, carried in pitchbend lsb/msb or in
+   the first two data bytes after the SysEx header. */
+#define TEST_PROBE_SEQ_MASK         0x3FFF
+#define TEST_PROBE_TABLE_SIZE       (TEST_PROBE_SEQ_MASK + 1)
+
+/* Non-commercial SysEx ID, followed by 'J' */
+#define TEST_PROBE_SYSEX_ID         0x7D
+#define TEST_PROBE_SYSEX_TAG        0x4A
+#define TEST_PROBE_SYSEX_MIN_SIZE   6
+
+
+/* Results of one test stage (one rate), filled in by the JACK thread and
+   handed to the watchdog thread once complete. */
+typedef struct test_stage {
+	unsigned int        rate;               /* probes per second */
+	guint32             sent;
+	guint32             received;
+	guint32             stray;              /* duplicate / stale probes */
+	guint32             late_dequeues;      /* on the Tx queue */
+	timensec_t          duration;           /* sending time */
+	timensec_t          latency_min;
+	timensec_t          latency_max;
+	timensec_t          latency_sum;
+	NSEC_HISTOGRAM      latency;
+} TEST_STAGE;
+
+
+extern int                  test_mode;
+extern unsigned int         test_rate;
+extern unsigned int         test_size;
+extern unsigned int         test_seconds;
+
+
+int  set_test_mode(char *mode);
+void init_test_mode(void);
+void test_mode_send_probes(unsigned short period);
+int  test_mode_receive_probe(volatile MIDI_EVENT *event);
+void test_mode_cycle(void);
+
+
+#endif /* _JAMROUTER_TESTMODE_H_ */
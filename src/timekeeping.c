@@ -45,13 +45,20 @@
 
 volatile SYNC_INFO      sync_info[MAX_BUFFER_PERIODS];
 
-struct timespec         jack_start_time       = { 0, JAMROUTER_CLOCK_INIT };
+volatile SYNC_LATCH     sync_latch[MAX_BUFFER_PERIODS];
+volatile ANCHOR_LATCH   midi_clock_anchor;
+
+volatile CLOCK_DLL      clock_dll;
+
+timensec_t              jack_start_time       = JAMROUTER_CLOCK_INIT;
 
 timecalc_t              midi_phase_lock       = 0;
 timecalc_t              midi_phase_min        = 1.0;
 timecalc_t              midi_phase_max        = 127.0;
 timecalc_t              setting_midi_phase_lock = DEFAULT_MIDI_PHASE_LOCK;
-timecalc_t              decay_factor          = 0.00048828125;
+
+/* phase lock frame position in fixed point, for set_midi_cycle_time() */
+timensec_t              midi_phase_lock_frac  = 0;
 
 int                     max_event_latency     = 0;
 
@@ -59,36 +66,33 @@ int                     max_event_latency     = 0;
 /*****************************************************************************
  * sleep_until_next_period()
  *
+ * Sleeps until the absolute end time of the current period, and returns
+ * the next period.
+ *
  * TODO:  Consider the use of select() to sleep for a maximum time instead
  *        a minimum time as with usleep() and clock_nanosleep().
  *****************************************************************************/
 unsigned short
-sleep_until_next_period(unsigned short period, TIMESTAMP *now)
+sleep_until_next_period(unsigned short period, timensec_t *now)
 {
-	TIMESTAMP           sleep_time = { 0, 20000 };
+	SYNC_SNAPSHOT       snapshot;
 
-	if ( (clock_gettime(system_clockid, now) == 0) &&
-	     timecmp(now, &(sync_info[period].end_time), TIME_LT) ) {
-		time_copy(&sleep_time, &(sync_info[period].end_time));
-		time_sub(&sleep_time, now);
+	get_sync_snapshot(period, &snapshot);
+
+	if ( (time_get_nsecs(now) == 0) && (*now < snapshot.end_time) ) {
+		jamrouter_sleep_until(snapshot.end_time);
+	}
+	else {
+		jamrouter_nanosleep(20000);
 	}
-#ifdef HAVE_CLOCK_NANOSLEEP
-	clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep_time, NULL);
-#else
-	nanosleep(sleep_time);
-#endif
 
-	period = sync_info[period].next;
+	period = snapshot.next;
 
 	sync_info[period].jack_wakeup_frame = 0;
 
 	JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
 	                DEBUG_COLOR_YELLOW "%d! " DEBUG_COLOR_DEFAULT, period);
 
-	/* When debug is disabled, a full memory fence is still needed here,
-	   as MIDI Tx is about to dequeue. */
-	asm volatile (" mfence; # read/write fence" : : : "memory");
-
 	return period;
 }
 
@@ -96,29 +100,17 @@ sleep_until_next_period(unsigned short period, TIMESTAMP *now)
 /*****************************************************************************
  * sleep_until_frame()
  *
+ * Sleeps until the absolute start time of <frame> in <period>.  The Tx
+ * threads only call this for frames found populated in the queue's frame
+ * bitmap, which serves as the deadline queue for the period.
+ *
  * TODO:  Consider the use of select() to sleep for a maximum time instead
  *        a minimum time as with usleep() and clock_nanosleep().
  *****************************************************************************/
 void
 sleep_until_frame(unsigned short period, unsigned short frame)
 {
-	TIMESTAMP now;
-	TIMESTAMP sleep_time;
-
-	time_copy(&sleep_time, &(sync_info[period].start_time));
-	time_add_nsecs(&sleep_time,
-	               (int)(sync_info[period].nsec_per_frame *
-	                     (timecalc_t)(frame)));
-
-	if ( (clock_gettime(system_clockid, &now) == 0) &&
-	     (timecmp(&now, &sleep_time, TIME_LT) ) ) {
-		time_sub(&sleep_time, &now);
-#ifdef HAVE_CLOCK_NANOSLEEP
-		clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep_time, NULL);
-#else
-		nanosleep(sleep_time);
-#endif
-	}
+	jamrouter_sleep_until(get_frame_time(period, frame));
 }
 
 
@@ -169,6 +161,9 @@ set_midi_phase_lock(unsigned short period)
 			midi_phase_min  = midi_phase_lock - (timecalc_t)(4.0);
 			midi_phase_max  = midi_phase_lock + (timecalc_t)(4.0);
 		}
+
+		midi_phase_lock_frac =
+			(timensec_t)(midi_phase_lock * (timecalc_t)(FRAME_NSEC_ONE));
 }
 
 
@@ -182,18 +177,13 @@ void
 start_midi_clock(void)
 {
 	TIMESTAMP           now;
+	timensec_t          start_time;
 	unsigned char       period = 0;
+	unsigned char       q;
 
-	time_init(&jack_start_time, JAMROUTER_CLOCK_INIT);
+	jack_start_time = JAMROUTER_CLOCK_INIT;
 
-	sync_info[period].nsec_per_period =
-		sync_info[period].f_buffer_period_size *
-		(timecalc_t)(1000000000.0) /
-		(timecalc_t)(sync_info[period].sample_rate);
-
-	sync_info[period].nsec_per_frame =
-		sync_info[period].nsec_per_period
-		/ sync_info[period].f_buffer_period_size;
+	set_period_length(period, get_nominal_period_length(period));
 
 	/* now initialize the reference timestamps. */
 #ifdef CLOCK_MONOTONIC
@@ -211,91 +201,229 @@ start_midi_clock(void)
 		system_clockid = CLOCK_MONOTONIC_RAW;
 	}
 #endif
-	if (clock_gettime(system_clockid, &now) == 0) {
+	if (time_get_nsecs(&start_time) == 0) {
 		for (period = 0; period < DEFAULT_BUFFER_PERIODS; period++) {
-			time_copy(&(sync_info[period].start_time), &now);
+			sync_info[period].start_time = start_time;
 			/* initialize the active sensing timeout to zero (off). */
-			time_init(&(sync_info[period].sensing_timeout[A2J_QUEUE]),
-			          JAMROUTER_CLOCK_INIT);
-			time_init(&(sync_info[period].sensing_timeout[J2A_QUEUE]),
-			          JAMROUTER_CLOCK_INIT);
+			for (q = 0; q < MAX_MIDI_QUEUES; q++) {
+				sync_info[period].sensing_timeout[q] = 0;
+			}
 		}
 	}
+
+	publish_all_sync_snapshots();
+
+	/* extrapolate from period 0 until the JACK thread takes over */
+	publish_midi_clock_anchor(0);
+}
+
+
+/*****************************************************************************
+ * copy_sync_snapshot()
+ *****************************************************************************/
+static inline void
+copy_sync_snapshot(SYNC_SNAPSHOT *dest, volatile SYNC_SNAPSHOT *src)
+{
+	dest->start_time         = src->start_time;
+	dest->end_time           = src->end_time;
+	dest->nsec_per_frame     = src->nsec_per_frame;
+	dest->nsec_per_period    = src->nsec_per_period;
+	dest->prev               = src->prev;
+	dest->next               = src->next;
+	dest->rx_index           = src->rx_index;
+	dest->tx_index           = src->tx_index;
+	dest->input_index        = src->input_index;
+	dest->output_index       = src->output_index;
+	dest->buffer_period_size = src->buffer_period_size;
+}
+
+
+/*****************************************************************************
+ * set_sync_snapshot()
+ *****************************************************************************/
+static inline void
+set_sync_snapshot(volatile SYNC_SNAPSHOT *dest, unsigned short period)
+{
+	dest->start_time         = sync_info[period].start_time;
+	dest->end_time           = sync_info[period].end_time;
+	dest->nsec_per_frame     = sync_info[period].nsec_per_frame;
+	dest->nsec_per_period    = sync_info[period].nsec_per_period;
+	dest->prev               = sync_info[period].prev;
+	dest->next               = sync_info[period].next;
+	dest->rx_index           = sync_info[period].rx_index;
+	dest->tx_index           = sync_info[period].tx_index;
+	dest->input_index        = sync_info[period].input_index;
+	dest->output_index       = sync_info[period].output_index;
+	dest->buffer_period_size = sync_info[period].buffer_period_size;
+}
+
+
+/*****************************************************************************
+ * publish_sync_snapshot()
+ *
+ * Publishes the snapshot fields of sync_info[<period>] to the MIDI threads,
+ * once the JACK thread (the only writer) has finished computing them.  The
+ * latch is written one copy at a time, with the sequence counter directing
+ * readers to the other copy, so a reader preempting the writer always has
+ * a consistent copy to read, and never waits.
+ *****************************************************************************/
+void
+publish_sync_snapshot(unsigned short period)
+{
+	volatile SYNC_LATCH     *latch = &(sync_latch[period]);
+
+	g_atomic_int_inc(&(latch->sequence));
+	set_sync_snapshot(&(latch->copy[0]), period);
+	g_atomic_int_inc(&(latch->sequence));
+	set_sync_snapshot(&(latch->copy[1]), period);
+}
+
+
+/*****************************************************************************
+ * publish_all_sync_snapshots()
+ *****************************************************************************/
+void
+publish_all_sync_snapshots(void)
+{
+	unsigned short  period;
+
+	for (period = 0; period < MAX_BUFFER_PERIODS; period++) {
+		publish_sync_snapshot(period);
+	}
+}
+
+
+/*****************************************************************************
+ * get_sync_snapshot()
+ *
+ * Copies a consistent set of timing values for <period>, as last published
+ * by the JACK thread.  A retry is only needed when the writer has made
+ * progress in the meantime, so this cannot livelock against a preempted
+ * writer.
+ *****************************************************************************/
+void
+get_sync_snapshot(unsigned short period, SYNC_SNAPSHOT *snapshot)
+{
+	volatile SYNC_LATCH     *latch = &(sync_latch[period]);
+	gint                    sequence;
+
+	do {
+		sequence = g_atomic_int_get(&(latch->sequence));
+		copy_sync_snapshot(snapshot, &(latch->copy[sequence & 0x1]));
+	} while (g_atomic_int_get(&(latch->sequence)) != sequence);
+}
+
+
+/*****************************************************************************
+ * set_midi_clock_anchor()
+ *****************************************************************************/
+static inline void
+set_midi_clock_anchor(volatile MIDI_CLOCK_ANCHOR *anchor, unsigned short period)
+{
+	anchor->start_time      = sync_info[period].start_time;
+	anchor->nsec_per_period = sync_info[period].nsec_per_period;
+	anchor->periods_per_nsec = (anchor->nsec_per_period > 0) ?
+		((((timensec_t) 1 << PERIOD_RECIP_FRAC_BITS) +
+		  anchor->nsec_per_period - 1) / anchor->nsec_per_period) : 0;
+	anchor->period          = period;
+	anchor->period_mask     = sync_info[period].period_mask;
+}
+
+
+/*****************************************************************************
+ * publish_midi_clock_anchor()
+ *
+ * Sets <period> and its start time and length as the reference point for
+ * get_midi_period(), through the same kind of latch as the snapshots.
+ *****************************************************************************/
+void
+publish_midi_clock_anchor(unsigned short period)
+{
+	g_atomic_int_inc(&(midi_clock_anchor.sequence));
+	set_midi_clock_anchor(&(midi_clock_anchor.copy[0]), period);
+	g_atomic_int_inc(&(midi_clock_anchor.sequence));
+	set_midi_clock_anchor(&(midi_clock_anchor.copy[1]), period);
+}
+
+
+/*****************************************************************************
+ * get_elapsed_periods()
+ *
+ * Returns the number of whole periods in <delta_nsec> (not negative), from
+ * the anchor's fixed point periods per nanosecond.  The reciprocal is
+ * rounded up, so below PERIOD_RECIP_MAX_NSEC the estimate is never short,
+ * and is at most one over.
+ *****************************************************************************/
+static inline timensec_t
+get_elapsed_periods(MIDI_CLOCK_ANCHOR *anchor, timensec_t delta_nsec)
+{
+	timensec_t  periods;
+
+	/* an anchor this old means JACK has stopped, and speed matters less */
+	if (delta_nsec >= PERIOD_RECIP_MAX_NSEC) {
+		return delta_nsec / anchor->nsec_per_period;
+	}
+
+	periods = (timensec_t)(((guint64)(delta_nsec) *
+	                        (guint64)(anchor->periods_per_nsec)) >>
+	                       PERIOD_RECIP_FRAC_BITS);
+	if ((periods * anchor->nsec_per_period) > delta_nsec) {
+		periods--;
+	}
+
+	return periods;
 }
 
 
 /*****************************************************************************
  * get_midi_period()
+ *
+ * Returns the current MIDI period, extrapolated from the most recently
+ * published clock anchor with one subtraction and a fixed point multiply
+ * by the anchor's periods per nanosecond, corrected to the exact period
+ * with one more multiply.  When the JACK thread is late (or has stopped),
+ * timing keeps being extrapolated from the most recent anchor.
  *****************************************************************************/
 unsigned short
-get_midi_period(TIMESTAMP *now)
+get_midi_period(timensec_t *now)
 {
-	TIMESTAMP          recent           = { 0, 0 };
-	TIMESTAMP          delta;
-	timecalc_t         delta_nsec;
-	unsigned short     last_period      = sync_info[0].period_mask;
-	unsigned short     recent_period    = 0;
-	unsigned short     period;
-	unsigned short     elapsed_periods;
-	
-	if (clock_gettime(system_clockid, now) != 0) {
+	MIDI_CLOCK_ANCHOR   anchor;
+	timensec_t          delta_nsec;
+	timensec_t          elapsed_periods;
+	volatile MIDI_CLOCK_ANCHOR  *latched;
+	gint                sequence;
+
+	do {
+		sequence = g_atomic_int_get(&(midi_clock_anchor.sequence));
+		latched  = &(midi_clock_anchor.copy[sequence & 0x1]);
+		anchor.start_time      = latched->start_time;
+		anchor.nsec_per_period = latched->nsec_per_period;
+		anchor.periods_per_nsec = latched->periods_per_nsec;
+		anchor.period          = latched->period;
+		anchor.period_mask     = latched->period_mask;
+	} while (g_atomic_int_get(&(midi_clock_anchor.sequence)) != sequence);
+
+	if (time_get_nsecs(now) != 0) {
 		jamrouter_shutdown("clock_gettime() failed!\n");
 	}
 
-	/* Any thread needing to know what period we are in right now should under
-	   no circumstances use invalid sync_info[] for the current period.  This
-	   memory fence assures us that the compiler and the CPU do not do the
-	   wrong thing here.  In the case where current sync_info[] is not
-	   fetched, either a true CPU cache latency miss or the audio system
-	   skipping a cycle, extra logic is included below so that JAMRouter MIDI
-	   threads do not do the wrong thing when it comes to synchronization. */
-	asm volatile ("mfence; # read/write fence" : : : "memory");
-
-	for (period = 0; period < MAX_BUFFER_PERIODS; period++) {
-		/* check timestamps to find current MIDI period */
-		if ( ( timecmp(now, &(sync_info[last_period].end_time), TIME_GT) ||
-		       timecmp(now, &(sync_info[period].start_time),    TIME_GE) ) &&
-		     timecmp(now, &(sync_info[period].end_time),    TIME_LE) ) {
-			return (unsigned short)(period);
-		}
-		/* keep track of most recent sync_info found. */
-		if ( timecmp(&recent, &(sync_info[period].start_time),    TIME_LE) ||
-		     timecmp(&recent, &(sync_info[last_period].end_time), TIME_LT) ) {
-			time_copy(&recent, &(sync_info[period].start_time));
-			recent_period = period;
-		}
-		last_period = period;
+	if (anchor.nsec_per_period <= 0) {
+		JAMROUTER_DEBUG(DEBUG_CLASS_TESTING, DEBUG_COLOR_RED "}}{{ ");
+		return anchor.period;
 	}
 
-	/* Control reaches this point only before clock starts or when
-       sync_info[period] is found to be stale.  This extra logic only becomes
-       necessary when the number of periods in the sync_info[] ringbuffer is
-       pushed lower than 4, yet it remains as an extra safeguard against
-       against synchronization error, as the behavior of this logic has shown
-       itself to be 100% correct.  In the case of any sort of synchronization
-       error, timing information is dependably extrapolated from the most
-       recent sync_info in the ringbuffer.  In the case of buffer size changes
-       and synchronization failure at the same time, the MIDI threads will
-       pick up the change exactly one period (pre jack_bufsize reckoning)
-       late.  This of course should never be a concern during the middle of a
-       performance. */
-	time_copy(&delta, now);
-	time_sub(&delta, &recent);
-	delta_nsec = time_nsecs(&delta);
-	if (sync_info[recent_period].nsec_per_period != 0.0) {
-		elapsed_periods =
-			(unsigned short)(delta_nsec /
-			                 sync_info[recent_period].nsec_per_period);
-		period =
-			(unsigned short)((recent_period + elapsed_periods) &
-			                 sync_info[recent_period].period_mask);
-		//JAMROUTER_DEBUG(DEBUG_CLASS_TESTING, DEBUG_COLOR_RED "}}%d{{ ", period);
+	delta_nsec = *now - anchor.start_time;
+
+	/* round toward negative infinity, since the anchor may be the period
+	   after the current one. */
+	if (delta_nsec >= 0) {
+		elapsed_periods = get_elapsed_periods(&anchor, delta_nsec);
 	}
 	else {
-		JAMROUTER_DEBUG(DEBUG_CLASS_TESTING, DEBUG_COLOR_RED "}}{{ ", period);
+		elapsed_periods = -get_elapsed_periods(&anchor, -delta_nsec - 1) - 1;
 	}
 
-	return period;
+	return (unsigned short)((anchor.period + elapsed_periods) & anchor.period_mask);
 }
 
 
@@ -319,23 +447,25 @@ get_midi_period(TIMESTAMP *now)
  *   the time.
  *****************************************************************************/
 unsigned short
-get_midi_frame(unsigned short *period, TIMESTAMP *now, unsigned char flags)
+get_midi_frame(unsigned short *period, timensec_t *now, unsigned char flags)
 {
-	timecalc_t      period_time_nsec;
+	SYNC_SNAPSHOT   snapshot;
 	short           frame;
 
 	if (flags & FRAME_TIMESTAMP) {
-		if (clock_gettime(system_clockid, now) != 0) {
+		if (time_get_nsecs(now) != 0) {
 			jamrouter_shutdown("clock_gettime() failed!\n");
 		}
 	}
 
-	period_time_nsec =
-		(timecalc_t)(((now->tv_sec - sync_info[*period].start_time.tv_sec) *
-		              1000000000) +
-		             (now->tv_nsec - sync_info[*period].start_time.tv_nsec));
+	get_sync_snapshot(*period, &snapshot);
+
+	if (snapshot.nsec_per_frame <= 0) {
+		return 0;
+	}
 
-	frame = (short)(period_time_nsec / sync_info[*period].nsec_per_frame);
+	frame = (short)(NSECS_TO_FRAMES(snapshot.nsec_per_frame,
+	                                *now - snapshot.start_time));
 
 	if (frame < 0) {
 		if (flags & FRAME_LIMIT_LOWER) {
@@ -345,15 +475,15 @@ get_midi_frame(unsigned short *period, TIMESTAMP *now, unsigned char flags)
 			JAMROUTER_DEBUG(DEBUG_CLASS_TESTING,
 			                DEBUG_COLOR_RED "]]%d[[ ", *period);
 			while (frame < 0) {
-				frame =	(short)(frame + (short)
-					        (sync_info[*period].buffer_period_size));
-				*period = sync_info[*period].prev;
+				frame =	(short)(frame + (short)(snapshot.buffer_period_size));
+				*period = snapshot.prev;
+				get_sync_snapshot(*period, &snapshot);
 			}
 		}
 	}
 	else if ( (flags & FRAME_LIMIT_UPPER) &&
-	          (frame >= sync_info[*period].buffer_period_size) ) {
-		frame = (short)(sync_info[*period].buffer_period_size);
+	          (frame >= snapshot.buffer_period_size) ) {
+		frame = (short)(snapshot.buffer_period_size);
 		frame--;
 	}
 
@@ -364,19 +494,55 @@ get_midi_frame(unsigned short *period, TIMESTAMP *now, unsigned char flags)
 /*****************************************************************************
  * get_frame_time()
  *
- * Fills and returns the supplied timestamp with the time corresponding to
- * the supplied frame offset within the supplied period.
+ * Returns the time corresponding to the supplied frame offset within the
+ * supplied period.
  *****************************************************************************/
-TIMESTAMP *
-get_frame_time(unsigned short   period,
-               unsigned short   frame,
-               TIMESTAMP        *frame_time)
+timensec_t
+get_frame_time(unsigned short period, unsigned short frame)
 {
-	time_copy(frame_time, &(sync_info[period].start_time));
-	time_add_nsecs(frame_time, (int)(sync_info[period].nsec_per_frame *
-	                                 (timecalc_t)(frame)));
+	SYNC_SNAPSHOT   snapshot;
 
-	return frame_time;
+	get_sync_snapshot(period, &snapshot);
+
+	return snapshot.start_time + FRAMES_TO_NSECS(snapshot.nsec_per_frame, frame);
+}
+
+
+/*****************************************************************************
+ * get_nominal_period_length()
+ *
+ * Returns the fixed point period length for <period> as given by its sample
+ * rate and buffer period size.
+ *****************************************************************************/
+timensec_t
+get_nominal_period_length(unsigned short period)
+{
+	if (sync_info[period].sample_rate == 0) {
+		return 0;
+	}
+	return ((timensec_t)(sync_info[period].buffer_period_size) *
+	        NSECS_PER_SEC * FRAME_NSEC_ONE) /
+		(timensec_t)(sync_info[period].sample_rate);
+}
+
+
+/*****************************************************************************
+ * set_period_length()
+ *
+ * Sets the fixed point average period length for <period>, and derives the
+ * whole nanosecond period length and fixed point frame length from it, so
+ * that all frame <--> time conversion for the period is integer math.
+ *****************************************************************************/
+void
+set_period_length(unsigned short period, timensec_t nsec_per_period_avg)
+{
+	sync_info[period].nsec_per_period_avg = nsec_per_period_avg;
+	sync_info[period].nsec_per_period     =
+		(nsec_per_period_avg + (FRAME_NSEC_ONE >> 1)) >> FRAME_NSEC_FRAC_BITS;
+	if (sync_info[period].buffer_period_size > 0) {
+		sync_info[period].nsec_per_frame  =
+			nsec_per_period_avg / sync_info[period].buffer_period_size;
+	}
 }
 
 
@@ -563,14 +729,7 @@ set_new_period_size(unsigned short period, unsigned short nframes)
 		                 sync_info[period].buffer_size_mask);
 
 	/* nsec_per_period and nsec_per_frame depend on period size. */
-	sync_info[period].nsec_per_period  =
-		sync_info[period].f_buffer_period_size *
-		(timecalc_t)(1000000000.0) /
-		(timecalc_t)(sync_info[period].sample_rate);
-
-	sync_info[period].nsec_per_frame =
-		sync_info[period].nsec_per_period /
-		sync_info[period].f_buffer_period_size;
+	set_period_length(period, get_nominal_period_length(period));
 
 	/* set frames per byte for latency calculation and jitter correction. */
 	switch (sync_info[period].sample_rate) {
@@ -612,14 +771,6 @@ set_new_period_size(unsigned short period, unsigned short nframes)
 			((sync_info[period].sample_rate * 10 ) / 31250);
 	}
 
-	/* Since the decayed average is integrated at higher frequencies with
-	   lower buffer sizes and higher sampling rates, compensate here for
-	   stability.  This is tunable in seconds and provides nearly the same
-	   drift vs. time characteristics at all buffer size and sample rate
-	   combinations. */
-	decay_factor = sync_info[period].f_buffer_period_size /
-		((timecalc_t)(512.0) * sync_info[period].f_sample_rate);
-
 	/* calculate new midi phase lock for current buffer size. */
 	set_midi_phase_lock(period);
 }
@@ -636,6 +787,7 @@ init_sync_info(unsigned int sample_rate, unsigned short period_size)
 {
 	unsigned short     period;
 	unsigned short     last_period  = MAX_BUFFER_PERIODS - 1;
+	unsigned char      q;
 
 	for (period = 0; period < MAX_BUFFER_PERIODS; period++) {
 		sync_info[period].jack_wakeup_frame  = 0;
@@ -643,15 +795,11 @@ init_sync_info(unsigned int sample_rate, unsigned short period_size)
 		sync_info[period].jack_current_usecs = 0;
 		sync_info[period].jack_next_usecs    = 0;
 		sync_info[period].sample_rate        = sample_rate;
-		sync_info[period].f_sample_rate      = (timecalc_t)(sample_rate);
-		time_init(&(sync_info[period].start_time),
-		          JAMROUTER_CLOCK_INIT);
-		time_init(&(sync_info[period].end_time),
-		          JAMROUTER_CLOCK_INIT);
-		time_init(&(sync_info[period].sensing_timeout[A2J_QUEUE]),
-		          JAMROUTER_CLOCK_INIT);
-		time_init(&(sync_info[period].sensing_timeout[J2A_QUEUE]),
-		          JAMROUTER_CLOCK_INIT);
+		sync_info[period].start_time         = JAMROUTER_CLOCK_INIT;
+		sync_info[period].end_time           = JAMROUTER_CLOCK_INIT;
+		for (q = 0; q < MAX_MIDI_QUEUES; q++) {
+			sync_info[period].sensing_timeout[q] = 0;
+		}
 		sync_info[period].prev = last_period;
 		sync_info[last_period].next = period;
 		last_period = period;
@@ -660,6 +808,117 @@ init_sync_info(unsigned int sample_rate, unsigned short period_size)
 		}
 		init_sync_info_nav(period);
 	}
+
+	publish_all_sync_snapshots();
+}
+
+
+/*****************************************************************************
+ * reset_clock_dll()
+ *
+ * Opens the clock DLL back up to its starting bandwidth after the MIDI
+ * period clock has been (re)locked to an audio wakeup at <now>.
+ *****************************************************************************/
+void
+reset_clock_dll(timensec_t now)
+{
+	clock_dll.bandwidth       = (timecalc_t)(CLOCK_DLL_BANDWIDTH_START);
+	clock_dll.narrow_time     = now;
+	clock_dll.phase_error     = 0;
+	clock_dll.phase_error_max = 0;
+	clock_dll.period_error    = 0;
+}
+
+
+/*****************************************************************************
+ * run_clock_dll()
+ *
+ * Runs one cycle of the second order delay-locked loop that replaces the
+ * old decayed average of period lengths.  The phase error is the distance
+ * between the audio wakeup (<delta_nsec> into <period>) and the phase lock
+ * point.  It corrects both the start of <next_period> (first order term)
+ * and the period length estimate (second order term), so that period and
+ * phase are tracked together.  With loop bandwidth B and period T:
+ *
+ *     omega = 2 * pi * B * T
+ *     start(next)  = start(period) + length(period) + sqrt(2) * omega * error
+ *     length(next) = length(period) + omega^2 * error
+ *
+ * The phase step is limited to half a frame at the steady state bandwidth
+ * to maintain continuity, and the limit widens with the loop bandwidth so
+ * that phase pulls in as quickly as period length while the loop is wide.
+ * Returns the start time of <next_period>.
+ *****************************************************************************/
+timensec_t
+run_clock_dll(unsigned short period, unsigned short next_period, timensec_t delta_nsec)
+{
+	timecalc_t      omega;
+	timensec_t      phase_error;
+	timensec_t      phase_step;
+	timensec_t      max_step;
+
+	/* Narrow the loop bandwidth as the clock settles. */
+	if ( (clock_dll.bandwidth > (timecalc_t)(CLOCK_DLL_BANDWIDTH)) &&
+	     ((jack_start_time - clock_dll.narrow_time) >=
+	      ((timensec_t)(CLOCK_DLL_NARROW_MSEC) * 1000000)) ) {
+		clock_dll.bandwidth *= (timecalc_t)(0.5);
+		if (clock_dll.bandwidth < (timecalc_t)(CLOCK_DLL_BANDWIDTH)) {
+			clock_dll.bandwidth = (timecalc_t)(CLOCK_DLL_BANDWIDTH);
+		}
+		clock_dll.narrow_time = jack_start_time;
+		JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
+		                DEBUG_COLOR_PINK "<DLL %g Hz  phase %+ld/%ld ns  "
+		                "period %+ld ns> " DEBUG_COLOR_DEFAULT,
+		                (double)(clock_dll.bandwidth),
+		                (long int)(clock_dll.phase_error),
+		                (long int)(clock_dll.phase_error_max),
+		                (long int)(clock_dll.period_error));
+	}
+
+	phase_error = delta_nsec -
+		(FRAMES_TO_NSECS(sync_info[period].nsec_per_frame,
+		                 midi_phase_lock_frac) >> FRAME_NSEC_FRAC_BITS);
+
+	omega = (timecalc_t)(6.283185307179586) * clock_dll.bandwidth *
+		(timecalc_t)(sync_info[period].nsec_per_period) /
+		(timecalc_t)(1000000000.0);
+	if (omega > (timecalc_t)(CLOCK_DLL_MAX_OMEGA)) {
+		omega = (timecalc_t)(CLOCK_DLL_MAX_OMEGA);
+	}
+
+	/* first order term:  phase */
+	phase_step = (timensec_t)((timecalc_t)(1.4142135623730951) * omega *
+	                          (timecalc_t)(phase_error));
+	max_step = (timensec_t)((timecalc_t)(sync_info[period].nsec_per_frame >>
+	                                     (FRAME_NSEC_FRAC_BITS + 1)) *
+	                        clock_dll.bandwidth /
+	                        (timecalc_t)(CLOCK_DLL_BANDWIDTH));
+	if (phase_step > max_step) {
+		phase_step = max_step;
+	}
+	else if (phase_step < -max_step) {
+		phase_step = -max_step;
+	}
+
+	/* second order term:  period length, kept in fixed point */
+	set_period_length(next_period,
+	                  sync_info[period].nsec_per_period_avg +
+	                  (timensec_t)(omega * omega * (timecalc_t)(phase_error) *
+	                               (timecalc_t)(FRAME_NSEC_ONE)));
+
+	clock_dll.phase_error  = phase_error;
+	if (phase_error > clock_dll.phase_error_max) {
+		clock_dll.phase_error_max = phase_error;
+	}
+	else if (-phase_error > clock_dll.phase_error_max) {
+		clock_dll.phase_error_max = -phase_error;
+	}
+	clock_dll.period_error = sync_info[next_period].nsec_per_period -
+		((get_nominal_period_length(next_period) + (FRAME_NSEC_ONE >> 1)) >>
+		 FRAME_NSEC_FRAC_BITS);
+
+	return sync_info[period].start_time + sync_info[period].nsec_per_period +
+		phase_step;
 }
 
 
@@ -667,8 +926,9 @@ init_sync_info(unsigned int sample_rate, unsigned short period_size)
  * set_midi_cycle_time()
  *
  * This function fully manages calculating the timestamps for MIDI period
- * start and end, using a decayed average to maintain a rock-steady MIDI
- * period time interval reference from one period to the next.  This design
+ * start and end, using a second order DLL (see run_clock_dll()) to maintain a
+ * rock-steady MIDI period time interval reference from one period to the
+ * next.  This design
  * allows the underlying audio system to wake up and begin its processing
  * early or late without translating thread scheduling jitter into event
  * scheduling and timestamping jitter, as long as there are no xruns and the
@@ -693,13 +953,11 @@ init_sync_info(unsigned int sample_rate, unsigned short period_size)
 unsigned short
 set_midi_cycle_time(unsigned short period, int nframes)
 {
-	TIMESTAMP               next_timeref;
-	TIMESTAMP               timeref;
-	TIMESTAMP               last;
-	TIMESTAMP               cb_start_time;
-	TIMESTAMP               calc_start_time;
-	timecalc_t              delta_nsec;
-	timecalc_t              avg_period_nsec;
+	timensec_t              next_timeref;
+	timensec_t              last;
+	timensec_t              cb_start_time;
+	timensec_t              calc_start_time;
+	timensec_t              delta_nsec;
 	unsigned short          next_period;
 #ifndef WITHOUT_JACK_DLL
 	/* these values are provided by jack_get_cycle_times() */
@@ -707,19 +965,22 @@ set_midi_cycle_time(unsigned short period, int nframes)
 	jack_time_t             current_usecs;
 	jack_time_t             next_usecs;
 	float                   period_usecs;
+	timensec_t              jack_cycle_start;
+	timensec_t              offset_error;
 #endif
 	jack_nframes_t          frames_since_start   = 0;
+	int                     restart              = 0;
 
 	next_period = sync_info[period].next;
-	time_copy(&last, &jack_start_time);
+	last = jack_start_time;
 
 #ifndef WITHOUT_JACK_DLL
 	frames_since_start = jack_frames_since_cycle_start(jack_audio_client);
 #endif
-	clock_gettime(system_clockid, &cb_start_time);
+	time_get_nsecs(&cb_start_time);
 
-	time_copy(&jack_start_time, &cb_start_time);
-	time_copy(&calc_start_time, &cb_start_time);
+	jack_start_time = cb_start_time;
+	calc_start_time = cb_start_time;
 
 #ifndef WITHOUT_JACK_DLL
 	if (jack_get_cycle_times(jack_audio_client,
@@ -730,37 +991,43 @@ set_midi_cycle_time(unsigned short period, int nframes)
 		sync_info[next_period].jack_current_usecs = current_usecs;
 		sync_info[next_period].jack_next_usecs    = next_usecs;
 
-		sync_info[next_period].jack_nsec_per_period =
-			(timecalc_t)((jack_time_t)(sync_info[next_period].jack_next_usecs) -
-			             (jack_time_t)(sync_info[next_period].jack_current_usecs)) *
-			(timecalc_t)(1000.0);
-
-		sync_info[next_period].jack_nsec_per_frame =
-			sync_info[next_period].jack_nsec_per_period /
-			sync_info[period].f_buffer_period_size;
-
-		/* JACK cycle start time, as reported by jack_get_cycle_times() */
-		jack_start_time.tv_sec  = current_usecs / 1000000;
-		jack_start_time.tv_nsec = (current_usecs % 1000000) * 1000;
+		/* JACK cycle start time, as reported by jack_get_cycle_times().
+		   JACK filters this with its own DLL, free of our wakeup jitter,
+		   but keeps it on its own clock. */
+		jack_cycle_start = (timensec_t)(current_usecs) * 1000;
 
 		/* Elapsed frames since cycle start -- JACK calculation */
-		time_sub_nsecs(&calc_start_time,
-		               (int)((timecalc_t)(frames_since_start) *
-		                     sync_info[period].nsec_per_frame));
+		calc_start_time -= FRAMES_TO_NSECS(sync_info[period].nsec_per_frame,
+		                                   frames_since_start);
 
 		sync_info[next_period].jack_error_nsecs =
-			time_delta_nsecs(&calc_start_time, &jack_start_time);
+			calc_start_time - jack_cycle_start;
+
+		/* Follow the offset between JACK's clock and ours with a slow
+		   average, which leaves our wakeup jitter out, and take the cycle
+		   start from JACK.  Start over when JACK's timing first becomes
+		   available or jumps by more than a period. */
+		offset_error = sync_info[next_period].jack_error_nsecs -
+			clock_dll.jack_offset;
+		if ( !clock_dll.jack_cycle_times ||
+		     (offset_error > sync_info[period].nsec_per_period) ||
+		     (offset_error < -sync_info[period].nsec_per_period) ) {
+			clock_dll.jack_offset = sync_info[next_period].jack_error_nsecs;
+		}
+		else {
+			clock_dll.jack_offset += offset_error / CLOCK_DLL_JACK_OFFSET_AVG;
+		}
+		clock_dll.jack_cycle_times = 1;
 
-		time_add_nsecs(&jack_start_time,
-		               sync_info[next_period].jack_error_nsecs);
+		jack_start_time = jack_cycle_start + clock_dll.jack_offset;
 
 		//JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
 		//                DEBUG_COLOR_PINK "<%d> " DEBUG_COLOR_DEFAULT,
-		//                (int)((timecalc_t)
-		//                      (sync_info[next_period].jack_error_nsecs /
-		//                       sync_info[next_period].nsec_per_frame)));
+		//                (int)(NSECS_TO_FRAMES(sync_info[next_period].nsec_per_frame,
+		//                      sync_info[next_period].jack_error_nsecs)));
 	}
 	else {
+		clock_dll.jack_cycle_times = 0;
 		JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
 		                DEBUG_COLOR_RED "!? " DEBUG_COLOR_DEFAULT);
 	}
@@ -769,8 +1036,6 @@ set_midi_cycle_time(unsigned short period, int nframes)
 	/* For next period, start with current period's sync_info[] */
 	sync_info[next_period].f_buffer_period_size =
 		sync_info[period].f_buffer_period_size;
-	sync_info[next_period].f_sample_rate        =
-		sync_info[period].f_sample_rate;
 	sync_info[next_period].sample_rate          =
 		sync_info[period].sample_rate;
 	sync_info[next_period].buffer_size          =
@@ -794,15 +1059,14 @@ set_midi_cycle_time(unsigned short period, int nframes)
 	sync_info[next_period].tx_latency_periods   =
 		sync_info[period].tx_latency_periods;
 
-	delta_nsec = time_delta_nsecs(&jack_start_time,
-	                              &(sync_info[period].start_time));
-
 	/* Delay between start_midi_clock() and first call to this
 	   function is not always determinate, so check for clock init
 	   and set timestamp here. */
-	if ( (last.tv_nsec == JAMROUTER_CLOCK_INIT) ||
+	if ( (last == JAMROUTER_CLOCK_INIT) ||
 	     (nframes != sync_info[period].buffer_period_size) ||
-	     (sync_info[period].end_time.tv_nsec == JAMROUTER_CLOCK_INIT) ) {
+	     (sync_info[period].end_time == JAMROUTER_CLOCK_INIT) ) {
+
+		restart = 1;
 
 		/* Set buffer period size and calculate new sync variables */
 		for (next_period = 0; next_period < MAX_BUFFER_PERIODS; next_period++) {
@@ -820,204 +1084,99 @@ set_midi_cycle_time(unsigned short period, int nframes)
 		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
 		                DEBUG_COLOR_YELLOW "%d@" DEBUG_COLOR_DEFAULT, period);
 
-		sync_info[period].nsec_per_period =
-			sync_info[period].f_buffer_period_size *
-			(timecalc_t)1000000000.0 /
-			(timecalc_t)sync_info[period].sample_rate;
-
-		sync_info[period].nsec_per_frame =
-			(sync_info[period].nsec_per_period /
-			 sync_info[period].f_buffer_period_size);
+		set_period_length(period, get_nominal_period_length(period));
 
 		/* Assume the processing thread woke up at the expected phase in the
 		   current MIDI period. */
-		delta_nsec = sync_info[next_period].nsec_per_frame *
-			(timecalc_t)(midi_phase_lock);
+		delta_nsec = FRAMES_TO_NSECS(sync_info[next_period].nsec_per_frame,
+		                             midi_phase_lock_frac) >> FRAME_NSEC_FRAC_BITS;
 
 		/* Set initial timeref to match target audio wakeup phase. */
-		time_copy(&(sync_info[period].start_time), &jack_start_time);
-		time_sub_nsecs(&(sync_info[period].start_time),
-		               (int)(delta_nsec));
-
-		time_copy(&(sync_info[period].end_time), &jack_start_time);
-		time_add_nsecs(&(sync_info[period].end_time),
-		               (int)(sync_info[period].nsec_per_period -
-		                     delta_nsec));
-
-		time_copy(&(sync_info[next_period].start_time), &jack_start_time);
-		time_add_nsecs(&(sync_info[next_period].start_time),
-		               (int)(sync_info[period].nsec_per_period -
-		                     delta_nsec));
-
-		time_copy(&(sync_info[next_period].end_time), &jack_start_time);
-		time_add_nsecs(&(sync_info[next_period].end_time),
-		               (int)((sync_info[period].nsec_per_period +
-		                      sync_info[next_period].nsec_per_period) -
-		                     delta_nsec));
-
-		/* Set nsec_per_period and nsec_per_frame for period after next */
-		sync_info[sync_info[next_period].next].nsec_per_period =
+		sync_info[period].start_time = jack_start_time - delta_nsec;
+
+		sync_info[period].end_time =
+			jack_start_time + sync_info[period].nsec_per_period - delta_nsec;
+
+		sync_info[next_period].start_time = sync_info[period].end_time;
+
+		sync_info[next_period].end_time =
+			sync_info[next_period].start_time +
 			sync_info[next_period].nsec_per_period;
-		sync_info[sync_info[next_period].next].nsec_per_frame =
-			sync_info[next_period].nsec_per_frame;
+
+		/* Set period length for period after next */
+		set_period_length(sync_info[next_period].next,
+		                  sync_info[next_period].nsec_per_period_avg);
+
+		reset_clock_dll(jack_start_time);
+
+		sync_info[period].jack_wakeup_frame = (signed short)
+			(NSECS_TO_FRAMES(sync_info[next_period].nsec_per_frame, delta_nsec));
+
+		next_timeref = sync_info[next_period].start_time;
 	}
 
 	/* handle the normal case (no clock restart). */
 	else {
 		/* get time in nanoseconds since beginning of MIDI period. */
-		delta_nsec = time_delta_nsecs(&jack_start_time,
-		                              &(sync_info[period].start_time));
-
-		avg_period_nsec  = sync_info[period].nsec_per_period;
-		avg_period_nsec -= (avg_period_nsec * decay_factor);
-
-		/* handle system clock wrapping around. */
-		if ((jack_start_time.tv_sec == 0) && (last.tv_sec != 0)) {
-			avg_period_nsec +=
-				((timecalc_t)((timecalc_t)(1000000000.0) +
-				              (timecalc_t)(jack_start_time.tv_nsec) -
-				              (timecalc_t)(last.tv_nsec)) * decay_factor);
-		}
-		else {
-			avg_period_nsec +=
-				((timecalc_t)((((timecalc_t)(jack_start_time.tv_sec) -
-				                (timecalc_t)(last.tv_sec)) *
-				               (timecalc_t)(1000000000.0)) +
-				              ((timecalc_t)(jack_start_time.tv_nsec) -
-				               (timecalc_t)(last.tv_nsec))) * decay_factor);
-		}
-		sync_info[next_period].nsec_per_period = avg_period_nsec;
-		sync_info[next_period].nsec_per_frame  =
-			(sync_info[next_period].nsec_per_period /
-			 sync_info[next_period].f_buffer_period_size);
-
-		/* TODO:  Turn this into a higher order filter by adding either
-		   additional decayed average stages or integrators tuned at different
-		   time intervals, with the first stage only being the one that
-		   compensates for buffer period size and sample rate. */
-	}
+		delta_nsec = jack_start_time - sync_info[period].start_time;
 
-	time_copy(&timeref, &(sync_info[period].start_time));
-	time_copy(&next_timeref, &timeref);
-
-	sync_info[period].jack_wakeup_frame = (signed short)
-		(delta_nsec / sync_info[next_period].nsec_per_frame);
+		sync_info[period].jack_wakeup_frame = (signed short)
+			(NSECS_TO_FRAMES(sync_info[next_period].nsec_per_frame, delta_nsec));
 
 #if defined(EXTRA_DEBUG) && !defined(WITHOUT_JACK_DLL)
-	if (debug_class & DEBUG_CLASS_ANALYZE) {
-		if ( (current_frames - sync_info[period].jack_frames) !=
-		     sync_info[period].buffer_period_size) {
-			JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
-			                DEBUG_COLOR_RED "{%u} "
-			                DEBUG_COLOR_DEFAULT,
-			                current_frames - sync_info[period].jack_frames);
+		if (debug_class & DEBUG_CLASS_ANALYZE) {
+			if ( (current_frames - sync_info[period].jack_frames) !=
+			     sync_info[period].buffer_period_size) {
+				JAMROUTER_DEBUG(DEBUG_CLASS_ANALYZE,
+				                DEBUG_COLOR_RED "{%u} "
+				                DEBUG_COLOR_DEFAULT,
+				                current_frames - sync_info[period].jack_frames);
+			}
 		}
-	}
 #endif
 
-#ifndef WITHOUT_JACK_DLL
-	avg_period_nsec = sync_info[next_period].nsec_per_period;
-#endif
-
-#if 0
-	/* Latch the clock when audio wakes up before the calculated midi period
-	   start. coming in one frame too early is unfortunately common with
-	   non-rt kernels or missing realtime priveleges.  allow for an extra
-	   frame. */
-	if (delta_nsec < (sync_info[period].nsec_per_frame)) {
-		next_timeref.tv_sec   = (int)jack_start_time.tv_sec;
-		next_timeref.tv_nsec  = (int)jack_start_time.tv_nsec;
-		next_timeref.tv_nsec -=
-			((int)(sync_info[next_period].nsec_per_period -
-			       (sync_info[next_period].nsec_per_frame *
-			        (sync_info[next_period].f_buffer_period_size -
-			         midi_phase_lock))));
-		/* Reset nsec_per_frame and nsec_per_period for quick clock resettling
-		   times after xruns or other events that throw off the audio process
-		   thread's scheduling. */
-		sync_info[next_period].nsec_per_frame =
-			(timecalc_t)(1000000000.0) / sync_info[period].f_sample_rate;
-		sync_info[next_period].nsec_per_period =
-			sync_info[period].f_buffer_period_size *
-			(timecalc_t)(1000000000.0) /
-			sync_info[period].f_sample_rate;
-		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-		                DEBUG_COLOR_YELLOW "|||%d%+d|||--- " DEBUG_COLOR_DEFAULT,
-		                sync_info[period].jack_wakeup_frame,
-		                frames_since_start);
-	}
-	/* Phase locking lower bound: subtract a partial frame from the start of
-	   the next period (no more than 0.5 to maintian continuity). */
-	else
-#endif
-	if (delta_nsec <
-		    (sync_info[period].nsec_per_frame * midi_phase_min)) {
-		time_sub_nsecs(&next_timeref, (int)
-		               (sync_info[next_period].nsec_per_frame * 0.25));
-		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-		                DEBUG_COLOR_LTBLUE "<<" DEBUG_COLOR_BLUE "%d%+d"
-		                DEBUG_COLOR_LTBLUE "<< " DEBUG_COLOR_DEFAULT,
-		                sync_info[period].jack_wakeup_frame,
-		                frames_since_start);
-	}
-	/* This condition is reached when the phase is locked. */
-	else if (delta_nsec <
-	         (sync_info[period].nsec_per_frame * midi_phase_max)) {
-		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-		                DEBUG_COLOR_BLUE "%d%+d " DEBUG_COLOR_DEFAULT,
-		                sync_info[period].jack_wakeup_frame,
-		                frames_since_start);
-	}
-	/* Phase locking upper bound: add a partial frame to the start of
-	   the next period (no more than 0.5 to maintian continuity). */
-	else if ( (delta_nsec < (sync_info[period].nsec_per_period)) &&
-	          (sync_info[period].jack_wakeup_frame <
-	           sync_info[period].f_buffer_period_size) ) {
-		time_add_nsecs(&next_timeref, (int)
-		               (sync_info[next_period].nsec_per_frame * 0.25));
-		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-		                DEBUG_COLOR_LTBLUE ">>" DEBUG_COLOR_BLUE "%d%+d"
-		                DEBUG_COLOR_LTBLUE ">> " DEBUG_COLOR_DEFAULT,
-		                sync_info[period].jack_wakeup_frame,
-		                frames_since_start);
-	}
-	/* Latch the clock when audio wakes up after the calculated period end. */
-	else {
-		time_add_nsecs(&next_timeref, (int)
-		               ((sync_info[next_period].nsec_per_frame * 
-		                 midi_phase_max)));
-		//(sync_info[next_period].f_buffer_period_size - 1.0))));
-		/* Reset nsec_per_frame and nsec_per_period for quick clock
-		   resettling times after xruns or other events that throw off the
-		   audio process thread's scheduling. */
-		sync_info[next_period].nsec_per_frame =
-			(timecalc_t)(1000000000.0) / sync_info[period].f_sample_rate;
-		sync_info[next_period].nsec_per_period =
-			sync_info[period].f_buffer_period_size *
-			(timecalc_t)(1000000000.0) / sync_info[period].f_sample_rate;
-		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
-		                DEBUG_COLOR_YELLOW "+++|||%d%+d||| " DEBUG_COLOR_DEFAULT,
-		                sync_info[period].jack_wakeup_frame,
-		                frames_since_start);
+		/* Audio woke up before the start or after the end of the calculated
+		   MIDI period (xrun, or any other event that throws off the audio
+		   process thread's scheduling).  Relock the clock to this wakeup
+		   and reset the period length for quick resettling. */
+		if ((delta_nsec < 0) || (delta_nsec >= sync_info[period].nsec_per_period)) {
+			set_period_length(next_period, get_nominal_period_length(period));
+			next_timeref = jack_start_time +
+				sync_info[next_period].nsec_per_period -
+				(FRAMES_TO_NSECS(sync_info[next_period].nsec_per_frame,
+				                 midi_phase_lock_frac) >> FRAME_NSEC_FRAC_BITS);
+			reset_clock_dll(jack_start_time);
+			clock_dll.relocks++;
+			JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
+			                DEBUG_COLOR_YELLOW "+++|||%d%+d||| " DEBUG_COLOR_DEFAULT,
+			                sync_info[period].jack_wakeup_frame,
+			                frames_since_start);
+		}
+		else {
+			next_timeref = run_clock_dll(period, next_period, delta_nsec);
+			JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
+			                DEBUG_COLOR_BLUE "%d%+d " DEBUG_COLOR_DEFAULT,
+			                sync_info[period].jack_wakeup_frame,
+			                frames_since_start);
+		}
 	}
-    /* Advance the timeref by one period for start of the next. */
-	time_add_nsecs(&next_timeref,
-	               (int)(sync_info[next_period].nsec_per_period));
-	time_copy(&(sync_info[next_period].start_time), &next_timeref);
 
-	/* Advance the timeref by another period for end of the next. */
-	time_add_nsecs(&next_timeref,
-	               (int)(sync_info[next_period].nsec_per_period));
-	time_copy(&(sync_info[next_period].end_time), &next_timeref);
+	/* next_timeref is now the start of the next period. */
+	sync_info[next_period].start_time = next_timeref;
+
+	/* Advance the timeref by one period for end of the next. */
+	next_timeref += sync_info[next_period].nsec_per_period;
+	sync_info[next_period].end_time = next_timeref;
 
 	/* Use the same timeref for the start of the period after the next. */
 	next_period = sync_info[next_period].next;
-	time_copy(&(sync_info[next_period].start_time), &next_timeref);
+	set_period_length(next_period,
+	                  sync_info[sync_info[next_period].prev].nsec_per_period_avg);
+	sync_info[next_period].start_time = next_timeref;
 
 	/* Advance by one period for end of the period after the next. */
-	time_add_nsecs(&next_timeref,
-	               (int)(sync_info[next_period].nsec_per_period));
-	time_copy(&(sync_info[next_period].end_time), &next_timeref);
+	next_timeref += sync_info[next_period].nsec_per_period;
+	sync_info[next_period].end_time = next_timeref;
 
 #ifndef WITHOUT_JACK_DLL
 	sync_info[next_period].jack_frames =
@@ -1031,10 +1190,19 @@ set_midi_cycle_time(unsigned short period, int nframes)
 	next_period = sync_info[period].next;
 
 	/* sync_info[] is now set for the next period and will not be written to
-	   again for one full period.  This memory fence helps ensure that the
-	   compiler and the CPU do not do the wrong thing when reordering reads
-	   into sync_info[]. */
-	asm volatile ("mfence; # read/write fence" : : : "memory");
+	   again for one full period.  Publish the periods written above to the
+	   MIDI threads, only now that all of the work is done. */
+	if (restart) {
+		publish_all_sync_snapshots();
+	}
+	else {
+		publish_sync_snapshot(period);
+		publish_sync_snapshot(next_period);
+		publish_sync_snapshot(sync_info[next_period].next);
+	}
+
+	/* direct get_midi_period() at the next period */
+	publish_midi_clock_anchor(next_period);
 
 	return next_period;
 }
@@ -1049,12 +1217,10 @@ set_midi_cycle_time(unsigned short period, int nframes)
 void
 set_active_sensing_timeout(unsigned short period, unsigned char queue_num)
 {
-	TIMESTAMP     now;
+	timensec_t    now;
 
-	if (clock_gettime(system_clockid, &(now)) == 0) {
-		time_copy(&(sync_info[period].sensing_timeout[queue_num]), &now);
-		time_add_nsecs(&(sync_info[period].sensing_timeout[queue_num]),
-		               300000000);
+	if (time_get_nsecs(&now) == 0) {
+		sync_info[period].sensing_timeout[queue_num] = now + 300000000;
 		JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
 		             DEBUG_COLOR_YELLOW "<A> " DEBUG_COLOR_DEFAULT);
 	}
@@ -1070,12 +1236,11 @@ set_active_sensing_timeout(unsigned short period, unsigned char queue_num)
 int
 check_active_sensing_timeout(unsigned short period, unsigned char queue_num)
 {
-	if ( (sync_info[period].sensing_timeout[queue_num].tv_sec != 0) &&
-	     (sync_info[period].sensing_timeout[queue_num].tv_nsec != 0) ) {
+	if (sync_info[period].sensing_timeout[queue_num] != 0) {
 
-		if (timecmp(&(sync_info[period].sensing_timeout[queue_num]),
-		            &(sync_info[period].end_time), TIME_LE)) {
-			time_init(&(sync_info[period].sensing_timeout[queue_num]), 0);
+		if (sync_info[period].sensing_timeout[queue_num] <=
+		    sync_info[period].end_time) {
+			sync_info[period].sensing_timeout[queue_num] = 0;
 			JAMROUTER_DEBUG(DEBUG_CLASS_TIMING,
 			             DEBUG_COLOR_YELLOW "<Z> " DEBUG_COLOR_DEFAULT);
 			return ACTIVE_SENSING_STATUS_TIMEOUT;
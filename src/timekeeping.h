@@ -46,6 +46,24 @@
 #define TIME_LT                        0x4
 #define TIME_LE                        0x5
 
+/* Frame lengths are kept in fixed point nanoseconds with this many fraction
+   bits, so that frame <--> time conversion is exact integer math. */
+#define FRAME_NSEC_FRAC_BITS           16
+#define FRAME_NSEC_ONE                 ((timensec_t)1 << FRAME_NSEC_FRAC_BITS)
+
+/* nanoseconds spanned by <frames>, given a fixed point frame length */
+#define FRAMES_TO_NSECS(nsec_per_frame, frames)                       \
+	((((timensec_t)(frames)) * (nsec_per_frame)) >> FRAME_NSEC_FRAC_BITS)
+
+/* whole frames spanned by <nsecs>, truncated toward zero */
+#define NSECS_TO_FRAMES(nsec_per_frame, nsecs)                        \
+	((((timensec_t)(nsecs)) * FRAME_NSEC_ONE) / (nsec_per_frame))
+
+/* The clock anchor carries periods per nanosecond in fixed point with this
+   many fraction bits, so get_midi_period() needs no 64-bit division. */
+#define PERIOD_RECIP_FRAC_BITS         32
+#define PERIOD_RECIP_MAX_NSEC          ((timensec_t)1 << PERIOD_RECIP_FRAC_BITS)
+
 
 #if (ARCH_BITS == 32)
 typedef float timecalc_t;
@@ -74,27 +92,89 @@ typedef struct sync_info {
 	unsigned short   tx_latency_size;
 	signed short     jack_wakeup_frame;
 	short            frames_per_byte;
-	timecalc_t       nsec_per_frame;
-	timecalc_t       nsec_per_period;
+	timensec_t       nsec_per_frame;        /* fixed point */
+	timensec_t       nsec_per_period_avg;   /* fixed point */
+	timensec_t       nsec_per_period;
 	timecalc_t       f_buffer_period_size;
-	timecalc_t       f_sample_rate;
 	unsigned int     sample_rate;
-	TIMESTAMP        start_time;
-	TIMESTAMP        end_time;
-	TIMESTAMP        sensing_timeout[MAX_MIDI_QUEUES];
+	timensec_t       start_time;
+	timensec_t       end_time;
+	timensec_t       sensing_timeout[MAX_MIDI_QUEUES];
 #ifdef HAVE_JACK_GET_CYCLE_TIMES
 	jack_nframes_t   jack_frames;
 	jack_time_t      jack_current_usecs;
 	jack_time_t      jack_next_usecs;
-	timecalc_t       jack_nsec_per_period;
-	timecalc_t       jack_nsec_per_frame;
-	timecalc_t       jack_error_nsecs;
+	timensec_t       jack_error_nsecs;
 #endif
 } SYNC_INFO;
 
 
+/* Reference point published by the JACK thread once per period, from which
+   any thread can find the current MIDI period without scanning sync_info[].
+   Published through a latch (see publish_midi_clock_anchor()). */
+typedef struct midi_clock_anchor {
+	timensec_t       start_time;
+	timensec_t       nsec_per_period;
+	timensec_t       periods_per_nsec;      /* fixed point */
+	unsigned short   period;
+	unsigned short   period_mask;
+} MIDI_CLOCK_ANCHOR;
+
+
+/* State and error terms of the clock DLL in set_midi_cycle_time().  Written
+   only by the JACK thread, and may be read anywhere for monitoring. */
+typedef struct clock_dll {
+	timecalc_t       bandwidth;             /* current loop bandwidth, Hz */
+	timensec_t       narrow_time;           /* last bandwidth change */
+	timensec_t       phase_error;           /* last wakeup phase error */
+	timensec_t       phase_error_max;       /* max |phase error| since lock */
+	timensec_t       period_error;          /* period length - nominal */
+	unsigned int     relocks;
+	timensec_t       jack_offset;           /* our clock - JACK's, averaged */
+	int              jack_cycle_times;      /* phase from JACK cycle times */
+} CLOCK_DLL;
+
+
+/* Consistent copy of the per-period timing most often needed by the MIDI
+   threads, taken with get_sync_snapshot(). */
+typedef struct sync_snapshot {
+	timensec_t       start_time;
+	timensec_t       end_time;
+	timensec_t       nsec_per_frame;        /* fixed point */
+	timensec_t       nsec_per_period;
+	unsigned short   prev;
+	unsigned short   next;
+	unsigned short   rx_index;
+	unsigned short   tx_index;
+	unsigned short   input_index;
+	unsigned short   output_index;
+	unsigned short   buffer_period_size;
+} SYNC_SNAPSHOT;
+
+
+/* Published timing for one period, as a latch:  two copies of the snapshot
+   and a sequence counter whose low bit tells readers which copy is not
+   being written.  Readers never wait on the writer, and only retry when
+   the writer has moved on while they were copying. */
+typedef struct sync_latch {
+	gint             sequence;
+	SYNC_SNAPSHOT    copy[2];
+} SYNC_LATCH;
+
+/* Published clock anchor, as a latch like SYNC_LATCH. */
+typedef struct anchor_latch {
+	gint             sequence;
+	MIDI_CLOCK_ANCHOR copy[2];
+} ANCHOR_LATCH;
+
+
 extern volatile SYNC_INFO   sync_info[MAX_BUFFER_PERIODS];
 
+extern volatile SYNC_LATCH  sync_latch[MAX_BUFFER_PERIODS];
+extern volatile ANCHOR_LATCH midi_clock_anchor;
+
+extern volatile CLOCK_DLL   clock_dll;
+
 extern timecalc_t           midi_phase_lock;
 extern timecalc_t           midi_phase_min;
 extern timecalc_t           midi_phase_max;
@@ -104,20 +184,28 @@ extern int                  max_event_latency;
 
 
 unsigned short sleep_until_next_period(unsigned short period,
-                                       TIMESTAMP *now);
+                                       timensec_t *now);
 void sleep_until_frame(unsigned short period,
                        unsigned short frame);
 
 void set_midi_phase_lock(unsigned short period);
 void start_midi_clock(void);
 
-unsigned short get_midi_period(TIMESTAMP *now);
+void publish_sync_snapshot(unsigned short period);
+void publish_all_sync_snapshots(void);
+void get_sync_snapshot(unsigned short period,
+                       SYNC_SNAPSHOT *snapshot);
+void publish_midi_clock_anchor(unsigned short period);
+unsigned short get_midi_period(timensec_t *now);
 unsigned short get_midi_frame(unsigned short *period,
-                              TIMESTAMP *now,
+                              timensec_t *now,
                               unsigned char flags);
-TIMESTAMP *get_frame_time(unsigned short period,
-                          unsigned short frame,
-                          TIMESTAMP *frame_time);
+timensec_t get_frame_time(unsigned short period,
+                          unsigned short frame);
+
+timensec_t get_nominal_period_length(unsigned short period);
+void set_period_length(unsigned short period,
+                       timensec_t nsec_per_period_avg);
 
 void set_new_period_size(unsigned short period,
                          unsigned short nframes);
@@ -125,6 +213,10 @@ void init_sync_info_nav(unsigned short period);
 void init_sync_info(unsigned int sample_rate,
                     unsigned short period_size);
 
+void reset_clock_dll(timensec_t now);
+timensec_t run_clock_dll(unsigned short period,
+                         unsigned short next_period,
+                         timensec_t delta_nsec);
 unsigned short set_midi_cycle_time(unsigned short period,
                                    int nframes);
 
@@ -0,0 +1,381 @@
+/*****************************************************************************
+ *
+ * timer_wheel.c
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "jamrouter.h"
+#include "timekeeping.h"
+#include "mididefs.h"
+#include "midi_event.h"
+#include "sysex_stream.h"
+#include "timer_wheel.h"
+#include "debug.h"
+
+
+/* one wheel per route in use, allocated by init_timer_wheels() */
+static TIMER_WHEEL      *timer_wheel = NULL;
+
+
+/*****************************************************************************
+ * init_timer_wheels()
+ *
+ * Called once at startup, after the number of routes is known.
+ *****************************************************************************/
+void
+init_timer_wheels(void)
+{
+	TIMER_WHEEL     *wheel;
+	unsigned char   route;
+	unsigned short  j;
+	unsigned short  k;
+
+	if ((timer_wheel = malloc(sizeof(TIMER_WHEEL) *
+	                          (size_t)(num_midi_routes))) == NULL) {
+		jamrouter_shutdown("Out of memory!\n");
+	}
+
+	for (route = 0; route < num_midi_routes; route++) {
+		wheel = &(timer_wheel[route]);
+		for (j = 0; j < TIMER_WHEEL_EVENTS; j++) {
+			wheel->event[j].next = (unsigned short)(j + 1);
+		}
+		wheel->event[TIMER_WHEEL_EVENTS - 1].next = TIMER_WHEEL_NONE;
+		for (j = 0; j < TIMER_WHEEL_L0_SLOTS; j++) {
+			wheel->level0[j].head = TIMER_WHEEL_NONE;
+			wheel->level0[j].tail = TIMER_WHEEL_NONE;
+		}
+		for (k = 0; k < (TIMER_WHEEL_LEVELS - 1); k++) {
+			for (j = 0; j < TIMER_WHEEL_LN_SLOTS; j++) {
+				wheel->level[k][j].head = TIMER_WHEEL_NONE;
+				wheel->level[k][j].tail = TIMER_WHEEL_NONE;
+			}
+		}
+		wheel->frame     = 0;
+		wheel->tick      = 0;
+		wheel->free_head = 0;
+		wheel->count     = 0;
+	}
+}
+
+
+/*****************************************************************************
+ * timer_wheel_get_frame()
+ *
+ * Returns the absolute frame time of <cycle_frame> in the current period,
+ * as counted by the timer wheel for <route>.
+ *****************************************************************************/
+guint64
+timer_wheel_get_frame(unsigned char route, unsigned short cycle_frame)
+{
+	return timer_wheel[route].frame + cycle_frame;
+}
+
+
+/*****************************************************************************
+ * timer_wheel_link()
+ *
+ * Appends held message <index> to the slot it belongs in, given how far
+ * ahead of the wheel's current tick it falls due.  Messages already due go
+ * in the current slot, and messages beyond the range of the wheel go in the
+ * last slot of the top level, to be placed again when cascaded.
+ *****************************************************************************/
+static void
+timer_wheel_link(TIMER_WHEEL *wheel, unsigned short index)
+{
+	TIMER_EVENT     *event    = &(wheel->event[index]);
+	TIMER_SLOT      *slot;
+	guint64         due_tick  = event->due_frame >> TIMER_WHEEL_TICK_SHIFT;
+	guint64         delta;
+	int             shift;
+	int             level;
+
+	if (due_tick < wheel->tick) {
+		due_tick = wheel->tick;
+	}
+	delta = due_tick - wheel->tick;
+
+	if (delta < TIMER_WHEEL_L0_SLOTS) {
+		slot = &(wheel->level0[due_tick & TIMER_WHEEL_L0_MASK]);
+	}
+	else {
+		if (delta >= TIMER_WHEEL_TICKS) {
+			due_tick = wheel->tick + TIMER_WHEEL_TICKS - 1;
+		}
+		shift = TIMER_WHEEL_L0_BITS;
+		for (level = 0; level < (TIMER_WHEEL_LEVELS - 2); level++) {
+			if (delta < (1ULL << (shift + TIMER_WHEEL_LN_BITS))) {
+				break;
+			}
+			shift += TIMER_WHEEL_LN_BITS;
+		}
+		slot = &(wheel->level[level][(due_tick >> shift) & TIMER_WHEEL_LN_MASK]);
+	}
+
+	event->next = TIMER_WHEEL_NONE;
+	if (slot->head == TIMER_WHEEL_NONE) {
+		slot->head = index;
+	}
+	else {
+		wheel->event[slot->tail].next = index;
+	}
+	slot->tail = index;
+}
+
+
+/*****************************************************************************
+ * timer_wheel_cascade()
+ *
+ * Moves every message in one slot of an upper level down to the slots it
+ * now belongs in, keeping the order they were held in.  Returns the slot
+ * index, which is 0 when the level above must be cascaded as well.
+ *****************************************************************************/
+static unsigned int
+timer_wheel_cascade(TIMER_WHEEL *wheel, int level)
+{
+	TIMER_SLOT      *slot;
+	unsigned int    slot_index;
+	unsigned short  index;
+	unsigned short  next;
+
+	slot_index = (unsigned int)((wheel->tick >> (TIMER_WHEEL_L0_BITS +
+	                                             (level * TIMER_WHEEL_LN_BITS)))
+	                            & TIMER_WHEEL_LN_MASK);
+	slot  = &(wheel->level[level][slot_index]);
+	index = slot->head;
+
+	slot->head = TIMER_WHEEL_NONE;
+	slot->tail = TIMER_WHEEL_NONE;
+
+	while (index != TIMER_WHEEL_NONE) {
+		next = wheel->event[index].next;
+		timer_wheel_link(wheel, index);
+		index = next;
+	}
+
+	return slot_index;
+}
+
+
+/*****************************************************************************
+ * timer_wheel_insert()
+ *
+ * Holds a (non-SysEx) message in the timer wheel for <route>, to be handed
+ * to the Tx queue in the period containing absolute frame <due_frame>.
+ * Returns 0 on success, or -1 when the wheel is full and the message has
+ * been dropped.
+ *****************************************************************************/
+int
+timer_wheel_insert(unsigned char        route,
+                   guint64              due_frame,
+                   volatile MIDI_EVENT  *event)
+{
+	TIMER_WHEEL     *wheel = &(timer_wheel[route]);
+	TIMER_EVENT     *held;
+	unsigned short  index;
+
+	if ((event->bytes == 0) || (event->bytes > 3)) {
+		return -1;
+	}
+	if ((index = wheel->free_head) == TIMER_WHEEL_NONE) {
+		JAMROUTER_WARN("Timer wheel full on route %d:  "
+		               "event %02X dropped.\n", route, event->type);
+		return -1;
+	}
+	held             = &(wheel->event[index]);
+	wheel->free_head = held->next;
+	wheel->count++;
+
+	held->due_frame = due_frame;
+	held->bytes     = (unsigned char)(event->bytes);
+	held->byte2     = event->byte2;
+	held->byte3     = event->byte3;
+	if (event->type < 0xF0) {
+		held->status = (unsigned char)((event->type & MIDI_TYPE_MASK) |
+		                               (event->channel & MIDI_CHANNEL_MASK));
+	}
+	else {
+		held->status = event->type;
+	}
+
+	timer_wheel_link(wheel, index);
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * timer_wheel_expire_slot()
+ *
+ * Queues every message in the current first level slot due before absolute
+ * frame <end_frame>, at its frame in the current period.  Returns -1 if the
+ * Tx queue runs out of events, leaving the rest for the next period.
+ *****************************************************************************/
+static int
+timer_wheel_expire_slot(TIMER_WHEEL     *wheel,
+                        unsigned short  period,
+                        unsigned char   route,
+                        guint64         end_frame)
+{
+	TIMER_SLOT              *slot      = &(wheel->level0[wheel->tick & TIMER_WHEEL_L0_MASK]);
+	TIMER_EVENT             *held;
+	volatile MIDI_EVENT     *event;
+	unsigned char           queue_num  = J2A_ROUTE_QUEUE(route);
+	unsigned short          frame;
+	unsigned short          index      = slot->head;
+	unsigned short          prev       = TIMER_WHEEL_NONE;
+	unsigned short          next;
+
+	while (index != TIMER_WHEEL_NONE) {
+		held = &(wheel->event[index]);
+		next = held->next;
+
+		/* the tick straddling the end of the period is visited again */
+		if (held->due_frame >= end_frame) {
+			prev  = index;
+			index = next;
+			continue;
+		}
+		if ((event = get_new_midi_event(queue_num)) == NULL) {
+			return -1;
+		}
+
+		if (held->status < 0xF0) {
+			event->type    = held->status & MIDI_TYPE_MASK;
+			event->channel = held->status & MIDI_CHANNEL_MASK;
+		}
+		else {
+			event->type    = held->status;
+		}
+		event->byte2 = held->byte2;
+		event->byte3 = held->byte3;
+		event->bytes = held->bytes;
+
+		frame = 0;
+		if (held->due_frame > wheel->frame) {
+			frame = (unsigned short)(held->due_frame - wheel->frame);
+		}
+		/* keep behind any SysEx stream in flight */
+		if ((event->type < MIDI_EVENT_TICK) && sysex_stream_pending(route)) {
+			sysex_stream_write_event(route, frame, event);
+		}
+		else {
+			queue_midi_event(period, queue_num, event, frame,
+			                 sync_info[period].input_index, 0);
+		}
+
+		/* unlink, and return to the free list */
+		if (prev == TIMER_WHEEL_NONE) {
+			slot->head = next;
+		}
+		else {
+			wheel->event[prev].next = next;
+		}
+		if (slot->tail == index) {
+			slot->tail = prev;
+		}
+		held->next       = wheel->free_head;
+		wheel->free_head = index;
+		wheel->count--;
+
+		index = next;
+	}
+
+	return 0;
+}
+
+
+/*****************************************************************************
+ * timer_wheel_expire()
+ *
+ * Called by the JACK thread once per process cycle, after JACK MIDI input
+ * for <route> has been handled.  Queues every held message falling due in
+ * this period of <nframes>, and advances the wheel to the next period.  An
+ * idle wheel skips straight ahead.  Otherwise, the work is one step per
+ * tick of the period, plus one per message cascaded or queued.
+ *****************************************************************************/
+void
+timer_wheel_expire(unsigned short period, unsigned char route, unsigned short nframes)
+{
+	TIMER_WHEEL     *wheel     = &(timer_wheel[route]);
+	guint64         end_frame  = wheel->frame + nframes;
+	guint64         end_tick   = end_frame >> TIMER_WHEEL_TICK_SHIFT;
+	int             level;
+
+	if (wheel->count == 0) {
+		wheel->tick  = end_tick;
+		wheel->frame = end_frame;
+		return;
+	}
+
+	for (;;) {
+		if (timer_wheel_expire_slot(wheel, period, route, end_frame) != 0) {
+			break;
+		}
+		if (wheel->tick >= end_tick) {
+			break;
+		}
+		wheel->tick++;
+		if ((wheel->tick & TIMER_WHEEL_L0_MASK) == 0) {
+			for (level = 0; level < (TIMER_WHEEL_LEVELS - 1); level++) {
+				if (timer_wheel_cascade(wheel, level) != 0) {
+					break;
+				}
+			}
+		}
+	}
+
+	wheel->frame = end_frame;
+}
+
+
+/*****************************************************************************
+ * channel_delay_event()
+ *
+ * Called by the JACK thread for each event from JACK on its way to MIDI Tx
+ * on <route>.  Channel messages for channels with a --channel-delay set are
+ * held in the timer wheel, to go out that much later.  Returns nonzero when
+ * the event is not to be queued now.
+ *****************************************************************************/
+int
+channel_delay_event(unsigned short       period,
+                    unsigned char        route,
+                    unsigned short       cycle_frame,
+                    volatile MIDI_EVENT  *event)
+{
+	guint64         delay_frames;
+	int             delay_msec;
+
+	if (event->type >= 0xF0) {
+		return 0;
+	}
+	if ((delay_msec = channel_delay_msec[event->channel & 0x0F]) <= 0) {
+		return 0;
+	}
+	delay_frames = ((guint64)(delay_msec) * sync_info[period].sample_rate) / 1000;
+
+	timer_wheel_insert(route, timer_wheel_get_frame(route, cycle_frame) + delay_frames,
+	                   event);
+
+	return 1;
+}
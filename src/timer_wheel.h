@@ -0,0 +1,78 @@
+/*****************************************************************************
+ *
+ * timer_wheel.h
+ *
+ * JAMRouter:  JACK <--> ALSA MIDI Router
+ *
+ * Copyright (C) 2012-2015 William Weston <william.h.weston@gmail.com>
+ *
+ * JAMROUTER is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JAMROUTER is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JAMROUTER.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+#ifndef _JAMROUTER_TIMER_WHEEL_H_
+#define _JAMROUTER_TIMER_WHEEL_H_
+
+#include <glib.h>
+#include "jamrouter.h"
+#include "mididefs.h"
+
+
+#define TIMER_WHEEL_NONE            0xFFFF
+
+
+/* Message held in the timer wheel, due at an absolute frame. */
+typedef struct timer_event {
+	guint64             due_frame;
+	unsigned short      next;               /* TIMER_WHEEL_NONE at end */
+	unsigned char       status;
+	unsigned char       byte2;
+	unsigned char       byte3;
+	unsigned char       bytes;
+} TIMER_EVENT;
+
+/* One wheel slot:  a list of held messages, in the order held. */
+typedef struct timer_slot {
+	unsigned short      head;
+	unsigned short      tail;
+} TIMER_SLOT;
+
+/* JACK --> MIDI timer wheel for one route.  Messages held here are handed
+   to the Tx queue in the period they fall due.  Owned by the JACK thread. */
+typedef struct timer_wheel {
+	TIMER_EVENT         event[TIMER_WHEEL_EVENTS];
+	TIMER_SLOT          level0[TIMER_WHEEL_L0_SLOTS];
+	TIMER_SLOT          level[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LN_SLOTS];
+	guint64             frame;              /* absolute frame of period start */
+	guint64             tick;               /* first tick not yet expired */
+	unsigned short      free_head;
+	unsigned short      count;
+} TIMER_WHEEL;
+
+
+void init_timer_wheels(void);
+guint64 timer_wheel_get_frame(unsigned char route,
+                              unsigned short cycle_frame);
+int  timer_wheel_insert(unsigned char route,
+                        guint64 due_frame,
+                        volatile MIDI_EVENT *event);
+void timer_wheel_expire(unsigned short period,
+                        unsigned char route,
+                        unsigned short nframes);
+int  channel_delay_event(unsigned short period,
+                         unsigned char route,
+                         unsigned short cycle_frame,
+                         volatile MIDI_EVENT *event);
+
+
+#endif /* _JAMROUTER_TIMER_WHEEL_H_ */
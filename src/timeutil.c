@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sys/types.h>
 #ifndef HAVE_CLOCK_GETTIME
@@ -34,6 +35,27 @@
 
 clockid_t               system_clockid        = CLOCK_MONOTONIC;
 
+#ifdef ENABLE_VIRTUAL_CLOCK
+/* A thread sleeping on the virtual clock.  Each sleeper lives on the stack
+   of its own thread, and stays on the sleeper list, in deadline order, for
+   as long as it sleeps.  Sleepers with equal deadlines keep the order they
+   went to sleep in. */
+typedef struct virtual_sleeper {
+	timensec_t              deadline;
+	int                     woken;
+	struct virtual_sleeper  *next;
+} VIRTUAL_SLEEPER;
+
+static pthread_mutex_t  virtual_clock_mutex   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   virtual_clock_cond    = PTHREAD_COND_INITIALIZER;
+static int              virtual_clock_running = 0;
+static timensec_t       virtual_clock_now     = 0;
+static VIRTUAL_SLEEPER  *virtual_clock_list   = NULL;
+static int              virtual_clock_sleepers = 0;
+
+static int virtual_clock_sleep_until(timensec_t deadline);
+#endif
+
 
 /*****************************************************************************
  * timecmp()
@@ -200,6 +222,65 @@ time_delta_nsecs(volatile TIMESTAMP *now, volatile TIMESTAMP *start)
 }
 
 
+/*****************************************************************************
+ * time_to_nsecs()
+ *
+ * Returns a timestamp as integer nanoseconds.
+ *****************************************************************************/
+timensec_t
+time_to_nsecs(volatile TIMESTAMP *a)
+{
+	return ((timensec_t)(a->tv_sec) * NSECS_PER_SEC) + (timensec_t)(a->tv_nsec);
+}
+
+
+/*****************************************************************************
+ * time_from_nsecs()
+ *
+ * Sets a timestamp from integer nanoseconds.
+ *****************************************************************************/
+void
+time_from_nsecs(volatile TIMESTAMP *a, timensec_t nsecs)
+{
+	timensec_t  sec = nsecs / NSECS_PER_SEC;
+	timensec_t  nsec = nsecs % NSECS_PER_SEC;
+
+	if (nsec < 0) {
+		nsec += NSECS_PER_SEC;
+		sec--;
+	}
+	a->tv_sec  = (time_t)(sec);
+	a->tv_nsec = (long)(nsec);
+}
+
+
+/*****************************************************************************
+ * time_get_nsecs()
+ *
+ * Reads the system clock as integer nanoseconds.  Returns the result of
+ * clock_gettime().
+ *****************************************************************************/
+int
+time_get_nsecs(timensec_t *now)
+{
+	TIMESTAMP   ts;
+	int         ret;
+
+#ifdef ENABLE_VIRTUAL_CLOCK
+	if (virtual_clock_running) {
+		pthread_mutex_lock(&virtual_clock_mutex);
+		*now = virtual_clock_now;
+		pthread_mutex_unlock(&virtual_clock_mutex);
+		return 0;
+	}
+#endif
+	ret = clock_gettime(system_clockid, &ts);
+	*now = ((timensec_t)(ts.tv_sec) * NSECS_PER_SEC) + (timensec_t)(ts.tv_nsec);
+
+	return ret;
+}
+
+
 /*****************************************************************************
  * time_copy()
  *****************************************************************************/
@@ -252,6 +333,15 @@ jamrouter_usleep(int usecs)
 #ifdef HAVE_CLOCK_NANOSLEEP
 	struct timespec         sleep_time       = { 0, usecs * 1000 };
 #endif
+#ifdef ENABLE_VIRTUAL_CLOCK
+	timensec_t              now;
+
+	if ((usecs > 0) && virtual_clock_running) {
+		time_get_nsecs(&now);
+		virtual_clock_sleep_until(now + ((timensec_t)(usecs) * 1000));
+		return;
+	}
+#endif
 
 	if (usecs > 0) {
 #ifdef HAVE_CLOCK_NANOSLEEP
@@ -272,6 +362,15 @@ jamrouter_nanosleep(long int nsecs)
 #ifdef HAVE_CLOCK_NANOSLEEP
 	struct timespec         sleep_time       = { 0, nsecs };
 #endif
+#ifdef ENABLE_VIRTUAL_CLOCK
+	timensec_t              now;
+
+	if ((nsecs > 5000) && virtual_clock_running) {
+		time_get_nsecs(&now);
+		virtual_clock_sleep_until(now + (timensec_t)(nsecs));
+		return;
+	}
+#endif
 
 	if (nsecs > 5000) {
 #ifdef HAVE_CLOCK_NANOSLEEP
@@ -316,3 +415,269 @@ jamrouter_sleep(TIMESTAMP   *request,
 #endif
 	}
 }
+
+
+/*****************************************************************************
+ * jamrouter_sleep_until()
+ *
+ * Sleeps until an absolute <deadline> on the system clock.  Since the
+ * deadline is absolute, preemption between reading the clock and going to
+ * sleep no longer adds to the wakeup time.  Absolute sleeps are not
+ * supported on CLOCK_MONOTONIC_RAW, so when that is the system clock the
+ * deadline is first translated to CLOCK_MONOTONIC.
+ *****************************************************************************/
+void
+jamrouter_sleep_until(timensec_t deadline)
+{
+	TIMESTAMP               wake_time;
+	timensec_t              now;
+#ifdef HAVE_CLOCK_NANOSLEEP
+	TIMESTAMP               mono_now;
+#endif
+
+#ifdef ENABLE_VIRTUAL_CLOCK
+	if (virtual_clock_sleep_until(deadline)) {
+		return;
+	}
+#endif
+#ifdef HAVE_CLOCK_NANOSLEEP
+	if (system_clockid != CLOCK_MONOTONIC) {
+		time_get_nsecs(&now);
+		clock_gettime(CLOCK_MONOTONIC, &mono_now);
+		if (now >= deadline) {
+			return;
+		}
+		deadline += time_to_nsecs(&mono_now) - now;
+	}
+	time_from_nsecs(&wake_time, deadline);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+	                       &wake_time, NULL) == EINTR);
+#else
+	time_get_nsecs(&now);
+	if (now < deadline) {
+		time_from_nsecs(&wake_time, deadline - now);
+		nanosleep(&wake_time, NULL);
+	}
+#endif
+}
+
+
+#ifdef ENABLE_VIRTUAL_CLOCK
+/*****************************************************************************
+ * virtual_clock_sleep_until()
+ *
+ * Blocks the calling thread until it is woken by the virtual clock reaching
+ * <deadline>.  Returns 0 without sleeping when the virtual clock is not
+ * running, so that the caller falls back to the system clock.
+ *****************************************************************************/
+static int
+virtual_clock_sleep_until(timensec_t deadline)
+{
+	VIRTUAL_SLEEPER     sleeper;
+	VIRTUAL_SLEEPER     **link;
+
+	if (!virtual_clock_running) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&virtual_clock_mutex);
+	if (!virtual_clock_running) {
+		pthread_mutex_unlock(&virtual_clock_mutex);
+		return 0;
+	}
+	if (deadline <= virtual_clock_now) {
+		pthread_mutex_unlock(&virtual_clock_mutex);
+		return 1;
+	}
+
+	sleeper.deadline = deadline;
+	sleeper.woken    = 0;
+	link = &virtual_clock_list;
+	while ((*link != NULL) && ((*link)->deadline <= deadline)) {
+		link = &((*link)->next);
+	}
+	sleeper.next = *link;
+	*link        = &sleeper;
+	virtual_clock_sleepers++;
+
+	pthread_cond_broadcast(&virtual_clock_cond);
+	while (virtual_clock_running && !sleeper.woken) {
+		pthread_cond_wait(&virtual_clock_cond, &virtual_clock_mutex);
+	}
+
+	/* released by virtual_clock_stop() instead of woken */
+	if (!sleeper.woken) {
+		link = &virtual_clock_list;
+		while ((*link != NULL) && (*link != &sleeper)) {
+			link = &((*link)->next);
+		}
+		if (*link != NULL) {
+			*link = sleeper.next;
+			virtual_clock_sleepers--;
+		}
+	}
+	pthread_mutex_unlock(&virtual_clock_mutex);
+
+	return 1;
+}
+
+
+/*****************************************************************************
+ * virtual_clock_wake_first()
+ *
+ * Takes the first sleeper off the list and wakes it.  The sleeper no longer
+ * counts as sleeping from here on, even before its thread gets to run.
+ * Called with the virtual clock mutex held.
+ *****************************************************************************/
+static void
+virtual_clock_wake_first(void)
+{
+	VIRTUAL_SLEEPER     *sleeper = virtual_clock_list;
+
+	virtual_clock_list = sleeper->next;
+	sleeper->next      = NULL;
+	sleeper->woken     = 1;
+	virtual_clock_sleepers--;
+}
+
+
+/*****************************************************************************
+ * virtual_clock_start()
+ *
+ * Switches all MIDI timing over to the virtual clock, starting at <now>.
+ *****************************************************************************/
+void
+virtual_clock_start(timensec_t now)
+{
+	pthread_mutex_lock(&virtual_clock_mutex);
+	virtual_clock_now      = now;
+	virtual_clock_running  = 1;
+	pthread_mutex_unlock(&virtual_clock_mutex);
+}
+
+
+/*****************************************************************************
+ * virtual_clock_stop()
+ *
+ * Switches back to the system clock, releasing all virtual sleepers.
+ *****************************************************************************/
+void
+virtual_clock_stop(void)
+{
+	pthread_mutex_lock(&virtual_clock_mutex);
+	virtual_clock_running = 0;
+	pthread_cond_broadcast(&virtual_clock_cond);
+	pthread_mutex_unlock(&virtual_clock_mutex);
+}
+
+
+/*****************************************************************************
+ * virtual_clock_advance()
+ *
+ * Moves the virtual clock forward to <now>, waking every thread sleeping
+ * on a deadline at or before it.  The virtual clock never moves backward.
+ *****************************************************************************/
+void
+virtual_clock_advance(timensec_t now)
+{
+	pthread_mutex_lock(&virtual_clock_mutex);
+	if (now > virtual_clock_now) {
+		virtual_clock_now = now;
+	}
+	while ((virtual_clock_list != NULL) &&
+	       (virtual_clock_list->deadline <= virtual_clock_now)) {
+		virtual_clock_wake_first();
+	}
+	pthread_cond_broadcast(&virtual_clock_cond);
+	pthread_mutex_unlock(&virtual_clock_mutex);
+}
+
+
+/*****************************************************************************
+ * virtual_clock_step()
+ *
+ * Moves the virtual clock forward to the earliest deadline of any sleeping
+ * thread, and wakes that one thread only.  Threads due at the same time are
+ * woken one step at a time, in the order they went to sleep, so that a
+ * driver loop waiting for each to sleep again between steps runs them in
+ * the same order every time.  Returns the new time, or -1 when no thread is
+ * sleeping.
+ *****************************************************************************/
+timensec_t
+virtual_clock_step(void)
+{
+	timensec_t  now = -1;
+
+	pthread_mutex_lock(&virtual_clock_mutex);
+	if (virtual_clock_list != NULL) {
+		if (virtual_clock_list->deadline > virtual_clock_now) {
+			virtual_clock_now = virtual_clock_list->deadline;
+		}
+		virtual_clock_wake_first();
+		pthread_cond_broadcast(&virtual_clock_cond);
+		now = virtual_clock_now;
+	}
+	pthread_mutex_unlock(&virtual_clock_mutex);
+
+	return now;
+}
+
+
+/*****************************************************************************
+ * virtual_clock_next_deadline()
+ *
+ * Returns the earliest deadline of any thread sleeping on the virtual
+ * clock, or -1 when no thread is sleeping.  A driver loop advances the
+ * clock to the lesser of this and its own next event.
+ *****************************************************************************/
+timensec_t
+virtual_clock_next_deadline(void)
+{
+	timensec_t  deadline = -1;
+
+	pthread_mutex_lock(&virtual_clock_mutex);
+	if (virtual_clock_list != NULL) {
+		deadline = virtual_clock_list->deadline;
+	}
+	pthread_mutex_unlock(&virtual_clock_mutex);
+
+	return deadline;
+}
+
+
+/*****************************************************************************
+ * virtual_clock_wait_sleepers()
+ *
+ * Waits until at least <count> threads are sleeping on the virtual clock,
+ * so that a driver loop only advances time once every thread has finished
+ * the work due at the current time.  Gives up after <timeout_msec> of real
+ * time, in case a thread is blocked on something other than the virtual
+ * clock.  Returns 0 when all are sleeping, or -1 on timeout.
+ *****************************************************************************/
+int
+virtual_clock_wait_sleepers(int count, int timeout_msec)
+{
+	struct timespec     limit;
+	int                 ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &limit);
+	limit.tv_sec  += timeout_msec / 1000;
+	limit.tv_nsec += (long)(timeout_msec % 1000) * 1000000;
+	if (limit.tv_nsec >= 1000000000) {
+		limit.tv_sec++;
+		limit.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&virtual_clock_mutex);
+	while (virtual_clock_running && (virtual_clock_sleepers < count)) {
+		if (pthread_cond_timedwait(&virtual_clock_cond, &virtual_clock_mutex,
+		                           &limit) == ETIMEDOUT) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&virtual_clock_mutex);
+
+	return ret;
+}
+#endif /* ENABLE_VIRTUAL_CLOCK */
@@ -28,6 +28,7 @@
 #ifndef HAVE_CLOCK_GETTIME
 #include <sys/time.h>
 #endif
+#include <glib.h>
 #include "jamrouter.h"
 
 
@@ -52,6 +53,12 @@ typedef double timecalc_t;
 
 typedef struct timespec TIMESTAMP;
 
+/* Signed 64-bit nanoseconds on the system clock.  Good for 292 years of
+   uptime, and compared or subtracted without any carry handling. */
+typedef gint64 timensec_t;
+
+#define NSECS_PER_SEC                  G_GINT64_CONSTANT(1000000000)
+
 
 extern clockid_t            system_clockid;
 
@@ -71,6 +78,11 @@ timecalc_t time_nsecs(volatile TIMESTAMP *a);
 timecalc_t time_delta_nsecs(volatile TIMESTAMP *now,
                             volatile TIMESTAMP *start);
 
+timensec_t time_to_nsecs(volatile TIMESTAMP *a);
+void time_from_nsecs(volatile TIMESTAMP *a,
+                     timensec_t nsecs);
+int time_get_nsecs(timensec_t *now);
+
 void time_copy(volatile TIMESTAMP *dest,
                volatile TIMESTAMP *src);
 void time_init(volatile TIMESTAMP *ts,
@@ -86,6 +98,17 @@ void jamrouter_sleep(TIMESTAMP   *request,
                      long int    nsecs,
                      int         usecs,
                      TIMESTAMP   *wake);
+void jamrouter_sleep_until(timensec_t deadline);
+
+#ifdef ENABLE_VIRTUAL_CLOCK
+void virtual_clock_start(timensec_t now);
+void virtual_clock_stop(void);
+void virtual_clock_advance(timensec_t now);
+timensec_t virtual_clock_step(void);
+timensec_t virtual_clock_next_deadline(void);
+int  virtual_clock_wait_sleepers(int count,
+                                 int timeout_msec);
+#endif
 
 
 #endif /* _JAMROUTER_TIMEUTIL_H_ */